@@ -0,0 +1,85 @@
+/*
+ *
+ * Adrian Brzezinski (2018) <adrbxx at gmail.com>
+ * License: GPLv2+
+ *
+ */
+
+#include "bench.h"
+
+__thread unsigned long bench_allocs;
+
+// glibc allocator, our wrappers replace malloc() for whole process
+// including libraries, so every allocation of thread is counted
+extern void *__libc_malloc( size_t size );
+extern void *__libc_calloc( size_t nmemb, size_t size );
+extern void *__libc_realloc( void *ptr, size_t size );
+extern void __libc_free( void *ptr );
+
+void *malloc( size_t size ) {
+
+  bench_allocs++;
+
+return __libc_malloc(size);
+}
+
+void *calloc( size_t nmemb, size_t size ) {
+
+  bench_allocs++;
+
+return __libc_calloc(nmemb, size);
+}
+
+void *realloc( void *ptr, size_t size ) {
+
+  bench_allocs++;
+
+return __libc_realloc(ptr, size);
+}
+
+void free( void *ptr ) {
+
+  __libc_free(ptr);
+}
+
+double bench_now( void ) {
+
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void bench_header( void ) {
+
+  printf("%-36s %12s %10s %10s %8s\n", "benchmark", "ops/s", "MB/s",
+      "allocs/op", "speedup");
+}
+
+void bench_start( t_benchrun *b, const char *name ) {
+
+  b->name = name;
+  b->allocs = bench_allocs;
+  b->start = bench_now();
+}
+
+double bench_stop( t_benchrun *b, long ops, long long bytes, double base ) {
+
+  double t = bench_now() - b->start;
+  double opss;
+
+  if ( t <= 0 ) t = 1e-9;
+  opss = ops / t;
+
+  printf("%-36s %12.0f %10.1f %10.2f", b->name, opss, bytes / t / 1e6,
+      ops ? (double)(bench_allocs - b->allocs) / ops : 0);
+
+  if ( base > 0 )
+    printf(" %7.2fx", opss / base);
+
+  printf("\n");
+  fflush(stdout);
+
+return opss;
+}
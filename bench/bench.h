@@ -0,0 +1,39 @@
+/*
+ *
+ * Adrian Brzezinski (2018) <adrbxx at gmail.com>
+ * License: GPLv2+
+ *
+ */
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Allocations made by calling thread, counted by malloc() wrappers
+// from bench.c. Server thread started by clibench has it's own.
+extern __thread unsigned long bench_allocs;
+
+typedef struct {
+
+  const char *name;
+  double start;
+  unsigned long allocs;
+
+} t_benchrun;
+
+double bench_now( void );
+
+// print column names
+void bench_header( void );
+
+void bench_start( t_benchrun *b, const char *name );
+
+// Print ops/s, MB/s and allocations per op since bench_start(), with
+// speedup over base ops/s if it's given. Returns ops/s.
+double bench_stop( t_benchrun *b, long ops, long long bytes, double base );
+
+#endif // __BENCH_H__
@@ -0,0 +1,322 @@
+/*
+ *
+ * Adrian Brzezinski (2018) <adrbxx at gmail.com>
+ * License: GPLv2+
+ *
+ */
+
+// Client code benchmarks: command line tokenizing and dispatch, path
+// resolving with nfs3pathlookup() and whole file get/put. Without NFS
+// server given path resolving and transfers go to built-in one serving
+// temporary directory, with optional latency and bandwidth limit.
+// Files are created in "clibench.d" directory of exported file system
+// and removed at the end.
+//
+// usage: clibench [-n iterations] [-s MB] [-l MS] [-b MB] [HOST EXPORT]
+
+#include "bench.h"
+#include "commands.h"
+
+#define BENCH_ITERATIONS  200000
+#define BENCH_LOOKUPS     2000    // lookups without caches
+#define BENCH_FILESIZE    64      // MB, transferred file
+#define BENCH_TRANSFERS   3       // times file is transferred
+
+#define BENCH_DIR   "clibench.d"
+#define BENCH_DEEP  BENCH_DIR "/a/b/c/d"
+#define BENCH_FILE  BENCH_DEEP "/file"
+#define BENCH_DATA  BENCH_DIR "/data"
+
+// in nfsclt.c, not exported by header
+LOOKUP3res* nfs3pathlookup( t_nfsclt *nfsclt, char *path, int follow );
+
+static void clibench_tokenize( long n ) {
+
+  static const char *line = "put -r \"some local dir\" remote/dir/name\n";
+  char buf[128], *argv[TOKENIZEARGMAX];
+  t_benchrun b;
+  int argc;
+  long i;
+
+  bench_start(&b, "tokenizestr");
+
+  for ( i = 0; i < n; i++ ) {
+    strcpy(buf, line);
+    tokenizestr(buf, argv, &argc);
+  }
+
+  bench_stop(&b, n, 0, 0);
+}
+
+// "set" is near the end of commands table and doesn't print anything
+static void clibench_dispatch( long n ) {
+
+  char buf[64];
+  t_benchrun b;
+  long i;
+
+  bench_start(&b, "execute_line set");
+
+  for ( i = 0; i < n; i++ ) {
+    strcpy(buf, "set gid 65534");
+    execute_line(buf);
+  }
+
+  bench_stop(&b, n, 0, 0);
+}
+
+static int clibench_lookup( const char *name, long n ) {
+
+  t_benchrun b;
+  long i;
+
+  bench_start(&b, name);
+
+  for ( i = 0; i < n; i++ )
+    if ( nfs3pathlookup(&nfsclt, BENCH_FILE, 1) == NULL ) return -1;
+
+  bench_stop(&b, n, 0, 0);
+
+return 0;
+}
+
+// local file of size bytes, removed already
+static int clibench_localfile( long long size ) {
+
+  char path[] = "/tmp/clibenchXXXXXX", buf[65536];
+  long long off;
+  int fd;
+
+  if ( (fd = mkstemp(path)) == -1 ) {
+    perror("mkstemp()");
+    return -1;
+  }
+
+  unlink(path);
+  memset(buf, 'x', sizeof(buf));
+
+  for ( off = 0; off < size ; off += sizeof(buf) ) {
+    if ( write(fd, buf, sizeof(buf)) != sizeof(buf) ) {
+      perror("write()");
+      close(fd);
+      return -1;
+    }
+  }
+
+return fd;
+}
+
+static int clibench_put( int fd, long long size, int count ) {
+
+  t_nfsfile nfsfile;
+  t_benchrun b;
+  int i;
+
+  if ( nfsfileopen(&nfsclt, &nfsfile, BENCH_DATA, 0) == -1 ) return -1;
+
+  bench_start(&b, "put");
+
+  for ( i = 0; i < count; i++ ) {
+    if ( nfsfilewrite(&nfsclt, &nfsfile, fd) != size ) {
+      nfsfileclose(&nfsclt, &nfsfile);
+      return -1;
+    }
+  }
+
+  bench_stop(&b, count, size * count, 0);
+  nfsfileclose(&nfsclt, &nfsfile);
+
+return 0;
+}
+
+static int clibench_get( long long size, int count ) {
+
+  t_nfsfile nfsfile;
+  t_benchrun b;
+  FILE *out;
+  int i;
+
+  if ( (out = fopen("/dev/null", "w")) == NULL ) {
+    perror("fopen()");
+    return -1;
+  }
+
+  if ( nfsfileopen(&nfsclt, &nfsfile, BENCH_DATA, 1) == -1 ) {
+    fclose(out);
+    return -1;
+  }
+
+  bench_start(&b, "get");
+
+  for ( i = 0; i < count; i++ ) {
+    if ( nfsfileread(&nfsclt, &nfsfile, out) != size ) {
+      nfsfileclose(&nfsclt, &nfsfile);
+      fclose(out);
+      return -1;
+    }
+  }
+
+  bench_stop(&b, count, size * count, 0);
+
+  nfsfileclose(&nfsclt, &nfsfile);
+  fclose(out);
+
+return 0;
+}
+
+static int clibench_remote( char *host, char *export, long n, long long size ) {
+
+  char *dirs[] = { BENCH_DIR, BENCH_DIR "/a", BENCH_DIR "/a/b",
+    BENCH_DIR "/a/b/c", BENCH_DEEP, NULL };
+  struct stat st;
+  int i, fd, dnlcttl, acttl, err = 0;
+
+  nfsclt.hostname = strdup(host);
+
+  if ( nfsconnect(&nfsclt, MOUNT_PROGRAM) == -1
+      || nfsmount(&nfsclt, export) == -1
+      || nfsconnect(&nfsclt, NFS_PROGRAM) == -1 )
+    return -1;
+
+  memset(&st, 0, sizeof(st));
+  st.st_mode = S_IFDIR | 0755;
+  st.st_uid = nfsclt.uid;
+  st.st_gid = nfsclt.gid;
+
+  // they could be left by interrupted run, lookup tells if they exist
+  for ( i = 0; dirs[i] ; i++ ) nfsdirmk(&nfsclt, dirs[i], &st);
+
+  st.st_mode = S_IFREG | 0644;
+
+  nfsfilecreate(&nfsclt, BENCH_FILE, &st);
+  nfsfilecreate(&nfsclt, BENCH_DATA, &st);
+
+  if ( clibench_lookup("nfs3pathlookup cached", n) == -1 ) err = -1;
+
+  dnlcttl = nfsclt.dnlc.ttl;
+  acttl = nfsclt.acache.ttl;
+  nfsclt.dnlc.ttl = nfsclt.acache.ttl = 0;
+
+  if ( !err && clibench_lookup("nfs3pathlookup", BENCH_LOOKUPS) == -1 ) err = -1;
+
+  nfsclt.dnlc.ttl = dnlcttl;
+  nfsclt.acache.ttl = acttl;
+
+  if ( !err && (fd = clibench_localfile(size)) != -1 ) {
+
+    if ( clibench_put(fd, size, BENCH_TRANSFERS) == -1
+        || clibench_get(size, BENCH_TRANSFERS) == -1 )
+      err = -1;
+
+    close(fd);
+
+  } else err = -1;
+
+  nfsfilerm(&nfsclt, BENCH_DATA);
+  nfsfilerm(&nfsclt, BENCH_FILE);
+
+  for ( i--; i >= 0 ; i-- ) nfsdirrm(&nfsclt, dirs[i]);
+
+  nfsumount(&nfsclt);
+  nfsdisconnectnfs(&nfsclt);
+  nfsdisconnect(&nfsclt.mount);
+
+return err;
+}
+
+// built-in server on temporary directory
+static int clibench_mock( t_mocksrv *srv, char *root, long n, long long size,
+    t_mocksrvconf *conf ) {
+
+  int err;
+
+  if ( mkdtemp(root) == NULL ) {
+    perror("mkdtemp()");
+    return -1;
+  }
+
+  if ( mocksrv_start(srv, root, conf) == -1 ) {
+    rmdir(root);
+    return -1;
+  }
+
+  printf("built-in server, latency %.3f ms, bandwidth ", conf->latency / 1000.0);
+  if ( conf->bandwidth ) printf("%.1f MB/s\n", conf->bandwidth / 1048576.0);
+  else printf("unlimited\n");
+
+  nfsclt.mountport = nfsclt.nfsport = srv->port;
+  err = clibench_remote(MOCKSRV_HOST, MOCKSRV_EXPORT, n, size);
+
+  mocksrv_stop(srv);
+
+  if ( rmdir(root) == -1 ) perror(root);
+
+return err;
+}
+
+int main( int argc, char *argv[] ) {
+
+  char root[] = "/tmp/clibenchXXXXXX";
+  long n = BENCH_ITERATIONS;
+  long long size = BENCH_FILESIZE;
+  t_mocksrvconf conf;
+  t_mocksrv *srv;
+  int opt, err;
+
+  memset(&conf, 0, sizeof(conf));
+
+  while ( (opt = getopt(argc, argv, "n:s:l:b:")) != -1 ) {
+    switch (opt) {
+      case 'n':
+        n = atol(optarg);
+        break;
+      case 's':
+        size = atoll(optarg);
+        break;
+      case 'l':
+        conf.latency = atof(optarg) * 1000;
+        break;
+      case 'b':
+        conf.bandwidth = atof(optarg) * 1048576;
+        break;
+      default:
+        n = 0;
+    }
+  }
+
+  if ( n <= 0 || size <= 0 || conf.latency < 0 || conf.bandwidth < 0
+      || (argc - optind != 0 && argc - optind != 2) ) {
+    fprintf(stderr, "usage: %s [-n iterations] [-s MB] [-l MS] [-b MB] [HOST EXPORT]\n",
+        argv[0]);
+    return 1;
+  }
+
+  printf("%ld iterations\n\n", n);
+  bench_header();
+
+  clibench_tokenize(n);
+  clibench_dispatch(n);
+
+  // connection messages go before results
+  printf("\n");
+
+  if ( argc - optind == 2 ) {
+    err = clibench_remote(argv[optind], argv[optind + 1], n, size << 20);
+  } else {
+
+    if ( (srv = malloc(sizeof(*srv))) == NULL ) {
+      perror("malloc()");
+      return 1;
+    }
+
+    err = clibench_mock(srv, root, n, size << 20, &conf);
+    free(srv);
+  }
+
+  if ( err == -1 ) {
+    fprintf(stderr, "Remote benchmarks failed\n");
+    return 1;
+  }
+
+return 0;
+}
@@ -0,0 +1,496 @@
+/*
+ *
+ * Adrian Brzezinski (2018) <adrbxx at gmail.com>
+ * License: GPLv2+
+ *
+ */
+
+// Encoding and decoding of NFSv3 messages. Hand written codecs from
+// nfs3xdr.c are compared with rpcgen ones, other messages have only
+// rpcgen codecs. With XDR=rpcgen hand written codecs move fields one
+// by one, their rows are marked with "hand*" then. Messages are encoded to and decoded from memory, like
+// rpcmux does it. Before timing, output of both codecs is checked to
+// be the same.
+//
+// usage: xdrbench [iterations]
+
+#include "bench.h"
+#include "nfs3xdr.h"
+
+#define BENCH_ITERATIONS  200000
+#define BENCH_BUFSIZE     (1 << 20)
+#define BENCH_DATASIZE    4096    // READ and WRITE payload
+#define BENCH_DIRENTRIES  64      // entries in READDIRPLUS reply
+
+#ifdef NFS3XDR_RPCGEN
+#define BENCH_HAND        "hand*"
+#else
+#define BENCH_HAND        "hand"
+#endif
+
+typedef struct {
+
+  const char *name;
+  xdrproc_t rpcgen;
+  xdrproc_t hand;     // NULL if there is only rpcgen codec
+  void *obj;          // message to encode
+  size_t size;        // of decoded object
+
+} t_xdrbench;
+
+static char wire[BENCH_BUFSIZE];
+static char wire2[BENCH_BUFSIZE];
+static char decoded[sizeof(t_nfsdirreply) + 4096];
+
+static u_int xdrbench_encode( xdrproc_t proc, void *obj, char *buf ) {
+
+  XDR xdrs;
+
+  xdrmem_create(&xdrs, buf, BENCH_BUFSIZE, XDR_ENCODE);
+  if ( !proc(&xdrs, obj) ) return 0;
+
+return xdr_getpos(&xdrs);
+}
+
+static int xdrbench_decode( xdrproc_t proc, void *obj, char *buf, u_int len ) {
+
+  XDR xdrs;
+
+  xdrmem_create(&xdrs, buf, len, XDR_DECODE);
+
+return proc(&xdrs, obj) && xdr_getpos(&xdrs) == len;
+}
+
+static double xdrbench_timeencode( const char *name, xdrproc_t proc, void *obj,
+    u_int len, long n, double base ) {
+
+  t_benchrun b;
+  long i;
+
+  bench_start(&b, name);
+  for ( i = 0; i < n; i++ ) xdrbench_encode(proc, obj, wire2);
+
+return bench_stop(&b, n, (long long)n * len, base);
+}
+
+// decoding with freeing, like client does it
+static double xdrbench_timedecode( const char *name, xdrproc_t proc,
+    size_t size, u_int len, long n, double base ) {
+
+  t_benchrun b;
+  long i;
+
+  bench_start(&b, name);
+
+  for ( i = 0; i < n; i++ ) {
+    memset(decoded, 0, size);
+    xdrbench_decode(proc, decoded, wire, len);
+    xdr_free(proc, (char *)decoded);
+  }
+
+return bench_stop(&b, n, (long long)n * len, base);
+}
+
+// Same bytes from both encoders, and hand decoded message encoded
+// again by rpcgen gives the same bytes
+static int xdrbench_check( t_xdrbench *x, u_int *len ) {
+
+  xdrproc_t hand = x->hand ? x->hand : x->rpcgen;
+  u_int l;
+
+  *len = xdrbench_encode(x->rpcgen, x->obj, wire);
+  l = xdrbench_encode(hand, x->obj, wire2);
+
+  if ( *len == 0 || l != *len || memcmp(wire, wire2, l) ) {
+    fprintf(stderr, "%s: encoded messages differ\n", x->name);
+    return -1;
+  }
+
+  memset(decoded, 0, x->size);
+
+  if ( !xdrbench_decode(hand, decoded, wire, *len)
+      || xdrbench_encode(x->rpcgen, decoded, wire2) != *len
+      || memcmp(wire, wire2, *len) ) {
+    fprintf(stderr, "%s: decoded message differs\n", x->name);
+    xdr_free(hand, (char *)decoded);
+    return -1;
+  }
+
+  xdr_free(hand, (char *)decoded);
+
+return 0;
+}
+
+static int xdrbench_run( t_xdrbench *x, long n ) {
+
+  char name[64];
+  double base;
+  u_int len;
+
+  if ( xdrbench_check(x, &len) == -1 ) return -1;
+
+  snprintf(name, sizeof(name), "xdr %s encode rpcgen", x->name);
+  base = xdrbench_timeencode(name, x->rpcgen, x->obj, len, n, 0);
+
+  if ( x->hand ) {
+    snprintf(name, sizeof(name), "xdr %s encode " BENCH_HAND, x->name);
+    xdrbench_timeencode(name, x->hand, x->obj, len, n, base);
+  }
+
+  snprintf(name, sizeof(name), "xdr %s decode rpcgen", x->name);
+  base = xdrbench_timedecode(name, x->rpcgen, x->size, len, n, 0);
+
+  if ( x->hand ) {
+    snprintf(name, sizeof(name), "xdr %s decode " BENCH_HAND, x->name);
+    xdrbench_timedecode(name, x->hand, x->size, len, n, base);
+  }
+
+return 0;
+}
+
+// READDIRPLUS reply is decoded by hand into reused arena, it can't be
+// encoded by hand
+static int xdrbench_rundirreply( READDIRPLUS3res *res, long n ) {
+
+  t_nfsdirreply r;
+  t_benchrun b;
+  entryplus3 *e, *de;
+  double base;
+  u_int len;
+  long i;
+
+  len = xdrbench_encode((xdrproc_t)xdr_READDIRPLUS3res, res, wire);
+
+  memset(&r, 0, sizeof(r));
+  r.plus = 1;
+
+  if ( len == 0 || !xdrbench_decode((xdrproc_t)nfs3xdrdirreply, &r, wire, len) ) {
+    fprintf(stderr, "READDIRPLUS3res: decoding failed\n");
+    return -1;
+  }
+
+  e = res->READDIRPLUS3res_u.resok.reply.entries;
+  de = r.res.nfs3plus.READDIRPLUS3res_u.resok.reply.entries;
+
+  for ( ; e && de ; e = e->nextentry, de = de->nextentry ) {
+    if ( e->fileid != de->fileid || e->cookie != de->cookie
+        || strcmp(e->name, de->name)
+        || memcmp(&e->name_attributes, &de->name_attributes, sizeof(post_op_attr)) )
+      break;
+  }
+
+  if ( e || de ) {
+    fprintf(stderr, "READDIRPLUS3res: decoded entries differ\n");
+    nfs3dirreplyfree(&r);
+    return -1;
+  }
+
+  xdrbench_timeencode("xdr READDIRPLUS3res encode rpcgen",
+      (xdrproc_t)xdr_READDIRPLUS3res, res, len, n, 0);
+  base = xdrbench_timedecode("xdr READDIRPLUS3res decode rpcgen",
+      (xdrproc_t)xdr_READDIRPLUS3res, sizeof(READDIRPLUS3res), len, n, 0);
+
+  bench_start(&b, "xdr READDIRPLUS3res decode " BENCH_HAND);
+  for ( i = 0; i < n; i++ )
+    xdrbench_decode((xdrproc_t)nfs3xdrdirreply, &r, wire, len);
+  bench_stop(&b, n, (long long)n * len, base);
+
+  nfs3dirreplyfree(&r);
+
+return 0;
+}
+
+static void xdrbench_fattr( fattr3 *a, u_int i ) {
+
+  a->type = NF3REG;
+  a->mode = 0644;
+  a->nlink = 1;
+  a->uid = 1000;
+  a->gid = 1000;
+  a->size = 123456789 + i;
+  a->used = 123469824;
+  a->fsid = 0x803;
+  a->fileid = 1234567 + i;
+  a->atime.seconds = a->mtime.seconds = a->ctime.seconds = 1500000000 + i;
+  a->atime.nseconds = a->mtime.nseconds = a->ctime.nseconds = 123456789;
+}
+
+static void xdrbench_postop( post_op_attr *a ) {
+
+  a->attributes_follow = TRUE;
+  xdrbench_fattr(&a->post_op_attr_u.attributes, 0);
+}
+
+static void xdrbench_wcc( wcc_data *w ) {
+
+  w->before.attributes_follow = TRUE;
+  w->before.pre_op_attr_u.attributes.size = 4096;
+  xdrbench_postop(&w->after);
+}
+
+int main( int argc, char *argv[] ) {
+
+  static char fhdata[32] = "0123456789abcdef0123456789abcdef";
+  static char data[BENCH_DATASIZE];
+  static entryplus3 entries[BENCH_DIRENTRIES];
+  static char names[BENCH_DIRENTRIES][32];
+  nfs_fh3 fh = { { sizeof(fhdata), fhdata } };
+  diropargs3 where = { fh, "somefile.txt" };
+  long n = BENCH_ITERATIONS;
+  int i, err = 0;
+
+  GETATTR3args getattrargs;
+  GETATTR3res getattrres;
+  LOOKUP3args lookupargs;
+  LOOKUP3res lookupres;
+  READ3args readargs;
+  READ3res readres;
+  WRITE3args writeargs;
+  WRITE3res writeres;
+  READDIR3args readdirargs;
+  READDIRPLUS3args readdirplusargs;
+  READDIRPLUS3res readdirplusres;
+
+  SETATTR3args setattrargs;
+  SETATTR3res setattrres;
+  ACCESS3args accessargs;
+  ACCESS3res accessres;
+  READLINK3args readlinkargs;
+  READLINK3res readlinkres;
+  CREATE3args createargs;
+  CREATE3res createres;
+  MKDIR3args mkdirargs;
+  SYMLINK3args symlinkargs;
+  MKNOD3args mknodargs;
+  REMOVE3args removeargs;
+  REMOVE3res removeres;
+  RENAME3args renameargs;
+  RENAME3res renameres;
+  LINK3args linkargs;
+  LINK3res linkres;
+  FSSTAT3args fsstatargs;
+  FSSTAT3res fsstatres;
+  FSINFO3res fsinfores;
+  PATHCONF3res pathconfres;
+  COMMIT3args commitargs;
+  COMMIT3res commitres;
+
+  if ( argc > 1 && (n = atol(argv[1])) <= 0 ) {
+    fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+    return 1;
+  }
+
+  memset(data, 'x', sizeof(data));
+
+  getattrargs.object = fh;
+
+  memset(&getattrres, 0, sizeof(getattrres));
+  getattrres.status = NFS3_OK;
+  xdrbench_fattr(&getattrres.GETATTR3res_u.resok.obj_attributes, 0);
+
+  lookupargs.what = where;
+
+  memset(&lookupres, 0, sizeof(lookupres));
+  lookupres.status = NFS3_OK;
+  lookupres.LOOKUP3res_u.resok.object = fh;
+  xdrbench_postop(&lookupres.LOOKUP3res_u.resok.obj_attributes);
+  xdrbench_postop(&lookupres.LOOKUP3res_u.resok.dir_attributes);
+  lookupres.LOOKUP3res_u.resok.dir_attributes.post_op_attr_u.attributes.type = NF3DIR;
+
+  readargs.file = fh;
+  readargs.offset = 1 << 30;
+  readargs.count = BENCH_DATASIZE;
+
+  memset(&readres, 0, sizeof(readres));
+  readres.status = NFS3_OK;
+  xdrbench_postop(&readres.READ3res_u.resok.file_attributes);
+  readres.READ3res_u.resok.count = BENCH_DATASIZE;
+  readres.READ3res_u.resok.data.data_len = BENCH_DATASIZE;
+  readres.READ3res_u.resok.data.data_val = data;
+
+  writeargs.file = fh;
+  writeargs.offset = 1 << 30;
+  writeargs.count = BENCH_DATASIZE;
+  writeargs.stable = UNSTABLE;
+  writeargs.data.data_len = BENCH_DATASIZE;
+  writeargs.data.data_val = data;
+
+  memset(&writeres, 0, sizeof(writeres));
+  writeres.status = NFS3_OK;
+  xdrbench_wcc(&writeres.WRITE3res_u.resok.file_wcc);
+  writeres.WRITE3res_u.resok.count = BENCH_DATASIZE;
+  writeres.WRITE3res_u.resok.committed = UNSTABLE;
+  memcpy(writeres.WRITE3res_u.resok.verf, "verifier", NFS3_WRITEVERFSIZE);
+
+  memset(&readdirargs, 0, sizeof(readdirargs));
+  readdirargs.dir = fh;
+  readdirargs.cookie = 12345;
+  memcpy(readdirargs.cookieverf, "cookieve", NFS3_COOKIEVERFSIZE);
+  readdirargs.count = 8192;
+
+  memset(&readdirplusargs, 0, sizeof(readdirplusargs));
+  readdirplusargs.dir = fh;
+  readdirplusargs.cookie = 12345;
+  memcpy(readdirplusargs.cookieverf, "cookieve", NFS3_COOKIEVERFSIZE);
+  readdirplusargs.dircount = 8192;
+  readdirplusargs.maxcount = 32768;
+
+  memset(&readdirplusres, 0, sizeof(readdirplusres));
+  readdirplusres.status = NFS3_OK;
+  xdrbench_postop(&readdirplusres.READDIRPLUS3res_u.resok.dir_attributes);
+
+  for ( i = 0; i < BENCH_DIRENTRIES; i++ ) {
+    snprintf(names[i], sizeof(names[i]), "file%05d.dat", i);
+    entries[i].fileid = 1000 + i;
+    entries[i].name = names[i];
+    entries[i].cookie = i + 1;
+    entries[i].name_attributes.attributes_follow = TRUE;
+    xdrbench_fattr(&entries[i].name_attributes.post_op_attr_u.attributes, i);
+    entries[i].name_handle.handle_follows = TRUE;
+    entries[i].name_handle.post_op_fh3_u.handle = fh;
+    entries[i].nextentry = i + 1 < BENCH_DIRENTRIES ? &entries[i + 1] : NULL;
+  }
+
+  readdirplusres.READDIRPLUS3res_u.resok.reply.entries = entries;
+  readdirplusres.READDIRPLUS3res_u.resok.reply.eof = TRUE;
+
+  // messages with rpcgen codecs only
+  memset(&setattrargs, 0, sizeof(setattrargs));
+  setattrargs.object = fh;
+  setattrargs.new_attributes.mode.set_it = TRUE;
+  setattrargs.new_attributes.mode.set_mode3_u.mode = 0644;
+
+  memset(&setattrres, 0, sizeof(setattrres));
+  xdrbench_wcc(&setattrres.SETATTR3res_u.resok.obj_wcc);
+
+  accessargs.object = fh;
+  accessargs.access = ACCESS3_READ | ACCESS3_LOOKUP;
+
+  memset(&accessres, 0, sizeof(accessres));
+  xdrbench_postop(&accessres.ACCESS3res_u.resok.obj_attributes);
+  accessres.ACCESS3res_u.resok.access = ACCESS3_READ;
+
+  readlinkargs.symlink = fh;
+
+  memset(&readlinkres, 0, sizeof(readlinkres));
+  xdrbench_postop(&readlinkres.READLINK3res_u.resok.symlink_attributes);
+  readlinkres.READLINK3res_u.resok.data = "../some/target";
+
+  memset(&createargs, 0, sizeof(createargs));
+  createargs.where = where;
+  createargs.how.mode = UNCHECKED;
+  createargs.how.createhow3_u.obj_attributes.mode.set_it = TRUE;
+  createargs.how.createhow3_u.obj_attributes.mode.set_mode3_u.mode = 0644;
+
+  memset(&createres, 0, sizeof(createres));
+  createres.CREATE3res_u.resok.obj.handle_follows = TRUE;
+  createres.CREATE3res_u.resok.obj.post_op_fh3_u.handle = fh;
+  xdrbench_postop(&createres.CREATE3res_u.resok.obj_attributes);
+  xdrbench_wcc(&createres.CREATE3res_u.resok.dir_wcc);
+
+  memset(&mkdirargs, 0, sizeof(mkdirargs));
+  mkdirargs.where = where;
+
+  memset(&symlinkargs, 0, sizeof(symlinkargs));
+  symlinkargs.where = where;
+  symlinkargs.symlink.symlink_data = "../some/target";
+
+  memset(&mknodargs, 0, sizeof(mknodargs));
+  mknodargs.where = where;
+  mknodargs.what.type = NF3FIFO;
+
+  removeargs.object = where;
+
+  memset(&removeres, 0, sizeof(removeres));
+  xdrbench_wcc(&removeres.REMOVE3res_u.resok.dir_wcc);
+
+  renameargs.from = where;
+  renameargs.to = where;
+
+  memset(&renameres, 0, sizeof(renameres));
+  xdrbench_wcc(&renameres.RENAME3res_u.resok.fromdir_wcc);
+  xdrbench_wcc(&renameres.RENAME3res_u.resok.todir_wcc);
+
+  linkargs.file = fh;
+  linkargs.link = where;
+
+  memset(&linkres, 0, sizeof(linkres));
+  xdrbench_postop(&linkres.LINK3res_u.resok.file_attributes);
+  xdrbench_wcc(&linkres.LINK3res_u.resok.linkdir_wcc);
+
+  fsstatargs.fsroot = fh;
+
+  memset(&fsstatres, 0, sizeof(fsstatres));
+  xdrbench_postop(&fsstatres.FSSTAT3res_u.resok.obj_attributes);
+  fsstatres.FSSTAT3res_u.resok.tbytes = 1LL << 40;
+
+  memset(&fsinfores, 0, sizeof(fsinfores));
+  xdrbench_postop(&fsinfores.FSINFO3res_u.resok.obj_attributes);
+  fsinfores.FSINFO3res_u.resok.rtmax = 1 << 20;
+
+  memset(&pathconfres, 0, sizeof(pathconfres));
+  xdrbench_postop(&pathconfres.PATHCONF3res_u.resok.obj_attributes);
+  pathconfres.PATHCONF3res_u.resok.name_max = 255;
+
+  commitargs.file = fh;
+  commitargs.offset = 0;
+  commitargs.count = 0;
+
+  memset(&commitres, 0, sizeof(commitres));
+  xdrbench_wcc(&commitres.COMMIT3res_u.resok.file_wcc);
+
+#define XDRBENCH(type, hand, obj) \
+  { #type, (xdrproc_t)xdr_##type, (xdrproc_t)hand, &obj, sizeof(type) }
+
+  t_xdrbench benches[] = {
+    XDRBENCH(GETATTR3args, nfs3xdr_GETATTR3args, getattrargs),
+    XDRBENCH(GETATTR3res, nfs3xdr_GETATTR3res, getattrres),
+    XDRBENCH(LOOKUP3args, nfs3xdr_LOOKUP3args, lookupargs),
+    XDRBENCH(LOOKUP3res, nfs3xdr_LOOKUP3res, lookupres),
+    XDRBENCH(READ3args, nfs3xdr_READ3args, readargs),
+    XDRBENCH(READ3res, nfs3xdr_READ3res, readres),
+    XDRBENCH(WRITE3args, nfs3xdr_WRITE3args, writeargs),
+    XDRBENCH(WRITE3res, nfs3xdr_WRITE3res, writeres),
+    XDRBENCH(READDIR3args, nfs3xdr_READDIR3args, readdirargs),
+    XDRBENCH(READDIRPLUS3args, nfs3xdr_READDIRPLUS3args, readdirplusargs),
+
+    XDRBENCH(SETATTR3args, NULL, setattrargs),
+    XDRBENCH(SETATTR3res, NULL, setattrres),
+    XDRBENCH(ACCESS3args, NULL, accessargs),
+    XDRBENCH(ACCESS3res, NULL, accessres),
+    XDRBENCH(READLINK3args, NULL, readlinkargs),
+    XDRBENCH(READLINK3res, NULL, readlinkres),
+    XDRBENCH(CREATE3args, NULL, createargs),
+    XDRBENCH(CREATE3res, NULL, createres),
+    XDRBENCH(MKDIR3args, NULL, mkdirargs),
+    XDRBENCH(SYMLINK3args, NULL, symlinkargs),
+    XDRBENCH(MKNOD3args, NULL, mknodargs),
+    XDRBENCH(REMOVE3args, NULL, removeargs),
+    XDRBENCH(REMOVE3res, NULL, removeres),
+    XDRBENCH(RENAME3args, NULL, renameargs),
+    XDRBENCH(RENAME3res, NULL, renameres),
+    XDRBENCH(LINK3args, NULL, linkargs),
+    XDRBENCH(LINK3res, NULL, linkres),
+    XDRBENCH(FSSTAT3args, NULL, fsstatargs),
+    XDRBENCH(FSSTAT3res, NULL, fsstatres),
+    XDRBENCH(FSINFO3res, NULL, fsinfores),
+    XDRBENCH(PATHCONF3res, NULL, pathconfres),
+    XDRBENCH(COMMIT3args, NULL, commitargs),
+    XDRBENCH(COMMIT3res, NULL, commitres),
+  };
+
+  printf("%ld iterations\n", n);
+#ifdef NFS3XDR_RPCGEN
+  printf("hand* rows are hand written codecs without XDR_INLINE(), as in XDR=rpcgen build\n");
+#endif
+  printf("\n");
+  bench_header();
+
+  for ( i = 0; i < sizeof(benches) / sizeof(benches[0]) ; i++ )
+    if ( xdrbench_run(&benches[i], n) == -1 ) err = 1;
+
+  if ( xdrbench_rundirreply(&readdirplusres, n / BENCH_DIRENTRIES + 1) == -1 )
+    err = 1;
+
+return err;
+}
@@ -0,0 +1,82 @@
+/*
+ *
+ * Adrian Brzezinski (2018) <adrbxx at gmail.com>
+ * License: GPLv2+
+ *
+ */
+
+#include "arena.h"
+
+void arena_init( t_arena *arena, size_t chunksize ) {
+
+  memset(arena, 0, sizeof(t_arena));
+  arena->chunksize = chunksize;
+}
+
+void arena_reset( t_arena *arena ) {
+
+  t_arenachunk *c;
+
+  for ( c = arena->chunks; c ; c = c->next ) c->used = 0;
+
+  arena->cur = arena->chunks;
+}
+
+void arena_free( t_arena *arena ) {
+
+  t_arenachunk *c;
+
+  while ( (c = arena->chunks) != NULL ) {
+    arena->chunks = c->next;
+    free(c);
+  }
+
+  arena->cur = NULL;
+}
+
+void *arena_alloc( t_arena *arena, size_t size ) {
+
+  t_arenachunk *c = arena->cur, *nc;
+  size_t csize;
+  void *ptr;
+
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+  // chunks following current one are free after reset
+  while ( c && c->used + size > c->size ) {
+    if ( c->next == NULL || c->next->size < size ) break;
+    c = c->next;
+  }
+
+  if ( c == NULL || c->used + size > c->size ) {
+
+    csize = arena->chunksize ? arena->chunksize : ARENA_CHUNKSIZE;
+    if ( csize < size ) csize = size;
+
+    if ( (nc = malloc(sizeof(t_arenachunk) + csize)) == NULL ) {
+      perror("malloc()");
+      return NULL;
+    }
+
+    nc->size = csize;
+    nc->used = 0;
+
+    // put it after current chunk, free ones stay behind it
+    if ( c ) {
+      nc->next = c->next;
+      c->next = nc;
+    } else {
+      nc->next = arena->chunks;
+      arena->chunks = nc;
+    }
+
+    c = nc;
+  }
+
+  arena->cur = c;
+
+  ptr = c->data + c->used;
+  c->used += size;
+
+return ptr;
+}
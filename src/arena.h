@@ -0,0 +1,52 @@
+/*
+ *
+ * Adrian Brzezinski (2018) <adrbxx at gmail.com>
+ * License: GPLv2+
+ *
+ */
+
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_CHUNKSIZE 65536     // default size of memory chunk
+#define ARENA_ALIGN     8
+
+typedef struct s_arenachunk {
+
+  struct s_arenachunk *next;
+
+  size_t size;
+  size_t used;
+
+  char data[];
+
+} t_arenachunk;
+
+// Memory for many small objects which are freed all at once.
+// Chunks are kept after reset, so arena reused for similar sets
+// of objects doesn't allocate anymore. Zeroed arena is empty.
+typedef struct {
+
+  t_arenachunk *chunks;
+  t_arenachunk *cur;      // chunk we allocate from
+
+  size_t chunksize;       // 0 means ARENA_CHUNKSIZE
+
+} t_arena;
+
+void arena_init( t_arena *arena, size_t chunksize );
+
+// forget all objects, memory is kept for reuse
+void arena_reset( t_arena *arena );
+
+// release memory
+void arena_free( t_arena *arena );
+
+// NULL if there is no memory
+void *arena_alloc( t_arena *arena, size_t size );
+
+#endif // __ARENA_H__
@@ -0,0 +1,245 @@
+/*
+ *
+ * Adrian Brzezinski (2018) <adrbxx at gmail.com>
+ * License: GPLv2+
+ *
+ */
+
+#include "batch.h"
+
+static char *batch_strndup( t_batch *batch, const char *s, size_t len ) {
+
+  char *p;
+
+  if ( (p = arena_alloc(&batch->arena, len + 1)) == NULL ) return NULL;
+
+  memcpy(p, s, len);
+  p[len] = '\0';
+
+return p;
+}
+
+// parse one command, blanks and comments are skipped
+static int batch_add( t_batch *batch, int lineno, const char *s, size_t len ) {
+
+  char *argv[TOKENIZEARGMAX], *buf;
+  t_batchcmd *cmd, *tmp;
+  int i, argc, size;
+
+  while ( len && *s <= ' ' ) {
+    s++;
+    len--;
+  }
+
+  while ( len && s[len - 1] <= ' ' ) len--;
+
+  if ( len == 0 || *s == '#' ) return 0;
+
+  if ( batch->ncmds == batch->maxcmds ) {
+
+    size = batch->maxcmds ? batch->maxcmds * 2 : 256;
+
+    if ( (tmp = realloc(batch->cmds, size * sizeof(t_batchcmd))) == NULL ) {
+      perror("realloc()");
+      return -1;
+    }
+
+    batch->cmds = tmp;
+    batch->maxcmds = size;
+  }
+
+  cmd = &batch->cmds[batch->ncmds];
+  memset(cmd, 0, sizeof(t_batchcmd));
+  cmd->lineno = lineno;
+
+  if ( (cmd->text = batch_strndup(batch, s, len)) == NULL
+      || (buf = batch_strndup(batch, s, len)) == NULL ) {
+    fprintf(stderr, "batch_add(): out of memory\n");
+    return -1;
+  }
+
+  tokenizestr(buf, argv, &argc);
+
+  if ( (cmd->argv = arena_alloc(&batch->arena, (argc + 1) * sizeof(char *))) == NULL ) {
+    fprintf(stderr, "batch_add(): out of memory\n");
+    return -1;
+  }
+
+  memcpy(cmd->argv, argv, argc * sizeof(char *));
+  cmd->argv[argc] = NULL;
+  cmd->argc = argc;
+
+  for ( i = 0; commands[i].name ; i++ ) {
+    if ( !strcmp(argv[0], commands[i].name) ) {
+      cmd->command = &commands[i];
+      break;
+    }
+  }
+
+  if ( cmd->command == NULL ) {
+    fprintf(stderr, "line %d: %s: No such command\n", lineno, argv[0]);
+    return -1;
+  }
+
+  batch->ncmds++;
+
+return 0;
+}
+
+int batch_parse( t_batch *batch, const char *script ) {
+
+  const char *s, *start;
+  int lineno = 1, quotes = 0, ret = 0;
+
+  memset(batch, 0, sizeof(t_batch));
+
+  for ( s = start = script; ; s++ ) {
+
+    if ( *s == '"' ) quotes ^= 1;
+
+    if ( *s && *s != '\n' && (*s != ';' || quotes) ) continue;
+
+    // report all unknown commands at once
+    if ( batch_add(batch, lineno, start, s - start) == -1 ) ret = -1;
+
+    if ( *s == '\0' ) break;
+
+    if ( *s == '\n' ) {
+      lineno++;
+      quotes = 0;
+    }
+
+    start = s + 1;
+  }
+
+return ret;
+}
+
+void batch_free( t_batch *batch ) {
+
+  if ( batch->cmds ) free(batch->cmds);
+  arena_free(&batch->arena);
+
+  memset(batch, 0, sizeof(t_batch));
+}
+
+static void batch_report( t_batchcmd *cmd, int ret ) {
+
+  printf("#%d %s: %s\n", cmd->lineno, ret ? "failed" : "ok", cmd->text);
+  fflush(stdout);
+}
+
+static int batch_runone( t_batchcmd *cmd ) {
+
+  int ret;
+
+  ret = cmd->command->cmd(cmd->argc, cmd->argv);
+  batch_report(cmd, ret);
+
+return ret ? 1 : 0;
+}
+
+// the only path of command which can be pipelined, or NULL
+static char *batch_path( t_batchcmd *cmd ) {
+
+  char *path = NULL;
+  int i;
+
+  if ( cmd->command->cmd == cmd_stat )
+    return cmd->argc == 2 ? cmd->argv[1] : NULL;
+
+  if ( cmd->command->cmd != cmd_rm ) return NULL;
+
+  for ( i = 1; i < cmd->argc ; i++ ) {
+
+    if ( !strcmp(cmd->argv[i], "-f") ) continue;
+    if ( path || cmd->argv[i][0] == '-' ) return NULL;
+
+    path = cmd->argv[i];
+  }
+
+return path;
+}
+
+// number of following commands which can be pipelined with first one
+static int batch_runlen( t_batch *batch, int first ) {
+
+  t_batchcmd *cmd = &batch->cmds[first];
+  int i;
+
+  if ( batch_path(cmd) == NULL ) return 1;
+
+  for ( i = first + 1; i < batch->ncmds && i - first < BATCH_RUNMAX ; i++ ) {
+    if ( batch->cmds[i].command->cmd != cmd->command->cmd
+        || batch_path(&batch->cmds[i]) == NULL )
+      break;
+  }
+
+return i - first;
+}
+
+// stat or rm commands with their calls in flight at once
+static int batch_pipeline( t_batch *batch, int first, int n ) {
+
+  t_batchcmd *cmds = &batch->cmds[first];
+  struct stat *fstats = NULL;
+  char **paths = NULL;
+  int i, *status = NULL, failed = 0;
+
+  // each of them reports why it can't be done
+  if ( nfsclt.hostname == NULL || nfsconnect(&nfsclt, NFS_PROGRAM) == -1 ) {
+    for ( i = 0; i < n ; i++ ) failed += batch_runone(&cmds[i]);
+    return failed;
+  }
+
+  paths = malloc(n * sizeof(char *));
+  status = malloc(n * sizeof(int));
+  if ( cmds->command->cmd == cmd_stat ) fstats = malloc(n * sizeof(struct stat));
+
+  if ( paths == NULL || status == NULL
+      || (cmds->command->cmd == cmd_stat && fstats == NULL) ) {
+    perror("malloc()");
+    failed = n;
+    goto ERR;
+  }
+
+  for ( i = 0; i < n ; i++ ) paths[i] = batch_path(&cmds[i]);
+
+  if ( fstats ) nfsfilestatall(&nfsclt, paths, n, fstats, status);
+  else nfsfilermall(&nfsclt, paths, n, status);
+
+  for ( i = 0; i < n ; i++ ) {
+
+    if ( fstats && status[i] == 0 ) stat_print(paths[i], &fstats[i]);
+
+    batch_report(&cmds[i], status[i]);
+    if ( status[i] ) failed++;
+  }
+
+ERR:
+  if ( paths ) free(paths);
+  if ( status ) free(status);
+  if ( fstats ) free(fstats);
+
+return failed;
+}
+
+int batch_run( t_batch *batch ) {
+
+  int i, n, failed = 0;
+
+  batchmode = 1;
+
+  for ( i = 0; i < batch->ncmds ; i += n ) {
+
+    // rest of script is skipped, caller cleans up
+    if ( batch->cmds[i].command->cmd == cmd_quit ) break;
+
+    if ( (n = batch_runlen(batch, i)) > 1 )
+      failed += batch_pipeline(batch, i, n);
+    else
+      failed += batch_runone(&batch->cmds[i]);
+  }
+
+return failed;
+}
@@ -0,0 +1,55 @@
+/*
+ *
+ * Adrian Brzezinski (2018) <adrbxx at gmail.com>
+ * License: GPLv2+
+ *
+ */
+
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "arena.h"
+#include "commands.h"
+
+#define BATCH_RUNMAX  4096    // commands pipelined together
+
+typedef struct {
+
+  int lineno;
+  char *text;           // as written, for status report
+
+  int argc;
+  char **argv;          // tokenized copy of text
+  t_command *command;
+
+} t_batchcmd;
+
+// Whole script, parsed before anything is run
+typedef struct {
+
+  t_batchcmd *cmds;
+  int ncmds;
+  int maxcmds;
+
+  t_arena arena;        // texts and arguments
+
+} t_batch;
+
+// Split script into commands on new lines and semicolons outside of
+// double quotes. Empty ones and lines starting with '#' are skipped.
+// Returns -1 if any command is unknown, nothing should be run then.
+int batch_parse( t_batch *batch, const char *script );
+
+// Run commands in order, without prompts. Consecutive stat or rm
+// commands with single path are pipelined. Status of each command is
+// printed after it, returns number of failed ones.
+int batch_run( t_batch *batch );
+
+void batch_free( t_batch *batch );
+
+#endif // __BATCH_H__
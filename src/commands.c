@@ -31,6 +31,27 @@
     } \
   }
 
+// Ask before overwriting or removing, anything but yes bails out.
+// There is nobody to ask in batch mode, so it's always yes then.
+static int confirm( const char *question, const char *name ) {
+
+  char answer[10];
+
+  if ( batchmode ) return 1;
+
+  printf("%s '%s'? [Y]: ", question, name);
+
+  answer[0] = '\0';
+  if ( fgets(answer, sizeof(answer), stdin) != NULL) {
+    if (answer[0] != 'y' && answer[0] != 'Y') {
+      printf("Bailing out!\n");
+      return 0;
+    }
+  }
+
+return 1;
+}
+
 int cmd_help( int argc, char **argv) {
   int i, col;
 
@@ -115,7 +136,7 @@ int cmd_umount( int argc, char **argv) {
   CHECK_ARGS_MAXNUM(0);
 
   nfsumount( &nfsclt );
-  nfsdisconnect( &nfsclt.nfs );
+  nfsdisconnectnfs( &nfsclt );
   nfsdisconnect( &nfsclt.mount );
 
 return 0;
@@ -130,7 +151,7 @@ int cmd_quit( int argc, char **argv) {
 
 int cmd_ls( int argc, char **argv) {
 
-  tp_nfsdir nfsdir;
+  t_nfsdir nfsdir;
   char *path = NULL;
   int ret, i, printattrs = 0;
 
@@ -152,19 +173,13 @@ int cmd_ls( int argc, char **argv) {
   if ( nfsconnect( &nfsclt, NFS_PROGRAM) == -1 )
     return -1;
 
-  memset(&nfsdir, 0, sizeof(nfsdir));
-
-  do {
-
-    ret = nfsdirread( &nfsclt, &nfsdir, path);
-    if ( ret == -1 ) return -1;
-
-    if ( nfsdirprint( &nfsclt, &nfsdir, printattrs, path) == -1 )
-      return -1;
+  if ( nfsdiropen( &nfsclt, &nfsdir, path, printattrs) == -1 )
+    return -1;
 
-  } while ( ret > 0 );
+  ret = nfsdirprint( &nfsclt, &nfsdir );
+  nfsdirclose( &nfsclt, &nfsdir );
 
-return 0;
+return ret;
 }
 
 int cmd_cd( int argc, char **argv ) {
@@ -186,10 +201,8 @@ return nfscd( &nfsclt, path );
 
 int cmd_cat( int argc, char **argv) {
 
-  char filedata[8192];
-  char *file = NULL;
-  long offset = 0;
-  int rlen = 0;
+  t_nfsfile nfsfile;
+  long rlen;
 
   CHECK_ARGS_NUM(1);
 
@@ -198,19 +211,15 @@ int cmd_cat( int argc, char **argv) {
   if ( nfsconnect( &nfsclt, NFS_PROGRAM) == -1 )
     return -1;
 
-  if ( argc == 2 )
-    file = argv[1];
-
-  while ( (rlen = nfsfilepread( &nfsclt, file, offset, filedata, sizeof(filedata))) > 0 ) {
-
-    if ( rlen == -1 ) return -1;
+  if ( nfsfileopen( &nfsclt, &nfsfile, argv[1], 1 ) == -1 )
+    return -1;
 
-    fwrite(filedata, rlen, sizeof(char), stdout);
+  rlen = nfsfileread( &nfsclt, &nfsfile, stdout );
+  fflush(stdout);
 
-    offset += rlen;
-  }
+  nfsfileclose( &nfsclt, &nfsfile );
 
-return 0;
+return rlen == -1 ? -1 : 0;
 }
 
 int cmd_handle( int argc, char **argv) {
@@ -227,6 +236,11 @@ int cmd_handle( int argc, char **argv) {
   handle = argv[1];
   nfshandleset_str(&nfsclt.currentdir, nfsclt.version, handle);
 
+  // handle could be from other file system
+  nfsclt.fsinfo.valid = 0;
+  dnlc_purge(&nfsclt.dnlc);
+  acache_purge(&nfsclt.acache);
+
 return 0;
 }
 
@@ -241,9 +255,27 @@ int cmd_set( int argc, char **argv) {
     else
       printf("host: <not set>\n");
 
+    printf("port:\t%d\n", nfsclt.nfsport);
+    printf("mountport:\t%d\n", nfsclt.mountport);
     printf("uid:\t%d\n", nfsclt.uid);
     printf("gid:\t%d\n", nfsclt.gid);
     printf("mode:\t%o\n", nfsclt.mode);
+    printf("window:\t%d\n", nfsclt.window);
+    printf("dnlcttl:\t%d (%d entries, %lu hits, %lu misses)\n", nfsclt.dnlc.ttl,
+        nfsclt.dnlc.count, nfsclt.dnlc.hits, nfsclt.dnlc.misses);
+    printf("acttl:\t%d (%d entries, %lu hits, %lu misses)\n", nfsclt.acache.ttl,
+        nfsclt.acache.count, nfsclt.acache.hits, nfsclt.acache.misses);
+    printf("nconnect:\t%d\n", nfsclt.nconnect);
+
+    for ( i = 0; i < nfsclt.nfsgroup.nmux ; i++ ) {
+      t_rpcmux *mux = nfsclt.nfsgroup.mux[i];
+
+      if ( !rpcmux_alive(mux) ) continue;
+
+      printf("\t%s:%d\t%lu calls, %lu replies, %llu bytes sent, %llu received\n",
+          sockname(mux->socket), sockport(mux->socket),
+          mux->submitted, mux->replies, mux->sent, mux->received);
+    }
 
     return 0;
   }
@@ -261,6 +293,20 @@ int cmd_set( int argc, char **argv) {
       break;
     }
 
+    if ( !strcmp(argv[i], "port") || !strcmp(argv[i], "mountport") ) {
+      int port = atoi(argv[i+1]);
+
+      if ( port < 0 || port > 65535 ) {
+        fprintf(stderr, "%s: invalid port\n", argv[0]);
+        return -1;
+      }
+
+      // used by next connection
+      if ( argv[i][0] == 'p' ) nfsclt.nfsport = port;
+      else nfsclt.mountport = port;
+      break;
+    }
+
     if ( !strcmp(argv[i], "uid") ) {
       nfsclt.uid = atoi(argv[i+1]);
       break;
@@ -271,6 +317,58 @@ int cmd_set( int argc, char **argv) {
       break;
     }
 
+    if ( !strcmp(argv[i], "window") ) {
+      int window = atoi(argv[i+1]);
+
+      if ( window < 1 || window > NFS_WINDOW_MAX ) {
+        fprintf(stderr, "%s: window must be between 1 and %d\n",
+            argv[0], NFS_WINDOW_MAX);
+        return -1;
+      }
+
+      nfsclt.window = window;
+      break;
+    }
+
+    if ( !strcmp(argv[i], "dnlcttl") ) {
+      int ttl = atoi(argv[i+1]);
+
+      if ( ttl < 0 ) {
+        fprintf(stderr, "%s: dnlcttl can't be negative\n", argv[0]);
+        return -1;
+      }
+
+      // drop what was cached with old ttl
+      dnlc_init(&nfsclt.dnlc, ttl, nfsclt.dnlc.max);
+      break;
+    }
+
+    if ( !strcmp(argv[i], "acttl") ) {
+      int ttl = atoi(argv[i+1]);
+
+      if ( ttl < 0 ) {
+        fprintf(stderr, "%s: acttl can't be negative\n", argv[0]);
+        return -1;
+      }
+
+      acache_init(&nfsclt.acache, ttl, nfsclt.acache.max);
+      break;
+    }
+
+    if ( !strcmp(argv[i], "nconnect") ) {
+      int nconnect = atoi(argv[i+1]);
+
+      if ( nconnect < 1 || nconnect > NFS_NCONNECT_MAX ) {
+        fprintf(stderr, "%s: nconnect must be between 1 and %d\n",
+            argv[0], NFS_NCONNECT_MAX);
+        return -1;
+      }
+
+      // connections are opened or closed on next command
+      nfsclt.nconnect = nconnect;
+      break;
+    }
+
     if ( !strcmp(argv[i], "mode") ) {
       if (sscanf(argv[i+1], "%o", &nfsclt.mode) != 1) {
         fprintf(stderr, "%s: invalid mode\n", argv[0]);
@@ -337,118 +435,155 @@ return 0;
 
 int cmd_get( int argc, char **argv) {
 
-  char filedata[16384];
   char *rfile = NULL; // remote file
   char *lfile = NULL; // local file
+  char *rcopy;
+  t_nfsfile nfsfile;
   FILE *lf;
-  long offset = 0;
-  int rlen = 0;
+  long rlen = 0;
+  int i, recursive = !strcmp(argv[0], "mirror");
 
-  CHECK_ARGS_MAXNUM(2);
+  CHECK_ARGS_MAXNUM(3);
 
   CHECK_HOSTNAME;
 
-  if ( nfsconnect( &nfsclt, NFS_PROGRAM) == -1 )
-    return -1;
+  for ( i=1; i < argc ; i++ ) {
 
-  if ( argc >= 2 )
-    rfile = argv[1];
+    if ( !strcmp(argv[i], "-r") ) {
+      recursive = 1;
+      continue;
+    }
 
-  if ( argc == 3 )
-    lfile = argv[2];
-  else
-    lfile = rfile;
+    if ( rfile == NULL ) {
+      rfile = argv[i];
+    } else if ( lfile == NULL ) {
+      lfile = argv[i];
+    } else {
+      fprintf(stderr,"%s: Too many arguments\n", argv[0]);
+      return -1;
+    }
+  }
 
   if ( rfile == NULL ) {
     fprintf(stderr, "Remote file not specified\n");
     return -1;
   }
 
+  if ( nfsconnect( &nfsclt, NFS_PROGRAM) == -1 )
+    return -1;
+
+  if ( recursive ) {
+
+    // tree goes into current directory by default
+    rcopy = strdup(rfile);
+    rlen = nfsmirror( &nfsclt, rfile, lfile ? lfile : basename(rcopy) );
+    free(rcopy);
+
+    return rlen == -1 ? -1 : 0;
+  }
+
+  if ( lfile == NULL )
+    lfile = rfile;
+
+  if ( nfsfileopen( &nfsclt, &nfsfile, rfile, 1 ) == -1 )
+    return -1;
+
   struct stat filestat;
   if ( !stat(lfile, &filestat) ) {
 
-    printf("Overwrite local file '%s'? [Y]: ", lfile);
-
-    filedata[0] = '\0';
-    if ( fgets(filedata, sizeof(filedata), stdin) != NULL) {
-      if (filedata[0] != 'y' && filedata[0] != 'Y') {
-        printf("Bailing out!\n");
-        return 0;
-      }
+    if ( !confirm("Overwrite local file", lfile) ) {
+      nfsfileclose( &nfsclt, &nfsfile );
+      return 0;
     }
   }
 
-  if ((lf = fopen(lfile, "w")) == NULL) {
+  // opened for reading too, so it can be mapped
+  if ((lf = fopen(lfile, "w+")) == NULL) {
     perror("fopen");
+    nfsfileclose( &nfsclt, &nfsfile );
     return -1;
   }
   
-  while ( (rlen = nfsfilepread( &nfsclt, rfile, offset, filedata, sizeof(filedata))) > 0 ) {
-
-    if ( rlen == -1 ) break;
-
-    fwrite(filedata, sizeof(char), rlen, lf);
-
-    offset += rlen;
-  }
+  rlen = nfsfileread( &nfsclt, &nfsfile, lf );
 
   fclose(lf);
+  nfsfileclose( &nfsclt, &nfsfile );
 
-return 0;
+return rlen == -1 ? -1 : 0;
 }
 
 int cmd_put( int argc, char **argv) {
 
-  char filedata[16384];
   char *rfile = NULL; // remote file
   char *lfile = NULL; // local file
+  char *lcopy;
+  t_nfsfile nfsfile;
   FILE *lf;   // local file handle
-  long offset = 0;
-  int rlen = 0, wlen = 0;
+  long wlen = 0;
   struct stat filestat;
+  int i, recursive = 0;
 
-  CHECK_ARGS_MAXNUM(2);
+  CHECK_ARGS_MAXNUM(3);
 
   CHECK_HOSTNAME;
 
-  if ( nfsconnect( &nfsclt, NFS_PROGRAM) == -1 )
-    return -1;
+  for ( i=1; i < argc ; i++ ) {
 
-  if ( argc >= 2 )
-    lfile = argv[1];
+    if ( !strcmp(argv[i], "-r") ) {
+      recursive = 1;
+      continue;
+    }
 
-  if ( argc == 3 )
-    rfile = argv[2];
-  else
-    rfile = lfile;
+    if ( lfile == NULL ) {
+      lfile = argv[i];
+    } else if ( rfile == NULL ) {
+      rfile = argv[i];
+    } else {
+      fprintf(stderr,"%s: Too many arguments\n", argv[0]);
+      return -1;
+    }
+  }
 
-  if ( rfile == NULL ) {
+  if ( lfile == NULL ) {
     fprintf(stderr, "Local file not specified\n");
     return -1;
   }
 
+  if ( nfsconnect( &nfsclt, NFS_PROGRAM) == -1 )
+    return -1;
+
+  if ( recursive ) {
+
+    // tree goes into current directory by default
+    lcopy = strdup(lfile);
+    wlen = nfsupload( &nfsclt, lfile, rfile ? rfile : basename(lcopy) );
+    free(lcopy);
+
+    return wlen == -1 ? -1 : 0;
+  }
+
+  if ( rfile == NULL )
+    rfile = lfile;
+
   if ((lf = fopen(lfile, "r")) == NULL) {
     perror("fopen");
     return -1;
   }
 
   printf("Checking whatever remote file exists...\n");
-  if ( nfsfilestat( &nfsclt, rfile, &filestat ) != -1 ) {
-
-    printf("Overwrite remote file '%s'? [Y]: ", rfile);
+  if ( nfsfileopen( &nfsclt, &nfsfile, rfile, 0 ) != -1 ) {
 
-    filedata[0] = '\0';
-    if ( fgets(filedata, sizeof(filedata), stdin) != NULL) {
-      if (filedata[0] != 'y' && filedata[0] != 'Y') {
-        printf("Bailing out!\n");
-        return 0;
-      }
+    if ( !confirm("Overwrite remote file", rfile) ) {
+      nfsfileclose( &nfsclt, &nfsfile );
+      fclose(lf);
+      return 0;
     }
   } else {
     // create nfs file, copy stats from local file
 
     if ( stat(lfile, &filestat) ) {
       perror("stat()");
+      fclose(lf);
       return -1;
     }
 
@@ -456,38 +591,68 @@ int cmd_put( int argc, char **argv) {
     filestat.st_uid = nfsclt.uid;
     filestat.st_gid = nfsclt.gid;
 
-    if ( nfsfilecreate( &nfsclt, rfile, &filestat ) == -1 )
+    if ( nfsfilecreate( &nfsclt, rfile, &filestat ) == -1 ||
+         nfsfileopen( &nfsclt, &nfsfile, rfile, 0 ) == -1 ) {
+      fclose(lf);
       return -1;
+    }
   }
 
-  do {
-    rlen = fread(filedata, sizeof(char), sizeof(filedata), lf);
-    if ( rlen == -1 ) break;
-
-    wlen = nfsfilepwrite( &nfsclt, rfile, offset, filedata, rlen);
-    if ( wlen == -1 ) break;
-    if ( wlen != rlen ) {
-      fprintf(stderr, "%s - %i bytes written but %i requested!\n",
-          rfile, wlen, rlen);
-      break;
-    }
+  wlen = nfsfilewrite( &nfsclt, &nfsfile, fileno(lf) );
 
-    offset += wlen;
+  fclose(lf);
+  nfsfileclose( &nfsclt, &nfsfile );
 
-  } while ( !feof(lf) );
+return wlen == -1 ? -1 : 0;
+}
 
-  fclose(lf);
+// remote side is prefixed with ':', like host in rsync
+int cmd_sync( int argc, char **argv) {
 
-return 0;
+  char *src, *dst;
+  long len;
+  int download;
+
+  CHECK_ARGS_MAXNUM(3);
+
+  CHECK_HOSTNAME;
+
+  if ( argc != 3 ) {
+    fprintf(stderr, "%s: Source and destination required\n", argv[0]);
+    return -1;
+  }
+
+  src = argv[1];
+  dst = argv[2];
+  download = src[0] == ':';
+
+  if ( download == (dst[0] == ':') ) {
+    fprintf(stderr, "%s: Exactly one of paths has to be remote, prefixed with ':'\n", argv[0]);
+    return -1;
+  }
+
+  if ( download ) src++;
+  else dst++;
+
+  if ( *src == '\0' || *dst == '\0' ) {
+    fprintf(stderr, "%s: Empty path\n", argv[0]);
+    return -1;
+  }
+
+  if ( nfsconnect( &nfsclt, NFS_PROGRAM) == -1 )
+    return -1;
+
+  len = nfssync( &nfsclt, src, dst, download );
+
+return len == -1 ? -1 : 0;
 }
 
 int cmd_rm( int argc, char **argv) {
 
-  char answer[10];
   char *file = NULL;
-  int i, force = 0;
+  int i, force = 0, recursive = 0;
 
-  CHECK_ARGS_MAXNUM(2);
+  CHECK_ARGS_MAXNUM(3);
 
   CHECK_HOSTNAME;
 
@@ -499,6 +664,9 @@ int cmd_rm( int argc, char **argv) {
     if ( !strcmp(argv[i], "-f") ) {
       force = 1;
       continue;
+    } else if ( !strcmp(argv[i], "-r") ) {
+      recursive = 1;
+      continue;
     } else {
       file = argv[i];
     }
@@ -509,18 +677,15 @@ int cmd_rm( int argc, char **argv) {
     return -1;
   }
 
-  if ( !force ) {
-    printf("Remove remote file '%s'? [Y]: ", file);
+  if ( recursive ) {
 
-    answer[0] = '\0';
-    if ( fgets(answer, sizeof(answer), stdin) != NULL) {
-      if (answer[0] != 'y' && answer[0] != 'Y') {
-        printf("Bailing out!\n");
-        return 0;
-      }
-    }
+    if ( !force && !confirm("Remove remote tree", file) ) return 0;
+
+    return nfsrmtree( &nfsclt, file ) == -1 ? -1 : 0;
   }
 
+  if ( !force && !confirm("Remove remote file", file) ) return 0;
+
 return nfsfilerm( &nfsclt, file );
 }
 
@@ -611,7 +776,6 @@ return nfsdirmk( &nfsclt, dir, &dirstat);
 
 int cmd_rmdir( int argc, char **argv) {
 
-  char answer[10];
   char *dir = NULL;
   int i, force = 0;
 
@@ -637,17 +801,7 @@ int cmd_rmdir( int argc, char **argv) {
     return -1;
   }
 
-  if ( !force ) {
-    printf("Remove remote directory '%s'? [Y]: ", dir);
-
-    answer[0] = '\0';
-    if ( fgets(answer, sizeof(answer), stdin) != NULL) {
-      if (answer[0] != 'y' && answer[0] != 'Y') {
-        printf("Bailing out!\n");
-        return 0;
-      }
-    }
-  }
+  if ( !force && !confirm("Remove remote directory", dir) ) return 0;
 
 return nfsdirrm( &nfsclt, dir );
 }
@@ -778,6 +932,19 @@ int cmd_mknod( int argc, char **argv) {
 return nfsmknod( &nfsclt, name, &fstat, dev);
 }
 
+void stat_print( char *file, struct stat *fstat ) {
+
+  printf("File: %s\t%s\n", file, stat_ftype(fstat->st_mode));
+  printf("Size: %ld\n", fstat->st_size);
+  printf("Device: %lx\tInode: %ld\tLinks: %ld\n",
+    fstat->st_dev, fstat->st_ino, fstat->st_nlink);
+  printf("Access: 0%o\tUid: %i\tGid: %i\n",
+    fstat->st_mode&0777, fstat->st_uid, fstat->st_gid);
+  printf ("Inode Last Change at: %s", ctime (&fstat->st_ctime));
+  printf ("      Last access at: %s", ctime (&fstat->st_atime));
+  printf ("    Last modified at: %s", ctime (&fstat->st_mtime));
+}
+
 int cmd_stat( int argc, char **argv) {
 
   char *file = NULL;
@@ -795,15 +962,7 @@ int cmd_stat( int argc, char **argv) {
   if ( nfsfilestat( &nfsclt, file, &fstat ) == -1 )
     return -1;
 
-  printf("File: %s\t%s\n", file, stat_ftype(fstat.st_mode));
-  printf("Size: %ld\n", fstat.st_size);
-  printf("Device: %lx\tInode: %ld\tLinks: %ld\n",
-    fstat.st_dev, fstat.st_ino, fstat.st_nlink);
-  printf("Access: 0%o\tUid: %i\tGid: %i\n",
-    fstat.st_mode&0777, fstat.st_uid, fstat.st_gid);
-  printf ("Inode Last Change at: %s", ctime (&fstat.st_ctime));
-  printf ("      Last access at: %s", ctime (&fstat.st_atime));
-  printf ("    Last modified at: %s", ctime (&fstat.st_mtime));
+  stat_print(file, &fstat);
 
 return 0;
 }
@@ -820,6 +979,319 @@ int cmd_df( int argc, char **argv) {
 return nfsprintstat(&nfsclt);
 }
 
+int cmd_du( int argc, char **argv) {
+
+  char *path = ".";
+  int i, all = 0, ntop = 0;
+
+  CHECK_HOSTNAME;
+
+  if ( nfsconnect( &nfsclt, NFS_PROGRAM ) == -1 )
+    return -1;
+
+  for ( i = 1; i < argc ; i++ ) {
+
+    if ( !strcmp(argv[i], "-a") ) {
+      all = 1;
+    } else if ( !strcmp(argv[i], "-n") ) {
+      if ( ++i == argc || (ntop = atoi(argv[i])) <= 0 ) {
+        fprintf(stderr, "%s: -n needs positive number\n", argv[0]);
+        return -1;
+      }
+    } else if ( argv[i][0] == '-' ) {
+      fprintf(stderr, "%s: not recognized option %s\n", argv[0], argv[i]);
+      return -1;
+    } else {
+      path = argv[i];
+    }
+  }
+
+return nfsdu( &nfsclt, path, all, ntop );
+}
+
+// [+-]N of find, sets cmp to 1, -1 or 0
+static int find_number( char *arg, int *cmp, unsigned long long *value, char **end ) {
+
+  *cmp = 0;
+  if ( *arg == '+' ) *cmp = 1;
+  else if ( *arg == '-' ) *cmp = -1;
+  if ( *cmp ) arg++;
+
+  if ( *arg < '0' || *arg > '9' ) return -1;
+
+  errno = 0;
+  *value = strtoull(arg, end, 10);
+
+return errno ? -1 : 0;
+}
+
+int cmd_find( int argc, char **argv) {
+
+  t_nfsfind query;
+  unsigned long long value;
+  char *path = ".", *end, *snapshot = NULL;
+  int i, havepath = 0;
+
+  memset(&query, 0, sizeof(query));
+  query.sizecmp = query.mtimecmp = NFSFIND_ANY;
+  query.uid = -1;
+
+  for ( i = 1; i < argc ; i++ ) {
+
+    if ( argv[i][0] != '-' ) {
+      if ( havepath++ ) goto USAGE;
+      path = argv[i];
+      continue;
+    }
+
+    if ( i + 1 == argc ) {
+      fprintf(stderr, "%s: %s needs argument\n", argv[0], argv[i]);
+      return -1;
+    }
+
+    if ( !strcmp(argv[i], "-name") ) {
+
+      query.name = argv[++i];
+
+    } else if ( !strcmp(argv[i], "-type") ) {
+
+      if ( argv[++i][0] == '\0' || argv[i][1] != '\0' ) goto USAGE;
+
+      switch ( argv[i][0] ) {
+        case 'f': query.type = NF3REG; break;
+        case 'd': query.type = NF3DIR; break;
+        case 'l': query.type = NF3LNK; break;
+        case 'b': query.type = NF3BLK; break;
+        case 'c': query.type = NF3CHR; break;
+        case 's': query.type = NF3SOCK; break;
+        case 'p': query.type = NF3FIFO; break;
+        default: goto USAGE;
+      }
+
+    } else if ( !strcmp(argv[i], "-size") ) {
+
+      if ( find_number(argv[++i], &query.sizecmp, &query.size, &end) == -1 )
+        goto USAGE;
+
+      switch ( *end ) {
+        case '\0': query.sizeunit = 512; break;
+        case 'c': query.sizeunit = 1; break;
+        case 'k': query.sizeunit = 1024; break;
+        case 'M': query.sizeunit = 1048576; break;
+        case 'G': query.sizeunit = 1073741824; break;
+        default: goto USAGE;
+      }
+
+      if ( *end && end[1] ) goto USAGE;
+
+    } else if ( !strcmp(argv[i], "-mtime") ) {
+
+      if ( find_number(argv[++i], &query.mtimecmp, &value, &end) == -1 || *end )
+        goto USAGE;
+      query.mtime = value;
+
+    } else if ( !strcmp(argv[i], "-S") ) {
+
+      snapshot = argv[++i];
+
+    } else if ( !strcmp(argv[i], "-uid") ) {
+
+      query.uid = strtol(argv[++i], &end, 10);
+      if ( *end || end == argv[i] || query.uid < 0 ) goto USAGE;
+
+    } else {
+      fprintf(stderr, "%s: not recognized option %s\n", argv[0], argv[i]);
+      return -1;
+    }
+  }
+
+  if ( snapshot )
+    return nfssnapfind( snapshot, path, &query ) == -1 ? -1 : 0;
+
+  CHECK_HOSTNAME;
+
+  if ( nfsconnect( &nfsclt, NFS_PROGRAM ) == -1 )
+    return -1;
+
+return nfsfind( &nfsclt, path, &query ) == -1 ? -1 : 0;
+
+USAGE:
+  fprintf(stderr, "%s: wrong argument %s, see help find\n", argv[0], argv[i]);
+
+return -1;
+}
+
+int cmd_snapshot( int argc, char **argv) {
+
+  char *path = NULL, *file = NULL;
+  int i, incremental = 0;
+
+  CHECK_ARGS_MAXNUM(3);
+
+  CHECK_HOSTNAME;
+
+  for ( i = 1; i < argc ; i++ ) {
+
+    if ( !strcmp(argv[i], "-i") ) {
+      incremental = 1;
+    } else if ( path == NULL ) {
+      path = argv[i];
+    } else if ( file == NULL ) {
+      file = argv[i];
+    } else {
+      fprintf(stderr,"%s: Too many arguments\n", argv[0]);
+      return -1;
+    }
+  }
+
+  if ( path == NULL || file == NULL ) {
+    fprintf(stderr,"%s: missing operand\n", argv[0]);
+    return -1;
+  }
+
+  if ( nfsconnect( &nfsclt, NFS_PROGRAM ) == -1 )
+    return -1;
+
+return nfssnapshot( &nfsclt, path, file, incremental ) == -1 ? -1 : 0;
+}
+
+int cmd_stats( int argc, char **argv) {
+
+  int i, parsable = 0, reset = 0;
+
+  for ( i = 1; i < argc ; i++ ) {
+
+    if ( !strcmp(argv[i], "-p") ) {
+      parsable = 1;
+    } else if ( !strcmp(argv[i], "-z") ) {
+      reset = 1;
+    } else {
+      fprintf(stderr, "%s: not recognized option %s\n", argv[0], argv[i]);
+      return -1;
+    }
+  }
+
+  nfsprintrpcstats(&nfsclt, parsable);
+
+  if ( reset ) {
+    rpcstats_reset(&nfsclt.mountstats);
+    rpcstats_reset(&nfsclt.nfsstats);
+  }
+
+return 0;
+}
+
+static t_mocksrv mocksrv;
+static int mocksrv_running;
+
+static void mock_print( void ) {
+
+  t_mocksrvconf conf;
+  t_mocksrvstats stats;
+
+  mocksrv_status(&mocksrv, &conf, &stats);
+
+  printf("serving %s as %s on %s:%d\n", mocksrv.root, MOCKSRV_EXPORT,
+      MOCKSRV_HOST, mocksrv.port);
+  printf("latency:\t%.3f ms\n", conf.latency / 1000.0);
+
+  if ( conf.bandwidth )
+    printf("bandwidth:\t%.1f MB/s\n", conf.bandwidth / 1048576.0);
+  else
+    printf("bandwidth:\tunlimited\n");
+
+  printf("errors:\t%.2f%%\n", conf.errors * 100);
+  printf("drops:\t%.2f%%\n", conf.drops * 100);
+  printf("%lu calls, %lu replies, %lu errors, %lu drops, "
+      "%llu bytes received, %llu sent\n", stats.calls, stats.replies,
+      stats.errors, stats.drops, stats.received, stats.sent);
+}
+
+int cmd_mock( int argc, char **argv) {
+
+  t_mocksrvconf conf;
+  char *dir = NULL, *args[2] = { "umount", "" };
+  double value;
+  int i, changed = 0;
+
+  memset(&conf, 0, sizeof(conf));
+  if ( mocksrv_running ) mocksrv_status(&mocksrv, &conf, NULL);
+
+  if ( argc == 2 && !strcmp(argv[1], "stop") ) {
+
+    if ( !mocksrv_running ) {
+      fprintf(stderr, "%s: server isn't running\n", argv[0]);
+      return -1;
+    }
+
+    // connections to it would be broken anyway
+    cmd_umount(1, args);
+    mocksrv_stop(&mocksrv);
+    mocksrv_running = 0;
+    nfsclt.mountport = nfsclt.nfsport = 0;
+
+    return 0;
+  }
+
+  for ( i = 1; i < argc ; i++ ) {
+
+    if ( argv[i][0] != '-' ) {
+      if ( dir ) {
+        fprintf(stderr, "%s: Too many arguments\n", argv[0]);
+        return -1;
+      }
+      dir = argv[i];
+      continue;
+    }
+
+    if ( strlen(argv[i]) != 2 || !strchr("lbed", argv[i][1]) ) {
+      fprintf(stderr, "%s: not recognized option %s\n", argv[0], argv[i]);
+      return -1;
+    }
+
+    if ( i + 1 == argc || sscanf(argv[i + 1], "%lf", &value) != 1 || value < 0
+        || (argv[i][1] == 'e' && value > 100) || (argv[i][1] == 'd' && value > 100) ) {
+      fprintf(stderr, "%s: invalid value of %s\n", argv[0], argv[i]);
+      return -1;
+    }
+
+    switch ( argv[i][1] ) {
+      case 'l': conf.latency = value * 1000; break;
+      case 'b': conf.bandwidth = value * 1048576; break;
+      case 'e': conf.errors = value / 100; break;
+      case 'd': conf.drops = value / 100; break;
+    }
+
+    changed = 1;
+    i++;
+  }
+
+  if ( dir ) {
+
+    if ( mocksrv_running ) {
+      fprintf(stderr, "%s: server is already running, 'mock stop' it first\n", argv[0]);
+      return -1;
+    }
+
+    if ( mocksrv_start(&mocksrv, dir, &conf) == -1 ) return -1;
+    mocksrv_running = 1;
+
+    if ( nfsclt.hostname ) free(nfsclt.hostname);
+    nfsclt.hostname = strdup(MOCKSRV_HOST);
+    nfsclt.mountport = nfsclt.nfsport = mocksrv.port;
+
+  } else if ( !mocksrv_running ) {
+    fprintf(stderr, "%s: server isn't running\n", argv[0]);
+    return -1;
+  } else if ( changed ) {
+    mocksrv_setconf(&mocksrv, &conf);
+  }
+
+  mock_print();
+
+return 0;
+}
+
 t_command commands[] = {
   { cmd_exports, "exports",
     "\n\n\tShow the NFS server's export list\n" \
@@ -855,19 +1327,33 @@ t_command commands[] = {
     "\tDisplay content of the file FILE\n" \
   },
   { cmd_get, "get",
-    "<RFILE> [LFILE]\n\n" \
+    "[-r] <RFILE> [LFILE]\n\n" \
     "\tGet remote file RFILE\n\n" \
+    "\t-r\tdownload directory tree, keeping modes and times,\n"
+    "\t\twindow READ requests are shared by all files\n"
     "\tLFILE\toptional local file name to save to\n"
   },
+  { cmd_get, "mirror", "Synonym for 'get -r'" },
   { cmd_put, "put",
-    "<LFILE> [RFILE]\n\n" \
+    "[-r] <LFILE> [RFILE]\n\n" \
     "\tPut local file LFILE to remote server\n\n" \
+    "\t-r\tupload directory tree, existing remote files are replaced,\n"
+    "\t\twindow WRITE requests are shared by all files\n"
     "\tRFILE\toptional remote file name to save to\n"
   },
+  { cmd_sync, "sync",
+    "<SRC> <DST>\n\n" \
+    "\tCopy directory tree SRC to DST, remote one prefixed with ':'\n\n" \
+    "\tFiles which copy has the same size and mtime are skipped,\n"
+    "\tof other existing ones only ranges which differ are written.\n"
+    "\tNothing is removed from DST\n"
+  },
   { cmd_rm, "rm",
-    "[-f] <FILE>\n\n" \
+    "[-f] [-r] <FILE>\n\n" \
     "\tDelete file FILE from remote server\n\n" \
     "\t-f\tnever prompt before removal\n" \
+    "\t-r\tremove directory FILE and everything inside, window\n" \
+    "\t\tREMOVE requests are shared by all directories\n" \
   },
   { cmd_chmod, "chmod",
     "<MODE> <FILE>\n\n" \
@@ -914,6 +1400,57 @@ t_command commands[] = {
   { cmd_df, "df",
     "\n\n\tShow information about the file system\n" \
   },
+  { cmd_du, "du",
+    "[-a] [-n N] [PATH]\n\n" \
+    "\tShow disk usage of tree: used and apparent size, number of files\n" \
+    "\tand directories. Directories are read in parallel, files with\n" \
+    "\tmore hard links are counted once\n\n" \
+    "\t-a\tprint every directory\n" \
+    "\t-n N\tprint N largest directories\n" \
+  },
+  { cmd_find, "find",
+    "[PATH] [-S FILE] [-name GLOB] [-type T] [-size [+-]N] [-mtime [+-]D]\n" \
+    "\t[-uid N]\n\n" \
+    "\tPrint paths in tree matching all conditions. Directories are read\n" \
+    "\tin parallel, breadth first, conditions are checked on attributes\n" \
+    "\treturned with directory entries. Symbolic links are not followed\n\n" \
+    "\t-name\tshell pattern of file name\n" \
+    "\t-type\tf, d, l, b, c, s or p\n" \
+    "\t-size\tsize in 512 byte blocks, or with c, k, M, G suffix, rounded up\n" \
+    "\t-mtime\twhole days since last modification\n" \
+    "\t-uid\towner uid\n" \
+    "\t-S\tsearch snapshot file instead of server, PATH is relative\n" \
+    "\t\tto snapshot root\n\n" \
+    "\t+N is more than N, -N less than N\n" \
+  },
+  { cmd_snapshot, "snapshot",
+    "[-i] PATH FILE\n\n" \
+    "\tWrite handles and attributes of everything in tree to local\n" \
+    "\tFILE, which find -S can search without server\n\n" \
+    "\t-i\tincremental, directories which modification time didn't\n" \
+    "\t\tchange since snapshot in FILE are not read again, their\n" \
+    "\t\tentries keep attributes from there\n" \
+  },
+  { cmd_stats, "stats",
+    "[-p] [-z]\n\n" \
+    "\tShow MOUNT and NFS calls made in this session, per procedure:\n"
+    "\tcalls, error replies, failed calls, bytes sent and received,\n"
+    "\taverage, median, 99th percentile and maximal latency\n\n" \
+    "\t-p\tone line per procedure, bytes and microseconds\n" \
+    "\t-z\tclear statistics after printing them\n"
+  },
+
+  { cmd_mock, "mock",
+    "[-l MS] [-b MB] [-e PERCENT] [-d PERCENT] [DIR | stop]\n\n" \
+    "\tServe local DIR with NFS server running inside the client and\n"
+    "\tconnect to it, export is \"/\". Without DIR change settings\n"
+    "\tof running server and show it's statistics\n\n" \
+    "\t-l\tlatency added to every reply in milliseconds\n" \
+    "\t-b\tbandwidth of each connection in MB/s, 0 is unlimited\n" \
+    "\t-e\tpercent of NFS calls failed with NFS3ERR_JUKEBOX\n" \
+    "\t-d\tpercent of calls never replied\n" \
+    "\tstop\tunmount and stop server\n"
+  },
 
   { cmd_handle, "handle",
     "[HANDLE]\n\n" \
@@ -925,9 +1462,15 @@ t_command commands[] = {
     "\tSet one of client PROPERTY\n\n" \
     "\tSupported properties:\n"
     "\thost\thost name to connect to\n"
+    "\tport\tNFS server port, 0 asks portmapper\n"
+    "\tmountport\tmount daemon port, 0 asks portmapper\n"
     "\tuid\tremote user id\n"
     "\tgid\tremote group id\n"
     "\tmode\toctal mode for newly created files and etc.\n"
+    "\twindow\tnumber of READ/WRITE requests kept in flight\n"
+    "\tdnlcttl\tseconds to cache name lookups, 0 disables cache\n"
+    "\tacttl\tseconds to cache file attributes, 0 disables cache\n"
+    "\tnconnect\tnumber of TCP connections for READ/WRITE requests\n"
   },
 
   { cmd_help, "help",
@@ -940,12 +1483,47 @@ t_command commands[] = {
   { (tf_command *)NULL, (char *)NULL, (char *)NULL }
 };
 
+// Execute a command line.
+int execute_line(char *line) {
+  
+  int argc;
+  char *argv[TOKENIZEARGMAX];
+  int i;
+  t_command *command = (t_command *)NULL;
+
+  if ( !tokenizestr(line, argv, &argc) ) return -1;
+
+  for (i = 0; commands[i].name; i++) {
+
+    if ( strcmp(argv[0], commands[i].name) == 0 ) {
+      command = &commands[i];
+      break;
+    }
+  }
+
+  if (!command) {
+    fprintf(stderr, "%s: No such command, try 'help'\n", argv[0]);
+    return -1;
+  }
+
+  // Call the function
+  return ((*(command->cmd))(argc, argv));
+}
+
+int batchmode;
+
 t_nfsclt nfsclt = {
   .version = 30,          // defaults to NFSv3
   .authtype = AUTH_UNIX,
 
   .uid = 65534, // nobody
   .gid = 65534,
-  .mode = 0755
+  .mode = 0755,
+
+  .window = NFS_WINDOW,
+  .nconnect = NFS_NCONNECT,
+
+  .dnlc = { .ttl = DNLC_TTL, .max = DNLC_MAX },
+  .acache = { .ttl = ACACHE_TTL, .max = ACACHE_MAX }
 };
 
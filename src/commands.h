@@ -16,6 +16,7 @@
 #include <sys/stat.h>
 
 #include "nfsclt.h"
+#include "mocksrv.h"
 
 typedef int (tf_command) ( int, char** );
 
@@ -26,9 +27,18 @@ typedef struct {
 } t_command;
 
 int cmd_quit( int argc, char **argv);   // exported for main()
+int cmd_umount( int argc, char **argv);
+int cmd_rm( int argc, char **argv);     // these are pipelined in batch mode
+int cmd_stat( int argc, char **argv);
+
+void stat_print( char *file, struct stat *fstat );
+
+// tokenize line and call command
+int execute_line( char *line );
 
 // defined at the end of commands.c file
 extern t_nfsclt nfsclt;
 extern t_command commands[];
+extern int batchmode;   // commands never prompt
 
 #endif // __COMMANDS_H__
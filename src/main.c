@@ -17,80 +17,7 @@
 #include <readline/readline.h>
 #include <readline/history.h>
 
-#include "commands.h"
-
-char* stripline( char *str ) {
-  char *start, *end;
-
-  for ( start = str; *start && isblank(*start) ; start++ ) ;
-
-  for ( end = start + strlen(start) -1;
-        end > start && isblank(*end);
-        end-- ) {
-
-    *end = '\0';
-  }
-
-return start;
-}
-
-#define TOKENIZEARGMAX 80
-char* tokenizestr( char *data, char *argv[TOKENIZEARGMAX], int *argc ) {
-
-  int quotes = 0;
-  char *line = NULL;
-  int i;
-
-  if ( !data || !data[0] || !argv || !argc ) return 0;
-
-// initialize argv list
-  for ( i = 0 ; i < TOKENIZEARGMAX ; i++ ) argv[i] = 0;
-  *argc = 0;
-
-// skip white chars at beginning
-  for ( line = data ; *line && *line <= ' ' ; line++ ) ;
-  if ( !(*line) ) return 0;
-
-  for ( i = 1, argv[0] = line ; *line ; line++ ) {
-
-    // end of line?
-    if ( *line == '\n' || *line == '\r' ) {
-      *line++ = '\0';
-      break;
-    }
-
-    if ( *line == '\"' ) {
-      quotes++;
-      continue;
-    }
-
-    if ( !(quotes&1) && *line <= ' ' && i < TOKENIZEARGMAX ) {
-      *line++ = '\0';
-
-      // skip white chars between args
-      while ( *line && *line <= ' ' )
-        if ( *line == '\n' || *line == '\r' )
-          break;
-        else
-          line++;
-
-      if ( !(*line) ) break;
-      if ( *line == '\n' || *line == '\r' ) {
-        *line++ = '\0';
-        break;
-      }
-
-      argv[i++] = line;
-
-      quotes = 0;
-      if ( *line == '\"' ) quotes++;
-    }
-  }
-
-  *argc = i;
-
-return line;
-}
+#include "batch.h"
 
 /* Generator function for command completion.  STATE lets us know whether
    to start from scratch; without any state (i.e. STATE == 0), then we
@@ -135,37 +62,113 @@ char **command_completion(
 return rl_completion_matches(text, command_generator);
 }
 
-// Execute a command line.
-int execute_line(char *line) {
-  
-  int argc;
-  char *argv[TOKENIZEARGMAX];
-  int i;
-  t_command *command = (t_command *)NULL;
+#define HISTORY_FILE ".nfshistory"
 
-  if ( !tokenizestr(line, argv, &argc) ) return -1;
+// whole file into memory, "-" is stdin
+static char *read_script( const char *path ) {
 
-  for (i = 0; commands[i].name; i++) {
+  FILE *f;
+  char *buf = NULL, *tmp;
+  size_t len = 0, size = 0, n;
 
-    if ( strcmp(argv[0], commands[i].name) == 0 ) {
-      command = &commands[i];
-      break;
+  if ( !strcmp(path, "-") ) f = stdin;
+  else if ( (f = fopen(path, "r")) == NULL ) {
+    perror(path);
+    return NULL;
+  }
+
+  do {
+    if ( size - len < 4096 ) {
+      size = size ? size * 2 : 65536;
+
+      if ( (tmp = realloc(buf, size)) == NULL ) {
+        perror("realloc()");
+        goto ERR;
+      }
+      buf = tmp;
     }
+
+    n = fread(buf + len, 1, size - len - 1, f);
+    len += n;
+  } while ( n > 0 );
+
+  if ( ferror(f) ) {
+    perror(path);
+    goto ERR;
   }
 
-  if (!command) {
-    fprintf(stderr, "%s: No such command, try 'help'\n", argv[0]);
-    return -1;
+  buf[len] = '\0';
+  if ( f != stdin ) fclose(f);
+
+return buf;
+
+ERR:
+  if ( buf ) free(buf);
+  if ( f != stdin ) fclose(f);
+
+return NULL;
+}
+
+// Parse whole script, then run it without prompts. Returns exit status.
+static int run_script( const char *script ) {
+
+  char *args[2] = {"umount", "" };
+  t_batch batch;
+  int failed;
+
+  if ( batch_parse(&batch, script) == -1 ) {
+    batch_free(&batch);
+    return 2;
   }
 
-  // Call the function
-  return ((*(command->cmd))(argc, argv));
+  failed = batch_run(&batch);
+  cmd_umount(1, args);
+
+  if ( failed )
+    fprintf(stderr, "%d of %d commands failed\n", failed, batch.ncmds);
+
+  batch_free(&batch);
+
+return failed ? 1 : 0;
 }
 
-#define HISTORY_FILE ".nfshistory"
+static void usage( const char *name ) {
+
+  fprintf(stderr, "usage: %s [-c \"COMMAND; COMMAND\" | -f SCRIPT]\n", name);
+}
 
 int main(int argc, char *argv[]) {
-  char *line, *s;
+  char *line, *s, *script = NULL;
+  int opt, ret;
+
+  while ( (opt = getopt(argc, argv, "c:f:")) != -1 ) {
+    switch (opt) {
+      case 'c':
+      case 'f':
+        if ( script ) {
+          usage(argv[0]);
+          return 2;
+        }
+
+        script = opt == 'c' ? strdup(optarg) : read_script(optarg);
+        if ( script == NULL ) return 2;
+        break;
+      default:
+        usage(argv[0]);
+        return 2;
+    }
+  }
+
+  if ( optind != argc ) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  if ( script ) {
+    ret = run_script(script);
+    free(script);
+    return ret;
+  }
 
   // initialize readline
   rl_readline_name = argv[0];
@@ -194,4 +197,3 @@ int main(int argc, char *argv[]) {
 
 return 0;
 }
-
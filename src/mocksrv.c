@@ -0,0 +1,1708 @@
+/*
+ *
+ * Adrian Brzezinski (2018) <adrbxx at gmail.com>
+ * License: GPLv2+
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <time.h>
+
+#include <arpa/inet.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/sysmacros.h>
+
+#include "mocksrv.h"
+#include "nfs3xdr.h"
+#include "netsocket.h"
+
+// record marking (RFC 5531), highest bit marks last fragment
+#define MOCKSRV_LASTFRAG  0x80000000
+#define MOCKSRV_FRAGLEN   0x7fffffff
+#define MOCKSRV_BUFSIZE   65536               // initial size of receive buffer
+#define MOCKSRV_MAXREC    (MOCKSRV_MAXIO + 4096)  // bigger calls break connection
+#define MOCKSRV_EVENTS    64
+
+#define MOCKSRV_ROOTID    1
+#define MOCKSRV_FHSIZE    16    // server verifier and node id
+#define MOCKSRV_DEPTHMAX  (PATH_MAX / 2)
+
+// READDIR reply sizes: fixed part, entry without name and what
+// READDIRPLUS adds to entry (attributes and handle)
+#define MOCKSRV_DIRSIZE   (4 + 88 + NFS3_COOKIEVERFSIZE + 4 + 4)
+#define MOCKSRV_ENTSIZE   (4 + 8 + 4 + 8)
+#define MOCKSRV_PLUSSIZE  (88 + 4 + 4 + MOCKSRV_FHSIZE)
+
+typedef int (tf_mockproc)( t_mocksrv *srv, void *args, void *res );
+
+// Procedure and it's codecs. Results start with status, failed
+// procedure returns it and result is sent without optional data.
+typedef struct {
+
+  tf_mockproc *fn;      // NULL procedure has none
+  xdrproc_t xargs;
+  xdrproc_t xres;
+  size_t ressize;
+
+} t_mockproc;
+
+typedef union {
+
+  GETATTR3args getattr;
+  SETATTR3args setattr;
+  LOOKUP3args lookup;
+  ACCESS3args access;
+  READLINK3args readlink;
+  READ3args read;
+  WRITE3args write;
+  CREATE3args create;
+  MKDIR3args mkdir;
+  SYMLINK3args symlink;
+  MKNOD3args mknod;
+  REMOVE3args remove;
+  RMDIR3args rmdir;
+  RENAME3args rename;
+  LINK3args link;
+  READDIR3args readdir;
+  READDIRPLUS3args readdirplus;
+  FSSTAT3args fsstat;
+  FSINFO3args fsinfo;
+  PATHCONF3args pathconf;
+  COMMIT3args commit;
+  dirpath mnt;
+
+} t_mockargs;
+
+typedef union {
+
+  nfsstat3 status;
+  GETATTR3res getattr;
+  SETATTR3res setattr;
+  LOOKUP3res lookup;
+  ACCESS3res access;
+  READLINK3res readlink;
+  READ3res read;
+  WRITE3res write;
+  CREATE3res create;
+  MKDIR3res mkdir;
+  SYMLINK3res symlink;
+  MKNOD3res mknod;
+  REMOVE3res remove;
+  RMDIR3res rmdir;
+  RENAME3res rename;
+  LINK3res link;
+  READDIR3res readdir;
+  READDIRPLUS3res readdirplus;
+  FSSTAT3res fsstat;
+  FSINFO3res fsinfo;
+  PATHCONF3res pathconf;
+  COMMIT3res commit;
+  mountres3 mnt;
+  exports exports;
+  mountlist dump;
+
+} t_mockres;
+
+static uint64_t mocksrv_now( void ) {
+
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static nfsstat3 mocksrv_errno( int err ) {
+
+  switch (err) {
+    case EPERM: return NFS3ERR_PERM;
+    case ENOENT: return NFS3ERR_NOENT;
+    case ENXIO: return NFS3ERR_NXIO;
+    case EACCES: return NFS3ERR_ACCES;
+    case EEXIST: return NFS3ERR_EXIST;
+    case EXDEV: return NFS3ERR_XDEV;
+    case ENODEV: return NFS3ERR_NODEV;
+    case ENOTDIR: return NFS3ERR_NOTDIR;
+    case EISDIR: return NFS3ERR_ISDIR;
+    case EINVAL: return NFS3ERR_INVAL;
+    case EFBIG: return NFS3ERR_FBIG;
+    case ENOSPC: return NFS3ERR_NOSPC;
+    case EROFS: return NFS3ERR_ROFS;
+    case EMLINK: return NFS3ERR_MLINK;
+    case ENAMETOOLONG: return NFS3ERR_NAMETOOLONG;
+    case ENOTEMPTY: return NFS3ERR_NOTEMPTY;
+    case EDQUOT: return NFS3ERR_DQUOT;
+    case ESTALE: return NFS3ERR_STALE;
+  }
+
+return NFS3ERR_IO;
+}
+
+static void mocksrv_fattr( const struct stat *st, fattr3 *a ) {
+
+  switch ( st->st_mode & S_IFMT ) {
+    case S_IFDIR: a->type = NF3DIR; break;
+    case S_IFLNK: a->type = NF3LNK; break;
+    case S_IFBLK: a->type = NF3BLK; break;
+    case S_IFCHR: a->type = NF3CHR; break;
+    case S_IFSOCK: a->type = NF3SOCK; break;
+    case S_IFIFO: a->type = NF3FIFO; break;
+    default: a->type = NF3REG;
+  }
+
+  a->mode = st->st_mode & 07777;
+  a->nlink = st->st_nlink;
+  a->uid = st->st_uid;
+  a->gid = st->st_gid;
+  a->size = st->st_size;
+  a->used = (size3)st->st_blocks * 512;
+  a->rdev.specdata1 = major(st->st_rdev);
+  a->rdev.specdata2 = minor(st->st_rdev);
+  a->fsid = st->st_dev;
+  a->fileid = st->st_ino;
+  a->atime.seconds = st->st_atim.tv_sec;
+  a->atime.nseconds = st->st_atim.tv_nsec;
+  a->mtime.seconds = st->st_mtim.tv_sec;
+  a->mtime.nseconds = st->st_mtim.tv_nsec;
+  a->ctime.seconds = st->st_ctim.tv_sec;
+  a->ctime.nseconds = st->st_ctim.tv_nsec;
+}
+
+static void mocksrv_attr( const struct stat *st, post_op_attr *attr ) {
+
+  attr->attributes_follow = TRUE;
+  mocksrv_fattr(st, &attr->post_op_attr_u.attributes);
+}
+
+static void mocksrv_postop( const char *path, post_op_attr *attr ) {
+
+  struct stat st;
+
+  attr->attributes_follow = FALSE;
+  if ( lstat(path, &st) == 0 ) mocksrv_attr(&st, attr);
+}
+
+// before are attributes seen when handle was resolved
+static void mocksrv_wcc( const struct stat *before, const char *path, wcc_data *wcc ) {
+
+  wcc_attr *a = &wcc->before.pre_op_attr_u.attributes;
+
+  wcc->before.attributes_follow = TRUE;
+  a->size = before->st_size;
+  a->mtime.seconds = before->st_mtim.tv_sec;
+  a->mtime.nseconds = before->st_mtim.tv_nsec;
+  a->ctime.seconds = before->st_ctim.tv_sec;
+  a->ctime.nseconds = before->st_ctim.tv_nsec;
+
+  mocksrv_postop(path, &wcc->after);
+}
+
+static u_int mocksrv_nodehash( dev_t dev, ino_t ino ) {
+
+return (u_int)(ino ^ (ino >> 16) ^ dev) & (MOCKSRV_HASHSIZE - 1);
+}
+
+static t_mocknode *mocksrv_findnode( t_mocksrv *srv, const struct stat *st ) {
+
+  t_mocknode *node;
+
+  for ( node = srv->hash[mocksrv_nodehash(st->st_dev, st->st_ino)];
+      node ; node = node->next ) {
+
+    if ( node->ino == st->st_ino && node->dev == st->st_dev ) break;
+  }
+
+return node;
+}
+
+// Node of object, new one when it wasn't seen before. Known object found
+// under other name was renamed behind our back or it's a hard link, it
+// takes the new name.
+static t_mocknode *mocksrv_node( t_mocksrv *srv, const struct stat *st,
+    uint64_t parent, const char *name ) {
+
+  t_mocknode *node, **tmp;
+  char *newname;
+  u_int h;
+
+  if ( (node = mocksrv_findnode(srv, st)) != NULL ) {
+
+    if ( node->id == MOCKSRV_ROOTID
+        || (node->parent == parent && !strcmp(node->name, name)) )
+      return node;
+
+    if ( (newname = strdup(name)) == NULL ) return NULL;
+
+    free(node->name);
+    node->name = newname;
+    node->parent = parent;
+
+    return node;
+  }
+
+  if ( srv->nnodes >= srv->maxnodes ) {
+
+    uint64_t max = srv->maxnodes ? srv->maxnodes * 2 : 1024;
+
+    if ( (tmp = realloc(srv->nodes, max * sizeof(*tmp))) == NULL ) return NULL;
+
+    memset(tmp + srv->maxnodes, 0, (max - srv->maxnodes) * sizeof(*tmp));
+    srv->nodes = tmp;
+    srv->maxnodes = max;
+  }
+
+  if ( (node = malloc(sizeof(*node))) == NULL ) return NULL;
+
+  if ( (node->name = strdup(name)) == NULL ) {
+    free(node);
+    return NULL;
+  }
+
+  node->id = srv->nnodes++;
+  node->parent = parent;
+  node->dev = st->st_dev;
+  node->ino = st->st_ino;
+
+  h = mocksrv_nodehash(node->dev, node->ino);
+  node->next = srv->hash[h];
+  srv->hash[h] = node;
+
+  srv->nodes[node->id] = node;
+
+return node;
+}
+
+// object was removed, it's handles become stale
+static void mocksrv_forget( t_mocksrv *srv, const struct stat *st ) {
+
+  t_mocknode *node, **prev;
+
+  prev = &srv->hash[mocksrv_nodehash(st->st_dev, st->st_ino)];
+
+  for ( node = *prev; node ; prev = &node->next, node = node->next ) {
+
+    if ( node->ino != st->st_ino || node->dev != st->st_dev ) continue;
+    if ( node->id == MOCKSRV_ROOTID ) return;
+
+    *prev = node->next;
+    srv->nodes[node->id] = NULL;
+
+    free(node->name);
+    free(node);
+    return;
+  }
+}
+
+static int mocksrv_path( t_mocksrv *srv, t_mocknode *node, char *path ) {
+
+  t_mocknode *chain[MOCKSRV_DEPTHMAX];
+  int n = 0, len;
+
+  while ( node->id != MOCKSRV_ROOTID ) {
+
+    if ( n == MOCKSRV_DEPTHMAX ) return -1;
+    chain[n++] = node;
+
+    // parent was removed
+    if ( (node = srv->nodes[node->parent]) == NULL ) return -1;
+  }
+
+  len = snprintf(path, PATH_MAX, "%s", srv->root);
+
+  while ( n-- > 0 && len < PATH_MAX )
+    len += snprintf(path + len, PATH_MAX - len, "/%s", chain[n]->name);
+
+return len < PATH_MAX ? 0 : -1;
+}
+
+static int mocksrv_fh( t_mocksrv *srv, t_mocknode *node, nfs_fh3 *fh ) {
+
+  if ( (fh->data.data_val = arena_alloc(&srv->arena, MOCKSRV_FHSIZE)) == NULL )
+    return -1;
+
+  fh->data.data_len = MOCKSRV_FHSIZE;
+  memcpy(fh->data.data_val, &srv->verf, sizeof(srv->verf));
+  memcpy(fh->data.data_val + sizeof(srv->verf), &node->id, sizeof(node->id));
+
+return 0;
+}
+
+static int mocksrv_postfh( t_mocksrv *srv, t_mocknode *node, post_op_fh3 *fh ) {
+
+  fh->handle_follows = mocksrv_fh(srv, node, &fh->post_op_fh3_u.handle) == 0;
+
+return fh->handle_follows ? 0 : -1;
+}
+
+// Node of handle, it's path and current attributes. Handle is stale when
+// object was removed, also when other object took it's name later.
+static nfsstat3 mocksrv_object( t_mocksrv *srv, nfs_fh3 *fh,
+    char *path, struct stat *st, t_mocknode **nodep ) {
+
+  t_mocknode *node;
+  uint64_t verf, id;
+
+  if ( fh->data.data_len != MOCKSRV_FHSIZE ) return NFS3ERR_BADHANDLE;
+
+  memcpy(&verf, fh->data.data_val, sizeof(verf));
+  memcpy(&id, fh->data.data_val + sizeof(verf), sizeof(id));
+
+  if ( verf != srv->verf || id >= srv->nnodes || (node = srv->nodes[id]) == NULL )
+    return NFS3ERR_STALE;
+
+  if ( mocksrv_path(srv, node, path) == -1 ) return NFS3ERR_STALE;
+
+  if ( lstat(path, st) == -1 )
+    return errno == ENOENT ? NFS3ERR_STALE : mocksrv_errno(errno);
+
+  if ( st->st_ino != node->ino || st->st_dev != node->dev ) return NFS3ERR_STALE;
+
+  if ( nodep ) *nodep = node;
+
+return NFS3_OK;
+}
+
+// directory of diropargs3 and path of the name in it
+static nfsstat3 mocksrv_dirop( t_mocksrv *srv, diropargs3 *where,
+    char *dirpath, struct stat *dirst, t_mocknode **dir, char *path ) {
+
+  nfsstat3 status;
+
+  if ( (status = mocksrv_object(srv, &where->dir, dirpath, dirst, dir)) != NFS3_OK )
+    return status;
+
+  if ( !S_ISDIR(dirst->st_mode) ) return NFS3ERR_NOTDIR;
+
+  if ( !where->name || !*where->name || strchr(where->name, '/') )
+    return NFS3ERR_INVAL;
+
+  if ( strlen(where->name) > NAME_MAX
+      || snprintf(path, PATH_MAX, "%s/%s", dirpath, where->name) >= PATH_MAX )
+    return NFS3ERR_NAMETOOLONG;
+
+return NFS3_OK;
+}
+
+// Node of name in directory, "." and ".." are nodes we already have.
+// Root is it's own parent, nothing above it is visible.
+static t_mocknode *mocksrv_child( t_mocksrv *srv, t_mocknode *dir,
+    const char *name, const char *path, struct stat *st ) {
+
+  char nodepath[PATH_MAX];
+  t_mocknode *node;
+
+  if ( strcmp(name, ".") && strcmp(name, "..") ) {
+    if ( lstat(path, st) == -1 ) return NULL;
+    return mocksrv_node(srv, st, dir->id, name);
+  }
+
+  node = name[1] ? srv->nodes[dir->parent] : dir;
+
+  if ( !node || mocksrv_path(srv, node, nodepath) == -1 ) {
+    errno = ESTALE;
+    return NULL;
+  }
+
+  if ( lstat(nodepath, st) == -1 ) return NULL;
+
+return node;
+}
+
+// handle and attributes of just created object
+static nfsstat3 mocksrv_created( t_mocksrv *srv, t_mocknode *dir, const char *name,
+    const char *path, post_op_fh3 *fh, post_op_attr *attr ) {
+
+  t_mocknode *node;
+  struct stat st;
+
+  if ( lstat(path, &st) == -1
+      || (node = mocksrv_node(srv, &st, dir->id, name)) == NULL )
+    return mocksrv_errno(errno);
+
+  if ( mocksrv_postfh(srv, node, fh) == -1 ) return NFS3ERR_SERVERFAULT;
+  mocksrv_attr(&st, attr);
+
+return NFS3_OK;
+}
+
+// Ownership is changed only by root, otherwise files are owned by user
+// running server, like with all_squash export option
+static int mocksrv_setattr( const char *path, sattr3 *a ) {
+
+  struct timespec ts[2] = { { 0, UTIME_OMIT }, { 0, UTIME_OMIT } };
+  struct stat st;
+
+  if ( a->mode.set_it ) {
+
+    if ( lstat(path, &st) == -1 ) return -1;
+
+    // symbolic links have no mode, chmod() would follow it
+    if ( !S_ISLNK(st.st_mode) && chmod(path, a->mode.set_mode3_u.mode & 07777) == -1 )
+      return -1;
+  }
+
+  if ( (a->uid.set_it || a->gid.set_it) && geteuid() == 0
+      && lchown(path, a->uid.set_it ? (uid_t)a->uid.set_uid3_u.uid : (uid_t)-1,
+        a->gid.set_it ? (gid_t)a->gid.set_gid3_u.gid : (gid_t)-1) == -1 )
+    return -1;
+
+  if ( a->size.set_it && truncate(path, a->size.set_size3_u.size) == -1 )
+    return -1;
+
+  if ( a->atime.set_it == SET_TO_SERVER_TIME ) ts[0].tv_nsec = UTIME_NOW;
+  if ( a->atime.set_it == SET_TO_CLIENT_TIME ) {
+    ts[0].tv_sec = a->atime.set_atime_u.atime.seconds;
+    ts[0].tv_nsec = a->atime.set_atime_u.atime.nseconds;
+  }
+
+  if ( a->mtime.set_it == SET_TO_SERVER_TIME ) ts[1].tv_nsec = UTIME_NOW;
+  if ( a->mtime.set_it == SET_TO_CLIENT_TIME ) {
+    ts[1].tv_sec = a->mtime.set_mtime_u.mtime.seconds;
+    ts[1].tv_nsec = a->mtime.set_mtime_u.mtime.nseconds;
+  }
+
+  if ( (a->atime.set_it != DONT_CHANGE || a->mtime.set_it != DONT_CHANGE)
+      && utimensat(AT_FDCWD, path, ts, AT_SYMLINK_NOFOLLOW) == -1 )
+    return -1;
+
+return 0;
+}
+
+static int mocksrv_getattr( t_mocksrv *srv, GETATTR3args *args, GETATTR3res *res ) {
+
+  char path[PATH_MAX];
+  struct stat st;
+  nfsstat3 status;
+
+  if ( (status = mocksrv_object(srv, &args->object, path, &st, NULL)) != NFS3_OK )
+    return status;
+
+  mocksrv_fattr(&st, &res->GETATTR3res_u.resok.obj_attributes);
+
+return NFS3_OK;
+}
+
+static int mocksrv_setattr3( t_mocksrv *srv, SETATTR3args *args, SETATTR3res *res ) {
+
+  nfstime3 *ctime = &args->guard.sattrguard3_u.obj_ctime;
+  char path[PATH_MAX];
+  struct stat st;
+  nfsstat3 status;
+
+  if ( (status = mocksrv_object(srv, &args->object, path, &st, NULL)) != NFS3_OK )
+    return status;
+
+  if ( args->guard.check && (ctime->seconds != (u_int)st.st_ctim.tv_sec
+        || ctime->nseconds != (u_int)st.st_ctim.tv_nsec) )
+    return NFS3ERR_NOT_SYNC;
+
+  if ( mocksrv_setattr(path, &args->new_attributes) == -1 )
+    return mocksrv_errno(errno);
+
+  mocksrv_wcc(&st, path, &res->SETATTR3res_u.resok.obj_wcc);
+
+return NFS3_OK;
+}
+
+static int mocksrv_lookup( t_mocksrv *srv, LOOKUP3args *args, LOOKUP3res *res ) {
+
+  LOOKUP3resok *resok = &res->LOOKUP3res_u.resok;
+  char dirpath[PATH_MAX], path[PATH_MAX];
+  struct stat dirst, st;
+  t_mocknode *dir, *node;
+  nfsstat3 status;
+
+  if ( (status = mocksrv_dirop(srv, &args->what, dirpath, &dirst, &dir, path)) != NFS3_OK )
+    return status;
+
+  if ( (node = mocksrv_child(srv, dir, args->what.name, path, &st)) == NULL )
+    return mocksrv_errno(errno);
+
+  if ( mocksrv_fh(srv, node, &resok->object) == -1 ) return NFS3ERR_SERVERFAULT;
+
+  mocksrv_attr(&st, &resok->obj_attributes);
+  mocksrv_attr(&dirst, &resok->dir_attributes);
+
+return NFS3_OK;
+}
+
+// permissions are checked when operation is done
+static int mocksrv_access( t_mocksrv *srv, ACCESS3args *args, ACCESS3res *res ) {
+
+  char path[PATH_MAX];
+  struct stat st;
+  nfsstat3 status;
+
+  if ( (status = mocksrv_object(srv, &args->object, path, &st, NULL)) != NFS3_OK )
+    return status;
+
+  mocksrv_attr(&st, &res->ACCESS3res_u.resok.obj_attributes);
+  res->ACCESS3res_u.resok.access = args->access;
+
+return NFS3_OK;
+}
+
+static int mocksrv_readlink( t_mocksrv *srv, READLINK3args *args, READLINK3res *res ) {
+
+  char path[PATH_MAX], *data;
+  struct stat st;
+  nfsstat3 status;
+  ssize_t n;
+
+  if ( (status = mocksrv_object(srv, &args->symlink, path, &st, NULL)) != NFS3_OK )
+    return status;
+
+  if ( (data = arena_alloc(&srv->arena, PATH_MAX)) == NULL ) return NFS3ERR_SERVERFAULT;
+
+  if ( (n = readlink(path, data, PATH_MAX - 1)) == -1 ) return mocksrv_errno(errno);
+  data[n] = '\0';
+
+  mocksrv_attr(&st, &res->READLINK3res_u.resok.symlink_attributes);
+  res->READLINK3res_u.resok.data = data;
+
+return NFS3_OK;
+}
+
+static int mocksrv_read( t_mocksrv *srv, READ3args *args, READ3res *res ) {
+
+  READ3resok *resok = &res->READ3res_u.resok;
+  char path[PATH_MAX];
+  struct stat st;
+  nfsstat3 status;
+  ssize_t n;
+  u_int count;
+  int fd;
+
+  if ( (status = mocksrv_object(srv, &args->file, path, &st, NULL)) != NFS3_OK )
+    return status;
+
+  if ( S_ISDIR(st.st_mode) ) return NFS3ERR_ISDIR;
+  if ( !S_ISREG(st.st_mode) ) return NFS3ERR_INVAL;
+
+  count = args->count > MOCKSRV_MAXIO ? MOCKSRV_MAXIO : args->count;
+
+  if ( (fd = open(path, O_RDONLY | O_NOFOLLOW)) == -1 ) return mocksrv_errno(errno);
+
+  n = pread(fd, srv->iobuf, count, args->offset);
+  close(fd);
+
+  if ( n == -1 ) return mocksrv_errno(errno);
+
+  mocksrv_attr(&st, &resok->file_attributes);
+  resok->count = n;
+  resok->eof = args->offset + n >= (offset3)st.st_size;
+  resok->data.data_len = n;
+  resok->data.data_val = srv->iobuf;
+
+return NFS3_OK;
+}
+
+// Data is left in page cache, but reply says what was asked for. Server
+// is for measuring client, not for keeping data.
+static int mocksrv_write( t_mocksrv *srv, WRITE3args *args, WRITE3res *res ) {
+
+  WRITE3resok *resok = &res->WRITE3res_u.resok;
+  char path[PATH_MAX];
+  struct stat st;
+  nfsstat3 status;
+  ssize_t n;
+  int fd;
+
+  if ( (status = mocksrv_object(srv, &args->file, path, &st, NULL)) != NFS3_OK )
+    return status;
+
+  if ( S_ISDIR(st.st_mode) ) return NFS3ERR_ISDIR;
+  if ( !S_ISREG(st.st_mode) ) return NFS3ERR_INVAL;
+
+  if ( (fd = open(path, O_WRONLY | O_NOFOLLOW)) == -1 ) return mocksrv_errno(errno);
+
+  n = pwrite(fd, args->data.data_val, args->data.data_len, args->offset);
+  close(fd);
+
+  if ( n == -1 ) return mocksrv_errno(errno);
+
+  mocksrv_wcc(&st, path, &resok->file_wcc);
+  resok->count = n;
+  resok->committed = args->stable;
+  memcpy(resok->verf, &srv->verf, NFS3_WRITEVERFSIZE);
+
+return NFS3_OK;
+}
+
+// Verifier of exclusive create isn't stored, so retransmitted
+// one fails with NFS3ERR_EXIST
+static int mocksrv_create( t_mocksrv *srv, CREATE3args *args, CREATE3res *res ) {
+
+  CREATE3resok *resok = &res->CREATE3res_u.resok;
+  sattr3 *attrs = &args->how.createhow3_u.obj_attributes;
+  char dirpath[PATH_MAX], path[PATH_MAX];
+  struct stat dirst;
+  t_mocknode *dir;
+  nfsstat3 status;
+  int fd, flags = O_RDONLY | O_CREAT | O_NOFOLLOW;
+  mode_t mode = 0644;
+
+  if ( (status = mocksrv_dirop(srv, &args->where, dirpath, &dirst, &dir, path)) != NFS3_OK )
+    return status;
+
+  if ( args->how.mode != UNCHECKED ) flags |= O_EXCL;
+  if ( args->how.mode != EXCLUSIVE && attrs->mode.set_it )
+    mode = attrs->mode.set_mode3_u.mode & 07777;
+
+  if ( (fd = open(path, flags, mode)) == -1 ) return mocksrv_errno(errno);
+  close(fd);
+
+  if ( args->how.mode != EXCLUSIVE && mocksrv_setattr(path, attrs) == -1 )
+    return mocksrv_errno(errno);
+
+  if ( (status = mocksrv_created(srv, dir, args->where.name, path,
+          &resok->obj, &resok->obj_attributes)) != NFS3_OK )
+    return status;
+
+  mocksrv_wcc(&dirst, dirpath, &resok->dir_wcc);
+
+return NFS3_OK;
+}
+
+static int mocksrv_mkdir( t_mocksrv *srv, MKDIR3args *args, MKDIR3res *res ) {
+
+  MKDIR3resok *resok = &res->MKDIR3res_u.resok;
+  char dirpath[PATH_MAX], path[PATH_MAX];
+  struct stat dirst;
+  t_mocknode *dir;
+  nfsstat3 status;
+  mode_t mode = 0755;
+
+  if ( (status = mocksrv_dirop(srv, &args->where, dirpath, &dirst, &dir, path)) != NFS3_OK )
+    return status;
+
+  if ( args->attributes.mode.set_it ) mode = args->attributes.mode.set_mode3_u.mode & 07777;
+
+  if ( mkdir(path, mode) == -1 || mocksrv_setattr(path, &args->attributes) == -1 )
+    return mocksrv_errno(errno);
+
+  if ( (status = mocksrv_created(srv, dir, args->where.name, path,
+          &resok->obj, &resok->obj_attributes)) != NFS3_OK )
+    return status;
+
+  mocksrv_wcc(&dirst, dirpath, &resok->dir_wcc);
+
+return NFS3_OK;
+}
+
+static int mocksrv_symlink( t_mocksrv *srv, SYMLINK3args *args, SYMLINK3res *res ) {
+
+  SYMLINK3resok *resok = &res->SYMLINK3res_u.resok;
+  char dirpath[PATH_MAX], path[PATH_MAX];
+  struct stat dirst;
+  t_mocknode *dir;
+  nfsstat3 status;
+
+  if ( (status = mocksrv_dirop(srv, &args->where, dirpath, &dirst, &dir, path)) != NFS3_OK )
+    return status;
+
+  if ( symlink(args->symlink.symlink_data, path) == -1
+      || mocksrv_setattr(path, &args->symlink.symlink_attributes) == -1 )
+    return mocksrv_errno(errno);
+
+  if ( (status = mocksrv_created(srv, dir, args->where.name, path,
+          &resok->obj, &resok->obj_attributes)) != NFS3_OK )
+    return status;
+
+  mocksrv_wcc(&dirst, dirpath, &resok->dir_wcc);
+
+return NFS3_OK;
+}
+
+static int mocksrv_mknod( t_mocksrv *srv, MKNOD3args *args, MKNOD3res *res ) {
+
+  MKNOD3resok *resok = &res->MKNOD3res_u.resok;
+  devicedata3 *device = &args->what.mknoddata3_u.device;
+  char dirpath[PATH_MAX], path[PATH_MAX];
+  struct stat dirst;
+  t_mocknode *dir;
+  nfsstat3 status;
+  sattr3 *attrs;
+  mode_t mode;
+  dev_t rdev = 0;
+
+  if ( (status = mocksrv_dirop(srv, &args->where, dirpath, &dirst, &dir, path)) != NFS3_OK )
+    return status;
+
+  switch ( args->what.type ) {
+    case NF3CHR:
+    case NF3BLK:
+      mode = args->what.type == NF3CHR ? S_IFCHR : S_IFBLK;
+      rdev = makedev(device->spec.specdata1, device->spec.specdata2);
+      attrs = &device->dev_attributes;
+      break;
+    case NF3SOCK:
+    case NF3FIFO:
+      mode = args->what.type == NF3SOCK ? S_IFSOCK : S_IFIFO;
+      attrs = &args->what.mknoddata3_u.pipe_attributes;
+      break;
+    default:
+      return NFS3ERR_BADTYPE;
+  }
+
+  mode |= attrs->mode.set_it ? attrs->mode.set_mode3_u.mode & 07777 : 0644;
+
+  if ( mknod(path, mode, rdev) == -1 || mocksrv_setattr(path, attrs) == -1 )
+    return mocksrv_errno(errno);
+
+  if ( (status = mocksrv_created(srv, dir, args->where.name, path,
+          &resok->obj, &resok->obj_attributes)) != NFS3_OK )
+    return status;
+
+  mocksrv_wcc(&dirst, dirpath, &resok->dir_wcc);
+
+return NFS3_OK;
+}
+
+// REMOVE and RMDIR, handles of removed object become stale
+static nfsstat3 mocksrv_unlink( t_mocksrv *srv, diropargs3 *where, int isdir, wcc_data *wcc ) {
+
+  char dirpath[PATH_MAX], path[PATH_MAX];
+  struct stat dirst, st;
+  t_mocknode *dir;
+  nfsstat3 status;
+
+  if ( (status = mocksrv_dirop(srv, where, dirpath, &dirst, &dir, path)) != NFS3_OK )
+    return status;
+
+  if ( !strcmp(where->name, ".") || !strcmp(where->name, "..") ) return NFS3ERR_INVAL;
+
+  if ( lstat(path, &st) == -1 ) return mocksrv_errno(errno);
+
+  if ( (isdir ? rmdir(path) : unlink(path)) == -1 ) return mocksrv_errno(errno);
+
+  if ( isdir || st.st_nlink <= 1 ) mocksrv_forget(srv, &st);
+
+  mocksrv_wcc(&dirst, dirpath, wcc);
+
+return NFS3_OK;
+}
+
+static int mocksrv_remove( t_mocksrv *srv, REMOVE3args *args, REMOVE3res *res ) {
+
+return mocksrv_unlink(srv, &args->object, 0, &res->REMOVE3res_u.resok.dir_wcc);
+}
+
+static int mocksrv_rmdir( t_mocksrv *srv, RMDIR3args *args, RMDIR3res *res ) {
+
+return mocksrv_unlink(srv, &args->object, 1, &res->RMDIR3res_u.resok.dir_wcc);
+}
+
+static int mocksrv_rename( t_mocksrv *srv, RENAME3args *args, RENAME3res *res ) {
+
+  RENAME3resok *resok = &res->RENAME3res_u.resok;
+  char fromdirpath[PATH_MAX], frompath[PATH_MAX];
+  char todirpath[PATH_MAX], topath[PATH_MAX];
+  struct stat fromdirst, todirst, st, tost;
+  t_mocknode *fromdir, *todir;
+  nfsstat3 status;
+  int replaced;
+
+  if ( (status = mocksrv_dirop(srv, &args->from, fromdirpath, &fromdirst,
+          &fromdir, frompath)) != NFS3_OK
+      || (status = mocksrv_dirop(srv, &args->to, todirpath, &todirst,
+          &todir, topath)) != NFS3_OK )
+    return status;
+
+  if ( lstat(frompath, &st) == -1 ) return mocksrv_errno(errno);
+
+  replaced = lstat(topath, &tost) == 0
+    && (tost.st_ino != st.st_ino || tost.st_dev != st.st_dev);
+
+  if ( rename(frompath, topath) == -1 ) return mocksrv_errno(errno);
+
+  if ( replaced && (S_ISDIR(tost.st_mode) || tost.st_nlink <= 1) )
+    mocksrv_forget(srv, &tost);
+
+  // node takes new name, so handles of objects below stay valid
+  if ( mocksrv_findnode(srv, &st) ) mocksrv_node(srv, &st, todir->id, args->to.name);
+
+  mocksrv_wcc(&fromdirst, fromdirpath, &resok->fromdir_wcc);
+  mocksrv_wcc(&todirst, todirpath, &resok->todir_wcc);
+
+return NFS3_OK;
+}
+
+static int mocksrv_link( t_mocksrv *srv, LINK3args *args, LINK3res *res ) {
+
+  LINK3resok *resok = &res->LINK3res_u.resok;
+  char filepath[PATH_MAX], dirpath[PATH_MAX], path[PATH_MAX];
+  struct stat filest, dirst;
+  t_mocknode *dir;
+  nfsstat3 status;
+
+  if ( (status = mocksrv_object(srv, &args->file, filepath, &filest, NULL)) != NFS3_OK
+      || (status = mocksrv_dirop(srv, &args->link, dirpath, &dirst, &dir, path)) != NFS3_OK )
+    return status;
+
+  if ( link(filepath, path) == -1 ) return mocksrv_errno(errno);
+
+  mocksrv_postop(filepath, &resok->file_attributes);
+  mocksrv_wcc(&dirst, dirpath, &resok->linkdir_wcc);
+
+return NFS3_OK;
+}
+
+// Entries after cookie, as many as fit into reply of maxcount bytes, or
+// dircount bytes without attributes and handles for READDIRPLUS. Cookie
+// is position in directory, so it's read from start on every call.
+// Verifier isn't used, it's always zero.
+static nfsstat3 mocksrv_readdir3( t_mocksrv *srv, nfs_fh3 *fh, cookie3 cookie,
+    u_int dircount, u_int maxcount, post_op_attr *dirattr,
+    entry3 **entries, entryplus3 **plusentries, bool_t *eof ) {
+
+  char path[PATH_MAX], entpath[PATH_MAX], *name;
+  struct stat st, entst;
+  t_mocknode *node, *ent;
+  struct dirent *de;
+  entryplus3 *ep;
+  entry3 *e;
+  DIR *dir;
+  nfsstat3 status;
+  u_int size = MOCKSRV_DIRSIZE, dsize = MOCKSRV_DIRSIZE, len;
+  cookie3 pos = 0;
+  int n = 0;
+
+  if ( (status = mocksrv_object(srv, fh, path, &st, &node)) != NFS3_OK )
+    return status;
+
+  if ( !S_ISDIR(st.st_mode) ) return NFS3ERR_NOTDIR;
+
+  if ( (dir = opendir(path)) == NULL ) return mocksrv_errno(errno);
+
+  mocksrv_attr(&st, dirattr);
+  *eof = TRUE;
+
+  while ( (de = readdir(dir)) != NULL ) {
+
+    if ( ++pos <= cookie ) continue;
+
+    len = strlen(de->d_name);
+
+    dsize += MOCKSRV_ENTSIZE + RNDUP(len);
+    size += MOCKSRV_ENTSIZE + RNDUP(len) + (plusentries ? MOCKSRV_PLUSSIZE : 0);
+
+    if ( size > maxcount || dsize > dircount ) {
+      *eof = FALSE;
+      break;
+    }
+
+    if ( (name = arena_alloc(&srv->arena, len + 1)) == NULL ) {
+      closedir(dir);
+      return NFS3ERR_SERVERFAULT;
+    }
+
+    memcpy(name, de->d_name, len + 1);
+
+    if ( entries ) {
+
+      if ( (e = arena_alloc(&srv->arena, sizeof(*e))) == NULL ) {
+        closedir(dir);
+        return NFS3ERR_SERVERFAULT;
+      }
+
+      e->fileid = de->d_ino;
+      e->name = name;
+      e->cookie = pos;
+      e->nextentry = NULL;
+
+      *entries = e;
+      entries = &e->nextentry;
+
+    } else {
+
+      if ( (ep = arena_alloc(&srv->arena, sizeof(*ep))) == NULL ) {
+        closedir(dir);
+        return NFS3ERR_SERVERFAULT;
+      }
+
+      memset(ep, 0, sizeof(*ep));
+      ep->fileid = de->d_ino;
+      ep->name = name;
+      ep->cookie = pos;
+
+      // entry removed meanwhile is listed without attributes
+      if ( snprintf(entpath, PATH_MAX, "%s/%s", path, name) < PATH_MAX
+          && (ent = mocksrv_child(srv, node, name, entpath, &entst)) != NULL ) {
+        ep->fileid = entst.st_ino;
+        mocksrv_attr(&entst, &ep->name_attributes);
+        mocksrv_postfh(srv, ent, &ep->name_handle);
+      }
+
+      *plusentries = ep;
+      plusentries = &ep->nextentry;
+    }
+
+    n++;
+  }
+
+  closedir(dir);
+
+  if ( n == 0 && !*eof ) return NFS3ERR_TOOSMALL;
+
+return NFS3_OK;
+}
+
+static int mocksrv_readdir( t_mocksrv *srv, READDIR3args *args, READDIR3res *res ) {
+
+  READDIR3resok *resok = &res->READDIR3res_u.resok;
+
+return mocksrv_readdir3(srv, &args->dir, args->cookie, args->count, args->count,
+    &resok->dir_attributes, &resok->reply.entries, NULL, &resok->reply.eof);
+}
+
+static int mocksrv_readdirplus( t_mocksrv *srv, READDIRPLUS3args *args, READDIRPLUS3res *res ) {
+
+  READDIRPLUS3resok *resok = &res->READDIRPLUS3res_u.resok;
+
+return mocksrv_readdir3(srv, &args->dir, args->cookie, args->dircount, args->maxcount,
+    &resok->dir_attributes, NULL, &resok->reply.entries, &resok->reply.eof);
+}
+
+static int mocksrv_fsstat( t_mocksrv *srv, FSSTAT3args *args, FSSTAT3res *res ) {
+
+  FSSTAT3resok *resok = &res->FSSTAT3res_u.resok;
+  char path[PATH_MAX];
+  struct statvfs vfs;
+  struct stat st;
+  nfsstat3 status;
+
+  if ( (status = mocksrv_object(srv, &args->fsroot, path, &st, NULL)) != NFS3_OK )
+    return status;
+
+  if ( statvfs(path, &vfs) == -1 ) return mocksrv_errno(errno);
+
+  mocksrv_attr(&st, &resok->obj_attributes);
+  resok->tbytes = (size3)vfs.f_blocks * vfs.f_frsize;
+  resok->fbytes = (size3)vfs.f_bfree * vfs.f_frsize;
+  resok->abytes = (size3)vfs.f_bavail * vfs.f_frsize;
+  resok->tfiles = vfs.f_files;
+  resok->ffiles = vfs.f_ffree;
+  resok->afiles = vfs.f_favail;
+  resok->invarsec = 0;
+
+return NFS3_OK;
+}
+
+static int mocksrv_fsinfo( t_mocksrv *srv, FSINFO3args *args, FSINFO3res *res ) {
+
+  FSINFO3resok *resok = &res->FSINFO3res_u.resok;
+  char path[PATH_MAX];
+  struct stat st;
+  nfsstat3 status;
+
+  if ( (status = mocksrv_object(srv, &args->fsroot, path, &st, NULL)) != NFS3_OK )
+    return status;
+
+  mocksrv_attr(&st, &resok->obj_attributes);
+  resok->rtmax = resok->rtpref = MOCKSRV_MAXIO;
+  resok->wtmax = resok->wtpref = MOCKSRV_MAXIO;
+  resok->rtmult = resok->wtmult = 4096;
+  resok->dtpref = MOCKSRV_DTPREF;
+  resok->maxfilesize = INT64_MAX;
+  resok->time_delta.seconds = 0;
+  resok->time_delta.nseconds = 1;
+  resok->properties = FSF3_LINK | FSF3_SYMLINK | FSF3_HOMOGENEOUS | FSF3_CANSETTIME;
+
+return NFS3_OK;
+}
+
+static int mocksrv_pathconf( t_mocksrv *srv, PATHCONF3args *args, PATHCONF3res *res ) {
+
+  PATHCONF3resok *resok = &res->PATHCONF3res_u.resok;
+  char path[PATH_MAX];
+  struct stat st;
+  nfsstat3 status;
+
+  if ( (status = mocksrv_object(srv, &args->object, path, &st, NULL)) != NFS3_OK )
+    return status;
+
+  mocksrv_attr(&st, &resok->obj_attributes);
+  resok->linkmax = 32000;
+  resok->name_max = NAME_MAX;
+  resok->no_trunc = TRUE;
+  resok->chown_restricted = TRUE;
+  resok->case_insensitive = FALSE;
+  resok->case_preserving = TRUE;
+
+return NFS3_OK;
+}
+
+static int mocksrv_commit( t_mocksrv *srv, COMMIT3args *args, COMMIT3res *res ) {
+
+  COMMIT3resok *resok = &res->COMMIT3res_u.resok;
+  char path[PATH_MAX];
+  struct stat st;
+  nfsstat3 status;
+
+  if ( (status = mocksrv_object(srv, &args->file, path, &st, NULL)) != NFS3_OK )
+    return status;
+
+  mocksrv_wcc(&st, path, &resok->file_wcc);
+  memcpy(resok->verf, &srv->verf, NFS3_WRITEVERFSIZE);
+
+return NFS3_OK;
+}
+
+static int mocksrv_mnt( t_mocksrv *srv, dirpath *args, mountres3 *res ) {
+
+  mountres3_ok *mountinfo = &res->mountres3_u.mountinfo;
+  static int flavors[] = { AUTH_UNIX };
+  nfs_fh3 fh;
+
+  if ( strcmp(*args, MOCKSRV_EXPORT) ) return MNT3ERR_NOENT;
+
+  if ( mocksrv_fh(srv, srv->nodes[MOCKSRV_ROOTID], &fh) == -1 ) return MNT3ERR_SERVERFAULT;
+
+  mountinfo->fhandle.fhandle3_len = fh.data.data_len;
+  mountinfo->fhandle.fhandle3_val = fh.data.data_val;
+  mountinfo->auth_flavors.auth_flavors_len = 1;
+  mountinfo->auth_flavors.auth_flavors_val = flavors;
+
+return MNT3_OK;
+}
+
+static int mocksrv_export( t_mocksrv *srv, void *args, exports *res ) {
+
+  static exportnode export = { MOCKSRV_EXPORT, NULL, NULL };
+
+  *res = &export;
+
+return 0;
+}
+
+#define MOCKPROC(proc, msg, xres) \
+  { (tf_mockproc *)mocksrv_##proc, (xdrproc_t)xdr_##msg##args, \
+    (xdrproc_t)(xres), sizeof(msg##res) }
+
+#define MOCKVOID { NULL, (xdrproc_t)xdr_void, (xdrproc_t)xdr_void, 0 }
+
+static const t_mockproc mocksrv_nfs3procs[] = {
+  [NFSPROC3_NULL] = MOCKVOID,
+  [NFSPROC3_GETATTR] = MOCKPROC(getattr, GETATTR3, NFS3XDR(GETATTR3res)),
+  [NFSPROC3_SETATTR] = MOCKPROC(setattr3, SETATTR3, xdr_SETATTR3res),
+  [NFSPROC3_LOOKUP] = MOCKPROC(lookup, LOOKUP3, NFS3XDR(LOOKUP3res)),
+  [NFSPROC3_ACCESS] = MOCKPROC(access, ACCESS3, xdr_ACCESS3res),
+  [NFSPROC3_READLINK] = MOCKPROC(readlink, READLINK3, xdr_READLINK3res),
+  [NFSPROC3_READ] = MOCKPROC(read, READ3, NFS3XDR(READ3res)),
+  [NFSPROC3_WRITE] = MOCKPROC(write, WRITE3, NFS3XDR(WRITE3res)),
+  [NFSPROC3_CREATE] = MOCKPROC(create, CREATE3, xdr_CREATE3res),
+  [NFSPROC3_MKDIR] = MOCKPROC(mkdir, MKDIR3, xdr_MKDIR3res),
+  [NFSPROC3_SYMLINK] = MOCKPROC(symlink, SYMLINK3, xdr_SYMLINK3res),
+  [NFSPROC3_MKNOD] = MOCKPROC(mknod, MKNOD3, xdr_MKNOD3res),
+  [NFSPROC3_REMOVE] = MOCKPROC(remove, REMOVE3, xdr_REMOVE3res),
+  [NFSPROC3_RMDIR] = MOCKPROC(rmdir, RMDIR3, xdr_RMDIR3res),
+  [NFSPROC3_RENAME] = MOCKPROC(rename, RENAME3, xdr_RENAME3res),
+  [NFSPROC3_LINK] = MOCKPROC(link, LINK3, xdr_LINK3res),
+  [NFSPROC3_READDIR] = MOCKPROC(readdir, READDIR3, xdr_READDIR3res),
+  [NFSPROC3_READDIRPLUS] = MOCKPROC(readdirplus, READDIRPLUS3, xdr_READDIRPLUS3res),
+  [NFSPROC3_FSSTAT] = MOCKPROC(fsstat, FSSTAT3, xdr_FSSTAT3res),
+  [NFSPROC3_FSINFO] = MOCKPROC(fsinfo, FSINFO3, xdr_FSINFO3res),
+  [NFSPROC3_PATHCONF] = MOCKPROC(pathconf, PATHCONF3, xdr_PATHCONF3res),
+  [NFSPROC3_COMMIT] = MOCKPROC(commit, COMMIT3, xdr_COMMIT3res),
+};
+
+// nobody is mounting us for real, so there is nothing to dump or unmount
+static const t_mockproc mocksrv_mountprocs[] = {
+  [MOUNT3_NULL] = MOCKVOID,
+  [MOUNT3_MNT] = { (tf_mockproc *)mocksrv_mnt, (xdrproc_t)xdr_dirpath,
+    (xdrproc_t)xdr_mountres3, sizeof(mountres3) },
+  [MOUNT3_DUMP] = { NULL, (xdrproc_t)xdr_void, (xdrproc_t)xdr_mountlist, sizeof(mountlist) },
+  [MOUNT3_UMNT] = { NULL, (xdrproc_t)xdr_dirpath, (xdrproc_t)xdr_void, 0 },
+  [MOUNT3_UMNTALL] = MOCKVOID,
+  [MOUNT3_EXPORT] = { (tf_mockproc *)mocksrv_export, (xdrproc_t)xdr_void,
+    (xdrproc_t)xdr_exports, sizeof(exports) },
+};
+
+#define MOCKSRV_NPROCS(procs) (sizeof(procs) / sizeof(procs[0]))
+
+static int mocksrv_chance( t_mocksrv *srv, double fraction ) {
+
+return fraction > 0 && rand_r(&srv->seed) < fraction * ((double)RAND_MAX + 1);
+}
+
+// Transfers of call and reply share link of given bandwidth, one after
+// another. Reply is sent latency after it's transfer ends, in order.
+static void mocksrv_queue( t_mockconn *conn, t_mockreply *reply,
+    u_int calllen, const t_mocksrvconf *conf ) {
+
+  uint64_t now = mocksrv_now();
+
+  if ( conn->linkfree < now ) conn->linkfree = now;
+
+  if ( conf->bandwidth > 0 )
+    conn->linkfree += (uint64_t)(calllen + reply->len) * 1000000 / conf->bandwidth;
+
+  reply->due = conn->linkfree + conf->latency;
+
+  // latency was lowered meanwhile
+  if ( conn->lastreply && reply->due < conn->lastreply->due )
+    reply->due = conn->lastreply->due;
+
+  reply->next = NULL;
+
+  if ( conn->lastreply ) conn->lastreply->next = reply;
+  else conn->replies = reply;
+
+  conn->lastreply = reply;
+}
+
+// Decode call, execute and queue reply. Anything which isn't a call
+// is ignored, there is no one to reply to.
+static void mocksrv_call( t_mocksrv *srv, t_mockconn *conn, char *rec, u_int len ) {
+
+  char credbuf[MAX_AUTH_BYTES], verfbuf[MAX_AUTH_BYTES];
+  const t_mockproc *procs = NULL, *proc = NULL;
+  struct rpc_msg msg, reply;
+  t_mockreply *r;
+  t_mocksrvconf conf;
+  t_mockargs args;
+  t_mockres res;
+  XDR xdrs;
+  u_int nprocs = 0, size, fraghdr;
+  int status = 0, injected = 0, drop;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.rm_call.cb_cred.oa_base = credbuf;
+  msg.rm_call.cb_verf.oa_base = verfbuf;
+
+  xdrmem_create(&xdrs, rec, len, XDR_DECODE);
+
+  if ( !xdr_callmsg(&xdrs, &msg) || msg.rm_direction != CALL ) return;
+
+  pthread_mutex_lock(&srv->lock);
+  conf = srv->conf;
+  srv->stats.calls++;
+  pthread_mutex_unlock(&srv->lock);
+
+  memset(&reply, 0, sizeof(reply));
+  reply.rm_xid = msg.rm_xid;
+  reply.rm_direction = REPLY;
+  reply.rm_reply.rp_stat = MSG_ACCEPTED;
+  reply.acpted_rply.ar_verf = _null_auth;
+  reply.acpted_rply.ar_stat = SUCCESS;
+  reply.acpted_rply.ar_results.where = NULL;
+  reply.acpted_rply.ar_results.proc = (xdrproc_t)xdr_void;
+
+  switch ( msg.rm_call.cb_prog ) {
+    case NFS_PROGRAM:
+      procs = mocksrv_nfs3procs;
+      nprocs = MOCKSRV_NPROCS(mocksrv_nfs3procs);
+      break;
+    case MOUNT_PROGRAM:
+      procs = mocksrv_mountprocs;
+      nprocs = MOCKSRV_NPROCS(mocksrv_mountprocs);
+      break;
+  }
+
+  if ( !procs ) {
+    reply.acpted_rply.ar_stat = PROG_UNAVAIL;
+  } else if ( msg.rm_call.cb_vers != 3 ) {
+    reply.acpted_rply.ar_stat = PROG_MISMATCH;
+    reply.acpted_rply.ar_vers.low = reply.acpted_rply.ar_vers.high = 3;
+  } else if ( msg.rm_call.cb_proc >= nprocs ) {
+    reply.acpted_rply.ar_stat = PROC_UNAVAIL;
+  } else {
+    proc = &procs[msg.rm_call.cb_proc];
+  }
+
+  if ( proc ) {
+
+    memset(&args, 0, sizeof(args));
+    memset(&res, 0, sizeof(res));
+    arena_reset(&srv->arena);
+
+    if ( !proc->xargs(&xdrs, &args) ) {
+      reply.acpted_rply.ar_stat = GARBAGE_ARGS;
+    } else {
+
+      // server is too busy, procedure isn't executed
+      if ( procs == mocksrv_nfs3procs && proc->fn && mocksrv_chance(srv, conf.errors) ) {
+        status = NFS3ERR_JUKEBOX;
+        injected = 1;
+      } else if ( proc->fn ) {
+        status = proc->fn(srv, &args, &res);
+      }
+
+      if ( status ) {
+        memset(&res, 0, proc->ressize);
+        res.status = status;
+      }
+
+      reply.acpted_rply.ar_results.where = (caddr_t)&res;
+      reply.acpted_rply.ar_results.proc = proc->xres;
+    }
+  }
+
+  drop = mocksrv_chance(srv, conf.drops);
+
+  pthread_mutex_lock(&srv->lock);
+  if ( injected ) srv->stats.errors++;
+  if ( drop ) srv->stats.drops++;
+  pthread_mutex_unlock(&srv->lock);
+
+  if ( drop ) goto DONE;
+
+  size = xdr_sizeof((xdrproc_t)xdr_replymsg, &reply);
+
+  if ( (r = malloc(sizeof(*r) + sizeof(fraghdr) + size)) == NULL ) {
+    perror("malloc()");
+    goto DONE;
+  }
+
+  xdrmem_create(&xdrs, r->data + sizeof(fraghdr), size, XDR_ENCODE);
+
+  if ( !xdr_replymsg(&xdrs, &reply) ) {
+    fprintf(stderr, "mocksrv: can't encode reply\n");
+    free(r);
+    goto DONE;
+  }
+
+  fraghdr = htonl(MOCKSRV_LASTFRAG | size);
+  memcpy(r->data, &fraghdr, sizeof(fraghdr));
+  r->len = sizeof(fraghdr) + size;
+  r->off = 0;
+
+  mocksrv_queue(conn, r, len, &conf);
+
+DONE:
+  if ( proc ) xdr_free(proc->xargs, (char *)&args);
+}
+
+// Read what is available and execute complete calls, -1 when
+// connection is closed or broken
+static int mocksrv_input( t_mocksrv *srv, t_mockconn *conn ) {
+
+  u_int pos, fraghdr, fraglen, need = 0;
+  char *tmp;
+  ssize_t n;
+
+  while ( 1 ) {
+
+    if ( conn->ibufsize - conn->ibuflen < MOCKSRV_BUFSIZE / 4
+        || conn->ibufsize < need ) {
+
+      u_int size = conn->ibufsize ? conn->ibufsize * 2 : MOCKSRV_BUFSIZE;
+      while ( size < need ) size *= 2;
+
+      if ( (tmp = realloc(conn->ibuf, size)) == NULL ) {
+        perror("realloc()");
+        return -1;
+      }
+
+      conn->ibuf = tmp;
+      conn->ibufsize = size;
+    }
+
+    n = recv(conn->socket, conn->ibuf + conn->ibuflen,
+        conn->ibufsize - conn->ibuflen, MSG_DONTWAIT);
+
+    if ( n < 0 && errno == EINTR ) continue;
+    if ( n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ) return 0;
+    if ( n <= 0 ) return -1;
+
+    conn->ibuflen += n;
+    need = 0;
+
+    pthread_mutex_lock(&srv->lock);
+    srv->stats.received += n;
+    pthread_mutex_unlock(&srv->lock);
+
+    for ( pos = 0; conn->ibuflen - pos >= sizeof(u_int) ; ) {
+
+      memcpy(&fraghdr, conn->ibuf + pos, sizeof(u_int));
+      fraghdr = ntohl(fraghdr);
+      fraglen = fraghdr & MOCKSRV_FRAGLEN;
+
+      if ( conn->rbuflen + fraglen > MOCKSRV_MAXREC ) {
+        fprintf(stderr, "mocksrv: call too big\n");
+        return -1;
+      }
+
+      if ( conn->ibuflen - pos - sizeof(u_int) < fraglen ) {
+        need = fraglen + sizeof(u_int);
+        break;
+      }
+
+      pos += sizeof(u_int);
+
+      if ( (fraghdr & MOCKSRV_LASTFRAG) && conn->rbuflen == 0 ) {
+
+        // whole record in one fragment, decode in place
+        mocksrv_call(srv, conn, conn->ibuf + pos, fraglen);
+      } else {
+
+        if ( conn->rbuflen + fraglen > conn->rbufsize ) {
+          if ( (tmp = realloc(conn->rbuf, conn->rbuflen + fraglen)) == NULL ) {
+            perror("realloc()");
+            return -1;
+          }
+
+          conn->rbuf = tmp;
+          conn->rbufsize = conn->rbuflen + fraglen;
+        }
+
+        memcpy(conn->rbuf + conn->rbuflen, conn->ibuf + pos, fraglen);
+        conn->rbuflen += fraglen;
+
+        if ( fraghdr & MOCKSRV_LASTFRAG ) {
+          mocksrv_call(srv, conn, conn->rbuf, conn->rbuflen);
+          conn->rbuflen = 0;
+        }
+      }
+
+      pos += fraglen;
+    }
+
+    if ( pos ) {
+      memmove(conn->ibuf, conn->ibuf + pos, conn->ibuflen - pos);
+      conn->ibuflen -= pos;
+    }
+  }
+}
+
+static int mocksrv_pollout( t_mocksrv *srv, t_mockconn *conn, int set ) {
+
+  struct epoll_event ev;
+
+  if ( conn->pollout == set ) return 0;
+
+  ev.events = EPOLLIN | (set ? EPOLLOUT : 0);
+  ev.data.ptr = conn;
+
+  if ( epoll_ctl(srv->epfd, EPOLL_CTL_MOD, conn->socket, &ev) == -1 ) {
+    perror("epoll_ctl()");
+    return -1;
+  }
+
+  conn->pollout = set;
+
+return 0;
+}
+
+// send replies which are due, -1 when connection is broken
+static int mocksrv_output( t_mocksrv *srv, t_mockconn *conn, uint64_t now ) {
+
+  t_mockreply *r;
+  ssize_t n;
+
+  while ( (r = conn->replies) != NULL && r->due <= now ) {
+
+    n = send(conn->socket, r->data + r->off, r->len - r->off, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+    if ( n < 0 && errno == EINTR ) continue;
+    if ( n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+      return mocksrv_pollout(srv, conn, 1);
+    if ( n < 0 ) return -1;
+
+    r->off += n;
+
+    pthread_mutex_lock(&srv->lock);
+    srv->stats.sent += n;
+    if ( r->off == r->len ) srv->stats.replies++;
+    pthread_mutex_unlock(&srv->lock);
+
+    if ( r->off < r->len ) continue;
+
+    if ( (conn->replies = r->next) == NULL ) conn->lastreply = NULL;
+    free(r);
+  }
+
+return mocksrv_pollout(srv, conn, 0);
+}
+
+// wake up for the earliest reply, connections waiting for socket don't count
+static void mocksrv_arm( t_mocksrv *srv ) {
+
+  struct itimerspec its;
+  t_mockconn *conn;
+  uint64_t due = 0;
+
+  for ( conn = srv->conns; conn ; conn = conn->next ) {
+    if ( conn->replies && !conn->pollout && (!due || conn->replies->due < due) )
+      due = conn->replies->due;
+  }
+
+  // zero disarms timer
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = due / 1000000;
+  its.it_value.tv_nsec = (due % 1000000) * 1000;
+
+  if ( timerfd_settime(srv->timerfd, TFD_TIMER_ABSTIME, &its, NULL) == -1 )
+    perror("timerfd_settime()");
+}
+
+static void mocksrv_accept( t_mocksrv *srv ) {
+
+  struct epoll_event ev;
+  t_mockconn *conn;
+  int sd;
+
+  if ( (sd = sockaccept(srv->socket)) == -1 ) return;
+
+  if ( (conn = calloc(1, sizeof(*conn))) == NULL ) {
+    perror("calloc()");
+    sockclose(sd);
+    return;
+  }
+
+  conn->socket = sd;
+  socknagle(sd, 0);
+
+  ev.events = EPOLLIN;
+  ev.data.ptr = conn;
+
+  if ( epoll_ctl(srv->epfd, EPOLL_CTL_ADD, sd, &ev) == -1 ) {
+    perror("epoll_ctl()");
+    sockclose(sd);
+    free(conn);
+    return;
+  }
+
+  conn->next = srv->conns;
+  srv->conns = conn;
+}
+
+static void mocksrv_close( t_mockconn *conn ) {
+
+  t_mockreply *r;
+
+  while ( (r = conn->replies) != NULL ) {
+    conn->replies = r->next;
+    free(r);
+  }
+
+  sockclose(conn->socket);
+
+  free(conn->ibuf);
+  free(conn->rbuf);
+  free(conn);
+}
+
+static void *mocksrv_loop( void *arg ) {
+
+  t_mocksrv *srv = arg;
+  struct epoll_event evs[MOCKSRV_EVENTS];
+  t_mockconn *conn, **prev;
+  uint64_t now, expirations;
+  void *ptr;
+  int i, n;
+
+  while ( 1 ) {
+
+    mocksrv_arm(srv);
+
+    if ( (n = epoll_wait(srv->epfd, evs, MOCKSRV_EVENTS, -1)) == -1 ) {
+      if ( errno == EINTR ) continue;
+      perror("epoll_wait()");
+      break;
+    }
+
+    for ( i = 0; i < n ; i++ ) {
+
+      ptr = evs[i].data.ptr;
+
+      if ( ptr == &srv->stopfd ) return NULL;
+
+      if ( ptr == &srv->socket ) {
+        mocksrv_accept(srv);
+        continue;
+      }
+
+      if ( ptr == &srv->timerfd ) {
+        if ( read(srv->timerfd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN )
+          perror("read()");
+        continue;
+      }
+
+      conn = ptr;
+
+      if ( evs[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP) )
+        if ( mocksrv_input(srv, conn) == -1 ) conn->broken = 1;
+    }
+
+    // send what is due, forget closed connections
+    now = mocksrv_now();
+
+    for ( prev = &srv->conns; (conn = *prev) != NULL ; ) {
+
+      if ( !conn->broken && mocksrv_output(srv, conn, now) == -1 ) conn->broken = 1;
+
+      if ( conn->broken ) {
+        *prev = conn->next;
+        mocksrv_close(conn);
+      } else {
+        prev = &conn->next;
+      }
+    }
+  }
+
+return NULL;
+}
+
+static void mocksrv_free( t_mocksrv *srv ) {
+
+  t_mockconn *conn;
+  uint64_t id;
+
+  while ( (conn = srv->conns) != NULL ) {
+    srv->conns = conn->next;
+    mocksrv_close(conn);
+  }
+
+  if ( srv->socket >= 0 ) sockclose(srv->socket);
+  if ( srv->epfd >= 0 ) close(srv->epfd);
+  if ( srv->timerfd >= 0 ) close(srv->timerfd);
+  if ( srv->stopfd >= 0 ) close(srv->stopfd);
+
+  for ( id = 0; id < srv->nnodes ; id++ ) {
+    if ( !srv->nodes[id] ) continue;
+    free(srv->nodes[id]->name);
+    free(srv->nodes[id]);
+  }
+
+  free(srv->nodes);
+  arena_free(&srv->arena);
+  free(srv->iobuf);
+  free(srv->root);
+
+  memset(srv, 0, sizeof(*srv));
+  srv->socket = srv->epfd = srv->timerfd = srv->stopfd = -1;
+}
+
+static int mocksrv_watch( t_mocksrv *srv, int fd, int *tag ) {
+
+  struct epoll_event ev;
+
+  ev.events = EPOLLIN;
+  ev.data.ptr = tag;
+
+  if ( epoll_ctl(srv->epfd, EPOLL_CTL_ADD, fd, &ev) == -1 ) {
+    perror("epoll_ctl()");
+    return -1;
+  }
+
+return 0;
+}
+
+int mocksrv_start( t_mocksrv *srv, const char *root, const t_mocksrvconf *conf ) {
+
+  struct timespec ts;
+  struct stat st;
+  int err;
+
+  memset(srv, 0, sizeof(*srv));
+  srv->socket = srv->epfd = srv->timerfd = srv->stopfd = -1;
+
+  if ( (srv->root = realpath(root, NULL)) == NULL || lstat(srv->root, &st) == -1 ) {
+    fprintf(stderr, "%s: %s\n", root, strerror(errno));
+    goto ERR;
+  }
+
+  if ( !S_ISDIR(st.st_mode) ) {
+    fprintf(stderr, "%s: %s\n", root, strerror(ENOTDIR));
+    goto ERR;
+  }
+
+  srv->conf = *conf;
+  srv->seed = 1;
+
+  // handles of previous server instance are stale
+  clock_gettime(CLOCK_REALTIME, &ts);
+  srv->verf = (uint64_t)ts.tv_sec << 32 ^ (uint64_t)ts.tv_nsec ^ getpid();
+
+  arena_init(&srv->arena, 0);
+
+  if ( (srv->iobuf = malloc(MOCKSRV_MAXIO)) == NULL ) {
+    perror("malloc()");
+    goto ERR;
+  }
+
+  // node 0 isn't used, root is it's own parent
+  srv->nnodes = MOCKSRV_ROOTID;
+  if ( mocksrv_node(srv, &st, MOCKSRV_ROOTID, "") == NULL ) {
+    perror("mocksrv_node()");
+    goto ERR;
+  }
+
+  if ( (srv->socket = sockbind(MOCKSRV_HOST, 0, SOMAXCONN)) == -1 ) goto ERR;
+  srv->port = sockport(srv->socket);
+
+  if ( (srv->epfd = epoll_create1(0)) == -1 ) {
+    perror("epoll_create1()");
+    goto ERR;
+  }
+
+  if ( (srv->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) == -1 ) {
+    perror("timerfd_create()");
+    goto ERR;
+  }
+
+  if ( (srv->stopfd = eventfd(0, 0)) == -1 ) {
+    perror("eventfd()");
+    goto ERR;
+  }
+
+  if ( mocksrv_watch(srv, srv->socket, &srv->socket) == -1
+      || mocksrv_watch(srv, srv->timerfd, &srv->timerfd) == -1
+      || mocksrv_watch(srv, srv->stopfd, &srv->stopfd) == -1 )
+    goto ERR;
+
+  pthread_mutex_init(&srv->lock, NULL);
+
+  if ( (err = pthread_create(&srv->thread, NULL, mocksrv_loop, srv)) != 0 ) {
+    fprintf(stderr, "pthread_create(): %s\n", strerror(err));
+    pthread_mutex_destroy(&srv->lock);
+    goto ERR;
+  }
+
+return 0;
+
+ERR:
+  mocksrv_free(srv);
+
+return -1;
+}
+
+void mocksrv_stop( t_mocksrv *srv ) {
+
+  uint64_t one = 1;
+
+  if ( write(srv->stopfd, &one, sizeof(one)) != sizeof(one) ) {
+    perror("write()");
+    return;
+  }
+
+  pthread_join(srv->thread, NULL);
+  pthread_mutex_destroy(&srv->lock);
+
+  mocksrv_free(srv);
+}
+
+void mocksrv_setconf( t_mocksrv *srv, const t_mocksrvconf *conf ) {
+
+  pthread_mutex_lock(&srv->lock);
+  srv->conf = *conf;
+  pthread_mutex_unlock(&srv->lock);
+}
+
+void mocksrv_status( t_mocksrv *srv, t_mocksrvconf *conf, t_mocksrvstats *stats ) {
+
+  pthread_mutex_lock(&srv->lock);
+  if ( conf ) *conf = srv->conf;
+  if ( stats ) *stats = srv->stats;
+  pthread_mutex_unlock(&srv->lock);
+}
@@ -0,0 +1,149 @@
+/*
+ *
+ * Adrian Brzezinski (2018) <adrbxx at gmail.com>
+ * License: GPLv2+
+ *
+ */
+
+#ifndef __MOCKSRV_H__
+#define __MOCKSRV_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+
+#include <rpc/rpc.h>
+
+#include "arena.h"
+#include "xdr/mount.h"
+#include "xdr/nfsv3.h"
+
+#define MOCKSRV_HOST      "127.0.0.1"
+#define MOCKSRV_EXPORT    "/"         // the only exported path
+#define MOCKSRV_MAXIO     1048576     // rtmax and wtmax
+#define MOCKSRV_DTPREF    65536
+#define MOCKSRV_HASHSIZE  16384       // buckets of nodes table, power of 2
+
+// What server does with every call. Can be changed while it runs,
+// time is spent on server side so client pipelining can hide it.
+typedef struct {
+
+  long latency;       // microseconds between call arrival and reply
+  long bandwidth;     // bytes per second of calls and replies on each
+                      // connection, 0 is unlimited
+  double errors;      // fraction of NFS calls failed with NFS3ERR_JUKEBOX
+  double drops;       // fraction of calls executed but never replied
+
+} t_mocksrvconf;
+
+typedef struct {
+
+  unsigned long calls;
+  unsigned long replies;
+  unsigned long errors;       // injected ones
+  unsigned long drops;
+  unsigned long long received;
+  unsigned long long sent;
+
+} t_mocksrvstats;
+
+// Object of served directory. Handle carries node id, node keeps
+// parent and name, so path is valid after rename of any directory above.
+typedef struct s_mocknode {
+
+  struct s_mocknode *next;  // hash chain by inode
+
+  uint64_t id;
+  uint64_t parent;
+
+  dev_t dev;
+  ino_t ino;
+
+  char *name;
+
+} t_mocknode;
+
+typedef struct s_mockreply {
+
+  struct s_mockreply *next;
+
+  uint64_t due;     // monotonic time in microseconds to send it
+  u_int len;
+  u_int off;        // bytes already sent
+
+  char data[];
+
+} t_mockreply;
+
+typedef struct s_mockconn {
+
+  struct s_mockconn *next;
+
+  int socket;
+  int pollout;      // waiting for socket to accept more data
+  int broken;       // closed after current events are handled
+
+  char *ibuf;       // received data
+  u_int ibuflen;
+  u_int ibufsize;
+
+  char *rbuf;       // record assembled from fragments
+  u_int rbuflen;
+  u_int rbufsize;
+
+  uint64_t linkfree;  // when transfers queued so far are done
+
+  t_mockreply *replies;
+  t_mockreply *lastreply;
+
+} t_mockconn;
+
+// Single threaded NFSv3 and MOUNT server for tests and benchmarks,
+// serving local directory on loopback. Both programs are on the same
+// port, portmapper isn't used. Files are accessed with server process
+// credentials, ownership is changed only when it runs as root.
+typedef struct {
+
+  char *root;
+  int port;
+
+  int socket;       // listening one
+  int epfd;
+  int timerfd;      // armed for the earliest reply
+  int stopfd;
+
+  pthread_t thread;
+  pthread_mutex_t lock;   // conf and statistics
+
+  t_mocksrvconf conf;
+  unsigned int seed;      // fixed, so injected failures are reproducible
+  uint64_t verf;          // write verifier, also in every handle
+
+  t_mocknode **nodes;     // indexed by id
+  uint64_t nnodes;
+  uint64_t maxnodes;
+  t_mocknode *hash[MOCKSRV_HASHSIZE];
+
+  t_mockconn *conns;
+
+  t_arena arena;          // memory of current call results
+  char *iobuf;            // READ data
+
+  t_mocksrvstats stats;
+
+} t_mocksrv;
+
+// Serve root directory in new thread, on port chosen by kernel
+int mocksrv_start( t_mocksrv *srv, const char *root, const t_mocksrvconf *conf );
+void mocksrv_stop( t_mocksrv *srv );
+
+void mocksrv_setconf( t_mocksrv *srv, const t_mocksrvconf *conf );
+
+void mocksrv_status( t_mocksrv *srv, t_mocksrvconf *conf, t_mocksrvstats *stats );
+
+#endif // __MOCKSRV_H__
@@ -140,7 +140,8 @@ int sockbind( char *host, int port, int listnum ) {
 
   int sd;
 
-  if ( !host || port <= 0 || listnum <= 0 ) return 1;
+  // port 0 lets kernel choose one, see sockport()
+  if ( !host || port < 0 || listnum <= 0 ) return -1;
 
   if ( sockaddrsetup(&addr, addrlen, host, port) < 0 )
     return -1;
@@ -337,6 +338,26 @@ int socktimeout( int sd, long timeout ) {
 return 0;
 }
 
+int socknonblock( int sd, int set ) {
+
+  int flags;
+
+  if ( (flags = fcntl(sd, F_GETFL, 0)) == -1 ) {
+    perror("fcntl(F_GETFL)");
+    return -1;
+  }
+
+  if ( set ) flags |= O_NONBLOCK;
+  else flags &= ~O_NONBLOCK;
+
+  if ( fcntl(sd, F_SETFL, flags) == -1 ) {
+    perror("fcntl(F_SETFL)");
+    return -1;
+  }
+
+return 0;
+}
+
 // returns number of bytes transferred from one socket
 // to another or error number
 int sockpipe( int sdread, int sdwrite ) {
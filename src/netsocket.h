@@ -56,6 +56,7 @@ char* sockpeername( int sd );
 
 int socknagle( int sd, int set ); // enable or disable nagle algorithm
 int socktimeout( int sd, long timeout ); // set read&write timeout in seconds
+int socknonblock( int sd, int set ); // enable or disable non-blocking mode
 
 // copy data from sdread to sdwrite
 int sockpipe( int sdread, int sdwrite );
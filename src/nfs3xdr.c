@@ -0,0 +1,669 @@
+/*
+ *
+ * Adrian Brzezinski (2018) <adrbxx at gmail.com>
+ * License: GPLv2+
+ *
+ */
+
+#include "nfs3xdr.h"
+
+#define NFS3XDR_FATTRWORDS  21    // fattr3 on the wire
+#define NFS3XDR_WCCWORDS    6     // wcc_attr on the wire
+
+#define NFS3XDR_GET64(w)    ((uint64_t)(w)[0] << 32 | (w)[1])
+#define NFS3XDR_PUT64(w, v) ((w)[0] = (uint64_t)(v) >> 32, (w)[1] = (uint32_t)(v))
+
+// rpcgen build moves fields one by one also in our own decoders
+#ifdef NFS3XDR_RPCGEN
+#define NFS3XDR_INLINE(xdrs, len) NULL
+#else
+#define NFS3XDR_INLINE(xdrs, len) XDR_INLINE(xdrs, len)
+#endif
+
+// Move n words, in host order at our side. Words given for encoding
+// are clobbered.
+static bool_t nfs3xdr_words( XDR *xdrs, uint32_t *w, u_int n ) {
+
+  char *p;
+  u_int i;
+
+  if ( xdrs->x_op == XDR_FREE ) return TRUE;
+
+  if ( (p = (char *)NFS3XDR_INLINE(xdrs, n * BYTES_PER_XDR_UNIT)) == NULL ) {
+
+    for ( i = 0; i < n; i++ )
+      if ( !xdr_u_int(xdrs, &w[i]) ) return FALSE;
+
+    return TRUE;
+  }
+
+  // stream memory doesn't have to be aligned, swaps are done in our
+  // array where compiler can vectorize them
+  if ( xdrs->x_op == XDR_DECODE ) {
+
+    memcpy(w, p, n * BYTES_PER_XDR_UNIT);
+    for ( i = 0; i < n; i++ ) w[i] = be32toh(w[i]);
+
+  } else {
+
+    for ( i = 0; i < n; i++ ) w[i] = htobe32(w[i]);
+    memcpy(p, w, n * BYTES_PER_XDR_UNIT);
+  }
+
+return TRUE;
+}
+
+// Encode handle followed by n words with single XDR_INLINE()
+static bool_t nfs3xdr_fhwords( XDR *xdrs, nfs_fh3 *fh, uint32_t *w, u_int n ) {
+
+  u_int len = fh->data.data_len;
+  uint32_t be;
+  char *p;
+  u_int i;
+
+  if ( len > NFS3_FHSIZE ) return FALSE;
+
+  p = (char *)NFS3XDR_INLINE(xdrs, (1 + n) * BYTES_PER_XDR_UNIT + RNDUP(len));
+  if ( p == NULL )
+    return xdr_nfs_fh3(xdrs, fh) && ( n == 0 || nfs3xdr_words(xdrs, w, n) );
+
+  be = htobe32(len);
+  memcpy(p, &be, BYTES_PER_XDR_UNIT);
+  p += BYTES_PER_XDR_UNIT;
+
+  memcpy(p, fh->data.data_val, len);
+  memset(p + len, 0, RNDUP(len) - len);
+  p += RNDUP(len);
+
+  for ( i = 0; i < n; i++ ) w[i] = htobe32(w[i]);
+  memcpy(p, w, n * BYTES_PER_XDR_UNIT);
+
+return TRUE;
+}
+
+static void nfs3xdr_getfattr( const uint32_t *w, fattr3 *a ) {
+
+  a->type = w[0];
+  a->mode = w[1];
+  a->nlink = w[2];
+  a->uid = w[3];
+  a->gid = w[4];
+  a->size = NFS3XDR_GET64(w + 5);
+  a->used = NFS3XDR_GET64(w + 7);
+  a->rdev.specdata1 = w[9];
+  a->rdev.specdata2 = w[10];
+  a->fsid = NFS3XDR_GET64(w + 11);
+  a->fileid = NFS3XDR_GET64(w + 13);
+  a->atime.seconds = w[15];
+  a->atime.nseconds = w[16];
+  a->mtime.seconds = w[17];
+  a->mtime.nseconds = w[18];
+  a->ctime.seconds = w[19];
+  a->ctime.nseconds = w[20];
+}
+
+static void nfs3xdr_putfattr( const fattr3 *a, uint32_t *w ) {
+
+  w[0] = a->type;
+  w[1] = a->mode;
+  w[2] = a->nlink;
+  w[3] = a->uid;
+  w[4] = a->gid;
+  NFS3XDR_PUT64(w + 5, a->size);
+  NFS3XDR_PUT64(w + 7, a->used);
+  w[9] = a->rdev.specdata1;
+  w[10] = a->rdev.specdata2;
+  NFS3XDR_PUT64(w + 11, a->fsid);
+  NFS3XDR_PUT64(w + 13, a->fileid);
+  w[15] = a->atime.seconds;
+  w[16] = a->atime.nseconds;
+  w[17] = a->mtime.seconds;
+  w[18] = a->mtime.nseconds;
+  w[19] = a->ctime.seconds;
+  w[20] = a->ctime.nseconds;
+}
+
+// Handles are decoded by rpcgen codec, it's just length and copy
+bool_t nfs3xdr_nfs_fh3( XDR *xdrs, nfs_fh3 *objp ) {
+
+  if ( xdrs->x_op != XDR_ENCODE ) return xdr_nfs_fh3(xdrs, objp);
+
+return nfs3xdr_fhwords(xdrs, objp, NULL, 0);
+}
+
+bool_t nfs3xdr_fattr3( XDR *xdrs, fattr3 *objp ) {
+
+  uint32_t w[NFS3XDR_FATTRWORDS];
+
+  if ( xdrs->x_op == XDR_FREE ) return TRUE;
+
+  if ( xdrs->x_op == XDR_ENCODE ) nfs3xdr_putfattr(objp, w);
+
+  if ( !nfs3xdr_words(xdrs, w, NFS3XDR_FATTRWORDS) ) return FALSE;
+
+  if ( xdrs->x_op == XDR_DECODE ) nfs3xdr_getfattr(w, objp);
+
+return TRUE;
+}
+
+bool_t nfs3xdr_post_op_attr( XDR *xdrs, post_op_attr *objp ) {
+
+  uint32_t w[1 + NFS3XDR_FATTRWORDS];
+
+  if ( xdrs->x_op == XDR_FREE ) return TRUE;
+
+  if ( xdrs->x_op == XDR_ENCODE ) {
+
+    w[0] = objp->attributes_follow ? 1 : 0;
+    if ( !objp->attributes_follow ) return nfs3xdr_words(xdrs, w, 1);
+
+    nfs3xdr_putfattr(&objp->post_op_attr_u.attributes, w + 1);
+
+    return nfs3xdr_words(xdrs, w, 1 + NFS3XDR_FATTRWORDS);
+  }
+
+  if ( !nfs3xdr_words(xdrs, w, 1) ) return FALSE;
+
+  objp->attributes_follow = w[0] ? TRUE : FALSE;
+  if ( !objp->attributes_follow ) return TRUE;
+
+  if ( !nfs3xdr_words(xdrs, w + 1, NFS3XDR_FATTRWORDS) ) return FALSE;
+
+  nfs3xdr_getfattr(w + 1, &objp->post_op_attr_u.attributes);
+
+return TRUE;
+}
+
+bool_t nfs3xdr_wcc_data( XDR *xdrs, wcc_data *objp ) {
+
+  wcc_attr *a = &objp->before.pre_op_attr_u.attributes;
+  uint32_t w[1 + NFS3XDR_WCCWORDS];
+  u_int n = 1;
+
+  if ( xdrs->x_op == XDR_FREE ) return TRUE;
+
+  if ( xdrs->x_op == XDR_ENCODE ) {
+
+    w[0] = objp->before.attributes_follow ? 1 : 0;
+
+    if ( objp->before.attributes_follow ) {
+      NFS3XDR_PUT64(w + 1, a->size);
+      w[3] = a->mtime.seconds;
+      w[4] = a->mtime.nseconds;
+      w[5] = a->ctime.seconds;
+      w[6] = a->ctime.nseconds;
+      n += NFS3XDR_WCCWORDS;
+    }
+
+    if ( !nfs3xdr_words(xdrs, w, n) ) return FALSE;
+
+  } else {
+
+    if ( !nfs3xdr_words(xdrs, w, 1) ) return FALSE;
+
+    objp->before.attributes_follow = w[0] ? TRUE : FALSE;
+
+    if ( objp->before.attributes_follow ) {
+
+      if ( !nfs3xdr_words(xdrs, w + 1, NFS3XDR_WCCWORDS) ) return FALSE;
+
+      a->size = NFS3XDR_GET64(w + 1);
+      a->mtime.seconds = w[3];
+      a->mtime.nseconds = w[4];
+      a->ctime.seconds = w[5];
+      a->ctime.nseconds = w[6];
+    }
+  }
+
+return nfs3xdr_post_op_attr(xdrs, &objp->after);
+}
+
+bool_t nfs3xdr_GETATTR3args( XDR *xdrs, GETATTR3args *objp ) {
+
+  if ( xdrs->x_op != XDR_ENCODE ) return xdr_GETATTR3args(xdrs, objp);
+
+return nfs3xdr_fhwords(xdrs, &objp->object, NULL, 0);
+}
+
+bool_t nfs3xdr_GETATTR3res( XDR *xdrs, GETATTR3res *objp ) {
+
+  if ( !xdr_nfsstat3(xdrs, &objp->status) ) return FALSE;
+
+  if ( objp->status != NFS3_OK ) return TRUE;
+
+return nfs3xdr_fattr3(xdrs, &objp->GETATTR3res_u.resok.obj_attributes);
+}
+
+bool_t nfs3xdr_LOOKUP3args( XDR *xdrs, LOOKUP3args *objp ) {
+
+  uint32_t w[1];
+  u_int len;
+
+  if ( xdrs->x_op != XDR_ENCODE ) return xdr_LOOKUP3args(xdrs, objp);
+
+  if ( objp->what.name == NULL ) return FALSE;
+
+  w[0] = len = strlen(objp->what.name);
+
+return nfs3xdr_fhwords(xdrs, &objp->what.dir, w, 1)
+  && xdr_opaque(xdrs, objp->what.name, len);
+}
+
+bool_t nfs3xdr_LOOKUP3res( XDR *xdrs, LOOKUP3res *objp ) {
+
+  LOOKUP3resok *resok = &objp->LOOKUP3res_u.resok;
+
+  if ( !xdr_nfsstat3(xdrs, &objp->status) ) return FALSE;
+
+  if ( objp->status != NFS3_OK )
+    return nfs3xdr_post_op_attr(xdrs, &objp->LOOKUP3res_u.resfail.dir_attributes);
+
+return nfs3xdr_nfs_fh3(xdrs, &resok->object)
+  && nfs3xdr_post_op_attr(xdrs, &resok->obj_attributes)
+  && nfs3xdr_post_op_attr(xdrs, &resok->dir_attributes);
+}
+
+bool_t nfs3xdr_READ3args( XDR *xdrs, READ3args *objp ) {
+
+  uint32_t w[3];
+
+  if ( xdrs->x_op != XDR_ENCODE ) return xdr_READ3args(xdrs, objp);
+
+  NFS3XDR_PUT64(w, objp->offset);
+  w[2] = objp->count;
+
+return nfs3xdr_fhwords(xdrs, &objp->file, w, 3);
+}
+
+// status, attributes, count and eof of READ3res
+static bool_t nfs3xdr_readhead( XDR *xdrs, READ3res *objp ) {
+
+  READ3resok *resok = &objp->READ3res_u.resok;
+  uint32_t w[2];
+
+  if ( !xdr_nfsstat3(xdrs, &objp->status) ) return FALSE;
+
+  if ( objp->status != NFS3_OK )
+    return nfs3xdr_post_op_attr(xdrs, &objp->READ3res_u.resfail.file_attributes);
+
+  if ( !nfs3xdr_post_op_attr(xdrs, &resok->file_attributes) ) return FALSE;
+
+  w[0] = resok->count;
+  w[1] = resok->eof ? 1 : 0;
+
+  if ( !nfs3xdr_words(xdrs, w, 2) ) return FALSE;
+
+  // encoding swaps words in place, they aren't values anymore
+  if ( xdrs->x_op == XDR_DECODE ) {
+    resok->count = w[0];
+    resok->eof = w[1] ? TRUE : FALSE;
+  }
+
+return TRUE;
+}
+
+bool_t nfs3xdr_READ3res( XDR *xdrs, READ3res *objp ) {
+
+  READ3resok *resok = &objp->READ3res_u.resok;
+
+  if ( !nfs3xdr_readhead(xdrs, objp) ) return FALSE;
+
+  if ( objp->status != NFS3_OK ) return TRUE;
+
+return xdr_bytes(xdrs, &resok->data.data_val, &resok->data.data_len, ~0);
+}
+
+bool_t nfs3xdrreadinplace( XDR *xdrs, READ3res *objp ) {
+
+  READ3resok *resok = &objp->READ3res_u.resok;
+  u_int size = resok->data.data_len;
+
+  if ( xdrs->x_op == XDR_FREE ) return TRUE;
+
+  if ( !nfs3xdr_readhead(xdrs, objp) ) return FALSE;
+
+  if ( objp->status != NFS3_OK ) return TRUE;
+
+  // more than fits into buffer fails decoding
+return xdr_bytes(xdrs, &resok->data.data_val, &resok->data.data_len, size);
+}
+
+bool_t nfs3xdrwritehead( XDR *xdrs, WRITE3args *objp ) {
+
+  uint32_t w[5];
+
+  if ( xdrs->x_op != XDR_ENCODE ) return FALSE;
+
+  NFS3XDR_PUT64(w, objp->offset);
+  w[2] = objp->count;
+  w[3] = objp->stable;
+  w[4] = objp->data.data_len;
+
+return nfs3xdr_fhwords(xdrs, &objp->file, w, 5);
+}
+
+bool_t nfs3xdr_WRITE3args( XDR *xdrs, WRITE3args *objp ) {
+
+  if ( xdrs->x_op != XDR_ENCODE ) return xdr_WRITE3args(xdrs, objp);
+
+return nfs3xdrwritehead(xdrs, objp)
+  && xdr_opaque(xdrs, objp->data.data_val, objp->data.data_len);
+}
+
+bool_t nfs3xdr_WRITE3res( XDR *xdrs, WRITE3res *objp ) {
+
+  WRITE3resok *resok = &objp->WRITE3res_u.resok;
+  uint32_t w[2];
+
+  if ( !xdr_nfsstat3(xdrs, &objp->status) ) return FALSE;
+
+  if ( objp->status != NFS3_OK )
+    return nfs3xdr_wcc_data(xdrs, &objp->WRITE3res_u.resfail.file_wcc);
+
+  if ( !nfs3xdr_wcc_data(xdrs, &resok->file_wcc) ) return FALSE;
+
+  w[0] = resok->count;
+  w[1] = resok->committed;
+
+  if ( !nfs3xdr_words(xdrs, w, 2) ) return FALSE;
+
+  if ( xdrs->x_op == XDR_DECODE ) {
+    resok->count = w[0];
+    resok->committed = w[1];
+  }
+
+return xdr_opaque(xdrs, resok->verf, NFS3_WRITEVERFSIZE);
+}
+
+// opaque verifier as two words, encoding swaps it back to wire order
+static void nfs3xdr_verfwords( char *verf, uint32_t *w ) {
+
+  memcpy(w, verf, NFS3_COOKIEVERFSIZE);
+  w[0] = be32toh(w[0]);
+  w[1] = be32toh(w[1]);
+}
+
+bool_t nfs3xdr_READDIR3args( XDR *xdrs, READDIR3args *objp ) {
+
+  uint32_t w[5];
+
+  if ( xdrs->x_op != XDR_ENCODE ) return xdr_READDIR3args(xdrs, objp);
+
+  NFS3XDR_PUT64(w, objp->cookie);
+  nfs3xdr_verfwords(objp->cookieverf, w + 2);
+  w[4] = objp->count;
+
+return nfs3xdr_fhwords(xdrs, &objp->dir, w, 5);
+}
+
+bool_t nfs3xdr_READDIRPLUS3args( XDR *xdrs, READDIRPLUS3args *objp ) {
+
+  uint32_t w[6];
+
+  if ( xdrs->x_op != XDR_ENCODE ) return xdr_READDIRPLUS3args(xdrs, objp);
+
+  NFS3XDR_PUT64(w, objp->cookie);
+  nfs3xdr_verfwords(objp->cookieverf, w + 2);
+  w[4] = objp->dircount;
+  w[5] = objp->maxcount;
+
+return nfs3xdr_fhwords(xdrs, &objp->dir, w, 6);
+}
+
+// opaque of len bytes taken from arena and terminated with zero,
+// so it can be a string
+static bool_t nfs3xdrarenaopaque( XDR *xdrs, t_arena *arena,
+    char **data, u_int len ) {
+
+  if ( (*data = arena_alloc(arena, len + 1)) == NULL ) return FALSE;
+  (*data)[len] = '\0';
+
+return xdr_opaque(xdrs, *data, len);
+}
+
+// room for next entry, array grows twice when it's full
+static void *nfs3dirreplyentry( t_nfsdirreply *r ) {
+
+  size_t size = r->plus ? sizeof(entryplus3) : sizeof(entry3);
+  u_int n;
+  void *p;
+
+  if ( r->nentries == r->maxentries ) {
+
+    n = r->maxentries ? r->maxentries * 2 : 64;
+
+    if ( (p = realloc(r->entries.nfs3, n * size)) == NULL ) {
+      perror("realloc()");
+      return NULL;
+    }
+
+    r->entries.nfs3 = p;
+    r->maxentries = n;
+  }
+
+  p = (char *)r->entries.nfs3 + r->nentries * size;
+  r->nentries++;
+
+  memset(p, 0, size);
+
+return p;
+}
+
+// Entry of READDIRPLUS reply, returns following value of "follows"
+// in *follows.
+static bool_t nfs3xdrdirentryplus( XDR *xdrs, t_nfsdirreply *r,
+    uint32_t *follows ) {
+
+  entryplus3 *pep;
+  uint32_t w[NFS3XDR_FATTRWORDS + 1];
+  nfs_fh3 *fh;
+
+  // fileid and name length
+  if ( (pep = nfs3dirreplyentry(r)) == NULL
+      || !nfs3xdr_words(xdrs, w, 3)
+      || w[2] > PATH_MAX
+      || !nfs3xdrarenaopaque(xdrs, &r->arena, &pep->name, w[2]) )
+    return FALSE;
+
+  pep->fileid = NFS3XDR_GET64(w);
+
+  // cookie and attributes_follow
+  if ( !nfs3xdr_words(xdrs, w, 3) ) return FALSE;
+
+  pep->cookie = NFS3XDR_GET64(w);
+
+  // attributes are taken together with handle_follows
+  if ( w[2] ) {
+
+    if ( !nfs3xdr_words(xdrs, w, NFS3XDR_FATTRWORDS + 1) ) return FALSE;
+
+    pep->name_attributes.attributes_follow = TRUE;
+    nfs3xdr_getfattr(w, &pep->name_attributes.post_op_attr_u.attributes);
+    w[0] = w[NFS3XDR_FATTRWORDS];
+
+  } else if ( !nfs3xdr_words(xdrs, w, 1) ) return FALSE;
+
+  if ( w[0] ) {
+
+    pep->name_handle.handle_follows = TRUE;
+    fh = &pep->name_handle.post_op_fh3_u.handle;
+
+    if ( !nfs3xdr_words(xdrs, w, 1)
+        || w[0] > NFS3_FHSIZE
+        || !nfs3xdrarenaopaque(xdrs, &r->arena, &fh->data.data_val, w[0]) )
+      return FALSE;
+
+    fh->data.data_len = w[0];
+  }
+
+return nfs3xdr_words(xdrs, follows, 1);
+}
+
+// Entry of READDIR reply, cookie is taken together with following
+// value of "follows"
+static bool_t nfs3xdrdirentry( XDR *xdrs, t_nfsdirreply *r,
+    uint32_t *follows ) {
+
+  entry3 *ep;
+  uint32_t w[3];
+
+  // fileid and name length
+  if ( (ep = nfs3dirreplyentry(r)) == NULL
+      || !nfs3xdr_words(xdrs, w, 3)
+      || w[2] > PATH_MAX
+      || !nfs3xdrarenaopaque(xdrs, &r->arena, &ep->name, w[2]) )
+    return FALSE;
+
+  ep->fileid = NFS3XDR_GET64(w);
+
+  if ( !nfs3xdr_words(xdrs, w, 3) ) return FALSE;
+
+  ep->cookie = NFS3XDR_GET64(w);
+  *follows = w[2];
+
+return TRUE;
+}
+
+bool_t nfs3xdrdirreply( XDR *xdrs, t_nfsdirreply *r ) {
+
+  READDIR3res *res = &r->res.nfs3;
+  READDIRPLUS3res *pres = &r->res.nfs3plus;
+  post_op_attr *dirattr;
+  char *verf;
+  bool_t *eof;
+  uint32_t w;
+  u_int i;
+
+  arena_reset(&r->arena);
+  r->nentries = 0;
+  memset(&r->res, 0, sizeof(r->res));
+
+  if ( xdrs->x_op == XDR_FREE ) return TRUE;
+  if ( xdrs->x_op != XDR_DECODE ) return FALSE;
+
+  // status is first member of both unions
+  if ( !xdr_nfsstat3(xdrs, &res->status) ) return FALSE;
+
+  if ( res->status != NFS3_OK )
+    return nfs3xdr_post_op_attr(xdrs, r->plus ?
+        &pres->READDIRPLUS3res_u.resfail.dir_attributes :
+        &res->READDIR3res_u.resfail.dir_attributes);
+
+  if ( r->plus ) {
+    dirattr = &pres->READDIRPLUS3res_u.resok.dir_attributes;
+    verf = pres->READDIRPLUS3res_u.resok.cookieverf;
+    eof = &pres->READDIRPLUS3res_u.resok.reply.eof;
+  } else {
+    dirattr = &res->READDIR3res_u.resok.dir_attributes;
+    verf = res->READDIR3res_u.resok.cookieverf;
+    eof = &res->READDIR3res_u.resok.reply.eof;
+  }
+
+  if ( !nfs3xdr_post_op_attr(xdrs, dirattr)
+      || !xdr_opaque(xdrs, verf, NFS3_COOKIEVERFSIZE)
+      || !nfs3xdr_words(xdrs, &w, 1) )
+    return FALSE;
+
+  while ( w ) {
+
+    if ( r->plus ) {
+      if ( !nfs3xdrdirentryplus(xdrs, r, &w) ) return FALSE;
+    } else {
+      if ( !nfs3xdrdirentry(xdrs, r, &w) ) return FALSE;
+    }
+  }
+
+  if ( !nfs3xdr_words(xdrs, &w, 1) ) return FALSE;
+  *eof = w ? TRUE : FALSE;
+
+  // chain entries only now, array could move while growing
+  for ( i = 0; i < r->nentries ; i++ ) {
+    if ( r->plus )
+      r->entries.nfs3plus[i].nextentry = i + 1 < r->nentries ?
+        &r->entries.nfs3plus[i + 1] : NULL;
+    else
+      r->entries.nfs3[i].nextentry = i + 1 < r->nentries ?
+        &r->entries.nfs3[i + 1] : NULL;
+  }
+
+  if ( r->nentries ) {
+    if ( r->plus )
+      pres->READDIRPLUS3res_u.resok.reply.entries = r->entries.nfs3plus;
+    else
+      res->READDIR3res_u.resok.reply.entries = r->entries.nfs3;
+  }
+
+return TRUE;
+}
+
+void nfs3dirreplyfree( t_nfsdirreply *r ) {
+
+  arena_free(&r->arena);
+  if ( r->entries.nfs3 ) free(r->entries.nfs3);
+
+  r->entries.nfs3 = NULL;
+  r->nentries = r->maxentries = 0;
+}
+
+// same as in rpcgen stubs
+static struct timeval nfs3xdr_timeout = { 25, 0 };
+
+GETATTR3res *nfs3xdrproc_getattr( GETATTR3args *argp, CLIENT *clnt ) {
+
+  static GETATTR3res res;
+
+  memset(&res, 0, sizeof(res));
+
+  if ( clnt_call(clnt, NFSPROC3_GETATTR,
+        (xdrproc_t)NFS3XDR(GETATTR3args), (caddr_t)argp,
+        (xdrproc_t)NFS3XDR(GETATTR3res), (caddr_t)&res,
+        nfs3xdr_timeout) != RPC_SUCCESS )
+    return NULL;
+
+return &res;
+}
+
+LOOKUP3res *nfs3xdrproc_lookup( LOOKUP3args *argp, CLIENT *clnt ) {
+
+  static LOOKUP3res res;
+
+  memset(&res, 0, sizeof(res));
+
+  if ( clnt_call(clnt, NFSPROC3_LOOKUP,
+        (xdrproc_t)NFS3XDR(LOOKUP3args), (caddr_t)argp,
+        (xdrproc_t)NFS3XDR(LOOKUP3res), (caddr_t)&res,
+        nfs3xdr_timeout) != RPC_SUCCESS )
+    return NULL;
+
+return &res;
+}
+
+READ3res *nfs3xdrproc_read( READ3args *argp, CLIENT *clnt ) {
+
+  static READ3res res;
+
+  memset(&res, 0, sizeof(res));
+
+  if ( clnt_call(clnt, NFSPROC3_READ,
+        (xdrproc_t)NFS3XDR(READ3args), (caddr_t)argp,
+        (xdrproc_t)NFS3XDR(READ3res), (caddr_t)&res,
+        nfs3xdr_timeout) != RPC_SUCCESS )
+    return NULL;
+
+return &res;
+}
+
+WRITE3res *nfs3xdrproc_write( WRITE3args *argp, CLIENT *clnt ) {
+
+  static WRITE3res res;
+
+  memset(&res, 0, sizeof(res));
+
+  if ( clnt_call(clnt, NFSPROC3_WRITE,
+        (xdrproc_t)NFS3XDR(WRITE3args), (caddr_t)argp,
+        (xdrproc_t)NFS3XDR(WRITE3res), (caddr_t)&res,
+        nfs3xdr_timeout) != RPC_SUCCESS )
+    return NULL;
+
+return &res;
+}
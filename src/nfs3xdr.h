@@ -0,0 +1,109 @@
+/*
+ *
+ * Adrian Brzezinski (2018) <adrbxx at gmail.com>
+ * License: GPLv2+
+ *
+ */
+
+#ifndef __NFS3XDR_H__
+#define __NFS3XDR_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <endian.h>
+
+#include <rpc/rpc.h>
+
+#include "arena.h"
+#include "xdr/nfsv3.h"
+
+// Hand written codecs of hot NFSv3 procedures. Fixed size parts of
+// messages are moved with single XDR_INLINE() and byte swapped at once,
+// instead of calling stream operation for every field. If stream can't
+// give contiguous memory they go field by field, so messages are the
+// same as encoded by rpcgen ones and both can be mixed. Results are
+// allocated like by rpcgen codecs and freed with xdr_free().
+//
+// Client uses codecs selected with NFS3XDR() and blocking calls with
+// NFS3PROC(), build with -DNFS3XDR_RPCGEN to use rpcgen ones there.
+// nfs3xdrdirreply(), nfs3xdrreadinplace() and nfs3xdrwritehead() are
+// used by both builds, in rpcgen one they move fields one by one.
+#ifdef NFS3XDR_RPCGEN
+#define NFS3XDR(type) xdr_##type
+#define NFS3PROC(proc) nfsproc3_##proc##_3
+#else
+#define NFS3XDR(type) nfs3xdr_##type
+#define NFS3PROC(proc) nfs3xdrproc_##proc
+#endif
+
+typedef union {
+
+  READDIR3res nfs3;
+  READDIRPLUS3res nfs3plus;     // entries with attributes
+
+} t_nfsdirres;
+
+typedef union {
+
+  entry3 *nfs3;
+  entryplus3 *nfs3plus;
+
+} tp_nfsdirent;
+
+// READDIR or READDIRPLUS reply decoded with nfs3xdrdirreply(). Entries
+// are contiguous array, still chained with nextentry. Their names and
+// handles are allocated from arena. Memory is kept for next replies
+// until nfs3dirreplyfree().
+typedef struct {
+
+  int plus;           // READDIRPLUS reply
+  t_nfsdirres res;
+
+  tp_nfsdirent entries;
+  u_int nentries;
+  u_int maxentries;
+
+  t_arena arena;
+
+} t_nfsdirreply;
+
+bool_t nfs3xdr_nfs_fh3( XDR *xdrs, nfs_fh3 *objp );
+bool_t nfs3xdr_fattr3( XDR *xdrs, fattr3 *objp );
+bool_t nfs3xdr_post_op_attr( XDR *xdrs, post_op_attr *objp );
+bool_t nfs3xdr_wcc_data( XDR *xdrs, wcc_data *objp );
+
+bool_t nfs3xdr_GETATTR3args( XDR *xdrs, GETATTR3args *objp );
+bool_t nfs3xdr_GETATTR3res( XDR *xdrs, GETATTR3res *objp );
+bool_t nfs3xdr_LOOKUP3args( XDR *xdrs, LOOKUP3args *objp );
+bool_t nfs3xdr_LOOKUP3res( XDR *xdrs, LOOKUP3res *objp );
+bool_t nfs3xdr_READ3args( XDR *xdrs, READ3args *objp );
+bool_t nfs3xdr_READ3res( XDR *xdrs, READ3res *objp );
+bool_t nfs3xdr_WRITE3args( XDR *xdrs, WRITE3args *objp );
+bool_t nfs3xdr_WRITE3res( XDR *xdrs, WRITE3res *objp );
+bool_t nfs3xdr_READDIR3args( XDR *xdrs, READDIR3args *objp );
+bool_t nfs3xdr_READDIRPLUS3args( XDR *xdrs, READDIRPLUS3args *objp );
+
+// READ3res decoder which stores data into buffer given by caller in
+// resok.data (data_val and it's size in data_len) instead of allocating
+// it, so data is copied only once, from receive buffer to destination.
+// Nothing is allocated, result doesn't need xdr_free().
+bool_t nfs3xdrreadinplace( XDR *xdrs, READ3res *objp );
+
+// WRITE3args up to the data length, data itself is sent by
+// rpcgroup_submitv() straight from it's buffer
+bool_t nfs3xdrwritehead( XDR *xdrs, WRITE3args *objp );
+
+// Decoder of READDIR and READDIRPLUS replies, see t_nfsdirreply.
+// Freeing only forgets entries, memory is reused by next decoding.
+bool_t nfs3xdrdirreply( XDR *xdrs, t_nfsdirreply *r );
+void nfs3dirreplyfree( t_nfsdirreply *r );
+
+// Like rpcgen client stubs, results are static
+GETATTR3res *nfs3xdrproc_getattr( GETATTR3args *argp, CLIENT *clnt );
+LOOKUP3res *nfs3xdrproc_lookup( LOOKUP3args *argp, CLIENT *clnt );
+READ3res *nfs3xdrproc_read( READ3args *argp, CLIENT *clnt );
+WRITE3res *nfs3xdrproc_write( WRITE3args *argp, CLIENT *clnt );
+
+#endif // __NFS3XDR_H__
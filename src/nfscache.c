@@ -0,0 +1,505 @@
+/*
+ *
+ * Adrian Brzezinski (2018) <adrbxx at gmail.com>
+ * License: GPLv2+
+ *
+ */
+
+#include "nfscache.h"
+
+// FNV-1a
+static u_int cachehash( u_int hash, char *data, u_int datalen ) {
+
+  u_int i;
+
+  for ( i = 0; i < datalen ; i++ ) {
+    hash ^= (unsigned char)data[i];
+    hash *= 16777619;
+  }
+
+return hash;
+}
+
+#define CACHEHASH_INIT 2166136261U
+
+static int nfstime3eq( nfstime3 *a, nfstime3 *b ) {
+return a->seconds == b->seconds && a->nseconds == b->nseconds;
+}
+
+static int fh3eq( nfs_fh3 *fh, char *data, u_int datalen ) {
+return fh->data.data_len == datalen && !memcmp(fh->data.data_val, data, datalen);
+}
+
+void dnlc_init( t_dnlc *dnlc, int ttl, int max ) {
+
+  dnlc_purge(dnlc);
+
+  dnlc->ttl = ttl;
+  dnlc->max = max;
+}
+
+void dnlc_purge( t_dnlc *dnlc ) {
+
+  t_dnlcentry *e, *enext;
+  t_dnlcdir *d, *dnext;
+  u_int i;
+
+  for ( e = dnlc->lruhead; e ; e = enext ) {
+    enext = e->lrunext;
+    free(e);
+  }
+
+  if ( dnlc->dirs ) {
+    for ( i = 0; i < dnlc->size ; i++ ) {
+      for ( d = dnlc->dirs[i]; d ; d = dnext ) {
+        dnext = d->next;
+        free(d);
+      }
+    }
+  }
+
+  if ( dnlc->entries ) free(dnlc->entries);
+  if ( dnlc->dirs ) free(dnlc->dirs);
+
+  dnlc->entries = NULL;
+  dnlc->dirs = NULL;
+  dnlc->lruhead = dnlc->lrutail = NULL;
+  dnlc->size = 0;
+  dnlc->count = 0;
+  dnlc->dircount = 0;
+}
+
+// allocate hash tables on first use
+static int dnlc_alloc( t_dnlc *dnlc ) {
+
+  u_int size;
+
+  if ( dnlc->entries ) return 0;
+
+  // keep chains short, about two entries per bucket
+  for ( size = 64; size < dnlc->max / 2 ; size <<= 1 ) ;
+
+  dnlc->entries = calloc(size, sizeof(t_dnlcentry *));
+  dnlc->dirs = calloc(size, sizeof(t_dnlcdir *));
+
+  if ( dnlc->entries == NULL || dnlc->dirs == NULL ) {
+    perror("calloc()");
+    dnlc_purge(dnlc);
+    return -1;
+  }
+
+  dnlc->size = size;
+
+return 0;
+}
+
+static void dnlc_unlink( t_dnlc *dnlc, t_dnlcentry *e ) {
+
+  t_dnlcentry **pe;
+
+  for ( pe = &dnlc->entries[e->hash & (dnlc->size - 1)]; *pe ; pe = &(*pe)->next ) {
+    if ( *pe == e ) {
+      *pe = e->next;
+      break;
+    }
+  }
+
+  if ( e->lruprev ) e->lruprev->lrunext = e->lrunext;
+  else dnlc->lruhead = e->lrunext;
+
+  if ( e->lrunext ) e->lrunext->lruprev = e->lruprev;
+  else dnlc->lrutail = e->lruprev;
+
+  dnlc->count--;
+  free(e);
+}
+
+static void dnlc_lrufront( t_dnlc *dnlc, t_dnlcentry *e ) {
+
+  if ( dnlc->lruhead == e ) return;
+
+  // take out from list
+  e->lruprev->lrunext = e->lrunext;
+  if ( e->lrunext ) e->lrunext->lruprev = e->lruprev;
+  else dnlc->lrutail = e->lruprev;
+
+  // and put at the head
+  e->lruprev = NULL;
+  e->lrunext = dnlc->lruhead;
+  dnlc->lruhead->lruprev = e;
+  dnlc->lruhead = e;
+}
+
+static t_dnlcentry *dnlc_find( t_dnlc *dnlc, nfs_fh3 *dirfh, char *name ) {
+
+  t_dnlcentry *e;
+  u_int hash;
+
+  if ( dnlc->entries == NULL ) return NULL;
+
+  hash = cachehash(CACHEHASH_INIT, dirfh->data.data_val, dirfh->data.data_len);
+  hash = cachehash(hash, name, strlen(name));
+
+  for ( e = dnlc->entries[hash & (dnlc->size - 1)]; e ; e = e->next ) {
+    if ( e->hash == hash && fh3eq(dirfh, e->dirfh, e->dirfhlen)
+        && !strcmp(e->name, name) )
+      return e;
+  }
+
+return NULL;
+}
+
+static t_dnlcdir *dnlc_finddir( t_dnlc *dnlc, char *fh, u_int fhlen ) {
+
+  t_dnlcdir *d;
+  u_int hash;
+
+  if ( dnlc->dirs == NULL ) return NULL;
+
+  hash = cachehash(CACHEHASH_INIT, fh, fhlen);
+
+  for ( d = dnlc->dirs[hash & (dnlc->size - 1)]; d ; d = d->next ) {
+    if ( d->hash == hash && d->fhlen == fhlen && !memcmp(d->fh, fh, fhlen) )
+      return d;
+  }
+
+return NULL;
+}
+
+t_dnlcentry *dnlc_lookup( t_dnlc *dnlc, nfs_fh3 *dirfh, char *name ) {
+
+  t_dnlcentry *e;
+  t_dnlcdir *d;
+
+  if ( dnlc->ttl <= 0 ) return NULL;
+
+  if ( (e = dnlc_find(dnlc, dirfh, name)) == NULL ) {
+    dnlc->misses++;
+    return NULL;
+  }
+
+  // expired or directory changed since entry was made,
+  // entries made without directory attributes live until expired
+  d = dnlc_finddir(dnlc, e->dirfh, e->dirfhlen);
+  if ( e->expire < time(NULL)
+      || (d ? d->gen != e->dirgen : e->dirgen != 0) ) {
+
+    dnlc_unlink(dnlc, e);
+    dnlc->misses++;
+    return NULL;
+  }
+
+  dnlc_lrufront(dnlc, e);
+  dnlc->hits++;
+
+return e;
+}
+
+// update directory record, returns NULL if it can't be kept
+static t_dnlcdir *dnlc_dirset( t_dnlc *dnlc, nfs_fh3 *dirfh, fattr3 *attr ) {
+
+  t_dnlcdir *d, *dnext;
+  u_int i;
+
+  if ( dirfh->data.data_len > NFS3_FHSIZE ) return NULL;
+
+  if ( dnlc_alloc(dnlc) == -1 ) return NULL;
+
+  d = dnlc_finddir(dnlc, dirfh->data.data_val, dirfh->data.data_len);
+
+  if ( d == NULL ) {
+
+    // too many directories, start over
+    if ( dnlc->dircount >= dnlc->max ) {
+      for ( i = 0; i < dnlc->size ; i++ ) {
+        for ( d = dnlc->dirs[i]; d ; d = dnext ) {
+          dnext = d->next;
+          free(d);
+        }
+        dnlc->dirs[i] = NULL;
+      }
+      dnlc->dircount = 0;
+    }
+
+    if ( (d = calloc(1, sizeof(t_dnlcdir))) == NULL ) return NULL;
+
+    d->fhlen = dirfh->data.data_len;
+    memcpy(d->fh, dirfh->data.data_val, d->fhlen);
+    d->hash = cachehash(CACHEHASH_INIT, d->fh, d->fhlen);
+    d->gen = ++dnlc->gen;
+
+    d->next = dnlc->dirs[d->hash & (dnlc->size - 1)];
+    dnlc->dirs[d->hash & (dnlc->size - 1)] = d;
+    dnlc->dircount++;
+
+  } else if ( !nfstime3eq(&d->mtime, &attr->mtime)
+      || !nfstime3eq(&d->ctime, &attr->ctime) ) {
+
+    // directory changed, invalidate all names in it
+    d->gen = ++dnlc->gen;
+  }
+
+  d->mtime = attr->mtime;
+  d->ctime = attr->ctime;
+
+return d;
+}
+
+void dnlc_dirattr( t_dnlc *dnlc, nfs_fh3 *dirfh, post_op_attr *dirattr ) {
+
+  if ( dnlc->ttl <= 0 || !dirattr->attributes_follow ) return;
+
+  dnlc_dirset(dnlc, dirfh, &dirattr->post_op_attr_u.attributes);
+}
+
+void dnlc_dirwcc( t_dnlc *dnlc, nfs_fh3 *dirfh, wcc_data *dirwcc ) {
+
+  t_dnlcdir *d;
+  wcc_attr *before;
+
+  if ( dnlc->ttl <= 0 || !dirwcc->after.attributes_follow ) return;
+
+  d = dnlc_finddir(dnlc, dirfh->data.data_val, dirfh->data.data_len);
+
+  // directory was as we remember it, so the only change is ours
+  // and caller takes care of names it touched
+  if ( d && dirwcc->before.attributes_follow ) {
+    before = &dirwcc->before.pre_op_attr_u.attributes;
+
+    if ( nfstime3eq(&d->mtime, &before->mtime)
+        && nfstime3eq(&d->ctime, &before->ctime) ) {
+
+      d->mtime = dirwcc->after.post_op_attr_u.attributes.mtime;
+      d->ctime = dirwcc->after.post_op_attr_u.attributes.ctime;
+      return;
+    }
+  }
+
+  dnlc_dirset(dnlc, dirfh, &dirwcc->after.post_op_attr_u.attributes);
+}
+
+int dnlc_enter( t_dnlc *dnlc, nfs_fh3 *dirfh, char *name,
+    nfs_fh3 *fh, post_op_attr *dirattr ) {
+
+  t_dnlcentry *e;
+  t_dnlcdir *d = NULL;
+
+  if ( dnlc->ttl <= 0 ) return 0;
+
+  if ( dirfh->data.data_len > NFS3_FHSIZE || fh->data.data_len > NFS3_FHSIZE )
+    return -1;
+
+  if ( dnlc_alloc(dnlc) == -1 ) return -1;
+
+  if ( (e = dnlc_find(dnlc, dirfh, name)) != NULL )
+    dnlc_unlink(dnlc, e);
+
+  if ( dirattr->attributes_follow )
+    d = dnlc_dirset(dnlc, dirfh, &dirattr->post_op_attr_u.attributes);
+
+  if ( (e = calloc(1, sizeof(t_dnlcentry) + strlen(name) + 1)) == NULL ) {
+    perror("calloc()");
+    return -1;
+  }
+
+  e->expire = time(NULL) + dnlc->ttl;
+  e->dirgen = d ? d->gen : 0;
+
+  e->dirfhlen = dirfh->data.data_len;
+  memcpy(e->dirfh, dirfh->data.data_val, e->dirfhlen);
+  e->fhlen = fh->data.data_len;
+  memcpy(e->fh, fh->data.data_val, e->fhlen);
+  strcpy(e->name, name);
+
+  e->hash = cachehash(CACHEHASH_INIT, e->dirfh, e->dirfhlen);
+  e->hash = cachehash(e->hash, e->name, strlen(e->name));
+
+  e->next = dnlc->entries[e->hash & (dnlc->size - 1)];
+  dnlc->entries[e->hash & (dnlc->size - 1)] = e;
+
+  e->lrunext = dnlc->lruhead;
+  if ( dnlc->lruhead ) dnlc->lruhead->lruprev = e;
+  dnlc->lruhead = e;
+  if ( dnlc->lrutail == NULL ) dnlc->lrutail = e;
+
+  dnlc->count++;
+
+  // drop least recently used
+  while ( dnlc->count > dnlc->max && dnlc->lrutail )
+    dnlc_unlink(dnlc, dnlc->lrutail);
+
+return 0;
+}
+
+void dnlc_remove( t_dnlc *dnlc, nfs_fh3 *dirfh, char *name ) {
+
+  t_dnlcentry *e;
+
+  if ( (e = dnlc_find(dnlc, dirfh, name)) != NULL )
+    dnlc_unlink(dnlc, e);
+}
+
+void acache_init( t_acache *acache, int ttl, int max ) {
+
+  acache_purge(acache);
+
+  acache->ttl = ttl;
+  acache->max = max;
+}
+
+void acache_purge( t_acache *acache ) {
+
+  t_acacheentry *e, *enext;
+
+  for ( e = acache->lruhead; e ; e = enext ) {
+    enext = e->lrunext;
+    free(e);
+  }
+
+  if ( acache->entries ) free(acache->entries);
+
+  acache->entries = NULL;
+  acache->lruhead = acache->lrutail = NULL;
+  acache->size = 0;
+  acache->count = 0;
+}
+
+static void acache_unlink( t_acache *acache, t_acacheentry *e ) {
+
+  t_acacheentry **pe;
+
+  for ( pe = &acache->entries[e->hash & (acache->size - 1)]; *pe ; pe = &(*pe)->next ) {
+    if ( *pe == e ) {
+      *pe = e->next;
+      break;
+    }
+  }
+
+  if ( e->lruprev ) e->lruprev->lrunext = e->lrunext;
+  else acache->lruhead = e->lrunext;
+
+  if ( e->lrunext ) e->lrunext->lruprev = e->lruprev;
+  else acache->lrutail = e->lruprev;
+
+  acache->count--;
+  free(e);
+}
+
+static t_acacheentry *acache_find( t_acache *acache, nfs_fh3 *fh ) {
+
+  t_acacheentry *e;
+  u_int hash;
+
+  if ( acache->entries == NULL ) return NULL;
+
+  hash = cachehash(CACHEHASH_INIT, fh->data.data_val, fh->data.data_len);
+
+  for ( e = acache->entries[hash & (acache->size - 1)]; e ; e = e->next ) {
+    if ( e->hash == hash && fh3eq(fh, e->fh, e->fhlen) )
+      return e;
+  }
+
+return NULL;
+}
+
+fattr3 *acache_get( t_acache *acache, nfs_fh3 *fh ) {
+
+  t_acacheentry *e;
+
+  if ( acache->ttl <= 0 ) return NULL;
+
+  if ( (e = acache_find(acache, fh)) == NULL ) {
+    acache->misses++;
+    return NULL;
+  }
+
+  if ( e->expire < time(NULL) ) {
+    acache_unlink(acache, e);
+    acache->misses++;
+    return NULL;
+  }
+
+  // move to the head of LRU list
+  if ( acache->lruhead != e ) {
+    e->lruprev->lrunext = e->lrunext;
+    if ( e->lrunext ) e->lrunext->lruprev = e->lruprev;
+    else acache->lrutail = e->lruprev;
+
+    e->lruprev = NULL;
+    e->lrunext = acache->lruhead;
+    acache->lruhead->lruprev = e;
+    acache->lruhead = e;
+  }
+
+  acache->hits++;
+
+return &e->attr;
+}
+
+void acache_update( t_acache *acache, nfs_fh3 *fh, post_op_attr *attr ) {
+
+  t_acacheentry *e;
+  u_int size;
+
+  if ( acache->ttl <= 0 || !attr->attributes_follow ) return;
+  if ( fh->data.data_len > NFS3_FHSIZE ) return;
+
+  // allocate hash table on first use
+  if ( acache->entries == NULL ) {
+    for ( size = 64; size < acache->max / 2 ; size <<= 1 ) ;
+
+    if ( (acache->entries = calloc(size, sizeof(t_acacheentry *))) == NULL ) {
+      perror("calloc()");
+      return;
+    }
+
+    acache->size = size;
+  }
+
+  if ( (e = acache_find(acache, fh)) == NULL ) {
+
+    if ( (e = calloc(1, sizeof(t_acacheentry))) == NULL ) {
+      perror("calloc()");
+      return;
+    }
+
+    e->fhlen = fh->data.data_len;
+    memcpy(e->fh, fh->data.data_val, e->fhlen);
+    e->hash = cachehash(CACHEHASH_INIT, e->fh, e->fhlen);
+
+    e->next = acache->entries[e->hash & (acache->size - 1)];
+    acache->entries[e->hash & (acache->size - 1)] = e;
+
+    e->lrunext = acache->lruhead;
+    if ( acache->lruhead ) acache->lruhead->lruprev = e;
+    acache->lruhead = e;
+    if ( acache->lrutail == NULL ) acache->lrutail = e;
+
+    acache->count++;
+  }
+
+  memcpy(&e->attr, &attr->post_op_attr_u.attributes, sizeof(fattr3));
+  e->expire = time(NULL) + acache->ttl;
+
+  // drop least recently used
+  while ( acache->count > acache->max && acache->lrutail )
+    acache_unlink(acache, acache->lrutail);
+}
+
+void acache_wcc( t_acache *acache, nfs_fh3 *fh, wcc_data *wcc ) {
+
+  if ( wcc->after.attributes_follow ) {
+    acache_update(acache, fh, &wcc->after);
+    return;
+  }
+
+  acache_forget(acache, fh);
+}
+
+void acache_forget( t_acache *acache, nfs_fh3 *fh ) {
+
+  t_acacheentry *e;
+
+  if ( (e = acache_find(acache, fh)) != NULL )
+    acache_unlink(acache, e);
+}
@@ -0,0 +1,159 @@
+/*
+ *
+ * Adrian Brzezinski (2018) <adrbxx at gmail.com>
+ * License: GPLv2+
+ *
+ */
+
+#ifndef __NFSCACHE_H__
+#define __NFSCACHE_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+
+#include <rpc/rpc.h>
+
+#include "xdr/nfsv3.h"
+
+// Default cache limits
+#define DNLC_TTL 30         // seconds
+#define DNLC_MAX 65536      // entries
+#define ACACHE_TTL 30       // seconds
+#define ACACHE_MAX 65536    // entries
+
+// Directory name lookup cache entry, maps (directory handle, name)
+// to handle of the object. Attributes are kept in attribute cache.
+typedef struct s_dnlcentry {
+
+  struct s_dnlcentry *next;     // hash chain
+  struct s_dnlcentry *lruprev;
+  struct s_dnlcentry *lrunext;
+
+  u_int hash;
+  time_t expire;
+
+  // directory generation when entry was made, entry is stale
+  // when we see that directory was modified by someone else
+  u_int dirgen;
+
+  u_int dirfhlen;
+  char dirfh[NFS3_FHSIZE];
+
+  u_int fhlen;
+  char fh[NFS3_FHSIZE];
+
+  char name[];
+
+} t_dnlcentry;
+
+// Last seen attributes of directory
+typedef struct s_dnlcdir {
+
+  struct s_dnlcdir *next;
+
+  u_int hash;
+  u_int gen;
+
+  nfstime3 mtime;
+  nfstime3 ctime;
+
+  u_int fhlen;
+  char fh[NFS3_FHSIZE];
+
+} t_dnlcdir;
+
+typedef struct {
+
+  int ttl;        // 0 disables cache
+  int max;
+
+  u_int size;     // number of hash buckets
+  int count;      // number of entries
+  t_dnlcentry **entries;
+
+  int dircount;
+  t_dnlcdir **dirs;
+  u_int gen;      // last given directory generation
+
+  // most recently used at head
+  t_dnlcentry *lruhead;
+  t_dnlcentry *lrutail;
+
+  unsigned long hits;
+  unsigned long misses;
+
+} t_dnlc;
+
+void dnlc_init( t_dnlc *dnlc, int ttl, int max );
+void dnlc_purge( t_dnlc *dnlc );
+
+// returns valid entry or NULL
+t_dnlcentry *dnlc_lookup( t_dnlc *dnlc, nfs_fh3 *dirfh, char *name );
+
+// dirattr are post operation directory attributes from LOOKUP reply
+int dnlc_enter( t_dnlc *dnlc, nfs_fh3 *dirfh, char *name,
+    nfs_fh3 *fh, post_op_attr *dirattr );
+
+// name was removed or renamed
+void dnlc_remove( t_dnlc *dnlc, nfs_fh3 *dirfh, char *name );
+
+// we've got fresh directory attributes from server
+void dnlc_dirattr( t_dnlc *dnlc, nfs_fh3 *dirfh, post_op_attr *dirattr );
+
+// directory was modified by us, names stay valid if nobody
+// else changed it in the meantime
+void dnlc_dirwcc( t_dnlc *dnlc, nfs_fh3 *dirfh, wcc_data *dirwcc );
+
+// Attribute cache entry, maps handle to attributes
+typedef struct s_acacheentry {
+
+  struct s_acacheentry *next;     // hash chain
+  struct s_acacheentry *lruprev;
+  struct s_acacheentry *lrunext;
+
+  u_int hash;
+  time_t expire;
+
+  u_int fhlen;
+  char fh[NFS3_FHSIZE];
+  fattr3 attr;
+
+} t_acacheentry;
+
+typedef struct {
+
+  int ttl;        // 0 disables cache
+  int max;
+
+  u_int size;     // number of hash buckets
+  int count;      // number of entries
+  t_acacheentry **entries;
+
+  // most recently used at head
+  t_acacheentry *lruhead;
+  t_acacheentry *lrutail;
+
+  unsigned long hits;
+  unsigned long misses;
+
+} t_acache;
+
+void acache_init( t_acache *acache, int ttl, int max );
+void acache_purge( t_acache *acache );
+
+// returns cached attributes or NULL
+fattr3 *acache_get( t_acache *acache, nfs_fh3 *fh );
+
+// remember attributes from reply, if server sent them
+void acache_update( t_acache *acache, nfs_fh3 *fh, post_op_attr *attr );
+
+// object was modified, take attributes after operation
+// or drop entry if server didn't sent them
+void acache_wcc( t_acache *acache, nfs_fh3 *fh, wcc_data *wcc );
+
+void acache_forget( t_acache *acache, nfs_fh3 *fh );
+
+#endif // __NFSCACHE_H__
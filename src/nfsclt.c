@@ -75,42 +75,17 @@ const char *nfs3_error(enum nfsstat3 stat) {
 return NULL;
 }
 
-void nfs_fh3free( nfs_fh3 *fh ) {
+// copy handle from decoded reply, decoders don't accept longer ones
+void nfs3fhset( t_nfs3fh *dest, nfs_fh3 *src ) {
 
-  if ( fh->data.data_val )
-    free(fh->data.data_val);
-
-  fh->data.data_val = NULL;
-  fh->data.data_len = 0;
-}
-
-int nfs_fh3alloc( nfs_fh3 *fh, unsigned int data_len ) {
-
-  nfs_fh3free(fh);
-
-  fh->data.data_len = data_len;
-  fh->data.data_val = calloc( data_len, sizeof(char));
-
-  if ( fh->data.data_val )
-    return 0;
-
-  fh->data.data_len = 0;
-
-return -1;
-}
-
-void *fhandle3_to_nfs_fh3(nfs_fh3 *dest, const fhandle3 *src) {
-
-  nfs_fh3alloc(dest, src->fhandle3_len);
-
-return memcpy(dest->data.data_val, src->fhandle3_val, src->fhandle3_len);
+  dest->len = src->data.data_len > NFS3_FHSIZE ? NFS3_FHSIZE : src->data.data_len;
+  memcpy(dest->data, src->data.data_val, dest->len);
 }
 
-void *nfs_fh3copy( nfs_fh3 *dest, nfs_fh3 *src ) {
+void nfs3fhsetmnt( t_nfs3fh *dest, fhandle3 *src ) {
 
-  nfs_fh3alloc(dest, src->data.data_len);
-
-return memcpy(dest->data.data_val, src->data.data_val, src->data.data_len);
+  dest->len = src->fhandle3_len > NFS3_FHSIZE ? NFS3_FHSIZE : src->fhandle3_len;
+  memcpy(dest->data, src->fhandle3_val, dest->len);
 }
 
 void stat_to_sattr3( sattr3 *sattr, struct stat *fstat) {
@@ -148,7 +123,7 @@ void stat_to_sattr3( sattr3 *sattr, struct stat *fstat) {
 
   if ( fstat->st_atim.tv_sec ) {
     sattr->atime = (set_atime) {
-      .set_it = TRUE,
+      .set_it = SET_TO_CLIENT_TIME,
       .set_atime_u.atime.seconds = fstat->st_atim.tv_sec,
       .set_atime_u.atime.nseconds = fstat->st_atim.tv_nsec
     };
@@ -158,7 +133,7 @@ void stat_to_sattr3( sattr3 *sattr, struct stat *fstat) {
 
   if ( fstat->st_mtim.tv_sec ) {
     sattr->mtime = (set_mtime) {
-      .set_it = TRUE,
+      .set_it = SET_TO_CLIENT_TIME,
       .set_mtime_u.mtime.seconds = fstat->st_mtim.tv_sec,
       .set_mtime_u.mtime.nseconds = fstat->st_mtim.tv_nsec
     };
@@ -198,12 +173,15 @@ return 0;
 void nfsdisconnect( t_nfsconnection *nfsconn ) {
 
   if ( nfsconn->client ) {
-    auth_destroy(nfsconn->client->cl_auth);
+    if ( nfsconn->client->cl_auth )
+      auth_destroy(nfsconn->client->cl_auth);
     clnt_destroy(nfsconn->client);
 
     nfsconn->client = NULL;
   }
 
+  rpcmux_free(&nfsconn->mux);
+
   if ( nfsconn->socket > 0 ) {
     sockclose(nfsconn->socket);
   }
@@ -211,41 +189,23 @@ void nfsdisconnect( t_nfsconnection *nfsconn ) {
 
 }
 
-int nfsconnect( t_nfsclt *nfsclt, unsigned long prognum ) {
-
-  int srcport, dstport;
-  struct sockaddr_in srvaddr;
-  struct timeval timeout = { 60, 0 };
-  unsigned long versnum;
-
-  t_nfsconnection *nfsconn;
+// disconnect from nfs daemon, all connections
+void nfsdisconnectnfs( t_nfsclt *nfsclt ) {
 
-  switch ( nfsclt->version ) {
-    case 30:  // NFSv3
+  int i;
 
-      switch ( prognum ) {
-        case MOUNT_PROGRAM:
-          versnum = MOUNT_V3;
-          nfsconn = &nfsclt->mount;
-        break;
-        case NFS_PROGRAM:
-          versnum = NFS_V3;
-          nfsconn = &nfsclt->nfs;
-        break;
-        default:
-          fprintf(stderr,"Not supported program\n");
-          return -1;
-      }
+  rpcgroup_free(&nfsclt->nfsgroup);
 
-    break;
+  nfsdisconnect(&nfsclt->nfs);
+  for ( i = 0; i < NFS_NCONNECT_MAX - 1 ; i++ )
+    nfsdisconnect(&nfsclt->nfsx[i]);
+}
 
-    default:
-      fprintf(stderr,"Not supported NFS version\n");
-      return -1;
-  }
+static int nfsconnection_open( t_nfsclt *nfsclt, t_nfsconnection *nfsconn,
+    unsigned long prognum, unsigned long versnum ) {
 
-  if ( sockisconnected(nfsconn->socket) )
-    return 0;
+  int srcport, dstport;
+  struct sockaddr_in srvaddr;
 
   // clean up in case that connection was interrupted
   nfsdisconnect(nfsconn);
@@ -256,7 +216,11 @@ int nfsconnect( t_nfsclt *nfsclt, unsigned long prognum ) {
   if ( sockaddrsetup(&srvaddr, sizeof(srvaddr), nfsclt->hostname, 0) == -1 )
     return -1;
 
-  dstport = pmap_getport(&srvaddr, prognum, versnum, IPPROTO_TCP);
+  dstport = prognum == MOUNT_PROGRAM ? nfsclt->mountport : nfsclt->nfsport;
+
+  if ( dstport == 0 )
+    dstport = pmap_getport(&srvaddr, prognum, versnum, IPPROTO_TCP);
+
   if ( dstport == 0 ) {
     perror("\npmap_getport()");
     return -1;
@@ -286,19 +250,23 @@ int nfsconnect( t_nfsclt *nfsclt, unsigned long prognum ) {
 
   printf("."); fflush(stdout);
 
-  // Creating RPC client
-  nfsconn->client = clnttcp_create(&srvaddr, prognum, versnum,
-      &nfsconn->socket, 0, 0);
-
-  if ( nfsconn->client == NULL ) {
-    clnt_pcreateerror("\nclnttcp_create()");
+  // Creating RPC transport, rpcgen stubs use it through it's client
+  if ( rpcmux_init(&nfsconn->mux, nfsconn->socket, prognum, versnum) == -1 ) {
+    fprintf(stderr,"\nrpcmux_init() failed\n");
     sockclose(nfsconn->socket);
     nfsconn->socket = -1;
     return -1;
   }
 
-  clnt_control(nfsconn->client, CLSET_TIMEOUT, (char *)&timeout);
-  clnt_control(nfsconn->client, CLSET_FD_CLOSE, (char *)NULL);
+  nfsconn->client = rpcmux_client(&nfsconn->mux);
+  nfsconn->mux.stats = prognum == MOUNT_PROGRAM ? &nfsclt->mountstats : &nfsclt->nfsstats;
+
+  if ( nfsconn->mux.stats->since.tv_sec == 0 && nfsconn->mux.stats->since.tv_nsec == 0 )
+    rpcstats_reset(nfsconn->mux.stats);
+
+  // all NFS results except NULL start with nfsstat3, of MOUNT only MNT
+  nfsconn->mux.stats->statusprocs = prognum == MOUNT_PROGRAM
+    ? 1U << MOUNT3_MNT : ~1U;
 
   if ( nfsauthenticator(nfsclt, nfsconn) == -1 )
     return -1;
@@ -306,10 +274,191 @@ int nfsconnect( t_nfsclt *nfsclt, unsigned long prognum ) {
   printf(" connected (%s:%d --> %s:%d)\n",
     sockname(nfsconn->socket), sockport(nfsconn->socket),
     sockpeername(nfsconn->socket), sockpeerport(nfsconn->socket));
-  
+
+return 0;
+}
+
+// never opened connection has socket 0, which could be connected stdin
+static int nfsconnection_alive( t_nfsconnection *nfsconn ) {
+return nfsconn->client
+  && sockisconnected(nfsconn->socket) && rpcmux_alive(&nfsconn->mux);
+}
+
+// Open additional connections to nfs daemon and put all of them into
+// group used by pipelined transfers. Failing additional connection
+// isn't fatal, we just have less of them.
+static void nfsconnectx( t_nfsclt *nfsclt, unsigned long versnum ) {
+
+  int i, changed = 0;
+
+  for ( i = 0; i < NFS_NCONNECT_MAX - 1 ; i++ ) {
+
+    if ( i >= nfsclt->nconnect - 1 ) {
+      if ( nfsclt->nfsx[i].client ) {
+        nfsdisconnect(&nfsclt->nfsx[i]);
+        changed = 1;
+      }
+      continue;
+    }
+
+    if ( nfsconnection_alive(&nfsclt->nfsx[i]) ) continue;
+
+    changed = 1;
+
+    if ( nfsconnection_open(nfsclt, &nfsclt->nfsx[i], NFS_PROGRAM, versnum) == -1 ) {
+      fprintf(stderr, "\nadditional connection %d failed\n", i + 1);
+      nfsdisconnect(&nfsclt->nfsx[i]);
+    }
+  }
+
+  if ( !changed && nfsclt->nfsgroup.nmux > 0
+      && nfsclt->nfsgroup.mux[0] == &nfsclt->nfs.mux )
+    return;
+
+  rpcgroup_free(&nfsclt->nfsgroup);
+  rpcgroup_init(&nfsclt->nfsgroup);
+
+  rpcgroup_add(&nfsclt->nfsgroup, &nfsclt->nfs.mux);
+
+  for ( i = 0; i < nfsclt->nconnect - 1 ; i++ ) {
+    if ( nfsconnection_alive(&nfsclt->nfsx[i]) )
+      rpcgroup_add(&nfsclt->nfsgroup, &nfsclt->nfsx[i].mux);
+  }
+}
+
+int nfsconnect( t_nfsclt *nfsclt, unsigned long prognum ) {
+
+  unsigned long versnum;
+
+  t_nfsconnection *nfsconn;
+
+  switch ( nfsclt->version ) {
+    case 30:  // NFSv3
+
+      switch ( prognum ) {
+        case MOUNT_PROGRAM:
+          versnum = MOUNT_V3;
+          nfsconn = &nfsclt->mount;
+        break;
+        case NFS_PROGRAM:
+          versnum = NFS_V3;
+          nfsconn = &nfsclt->nfs;
+        break;
+        default:
+          fprintf(stderr,"Not supported program\n");
+          return -1;
+      }
+
+    break;
+
+    default:
+      fprintf(stderr,"Not supported NFS version\n");
+      return -1;
+  }
+
+  if ( !nfsconnection_alive(nfsconn) ) {
+
+    if ( prognum == NFS_PROGRAM ) rpcgroup_free(&nfsclt->nfsgroup);
+
+    if ( nfsconnection_open(nfsclt, nfsconn, prognum, versnum) == -1 )
+      return -1;
+  }
+
+  if ( prognum == NFS_PROGRAM ) {
+    nfsconnectx(nfsclt, versnum);
+    nfsfsinfo(nfsclt);
+  }
+
+return 0;
+}
+
+// pick server preferred size, but don't exceed it's maximum
+static u_int nfs3fsinfosize( u_int pref, u_int max, u_int def ) {
+
+  if ( pref == 0 ) pref = def;
+  if ( max && pref > max ) pref = max;
+
+return pref;
+}
+
+int nfs3fsinfo( t_nfsclt *nfsclt ) {
+
+  FSINFO3args args;
+  FSINFO3res *res;
+  FSINFO3resok *fsres;
+  t_nfs3fh fsroot;
+
+  memset(&args, 0, sizeof(args));
+
+  if ( nfsclt->mountres.nfs3 != NULL ) {
+    nfs3fhsetmnt(&fsroot,
+      &nfsclt->mountres.nfs3->mountres3_u.mountinfo.fhandle);
+  } else {
+    fsroot = nfsclt->currentdir.nfs3;
+  }
+
+  args.fsroot = *NFS3FH(&fsroot);
+
+  res = nfsproc3_fsinfo_3(&args, nfsclt->nfs.client);
+
+  if ( res == NULL ) {
+    clnt_perror(nfsclt->nfs.client, "nfsproc3_fsinfo_3()");
+    return -1;
+  }
+
+  if (res->status != NFS3_OK) {
+    fprintf(stderr, "File system info: (%d) %s\n",
+        res->status, nfs3_error(res->status));
+    return -1;
+  }
+
+  fsres = &res->FSINFO3res_u.resok;
+
+  nfsclt->fsinfo.rtmax = fsres->rtmax;
+  nfsclt->fsinfo.wtmax = fsres->wtmax;
+  nfsclt->fsinfo.rtpref = nfs3fsinfosize(fsres->rtpref, fsres->rtmax, NFS_RTPREF);
+  nfsclt->fsinfo.wtpref = nfs3fsinfosize(fsres->wtpref, fsres->wtmax, NFS_WTPREF);
+  nfsclt->fsinfo.dtpref = nfs3fsinfosize(fsres->dtpref, 0, NFS_DTPREF);
+
 return 0;
 }
 
+// Ask server for preferred transfer sizes. It's done once per mounted
+// file system, defaults are used if server can't tell us.
+int nfsfsinfo( t_nfsclt *nfsclt ) {
+
+  int ret = -1;
+
+  if ( nfsclt->fsinfo.valid ) return 0;
+
+  nfsclt->fsinfo.rtmax = nfsclt->fsinfo.rtpref = NFS_RTPREF;
+  nfsclt->fsinfo.wtmax = nfsclt->fsinfo.wtpref = NFS_WTPREF;
+  nfsclt->fsinfo.dtpref = NFS_DTPREF;
+
+  if ( nfsclt->nfs.client == NULL ) return -1;
+
+  switch ( nfsclt->version ) {
+    case 30:
+
+      // nothing to ask about yet
+      if ( nfsclt->currentdir.nfs3.len == 0 )
+        return -1;
+
+      ret = nfs3fsinfo( nfsclt );
+    break;
+  }
+
+  // don't ask again for the same file system
+  nfsclt->fsinfo.valid = 1;
+
+  if ( ret == 0 ) {
+    printf("Transfer sizes: read %u, write %u, readdir %u\n",
+      nfsclt->fsinfo.rtpref, nfsclt->fsinfo.wtpref, nfsclt->fsinfo.dtpref);
+  }
+
+return ret;
+}
+
 exports nfsexports( t_nfsclt *nfsclt ) {
 
   if ( nfsclt->mount.client == NULL )
@@ -330,14 +479,14 @@ void nfshandleprint( t_nfsfh *nfsfh, unsigned long version ) {
   switch ( version ) {
     case 30:
 
-      if ( nfsfh->nfs3.data.data_len == 0 ) {
+      if ( nfsfh->nfs3.len == 0 ) {
         printf("Handle not set\n");
       }
 
-      printf("nfs3 fh: (%d) ", nfsfh->nfs3.data.data_len);
+      printf("nfs3 fh: (%d) ", nfsfh->nfs3.len);
 
-      for ( i = 0; i < nfsfh->nfs3.data.data_len ; i++ )
-        printf("%02x", nfsfh->nfs3.data.data_val[i] & 0xff);
+      for ( i = 0; i < nfsfh->nfs3.len ; i++ )
+        printf("%02x", nfsfh->nfs3.data[i] & 0xff);
       printf("\n");
 
     break;
@@ -362,17 +511,21 @@ int nfshandleset_str( t_nfsfh *nfsfh, unsigned long version, char *handle ) {
         return -1;
       }
 
-      nfs_fh3alloc( &tmpfh.nfs3, hlen >> 1 );
+      if ( (hlen >> 1) > NFS3_FHSIZE ) {
+        fprintf(stderr,"Handle is longer than %d bytes\n", NFS3_FHSIZE);
+        return -1;
+      }
+
+      tmpfh.nfs3.len = hlen >> 1;
 
       for ( i = 0; i < hlen ; i += 2 ) {
         sscanf(handle+i, "%02x", &val);
-        tmpfh.nfs3.data.data_val[i >> 1] = val & 0xff;
+        tmpfh.nfs3.data[i >> 1] = val & 0xff;
       }
 
       //nfshandleprint(&tmpfh, version);
 
-      nfs_fh3copy(&nfsfh->nfs3, &tmpfh.nfs3);
-      nfs_fh3free(&tmpfh.nfs3);
+      nfsfh->nfs3 = tmpfh.nfs3;
     break;
   }
 
@@ -402,7 +555,11 @@ void nfsumount( t_nfsclt *nfsclt ) {
     }
 
     nfsdisconnect( &nfsclt->mount );
-    nfsdisconnect( &nfsclt->nfs );
+    nfsdisconnectnfs( nfsclt );
+
+    nfsclt->fsinfo.valid = 0;
+    dnlc_purge(&nfsclt->dnlc);
+    acache_purge(&nfsclt->acache);
 
     if ( nfsclt->mountpath ) {
       free( nfsclt->mountpath );
@@ -445,12 +602,19 @@ int nfsmount( t_nfsclt *nfsclt, char *path ) {
       if ( nfsclt->mountpath ) free(nfsclt->mountpath);
       nfsclt->mountpath = strdup(path);
 
-      fhandle3_to_nfs_fh3(&nfsclt->currentdir.nfs3,
+      nfs3fhsetmnt(&nfsclt->currentdir.nfs3,
           &nfsclt->mountres.nfs3->mountres3_u.mountinfo.fhandle);
 
       nfshandleprint(&nfsclt->currentdir, nfsclt->version);
 
-    break;
+      // new file system, transfer sizes could be different
+      nfsclt->fsinfo.valid = 0;
+      nfsfsinfo(nfsclt);
+
+      dnlc_purge(&nfsclt->dnlc);
+      acache_purge(&nfsclt->acache);
+
+    return 0;
   }
 
 return -1;
@@ -463,11 +627,10 @@ LOOKUP3res* nfs3filelookup( CLIENT *client, nfs_fh3 *directoryfh, char *filename
 
   memset(&args, 0, sizeof(args));
 
-  nfs_fh3copy(&args.what.dir, directoryfh);
+  args.what.dir = *directoryfh;   // only read by encoder
   args.what.name = filename;
 
-  res = nfsproc3_lookup_3(&args, client);
-  nfs_fh3free( &args.what.dir );
+  res = NFS3PROC(lookup)(&args, client);
 
   if ( res == NULL ) {
     clnt_perror(client, "nfsproc3_lookup_3()");
@@ -483,6 +646,85 @@ LOOKUP3res* nfs3filelookup( CLIENT *client, nfs_fh3 *directoryfh, char *filename
 return res;
 }
 
+// remember attributes returned with reply
+void nfs3cacheattr( t_nfsclt *nfsclt, nfs_fh3 *fh, post_op_attr *attr ) {
+
+  if ( !attr->attributes_follow ) return;
+
+  acache_update(&nfsclt->acache, fh, attr);
+
+  if ( attr->post_op_attr_u.attributes.type == NF3DIR )
+    dnlc_dirattr(&nfsclt->dnlc, fh, attr);
+}
+
+// object was modified by us
+void nfs3cachewcc( t_nfsclt *nfsclt, nfs_fh3 *fh, wcc_data *wcc ) {
+
+  acache_wcc(&nfsclt->acache, fh, wcc);
+
+  if ( wcc->after.attributes_follow
+      && wcc->after.post_op_attr_u.attributes.type == NF3DIR )
+    dnlc_dirwcc(&nfsclt->dnlc, fh, wcc);
+}
+
+// new object was created in directory
+void nfs3cachenew( t_nfsclt *nfsclt, nfs_fh3 *dirfh, char *name,
+    post_op_fh3 *obj, post_op_attr *objattr, wcc_data *dirwcc ) {
+
+  nfs3cachewcc( nfsclt, dirfh, dirwcc );
+
+  if ( !obj->handle_follows ) return;
+
+  nfs3cacheattr( nfsclt, &obj->post_op_fh3_u.handle, objattr );
+  dnlc_enter(&nfsclt->dnlc, dirfh, name, &obj->post_op_fh3_u.handle, &dirwcc->after);
+}
+
+// lookup through name and attribute caches,
+// on miss ask server and remember answer
+LOOKUP3res* nfs3cachedlookup( t_nfsclt *nfsclt, nfs_fh3 *directoryfh, char *filename) {
+
+  static LOOKUP3res cres;
+  static char cfh[NFS3_FHSIZE];
+  LOOKUP3res *res;
+  t_dnlcentry *e;
+  fattr3 *attr = NULL;
+
+  e = dnlc_lookup(&nfsclt->dnlc, directoryfh, filename);
+
+  if ( e ) {
+    memset(&cres, 0, sizeof(cres));
+    memcpy(cfh, e->fh, e->fhlen);
+
+    cres.status = NFS3_OK;
+    cres.LOOKUP3res_u.resok.object.data.data_val = cfh;
+    cres.LOOKUP3res_u.resok.object.data.data_len = e->fhlen;
+
+    attr = acache_get(&nfsclt->acache, &cres.LOOKUP3res_u.resok.object);
+  }
+
+  if ( attr ) {
+    cres.LOOKUP3res_u.resok.obj_attributes.attributes_follow = 1;
+    cres.LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes = *attr;
+
+    return &cres;
+  }
+
+  res = nfs3filelookup( nfsclt->nfs.client, directoryfh, filename);
+  if ( res == NULL ) return NULL;
+
+  nfs3cacheattr( nfsclt, directoryfh, &res->LOOKUP3res_u.resok.dir_attributes);
+  nfs3cacheattr( nfsclt, &res->LOOKUP3res_u.resok.object,
+      &res->LOOKUP3res_u.resok.obj_attributes);
+
+  // without attributes we can't tell directories from links
+  if ( res->LOOKUP3res_u.resok.obj_attributes.attributes_follow )
+    dnlc_enter(&nfsclt->dnlc, directoryfh, filename,
+        &res->LOOKUP3res_u.resok.object,
+        &res->LOOKUP3res_u.resok.dir_attributes);
+
+return res;
+}
+
 // lookup for link target
 READLINK3res* nfs3linklookup( CLIENT *client, nfs_fh3 *filefh) {
  
@@ -491,10 +733,9 @@ READLINK3res* nfs3linklookup( CLIENT *client, nfs_fh3 *filefh) {
 
   memset(&largs, 0, sizeof(largs));
 
-  nfs_fh3copy(&largs.symlink, filefh);
+  largs.symlink = *filefh;
 
   lres = nfsproc3_readlink_3(&largs, client);
-  nfs_fh3free( &largs.symlink );
 
   if ( lres == NULL ) {
     clnt_perror(client, "nfsproc3_readlink_3()");
@@ -515,7 +756,7 @@ LOOKUP3res* nfs3pathlookup( t_nfsclt *nfsclt, char *path, int follow ) {
 
   LOOKUP3res *res = NULL;
   READLINK3res* lres;
-  nfs_fh3 fh;
+  t_nfs3fh fh;
   char *dirname, *p, *path_malloc;
   int d = 0, maxdepth = MAX_PATH_DEPTH;
 
@@ -523,13 +764,13 @@ LOOKUP3res* nfs3pathlookup( t_nfsclt *nfsclt, char *path, int follow ) {
 
   if ( path == NULL ) return NULL;
 
-  if ( nfsclt->currentdir.nfs3.data.data_val == NULL ) {
+  if ( nfsclt->currentdir.nfs3.len == 0 ) {
     fprintf(stderr, "Please set file handle\n");
     return NULL;
   }
 
   // start path resolving relatively to current directory
-  nfs_fh3copy(&fh, &nfsclt->currentdir.nfs3);
+  fh = nfsclt->currentdir.nfs3;
 
   path_malloc = strdup(path); // holds pointer to allocated path buffer
 
@@ -540,7 +781,7 @@ LOOKUP3res* nfs3pathlookup( t_nfsclt *nfsclt, char *path, int follow ) {
 
       while ( *p == '/' ) p++;
 
-      fhandle3_to_nfs_fh3(&fh, &nfsclt->mountres.nfs3->mountres3_u.mountinfo.fhandle);
+      nfs3fhsetmnt(&fh, &nfsclt->mountres.nfs3->mountres3_u.mountinfo.fhandle);
 
       // path is equal to '/', set dirname to '.' so we can
       // lookup root dir
@@ -556,7 +797,7 @@ LOOKUP3res* nfs3pathlookup( t_nfsclt *nfsclt, char *path, int follow ) {
     // not final object
     while ( *p == '/' ) *p++ = '\0';
 
-    res = nfs3filelookup( nfsclt->nfs.client, &fh, dirname);
+    res = nfs3cachedlookup( nfsclt, NFS3FH(&fh), dirname);
     if ( res == NULL ) break;
 
     d++;  // increase depth counter
@@ -566,7 +807,7 @@ LOOKUP3res* nfs3pathlookup( t_nfsclt *nfsclt, char *path, int follow ) {
 
       // don't follow links
       if ( !follow ) {
-        nfs_fh3copy(&fh, &res->LOOKUP3res_u.resok.object);
+        nfs3fhset(&fh, &res->LOOKUP3res_u.resok.object);
         break;
       }
 
@@ -578,7 +819,7 @@ LOOKUP3res* nfs3pathlookup( t_nfsclt *nfsclt, char *path, int follow ) {
 
       // insert link into our path
       char *tmp = calloc(
-          strlen(p) + strlen(lres->READLINK3res_u.resok.data),
+          strlen(p) + strlen(lres->READLINK3res_u.resok.data) + 2,
           sizeof(char));
 
       strcat(tmp, lres->READLINK3res_u.resok.data);
@@ -603,112 +844,315 @@ LOOKUP3res* nfs3pathlookup( t_nfsclt *nfsclt, char *path, int follow ) {
       break;
     }
 
-    nfs_fh3copy(&fh, &res->LOOKUP3res_u.resok.object);
+    nfs3fhset(&fh, &res->LOOKUP3res_u.resok.object);
   }
 
-  nfs_fh3free(&fh);
   free(path_malloc);
 
 return res;
 }
 
-// Returns 1 if there are more entries to read
-int nfs3dirread( t_nfsclt *nfsclt, tp_nfsdir *nfsdir, char *path ) {
+// get handle of directory path, current directory if path is NULL
+int nfs3dirfh( t_nfsclt *nfsclt, char *path, t_nfs3fh *dirfh ) {
 
-  READDIR3args args;
-  READDIR3res *res;
-  entry3 *ep = NULL;
-
-  memset(&args, 0, sizeof(args));
+  LOOKUP3res *dres;
 
-  // get directory FH
   if ( path == NULL ) {
+    *dirfh = nfsclt->currentdir.nfs3;
+    return 0;
+  }
 
-    // current directory
-    nfs_fh3copy(&args.dir, &nfsclt->currentdir.nfs3);
-  } else {
+  dres = nfs3pathlookup( nfsclt, path, 1 );
+  if ( dres == NULL ) return -1;
 
-    // resolve path
-    LOOKUP3res *dres = nfs3pathlookup( nfsclt, path, 1 );
-    if ( dres == NULL ) return -1;
+  if ( dres->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes.type
+      != NF3DIR ) {
+
+    fprintf(stderr, "%s: is not a directory\n", path);
+    return -1;
+  }
 
-    if ( dres->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes.type
-        != NF3DIR ) {
+  nfs3fhset(dirfh, &dres->LOOKUP3res_u.resok.object);
 
-      fprintf(stderr, "%s: is not a directory\n", path);
-      return -1;
-    }
+return 0;
+}
 
-    nfs_fh3copy(&args.dir, &dres->LOOKUP3res_u.resok.object);
-  }
+static void nfs3dirbatchdone( t_rpcmux *mux, t_rpccall *call );
 
-  // Find last entry and copy it's cookie.
-  // Cookies identify point in directory, where we
-  // finished reading entries in previous call.
-  if ( nfsdir->nfs3 && nfsdir->nfs3->status == NFS3_OK ) {
+// request next batch if there is room for it and position is known
+static int nfs3dirsend( t_nfsdir *nfsdir ) {
 
-    res = nfsdir->nfs3;
+  t_nfsdirbatch *b = &nfsdir->batch[nfsdir->send];
+  READDIR3args args;
+  READDIRPLUS3args pargs;
+  int i, ret;
 
-    for ( ep = res->READDIR3res_u.resok.reply.entries ;
-          ep && ep->nextentry != NULL; ep = ep->nextentry ) ;
-  }
+  if ( nfsdir->eof || nfsdir->err || b->state != NFS_DIRBATCH_FREE )
+    return 0;
+
+  // cookie of previous batch isn't known yet
+  for ( i = 0; i < NFS_DIRBATCHES ; i++ )
+    if ( nfsdir->batch[i].state == NFS_DIRBATCH_SENT ) return 0;
+
+  b->dir = nfsdir;
+  b->ok = 0;
+  b->reply.plus = nfsdir->withattrs;
+  b->call.xres = (xdrproc_t)nfs3xdrdirreply;
+  b->call.res = &b->reply;
+  b->call.donefn = nfs3dirbatchdone;
+  b->call.arg = b;
+
+  if ( nfsdir->withattrs ) {
 
-  if ( ep ) {
-    memcpy( &args.cookie, &ep->cookie, sizeof(args.cookie));
+    memset(&pargs, 0, sizeof(pargs));
+    pargs.dir = *NFS3FH(&nfsdir->fh.nfs3);
+    pargs.cookie = nfsdir->cookie;
+    memcpy(pargs.cookieverf, nfsdir->cookieverf, NFS3_COOKIEVERFSIZE);
+
+    // dircount limits size of names, maxcount size of whole reply
+    pargs.dircount = nfsdir->nfsclt->fsinfo.dtpref;
+    pargs.maxcount = nfsdir->nfsclt->fsinfo.rtpref > nfsdir->nfsclt->fsinfo.dtpref ?
+      nfsdir->nfsclt->fsinfo.rtpref : nfsdir->nfsclt->fsinfo.dtpref;
+
+    ret = rpcgroup_submit(&nfsdir->nfsclt->nfsgroup, &b->call, NFSPROC3_READDIRPLUS,
+        (xdrproc_t)NFS3XDR(READDIRPLUS3args), &pargs);
   } else {
 
-    // We hadn't read that directory before
-    memset(&args.cookie, 0, sizeof(args.cookie));
-    args.count = 8192;
-  }
+    memset(&args, 0, sizeof(args));
+    args.dir = *NFS3FH(&nfsdir->fh.nfs3);
+    args.cookie = nfsdir->cookie;
+    memcpy(args.cookieverf, nfsdir->cookieverf, NFS3_COOKIEVERFSIZE);
+    args.count = nfsdir->nfsclt->fsinfo.dtpref;
 
-  // read directory entries
-  res = nfsproc3_readdir_3(&args, nfsclt->nfs.client);
-  nfs_fh3free( &args.dir );
+    ret = rpcgroup_submit(&nfsdir->nfsclt->nfsgroup, &b->call, NFSPROC3_READDIR,
+        (xdrproc_t)NFS3XDR(READDIR3args), &args);
+  }
 
-  if ( res == NULL ) {
-    clnt_perror(nfsclt->nfs.client, "nfsproc3_readdir_3()");
+  if ( ret == -1 ) {
+    nfsdir->err = 1;
     return -1;
   }
 
-  if (res->status == NFS3_OK) {
-    nfsdir->nfs3 = res;
+  b->state = NFS_DIRBATCH_SENT;
+  nfsdir->send = (nfsdir->send + 1) % NFS_DIRBATCHES;
 
-    if ( res->READDIR3res_u.resok.reply.eof )
-      return 0;
+return 0;
+}
 
-    return 1;
-  }
+static void nfs3dirbatchdone( t_rpcmux *mux, t_rpccall *call ) {
 
-  fprintf(stderr, "Readdir failed: (%d) %s\n", res->status, nfs3_error(res->status));
+  t_nfsdirbatch *b = (t_nfsdirbatch *)call->arg;
+  t_nfsdir *nfsdir = b->dir;
+  t_nfsclt *nfsclt = nfsdir->nfsclt;
+  READDIR3resok *resok = &b->reply.res.nfs3.READDIR3res_u.resok;
+  READDIRPLUS3resok *presok = &b->reply.res.nfs3plus.READDIRPLUS3res_u.resok;
+  entry3 *ep, *last = NULL;
+  entryplus3 *pep, *plast = NULL;
+  nfsstat3 status;
 
-return -1;
-}
+  b->state = NFS_DIRBATCH_READY;
+
+  if ( call->stat != RPC_SUCCESS ) {
+    fprintf(stderr, "Readdir failed: %s\n", clnt_sperrno(call->stat));
+    nfsdir->err = 1;
+    return;
+  }
 
-int nfsdirread( t_nfsclt *nfsclt, tp_nfsdir *nfsdir, char *path ) {
+  status = nfsdir->withattrs ? b->reply.res.nfs3plus.status : b->reply.res.nfs3.status;
 
-  switch ( nfsclt->version ) {
-    case 30:
-      return nfs3dirread( nfsclt, nfsdir, path );
-    break;
+  if ( status != NFS3_OK ) {
+    fprintf(stderr, "%s failed: (%d) %s\n", nfsdir->withattrs ? "Readdirplus" : "Readdir",
+        status, nfs3_error(status));
+    nfsdir->err = 1;
+    return;
   }
 
-return -1;
-}
+  b->ok = 1;
 
-int nfs3fileprint( t_nfsclt *nfsclt, nfs_fh3 *dirfh, char *name ) {
+  // Only pass over the batch. Next one starts after it's last
+  // entry, cookies identify point in directory.
+  if ( nfsdir->withattrs ) {
 
-  LOOKUP3res *res;
-  int mode;
+    nfs3cacheattr( nfsclt, NFS3FH(&nfsdir->fh.nfs3), &presok->dir_attributes);
 
-  res = nfs3filelookup( nfsclt->nfs.client, dirfh, name);
-  if ( res == NULL ) return -1;
+    // we've got handles for free, remember them for path lookups
+    for ( pep = presok->reply.entries; pep ; pep = pep->nextentry ) {
+      if ( pep->name_handle.handle_follows && pep->name_attributes.attributes_follow ) {
+        nfs3cacheattr( nfsclt, &pep->name_handle.post_op_fh3_u.handle,
+            &pep->name_attributes);
+        dnlc_enter(&nfsclt->dnlc, NFS3FH(&nfsdir->fh.nfs3), pep->name,
+            &pep->name_handle.post_op_fh3_u.handle, &presok->dir_attributes);
+      }
+      plast = pep;
+    }
 
-  switch (res->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes.type) {
-  case NF3SOCK:
-    putchar('s');
-  break;
-  case NF3FIFO:
+    memcpy(nfsdir->cookieverf, presok->cookieverf, NFS3_COOKIEVERFSIZE);
+    if ( plast ) nfsdir->cookie = plast->cookie;
+    nfsdir->eof = presok->reply.eof;
+  } else {
+
+    nfs3cacheattr( nfsclt, NFS3FH(&nfsdir->fh.nfs3), &resok->dir_attributes);
+
+    for ( ep = resok->reply.entries; ep ; ep = ep->nextentry ) last = ep;
+
+    memcpy(nfsdir->cookieverf, resok->cookieverf, NFS3_COOKIEVERFSIZE);
+    if ( last ) nfsdir->cookie = last->cookie;
+    nfsdir->eof = resok->reply.eof;
+  }
+
+  // we would ask for the same entries forever
+  if ( !nfsdir->eof && last == NULL && plast == NULL ) {
+    fprintf(stderr, "Readdir failed: server returned no entries\n");
+    nfsdir->err = 1;
+    return;
+  }
+
+  nfs3dirsend(nfsdir);
+}
+
+// Release consumed batch and wait for the next one.
+// Returns NULL after last one or when reading failed.
+static t_nfsdirbatch *nfs3dirbatchnext( t_nfsdir *nfsdir ) {
+
+  t_nfsdirbatch *b = &nfsdir->batch[nfsdir->cur];
+
+  if ( b->state == NFS_DIRBATCH_USED ) {
+    xdr_free(b->call.xres, (char *)&b->reply);
+    b->state = NFS_DIRBATCH_FREE;
+
+    nfsdir->cur = (nfsdir->cur + 1) % NFS_DIRBATCHES;
+    b = &nfsdir->batch[nfsdir->cur];
+
+    nfs3dirsend(nfsdir);
+  }
+
+  // on failure outstanding calls are completed with error
+  while ( b->state == NFS_DIRBATCH_SENT )
+    rpcgroup_run(&nfsdir->nfsclt->nfsgroup);
+
+  if ( b->state != NFS_DIRBATCH_READY ) return NULL;
+
+  b->state = NFS_DIRBATCH_USED;
+
+  if ( !b->ok ) return NULL;
+
+return b;
+}
+
+void nfs3dirclose( t_nfsclt *nfsclt, t_nfsdir *nfsdir ) {
+
+  t_nfsdirbatch *b;
+  int i;
+
+  // prefetched batch can't be dropped before it's reply
+  nfsdir->err = 1;
+
+  for ( i = 0; i < NFS_DIRBATCHES ; i++ ) {
+    b = &nfsdir->batch[i];
+
+    while ( b->state == NFS_DIRBATCH_SENT )
+      rpcgroup_run(&nfsclt->nfsgroup);
+
+    nfs3dirreplyfree(&b->reply);
+    b->state = NFS_DIRBATCH_FREE;
+  }
+
+  nfsdir->next.nfs3 = NULL;
+}
+
+// open directory which handle is known already
+static int nfs3diropenfh( t_nfsclt *nfsclt, t_nfsdir *nfsdir, t_nfs3fh *fh, int withattrs ) {
+
+  memset(nfsdir, 0, sizeof(t_nfsdir));
+  nfsdir->nfsclt = nfsclt;
+  nfsdir->withattrs = withattrs;
+  nfsdir->fh.nfs3 = *fh;
+
+  if ( nfs3dirsend(nfsdir) == -1 ) {
+    nfs3dirclose(nfsclt, nfsdir);
+    return -1;
+  }
+
+return 0;
+}
+
+int nfs3diropen( t_nfsclt *nfsclt, t_nfsdir *nfsdir, char *path, int withattrs ) {
+
+  t_nfs3fh fh;
+
+  // directory handle is resolved only once
+  if ( nfs3dirfh( nfsclt, path, &fh ) == -1 )
+    return -1;
+
+return nfs3diropenfh( nfsclt, nfsdir, &fh, withattrs );
+}
+
+int nfs3dirnext( t_nfsclt *nfsclt, t_nfsdir *nfsdir, tp_nfsdirent *ent ) {
+
+  t_nfsdirbatch *b;
+
+  while ( nfsdir->next.nfs3 == NULL ) {
+
+    if ( (b = nfs3dirbatchnext(nfsdir)) == NULL )
+      return nfsdir->err ? -1 : 0;
+
+    if ( nfsdir->withattrs )
+      nfsdir->next.nfs3plus = b->reply.res.nfs3plus.READDIRPLUS3res_u.resok.reply.entries;
+    else
+      nfsdir->next.nfs3 = b->reply.res.nfs3.READDIR3res_u.resok.reply.entries;
+  }
+
+  *ent = nfsdir->next;
+
+  if ( nfsdir->withattrs )
+    nfsdir->next.nfs3plus = ent->nfs3plus->nextentry;
+  else
+    nfsdir->next.nfs3 = ent->nfs3->nextentry;
+
+return 1;
+}
+
+int nfsdiropen( t_nfsclt *nfsclt, t_nfsdir *nfsdir, char *path, int withattrs ) {
+
+  switch ( nfsclt->version ) {
+    case 30:
+      return nfs3diropen( nfsclt, nfsdir, path, withattrs );
+    break;
+  }
+
+return -1;
+}
+
+int nfsdirnext( t_nfsclt *nfsclt, t_nfsdir *nfsdir, tp_nfsdirent *ent ) {
+
+  switch ( nfsclt->version ) {
+    case 30:
+      return nfs3dirnext( nfsclt, nfsdir, ent );
+    break;
+  }
+
+return -1;
+}
+
+void nfsdirclose( t_nfsclt *nfsclt, t_nfsdir *nfsdir ) {
+
+  switch ( nfsclt->version ) {
+    case 30:
+      nfs3dirclose( nfsclt, nfsdir );
+    break;
+  }
+}
+
+// print attributes in 'ls -l' format, target is printed for links
+void nfs3attrprint( fattr3 *attr, char *name, char *target ) {
+
+  int mode;
+
+  switch (attr->type) {
+  case NF3SOCK:
+    putchar('s');
+  break;
+  case NF3FIFO:
     putchar('p');
   break;
   case NF3REG:
@@ -732,7 +1176,7 @@ int nfs3fileprint( t_nfsclt *nfsclt, nfs_fh3 *dirfh, char *name ) {
   }
 
   // now print file mode
-  mode = res->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes.mode;
+  mode = attr->mode;
 
   // owner
   if (mode & 0400) putchar('r'); else putchar('-');
@@ -762,84 +1206,207 @@ int nfs3fileprint( t_nfsclt *nfsclt, nfs_fh3 *dirfh, char *name ) {
   }
 
   // other details
-  printf("%3d%9d%6d%10ld ",
-    res->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes.nlink,
-    res->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes.uid,
-    res->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes.gid,
-    res->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes.size);
+  printf("%3d%9d%6d%10ld ", attr->nlink, attr->uid, attr->gid, attr->size);
 
-  time_t t_mtime = res->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes.mtime.seconds;
+  time_t t_mtime = attr->mtime.seconds;
   char *smtime = ctime(&t_mtime);
   if ( smtime ) {
     smtime[ strlen(smtime) -1 ] = '\0';   // clear \n at the end
     printf(" %s", smtime);
   }
 
-  if (res->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes.type != NF3LNK) {
+  if ( attr->type == NF3LNK && target ) {
+    printf(" %s -> %s\n", name, target);
+  } else {
     printf(" %s\n", name);
+  }
+}
+
+int nfs3fileprint( t_nfsclt *nfsclt, nfs_fh3 *dirfh, char *name ) {
+
+  LOOKUP3res *res;
+  READLINK3res* lres;
+  fattr3 *attr;
+
+  res = nfs3cachedlookup( nfsclt, dirfh, name);
+  if ( res == NULL ) return -1;
+
+  attr = &res->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes;
+
+  if ( attr->type != NF3LNK ) {
+    nfs3attrprint( attr, name, NULL );
     return 0;
   }
 
   // lookup for link target
-  READLINK3res* lres = nfs3linklookup( nfsclt->nfs.client,
-      &res->LOOKUP3res_u.resok.object );
-
+  lres = nfs3linklookup( nfsclt->nfs.client, &res->LOOKUP3res_u.resok.object );
   if ( lres == NULL ) return -1;
 
-  printf(" %s -> %s\n", name, lres->READLINK3res_u.resok.data);
+  nfs3attrprint( attr, name, lres->READLINK3res_u.resok.data );
 
 return 0;
 }
 
-int nfs3dirprint( t_nfsclt *nfsclt, READDIR3res *res, int printattrs, char *path ) {
+// READLINK calls of nfs3linkreadall()
+typedef struct {
+
+  t_rpccall *calls;
+  READLINK3res *res;
+  char **targets;
+  int inflight;
+
+} t_nfs3linkread;
+
+static void nfs3linkreaddone( t_rpcmux *mux, t_rpccall *call ) {
+
+  t_nfs3linkread *lr = (t_nfs3linkread *)call->arg;
+  READLINK3res *lres;
+  int i = call - lr->calls;
+
+  lres = &lr->res[i];
+  lr->inflight--;
+
+  if ( call->stat != RPC_SUCCESS ) {
+    fprintf(stderr, "nfs3linkreadall(): %s\n", clnt_sperrno(call->stat));
+  } else if ( lres->status != NFS3_OK ) {
+    fprintf(stderr, "Link lookup failed: (%d) %s\n",
+        lres->status, nfs3_error(lres->status));
+  } else {
+    // take over decoded string
+    lr->targets[i] = lres->READLINK3res_u.resok.data;
+    lres->READLINK3res_u.resok.data = NULL;
+  }
+
+  xdr_free((xdrproc_t)xdr_READLINK3res, (char *)lres);
+}
+
+// Read targets of all symbolic links in directory batch, keeping
+// window READLINK requests in flight. Targets are stored in order
+// of entries and need to be freed by caller.
+int nfs3linkreadall( t_nfsclt *nfsclt, entryplus3 *entries, int nentries, char **targets ) {
+
+  READLINK3args largs;
+  t_nfs3linkread lr;
+  entryplus3 *ep;
+  int window, idx = 0;
+
+  window = nfsclt->window > 0 ? nfsclt->window : 1;
 
-  nfs_fh3 dirfh;
-  entry3 *ep = NULL;
+  memset(&lr, 0, sizeof(lr));
+  lr.targets = targets;
+  lr.calls = calloc(nentries, sizeof(t_rpccall));
+  lr.res = calloc(nentries, sizeof(READLINK3res));
 
-  if ( !res || res->status != NFS3_OK )
+  if ( lr.calls == NULL || lr.res == NULL ) {
+    perror("calloc()");
+    if ( lr.calls ) free(lr.calls);
+    if ( lr.res ) free(lr.res);
     return -1;
+  }
 
-  if ( printattrs ) {
-    memset(&dirfh, 0, sizeof(dirfh));
+  ep = entries;
 
-    if ( path == NULL ) {
-      nfs_fh3copy(&dirfh, &nfsclt->currentdir.nfs3);
-    } else {
+  while ( 1 ) {
 
-      LOOKUP3res *dres = nfs3pathlookup( nfsclt, path, 1 );
-      if ( dres == NULL ) return -1;
+    // send requests for next links
+    for ( ; ep && lr.inflight < window ; ep = ep->nextentry, idx++ ) {
 
-      if ( dres->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes.type
-          != NF3DIR ) {
+      if ( !ep->name_attributes.attributes_follow
+          || ep->name_attributes.post_op_attr_u.attributes.type != NF3LNK
+          || !ep->name_handle.handle_follows )
+        continue;
 
-        fprintf(stderr, "%s: is not a directory\n", path);
-        return -1;
-      }
+      memset(&largs, 0, sizeof(largs));
+      largs.symlink = ep->name_handle.post_op_fh3_u.handle;
+
+      lr.calls[idx].xres = (xdrproc_t)xdr_READLINK3res;
+      lr.calls[idx].res = &lr.res[idx];
+      lr.calls[idx].donefn = nfs3linkreaddone;
+      lr.calls[idx].arg = &lr;
 
-      nfs_fh3copy(&dirfh, &dres->LOOKUP3res_u.resok.object);
+      if ( rpcgroup_submit(&nfsclt->nfsgroup, &lr.calls[idx], NFSPROC3_READLINK,
+          (xdrproc_t)xdr_READLINK3args, &largs) == 0 )
+        lr.inflight++;
     }
+
+    if ( lr.inflight == 0 ) break;
+
+    // on failure outstanding calls are completed with error
+    rpcgroup_run(&nfsclt->nfsgroup);
   }
 
-  for ( ep = res->READDIR3res_u.resok.reply.entries ;
-        ep != NULL ; ep = ep->nextentry ) {
+  free(lr.calls);
+  free(lr.res);
 
-    if ( printattrs ) {
-      nfs3fileprint( nfsclt, &dirfh, ep->name );
-    } else {
-      printf("%s\n", ep->name);
+return 0;
+}
+
+// print batches, READLINK calls for link targets are sent per batch
+int nfs3dirprintplus( t_nfsclt *nfsclt, t_nfsdir *nfsdir ) {
+
+  t_nfsdirbatch *b;
+  entryplus3 *entries, *ep;
+  char **targets;
+  int nentries, i;
+
+  while ( 1 ) {
+
+    // rest of current batch first
+    if ( (entries = nfsdir->next.nfs3plus) == NULL ) {
+      if ( (b = nfs3dirbatchnext(nfsdir)) == NULL ) break;
+      entries = b->reply.res.nfs3plus.READDIRPLUS3res_u.resok.reply.entries;
+    }
+
+    nfsdir->next.nfs3plus = NULL;
+
+    for ( nentries = 0, ep = entries; ep != NULL ; ep = ep->nextentry ) nentries++;
+
+    if ( (targets = calloc(nentries + 1, sizeof(char *))) == NULL ) {
+      perror("calloc()");
+      return -1;
+    }
+
+    nfs3linkreadall( nfsclt, entries, nentries, targets );
+
+    for ( i = 0, ep = entries; ep != NULL ; ep = ep->nextentry, i++ ) {
+
+      if ( ep->name_attributes.attributes_follow ) {
+        nfs3attrprint( &ep->name_attributes.post_op_attr_u.attributes,
+          ep->name, targets[i] );
+        continue;
+      }
+
+      // server skipped attributes for this entry, look them up
+      nfs3fileprint( nfsclt, NFS3FH(&nfsdir->fh.nfs3), ep->name );
     }
+
+    for ( i = 0; i < nentries ; i++ )
+      if ( targets[i] ) free(targets[i]);
+    free(targets);
   }
 
-  if ( printattrs ) nfs_fh3free(&dirfh);
+return nfsdir->err ? -1 : 0;
+}
+
+int nfs3dirprint( t_nfsclt *nfsclt, t_nfsdir *nfsdir ) {
 
-return 0;
+  tp_nfsdirent ent;
+  int ret;
+
+  while ( (ret = nfs3dirnext( nfsclt, nfsdir, &ent )) > 0 )
+    printf("%s\n", ent.nfs3->name);
+
+return ret;
 }
 
-int nfsdirprint( t_nfsclt *nfsclt, tp_nfsdir *nfsdir, int printattrs, char *path ) {
+int nfsdirprint( t_nfsclt *nfsclt, t_nfsdir *nfsdir ) {
 
   switch ( nfsclt->version ) {
     case 30:
-      return nfs3dirprint( nfsclt, nfsdir->nfs3, printattrs, path );
+      if ( nfsdir->withattrs )
+        return nfs3dirprintplus( nfsclt, nfsdir );
+
+      return nfs3dirprint( nfsclt, nfsdir );
     break;
   }
 
@@ -853,7 +1420,7 @@ int nfs3cd( t_nfsclt *nfsclt, char *path ) {
   // cd to root
   if ( path == NULL && nfsclt->mountres.nfs3 ) {
 
-    fhandle3_to_nfs_fh3(&nfsclt->currentdir.nfs3,
+    nfs3fhsetmnt(&nfsclt->currentdir.nfs3,
       &nfsclt->mountres.nfs3->mountres3_u.mountinfo.fhandle);
 
     return 0;
@@ -862,7 +1429,7 @@ int nfs3cd( t_nfsclt *nfsclt, char *path ) {
   res = nfs3pathlookup( nfsclt, path, 1 );
   if ( res == NULL ) return -1;
 
-  nfs_fh3copy(&nfsclt->currentdir.nfs3, &res->LOOKUP3res_u.resok.object);
+  nfs3fhset(&nfsclt->currentdir.nfs3, &res->LOOKUP3res_u.resok.object);
 
 return 0;
 }
@@ -878,50 +1445,131 @@ int nfscd( t_nfsclt *nfsclt, char *path ) {
 return -1;
 }
 
+int nfs3fileopen( t_nfsclt *nfsclt, t_nfsfile *nfsfile, char *path, int follow ) {
+
+  LOOKUP3res *res;
+  GETATTR3args args;
+  GETATTR3res *ares;
+  post_op_attr pattr;
+  fattr3 *attr;
+
+  res = nfs3pathlookup( nfsclt, path, follow );
+  if ( res == NULL ) return -1;
+
+  nfs3fhset(&nfsfile->fh.nfs3, &res->LOOKUP3res_u.resok.object);
+
+  if ( res->LOOKUP3res_u.resok.obj_attributes.attributes_follow ) {
+    memcpy(&nfsfile->attr.nfs3,
+      &res->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes,
+      sizeof(fattr3));
+
+    return 0;
+  }
+
+  // server didn't return attributes with lookup, ask for them
+  if ( (attr = acache_get(&nfsclt->acache, NFS3FH(&nfsfile->fh.nfs3))) != NULL ) {
+    memcpy(&nfsfile->attr.nfs3, attr, sizeof(fattr3));
+    return 0;
+  }
+
+  memset(&args, 0, sizeof(args));
+  args.object = *NFS3FH(&nfsfile->fh.nfs3);
+
+  ares = NFS3PROC(getattr)(&args, nfsclt->nfs.client);
+
+  if ( ares == NULL ) {
+    clnt_perror(nfsclt->nfs.client, "nfsproc3_getattr_3()");
+    return -1;
+  }
+
+  if ( ares->status != NFS3_OK ) {
+    fprintf(stderr, "Get attributes: %s - (%d) %s\n", path,
+        ares->status, nfs3_error(ares->status));
+    return -1;
+  }
+
+  memcpy(&nfsfile->attr.nfs3, &ares->GETATTR3res_u.resok.obj_attributes,
+    sizeof(fattr3));
+
+  pattr.attributes_follow = 1;
+  pattr.post_op_attr_u.attributes = nfsfile->attr.nfs3;
+  nfs3cacheattr( nfsclt, NFS3FH(&nfsfile->fh.nfs3), &pattr );
+
+return 0;
+}
+
+int nfsfileopen( t_nfsclt *nfsclt, t_nfsfile *nfsfile, char *path, int follow ) {
+
+  int ret = -1;
+
+  memset(nfsfile, 0, sizeof(t_nfsfile));
+
+  switch ( nfsclt->version ) {
+    case 30:
+      ret = nfs3fileopen( nfsclt, nfsfile, path, follow );
+    break;
+  }
+
+  if ( ret == -1 ) {
+    nfsfileclose( nfsclt, nfsfile );
+    return -1;
+  }
+
+  nfsfile->path = strdup(path);
+
+return ret;
+}
+
+void nfsfileclose( t_nfsclt *nfsclt, t_nfsfile *nfsfile ) {
+
+  switch ( nfsclt->version ) {
+    case 30:
+      nfsfile->fh.nfs3.len = 0;
+    break;
+  }
+
+  if ( nfsfile->path ) {
+    free( nfsfile->path );
+    nfsfile->path = NULL;
+  }
+}
+
 // returns number of read bytes
 int nfs3filepread(
-    t_nfsclt *nfsclt, char *path, long offset,
+    t_nfsclt *nfsclt, t_nfsfile *nfsfile, long offset,
     char *data, int datalen ) {
 
-  LOOKUP3res *fres;
   READ3args rargs;
   READ3res *rres;
-  unsigned long filesize;
+  fattr3 *attr = &nfsfile->attr.nfs3;
 
   memset( &rargs, 0, sizeof(rargs));
 
-  fres = nfs3pathlookup( nfsclt, path, 1 );
-  if ( fres == NULL ) return -1;
-
   // 'if' instead of 'case' to avoid compiler warnnings
-  ftype3 type = fres->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes.type;
-  if ( type == NF3DIR ) {
-    fprintf(stderr, "%s: is a directory\n", path);
+  if ( attr->type == NF3DIR ) {
+    fprintf(stderr, "%s: is a directory\n", nfsfile->path);
     return -1;
   }
-  if ( type == NF3LNK) {
-    fprintf(stderr, "%s: is a symbolic link\n", path);
+  if ( attr->type == NF3LNK) {
+    fprintf(stderr, "%s: is a symbolic link\n", nfsfile->path);
     return -1;
   }
 
-  filesize = fres->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes.size;
-
   // nothing to read
-  if ( offset >= filesize ) return 0;
+  if ( offset >= attr->size ) return 0;
 
   // clamp bytes to read
-  if ( offset+datalen > filesize ) {
-    rargs.count = filesize - offset;
+  if ( offset+datalen > attr->size ) {
+    rargs.count = attr->size - offset;
   } else {
     rargs.count = datalen;
   }
 
   rargs.offset = offset;
-  nfs_fh3copy(&rargs.file, &fres->LOOKUP3res_u.resok.object);
+  rargs.file = *NFS3FH(&nfsfile->fh.nfs3);
 
   // read file content
-  rres = nfsproc3_read_3(&rargs, nfsclt->nfs.client);
-  nfs_fh3free( &rargs.file );
+  rres = NFS3PROC(read)(&rargs, nfsclt->nfs.client);
 
   if ( rres == NULL ) {
     clnt_perror(nfsclt->nfs.client, "nfsproc3_read_3()");
@@ -929,40 +1577,40 @@ int nfs3filepread(
   }
 
   if (rres->status != NFS3_OK) {
-    fprintf(stderr, "Read failed: %s - (%d) %s\n", path,
+    fprintf(stderr, "Read failed: %s - (%d) %s\n", nfsfile->path,
         rres->status, nfs3_error(rres->status));
     return -1;
   }
 
+  // keep cached file size up to date
+  if ( rres->READ3res_u.resok.file_attributes.attributes_follow ) {
+    memcpy(attr, &rres->READ3res_u.resok.file_attributes.post_op_attr_u.attributes,
+      sizeof(fattr3));
+    nfs3cacheattr( nfsclt, NFS3FH(&nfsfile->fh.nfs3), &rres->READ3res_u.resok.file_attributes);
+  }
+
   memcpy(data, rres->READ3res_u.resok.data.data_val,
     rres->READ3res_u.resok.data.data_len);
 
-//      fwrite(rres->READ3res_u.resok.data.data_val,
-//        rres->READ3res_u.resok.data.data_len, 1, stdout);
-
 return rres->READ3res_u.resok.data.data_len;
 }
 
 // returns number of write bytes
 int nfs3filepwrite(
-    t_nfsclt *nfsclt, char *path, long offset,
+    t_nfsclt *nfsclt, t_nfsfile *nfsfile, long offset,
     char *data, int datalen ) {
 
-  LOOKUP3res *fres;
   WRITE3args wargs;
   WRITE3res *wres;
 
   memset( &wargs, 0, sizeof(wargs));
 
-  fres = nfs3pathlookup( nfsclt, path, 0 );
-  if ( fres == NULL ) return -1;
-
-  if (fres->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes.type != NF3REG) {
-    fprintf(stderr, "%s: is not a regular file\n", path);
+  if ( nfsfile->attr.nfs3.type != NF3REG ) {
+    fprintf(stderr, "%s: is not a regular file\n", nfsfile->path);
     return -1;
   }
 
-  nfs_fh3copy(&wargs.file, &fres->LOOKUP3res_u.resok.object);
+  wargs.file = *NFS3FH(&nfsfile->fh.nfs3);
   wargs.offset = offset;
   wargs.count = datalen;
   wargs.stable = FILE_SYNC;
@@ -970,8 +1618,7 @@ int nfs3filepwrite(
   wargs.data.data_val = data;
 
   // write data to file
-  wres = nfsproc3_write_3(&wargs, nfsclt->nfs.client);
-  nfs_fh3free( &wargs.file );
+  wres = NFS3PROC(write)(&wargs, nfsclt->nfs.client);
 
   if ( wres == NULL ) {
     clnt_perror(nfsclt->nfs.client, "nfsproc3_write_3()");
@@ -979,54 +1626,2960 @@ int nfs3filepwrite(
   }
 
   if (wres->status != NFS3_OK) {
-    fprintf(stderr, "Write failed: %s - (%d) %s\n", path,
+    fprintf(stderr, "Write failed: %s - (%d) %s\n", nfsfile->path,
         wres->status, nfs3_error(wres->status));
     return -1;
   }
 
+  if ( wres->WRITE3res_u.resok.file_wcc.after.attributes_follow ) {
+    memcpy(&nfsfile->attr.nfs3,
+      &wres->WRITE3res_u.resok.file_wcc.after.post_op_attr_u.attributes,
+      sizeof(fattr3));
+  }
+
+  nfs3cachewcc( nfsclt, NFS3FH(&nfsfile->fh.nfs3), &wres->WRITE3res_u.resok.file_wcc);
+
 return wres->WRITE3res_u.resok.count;
 }
 
-int nfsfilepwrite(
-    t_nfsclt *nfsclt, char *file, long offset,
-    char *data, int datalen ) {
+struct s_nfs3readpipe;
 
-  switch ( nfsclt->version ) {
-    case 30:
-      return nfs3filepwrite( nfsclt, file, offset, data, datalen );
-    break;
-  }
+// One READ request of the pipeline
+typedef struct {
 
-return -1;
-}
+  t_rpccall call;
+  READ3res res;
+  struct s_nfs3readpipe *pipe;
 
-int nfsfilepread(
-    t_nfsclt *nfsclt, char *file, long offset,
-    char *data, int datalen ) {
+  long offset;
+  u_int count;    // requested bytes
+  u_int len;      // bytes received so far
+  int done;
 
-  switch ( nfsclt->version ) {
-    case 30:
-      return nfs3filepread( nfsclt, file, offset, data, datalen );
-    break;
-  }
+  char *data;     // own buffer or part of mapped file
 
-return -1;
+} t_nfs3readslot;
+
+typedef struct s_nfs3readpipe {
+
+  t_nfsclt *nfsclt;
+  t_nfsfile *nfsfile;
+
+  int outstanding;  // calls waiting for reply
+  int err;
+
+} t_nfs3readpipe;
+
+static void nfs3readslotdone( t_rpcmux *mux, t_rpccall *call );
+
+static int nfs3readslotsend( t_nfs3readslot *slot ) {
+
+  t_nfs3readpipe *pipe = slot->pipe;
+  READ3args rargs;
+
+  memset( &rargs, 0, sizeof(rargs));
+  rargs.file = *NFS3FH(&pipe->nfsfile->fh.nfs3);
+  rargs.offset = slot->offset + slot->len;
+  rargs.count = slot->count - slot->len;
+
+  // reply is decoded straight into slot data
+  memset( &slot->res, 0, sizeof(slot->res));
+  slot->res.READ3res_u.resok.data.data_val = slot->data + slot->len;
+  slot->res.READ3res_u.resok.data.data_len = slot->count - slot->len;
+
+  slot->call.xres = (xdrproc_t)nfs3xdrreadinplace;
+  slot->call.res = &slot->res;
+  slot->call.donefn = nfs3readslotdone;
+  slot->call.arg = slot;
+
+  if ( rpcgroup_submit(&pipe->nfsclt->nfsgroup, &slot->call, NFSPROC3_READ,
+      (xdrproc_t)NFS3XDR(READ3args), &rargs) == -1 )
+    return -1;
+
+  pipe->outstanding++;
+
+return 0;
 }
 
-int nfs3filestat( t_nfsclt *nfsclt, char *path, struct stat *fstat ) {
+static void nfs3readslotdone( t_rpcmux *mux, t_rpccall *call ) {
 
-  LOOKUP3res *res;
-  fattr3 *attr;
+  t_nfs3readslot *slot = (t_nfs3readslot *)call->arg;
+  t_nfs3readpipe *pipe = slot->pipe;
+  t_nfsfile *nfsfile = pipe->nfsfile;
+  READ3res *rres = &slot->res;
 
-  res = nfs3pathlookup( nfsclt, path, 0); // don't follow links
-  if ( res == NULL ) return -1;
+  pipe->outstanding--;
 
-  attr = &res->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes;
-  memset(fstat, 0, sizeof(stat));
+  if ( call->stat != RPC_SUCCESS ) {
+    fprintf(stderr, "nfs3fileread(): %s\n", clnt_sperrno(call->stat));
+    pipe->err = 1;
+  } else if ( rres->status != NFS3_OK ) {
+    fprintf(stderr, "Read failed: %s - (%d) %s\n", nfsfile->path,
+        rres->status, nfs3_error(rres->status));
+    pipe->err = 1;
+  }
 
-  fstat->st_mode = attr->mode;
+  if ( pipe->err ) return;  // let outstanding replies drain
 
-  // set file type
+  slot->len += rres->READ3res_u.resok.data.data_len;
+
+  if ( rres->READ3res_u.resok.file_attributes.attributes_follow ) {
+    memcpy(&nfsfile->attr.nfs3,
+      &rres->READ3res_u.resok.file_attributes.post_op_attr_u.attributes,
+      sizeof(fattr3));
+    nfs3cacheattr( pipe->nfsclt, NFS3FH(&nfsfile->fh.nfs3), &rres->READ3res_u.resok.file_attributes);
+  }
+
+  if ( slot->len == slot->count || rres->READ3res_u.resok.eof
+      || rres->READ3res_u.resok.data.data_len == 0 ) {
+
+    slot->done = 1;
+
+  } else {
+    // short read, ask for the rest
+    if ( nfs3readslotsend( slot ) == -1 )
+      pipe->err = 1;
+  }
+}
+
+// Map regular file out, sized to size, so READ replies can be decoded
+// straight into it. Returns NULL when out can't be mapped.
+static char *nfs3filereadmap( FILE *out, long size ) {
+
+  struct stat st;
+  char *map;
+  int fd = fileno(out);
+
+  if ( size == 0 || fflush(out) == EOF ) return NULL;
+
+  // we must own whole file, stdout could be in the middle of something
+  if ( fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)
+      || lseek(fd, 0, SEEK_CUR) != 0 )
+    return NULL;
+
+  if ( ftruncate(fd, size) == -1 ) return NULL;
+
+  map = mmap(NULL, size, PROT_WRITE, MAP_SHARED, fd, 0);
+  if ( map == MAP_FAILED ) {
+    ftruncate(fd, st.st_size);
+    return NULL;
+  }
+
+return map;
+}
+
+// Reads are sent in file order into a ring of window slots. Replies can
+// come in any order, but slots are flushed to out only from the head,
+// so data is always written sequentially. When out is a regular file
+// it's mapped and replies are decoded directly into it, flushing then
+// just counts bytes.
+long nfs3fileread( t_nfsclt *nfsclt, t_nfsfile *nfsfile, FILE *out ) {
+
+  t_nfs3readslot *slots, *slot;
+  t_nfs3readpipe pipe;
+  fattr3 *attr = &nfsfile->attr.nfs3;
+  int window, chunk = nfsclt->fsinfo.rtpref;
+  int head = 0, inflight = 0, i;
+  long offset = 0, total = 0, size, mapsize;
+  char *map;
+
+  if ( attr->type == NF3DIR ) {
+    fprintf(stderr, "%s: is a directory\n", nfsfile->path);
+    return -1;
+  }
+  if ( attr->type == NF3LNK) {
+    fprintf(stderr, "%s: is a symbolic link\n", nfsfile->path);
+    return -1;
+  }
+
+  window = nfsclt->window > 0 ? nfsclt->window : 1;
+
+  memset(&pipe, 0, sizeof(pipe));
+  pipe.nfsclt = nfsclt;
+  pipe.nfsfile = nfsfile;
+
+  if ( (slots = calloc(window, sizeof(t_nfs3readslot))) == NULL ) {
+    perror("calloc()");
+    return -1;
+  }
+
+  // file could change while we read, stay within mapping
+  size = mapsize = attr->size;
+  map = nfs3filereadmap(out, mapsize);
+
+  for ( i = 0; i < window ; i++ ) {
+    slots[i].pipe = &pipe;
+
+    if ( map ) continue;
+
+    if ( (slots[i].data = malloc(chunk)) == NULL ) {
+      perror("malloc()");
+      pipe.err = 1;
+      goto END;
+    }
+  }
+
+  while ( 1 ) {
+
+    // fill the window
+    while ( !pipe.err && inflight < window && offset < size ) {
+
+      slot = &slots[(head + inflight) % window];
+      slot->offset = offset;
+      slot->count = (size - offset > chunk) ? chunk : size - offset;
+      slot->len = 0;
+      slot->done = 0;
+
+      if ( map ) slot->data = map + offset;
+
+      if ( nfs3readslotsend( slot ) == -1 ) {
+        pipe.err = 1;
+        break;
+      }
+
+      offset += slot->count;
+      inflight++;
+    }
+
+    if ( pipe.outstanding == 0 ) break;
+
+    // on failure outstanding calls are completed with error
+    rpcgroup_run(&nfsclt->nfsgroup);
+
+    // flush completed slots in file order
+    while ( !pipe.err && inflight > 0 && slots[head].done ) {
+
+      // file shrank, the rest of mapping is cut off below
+      if ( map && slots[head].len < slots[head].count ) {
+        total += slots[head].len;
+        offset = size = total;
+        inflight = 0;
+        break;
+      }
+
+      if ( !map && fwrite(slots[head].data, sizeof(char), slots[head].len, out)
+          != slots[head].len ) {
+        perror("fwrite()");
+        pipe.err = 1;
+        break;
+      }
+
+      total += slots[head].len;
+      slots[head].done = 0;
+
+      head = (head + 1) % window;
+      inflight--;
+    }
+  }
+
+END:
+  if ( map ) {
+    munmap(map, mapsize);
+
+    // leave file as if it was written
+    if ( ftruncate(fileno(out), total) == -1 || lseek(fileno(out), total, SEEK_SET) == -1 ) {
+      perror("ftruncate()");
+      pipe.err = 1;
+    }
+  } else {
+    for ( i = 0; i < window ; i++ )
+      if ( slots[i].data ) free(slots[i].data);
+  }
+  free(slots);
+
+return pipe.err ? -1 : total;
+}
+
+long nfsfileread( t_nfsclt *nfsclt, t_nfsfile *nfsfile, FILE *out ) {
+
+  switch ( nfsclt->version ) {
+    case 30:
+      return nfs3fileread( nfsclt, nfsfile, out );
+    break;
+  }
+
+return -1;
+}
+
+// Recursive download. Directories are read with READDIRPLUS, so every
+// entry comes with it's handle and attributes and no LOOKUP is needed.
+// Regular files are read in rtpref sized ranges through a pool of window
+// READ slots shared by all files, so many small files are transferred at
+// once and big ones are split over all free slots. Ranges are stored with
+// pwrite(), in whatever order replies come.
+//
+// Synchronizing skips files which local copy has the same size and
+// mtime. Other existing files are read whole, NFSv3 can't compare them
+// on server, but only ranges which differ from local data are written.
+
+// files queued per READ slot before we stop reading more directories
+#define NFS3_MIRROR_QUEUE 4
+
+struct s_nfs3mirror;
+
+// Directory waiting to be read, or being read
+typedef struct s_nfs3mdir {
+
+  struct s_nfs3mdir *next;
+
+  t_rpccall call;
+  t_nfsdirreply reply;
+  struct s_nfs3mirror *mirror;
+
+  t_nfs3fh fh;
+  cookie3 cookie;
+  cookieverf3 cookieverf;
+
+  char *lpath;
+
+} t_nfs3mdir;
+
+// Regular file being downloaded
+typedef struct s_nfs3mfile {
+
+  struct s_nfs3mfile *next;
+
+  t_nfs3fh fh;
+  fattr3 attr;
+
+  char *lpath;
+  int fd;
+  int delta;          // local copy exists, write only changed ranges
+
+  offset3 offset;     // next range to request
+  int outstanding;    // ranges in flight
+  int queued;         // still has ranges to request
+  int err;
+
+} t_nfs3mfile;
+
+// One READ request
+typedef struct s_nfs3mslot {
+
+  struct s_nfs3mslot *next;   // free slots chain
+
+  t_rpccall call;
+  READ3res res;
+  struct s_nfs3mirror *mirror;
+  t_nfs3mfile *file;
+
+  offset3 offset;
+  u_int count;    // requested bytes
+  u_int len;      // bytes received so far
+
+  char *buf;      // local data to compare, when synchronizing
+
+} t_nfs3mslot;
+
+// Symbolic link waiting for READLINK
+typedef struct s_nfs3mlink {
+
+  struct s_nfs3mlink *next;
+
+  t_rpccall call;
+  READLINK3res res;
+  struct s_nfs3mirror *mirror;
+
+  t_nfs3fh fh;
+  char *lpath;
+
+} t_nfs3mlink;
+
+// Entry which READDIRPLUS returned without handle or attributes,
+// it's looked up with synchronous call
+typedef struct s_nfs3mlater {
+
+  struct s_nfs3mlater *next;
+
+  t_nfs3fh dirfh;
+  char *name;
+
+  char *lpath;
+
+} t_nfs3mlater;
+
+// Directory attributes are set after whole tree is downloaded,
+// creating files inside would change it's times
+typedef struct s_nfs3mdirattr {
+
+  struct s_nfs3mdirattr *next;
+
+  fattr3 attr;
+  char path[];
+
+} t_nfs3mdirattr;
+
+typedef struct s_nfs3mirror {
+
+  t_nfsclt *nfsclt;
+
+  t_nfs3mdir *dirs;           // waiting to be read
+  t_nfs3mfile *files;         // with ranges to request
+  t_nfs3mfile *filestail;
+  int nqueued;
+  t_nfs3mslot *freeslots;
+  t_nfs3mlink *links;
+  t_nfs3mlater *later;
+  t_nfs3mdirattr *dirattrs;   // most recently created first
+
+  int outstanding;
+  int failed;                 // can't send more calls
+  int sync;
+
+  long ndirs;
+  long nfiles;
+  long nlinks;
+  long nunchanged;
+  long errors;
+  long long bytes;
+  long long written;
+
+} t_nfs3mirror;
+
+static char *nfs3mirrorpath( char *dir, char *name ) {
+
+  char *path;
+
+  if ( (path = malloc(strlen(dir) + strlen(name) + 2)) == NULL ) {
+    perror("malloc()");
+    return NULL;
+  }
+
+  sprintf(path, "%s/%s", dir, name);
+
+return path;
+}
+
+// don't let server put files outside of our tree
+static int nfs3mirrorname( char *name ) {
+return *name && strcmp(name, ".") && strcmp(name, "..") && !strchr(name, '/');
+}
+
+static void nfs3mirrortimes( struct timespec *ts, fattr3 *attr ) {
+
+  ts[0].tv_sec = attr->atime.seconds;
+  ts[0].tv_nsec = attr->atime.nseconds;
+  ts[1].tv_sec = attr->mtime.seconds;
+  ts[1].tv_nsec = attr->mtime.nseconds;
+}
+
+static void nfs3mirrorfinish( t_nfs3mirror *m, t_nfs3mfile *f ) {
+
+  struct timespec ts[2];
+
+  if ( f->fd >= 0 ) {
+    nfs3mirrortimes(ts, &f->attr);
+
+    // local copy could be longer
+    if ( !f->err && ((f->delta && ftruncate(f->fd, f->attr.size) == -1)
+        || fchmod(f->fd, f->attr.mode & 07777) == -1
+        || futimens(f->fd, ts) == -1) ) {
+      fprintf(stderr, "%s: %s\n", f->lpath, strerror(errno));
+      f->err = 1;
+    }
+
+    close(f->fd);
+  }
+
+  if ( f->err )
+    m->errors++;
+  else
+    m->nfiles++;
+
+  free(f->lpath);
+  free(f);
+}
+
+#define NFS3_SYNC_SIZEDIFF 4   // sizes differ by at most 1/4 for delta copy
+
+// Existing copy is compared range by range, for upload remote ranges are
+// read first. It pays off only for files bigger than all slots together
+// which size didn't change much, others are copied whole.
+static int nfs3syncdelta( t_nfsclt *nfsclt, size3 local, size3 remote, int chunk ) {
+
+  int window = nfsclt->window > 0 ? nfsclt->window : 1;
+  size3 min = local < remote ? local : remote;
+  size3 max = local < remote ? remote : local;
+
+  if ( min < (size3)window * chunk ) return 0;
+
+return max - min <= max / NFS3_SYNC_SIZEDIFF;
+}
+
+// take ownership of lpath and queue object for download
+static void nfs3mirrorentry( t_nfs3mirror *m, nfs_fh3 *fh, fattr3 *attr, char *lpath ) {
+
+  t_nfs3mdirattr *da;
+  t_nfs3mdir *d;
+  t_nfs3mfile *f;
+  t_nfs3mlink *l;
+  struct stat st;
+  int exists;
+
+  switch ( attr->type ) {
+    case NF3DIR:
+
+      st.st_mode = S_IFDIR;
+
+      if ( mkdir(lpath, 0700) == -1
+          && (errno != EEXIST || lstat(lpath, &st) == -1) ) {
+        fprintf(stderr, "%s: %s\n", lpath, strerror(errno));
+        m->errors++;
+        break;
+      }
+
+      // symbolic link could lead out of the tree, it isn't followed
+      if ( !S_ISDIR(st.st_mode) ) {
+        fprintf(stderr, "%s: exists and isn't a directory\n", lpath);
+        m->errors++;
+        break;
+      }
+
+      if ( (da = malloc(sizeof(t_nfs3mdirattr) + strlen(lpath) + 1)) == NULL
+          || (d = calloc(1, sizeof(t_nfs3mdir))) == NULL ) {
+        perror("malloc()");
+        if ( da ) free(da);
+        m->errors++;
+        break;
+      }
+
+      da->attr = *attr;
+      strcpy(da->path, lpath);
+      da->next = m->dirattrs;
+      m->dirattrs = da;
+
+      d->mirror = m;
+      nfs3fhset(&d->fh, fh);
+      d->lpath = lpath;
+
+      d->next = m->dirs;
+      m->dirs = d;
+
+    return;
+
+    case NF3REG:
+
+      exists = m->sync && lstat(lpath, &st) == 0 && S_ISREG(st.st_mode);
+
+      if ( exists && st.st_size == attr->size
+          && st.st_mtim.tv_sec == attr->mtime.seconds
+          && st.st_mtim.tv_nsec == attr->mtime.nseconds ) {
+        m->nunchanged++;
+        break;
+      }
+
+      if ( (f = calloc(1, sizeof(t_nfs3mfile))) == NULL ) {
+        perror("calloc()");
+        m->errors++;
+        break;
+      }
+
+      nfs3fhset(&f->fh, fh);
+      f->attr = *attr;
+      f->lpath = lpath;
+      f->fd = -1;
+      f->delta = exists && nfs3syncdelta(m->nfsclt, st.st_size, attr->size,
+          m->nfsclt->fsinfo.rtpref);
+      f->queued = 1;
+
+      if ( m->filestail )
+        m->filestail->next = f;
+      else
+        m->files = f;
+      m->filestail = f;
+      m->nqueued++;
+
+    return;
+
+    case NF3LNK:
+
+      if ( (l = calloc(1, sizeof(t_nfs3mlink))) == NULL ) {
+        perror("calloc()");
+        m->errors++;
+        break;
+      }
+
+      l->mirror = m;
+      nfs3fhset(&l->fh, fh);
+      l->lpath = lpath;
+
+      l->next = m->links;
+      m->links = l;
+
+    return;
+
+    default:
+      fprintf(stderr, "%s: skipping special file\n", lpath);
+    break;
+  }
+
+  free(lpath);
+}
+
+static void nfs3mirrordirdone( t_rpcmux *mux, t_rpccall *call ) {
+
+  t_nfs3mdir *d = (t_nfs3mdir *)call->arg;
+  t_nfs3mirror *m = d->mirror;
+  READDIRPLUS3res *res = &d->reply.res.nfs3plus;
+  t_nfs3mlater *l;
+  entryplus3 *ep;
+  char *lpath;
+
+  m->outstanding--;
+
+  if ( call->stat != RPC_SUCCESS ) {
+    fprintf(stderr, "%s: %s\n", d->lpath, clnt_sperrno(call->stat));
+    goto FAIL;
+  }
+
+  if ( res->status != NFS3_OK ) {
+    fprintf(stderr, "Readdirplus failed: %s - (%d) %s\n", d->lpath,
+        res->status, nfs3_error(res->status));
+    goto FAIL;
+  }
+
+  nfs3cacheattr( m->nfsclt, NFS3FH(&d->fh), &res->READDIRPLUS3res_u.resok.dir_attributes);
+
+  for ( ep = res->READDIRPLUS3res_u.resok.reply.entries; ep ; ep = ep->nextentry ) {
+
+    d->cookie = ep->cookie;
+
+    if ( !strcmp(ep->name, ".") || !strcmp(ep->name, "..") ) continue;
+
+    if ( !nfs3mirrorname(ep->name) ) {
+      fprintf(stderr, "%s: skipping invalid name '%s'\n", d->lpath, ep->name);
+      m->errors++;
+      continue;
+    }
+
+    if ( (lpath = nfs3mirrorpath(d->lpath, ep->name)) == NULL ) {
+      m->errors++;
+      continue;
+    }
+
+    if ( ep->name_handle.handle_follows && ep->name_attributes.attributes_follow ) {
+      nfs3mirrorentry(m, &ep->name_handle.post_op_fh3_u.handle,
+          &ep->name_attributes.post_op_attr_u.attributes, lpath);
+      continue;
+    }
+
+    // server didn't give us everything, lookup it later
+    if ( (l = calloc(1, sizeof(t_nfs3mlater))) == NULL
+        || (l->name = strdup(ep->name)) == NULL ) {
+      perror("calloc()");
+      if ( l ) free(l);
+      free(lpath);
+      m->errors++;
+      continue;
+    }
+
+    l->dirfh = d->fh;
+    l->lpath = lpath;
+
+    l->next = m->later;
+    m->later = l;
+  }
+
+  if ( !res->READDIRPLUS3res_u.resok.reply.eof ) {
+
+    // read rest of directory before others
+    memcpy(d->cookieverf, res->READDIRPLUS3res_u.resok.cookieverf,
+        sizeof(cookieverf3));
+
+    d->next = m->dirs;
+    m->dirs = d;
+    return;
+  }
+
+  nfs3dirreplyfree(&d->reply);
+  m->ndirs++;
+
+  free(d->lpath);
+  free(d);
+  return;
+
+FAIL:
+  nfs3dirreplyfree(&d->reply);
+  m->errors++;
+
+  free(d->lpath);
+  free(d);
+}
+
+static int nfs3mirrordirsend( t_nfs3mirror *m, t_nfs3mdir *d ) {
+
+  t_nfsclt *nfsclt = m->nfsclt;
+  READDIRPLUS3args args;
+
+  memset(&args, 0, sizeof(args));
+  args.dir = *NFS3FH(&d->fh);
+  args.cookie = d->cookie;
+  memcpy(args.cookieverf, d->cookieverf, sizeof(cookieverf3));
+
+  args.dircount = nfsclt->fsinfo.dtpref;
+  args.maxcount = nfsclt->fsinfo.rtpref > nfsclt->fsinfo.dtpref ?
+    nfsclt->fsinfo.rtpref : nfsclt->fsinfo.dtpref;
+
+  d->reply.plus = 1;
+  d->call.xres = (xdrproc_t)nfs3xdrdirreply;
+  d->call.res = &d->reply;
+  d->call.donefn = nfs3mirrordirdone;
+  d->call.arg = d;
+
+  if ( rpcgroup_submit(&nfsclt->nfsgroup, &d->call, NFSPROC3_READDIRPLUS,
+      (xdrproc_t)NFS3XDR(READDIRPLUS3args), &args) == -1 )
+    return -1;
+
+  m->outstanding++;
+
+return 0;
+}
+
+static void nfs3mirrorlinkfree( t_nfs3mlink *l ) {
+
+  free(l->lpath);
+  free(l);
+}
+
+static int nfs3mirrorsamelink( char *lpath, char *target ) {
+
+  char buf[PATH_MAX];
+  ssize_t n;
+
+  if ( (n = readlink(lpath, buf, sizeof(buf))) == -1 ) return 0;
+
+return n == strlen(target) && !memcmp(buf, target, n);
+}
+
+static void nfs3mirrorlinkdone( t_rpcmux *mux, t_rpccall *call ) {
+
+  t_nfs3mlink *l = (t_nfs3mlink *)call->arg;
+  t_nfs3mirror *m = l->mirror;
+  READLINK3res *lres = &l->res;
+
+  m->outstanding--;
+
+  if ( call->stat != RPC_SUCCESS ) {
+    fprintf(stderr, "%s: %s\n", l->lpath, clnt_sperrno(call->stat));
+    m->errors++;
+  } else if ( lres->status != NFS3_OK ) {
+    fprintf(stderr, "Link lookup failed: %s - (%d) %s\n", l->lpath,
+        lres->status, nfs3_error(lres->status));
+    m->errors++;
+  } else if ( m->sync && nfs3mirrorsamelink(l->lpath, lres->READLINK3res_u.resok.data) ) {
+    m->nunchanged++;
+  } else if ( symlink(lres->READLINK3res_u.resok.data, l->lpath) == -1
+      // replace what was left by previous mirror
+      && (errno != EEXIST || unlink(l->lpath) == -1
+        || symlink(lres->READLINK3res_u.resok.data, l->lpath) == -1) ) {
+    fprintf(stderr, "%s: %s\n", l->lpath, strerror(errno));
+    m->errors++;
+  } else {
+    m->nlinks++;
+  }
+
+  xdr_free((xdrproc_t)xdr_READLINK3res, (char *)lres);
+  nfs3mirrorlinkfree(l);
+}
+
+static int nfs3mirrorlinksend( t_nfs3mirror *m, t_nfs3mlink *l ) {
+
+  READLINK3args largs;
+
+  memset(&largs, 0, sizeof(largs));
+  largs.symlink = *NFS3FH(&l->fh);
+
+  memset(&l->res, 0, sizeof(l->res));
+  l->call.xres = (xdrproc_t)xdr_READLINK3res;
+  l->call.res = &l->res;
+  l->call.donefn = nfs3mirrorlinkdone;
+  l->call.arg = l;
+
+  if ( rpcgroup_submit(&m->nfsclt->nfsgroup, &l->call, NFSPROC3_READLINK,
+      (xdrproc_t)xdr_READLINK3args, &largs) == -1 )
+    return -1;
+
+  m->outstanding++;
+
+return 0;
+}
+
+static void nfs3mirrorreaddone( t_rpcmux *mux, t_rpccall *call );
+
+static int nfs3mirrorreadsend( t_nfs3mslot *slot ) {
+
+  t_nfs3mirror *m = slot->mirror;
+  READ3args rargs;
+
+  memset( &rargs, 0, sizeof(rargs));
+  rargs.file = *NFS3FH(&slot->file->fh);
+  rargs.offset = slot->offset + slot->len;
+  rargs.count = slot->count - slot->len;
+
+  memset( &slot->res, 0, sizeof(slot->res));
+  slot->call.xres = (xdrproc_t)NFS3XDR(READ3res);
+  slot->call.res = &slot->res;
+  slot->call.donefn = nfs3mirrorreaddone;
+  slot->call.arg = slot;
+
+  if ( rpcgroup_submit(&m->nfsclt->nfsgroup, &slot->call, NFSPROC3_READ,
+      (xdrproc_t)NFS3XDR(READ3args), &rargs) == -1 )
+    return -1;
+
+  m->outstanding++;
+  slot->file->outstanding++;
+
+return 0;
+}
+
+static void nfs3mirrorslotfree( t_nfs3mslot *slot ) {
+
+  t_nfs3mirror *m = slot->mirror;
+  t_nfs3mfile *f = slot->file;
+
+  slot->file = NULL;
+  slot->next = m->freeslots;
+  m->freeslots = slot;
+
+  // last range of the file
+  if ( !f->queued && f->outstanding == 0 ) nfs3mirrorfinish(m, f);
+}
+
+static void nfs3mirrorreaddone( t_rpcmux *mux, t_rpccall *call ) {
+
+  t_nfs3mslot *slot = (t_nfs3mslot *)call->arg;
+  t_nfs3mirror *m = slot->mirror;
+  t_nfs3mfile *f = slot->file;
+  READ3res *rres = &slot->res;
+  u_int len;
+
+  m->outstanding--;
+  f->outstanding--;
+
+  if ( call->stat != RPC_SUCCESS ) {
+    fprintf(stderr, "%s: %s\n", f->lpath, clnt_sperrno(call->stat));
+    f->err = 1;
+  } else if ( rres->status != NFS3_OK ) {
+    fprintf(stderr, "Read failed: %s - (%d) %s\n", f->lpath,
+        rres->status, nfs3_error(rres->status));
+    f->err = 1;
+  } else if ( rres->READ3res_u.resok.data.data_len > slot->count - slot->len ) {
+    fprintf(stderr, "Read failed: %s - server returned too much data\n",
+        f->lpath);
+    f->err = 1;
+  }
+
+  if ( f->err ) {
+    xdr_free((xdrproc_t)NFS3XDR(READ3res), (char *)rres);
+    nfs3mirrorslotfree(slot);
+    return;
+  }
+
+  len = rres->READ3res_u.resok.data.data_len;
+
+  // range which local copy has already isn't written
+  if ( len && f->delta && pread(f->fd, slot->buf, len, slot->offset + slot->len) == len
+      && !memcmp(slot->buf, rres->READ3res_u.resok.data.data_val, len) ) {
+    // nothing to do
+  } else if ( len && pwrite(f->fd, rres->READ3res_u.resok.data.data_val, len,
+      slot->offset + slot->len) != len ) {
+    fprintf(stderr, "%s: %s\n", f->lpath, strerror(errno));
+    f->err = 1;
+  } else {
+    m->written += len;
+  }
+
+  slot->len += len;
+  m->bytes += len;
+
+  if ( !f->err && slot->len < slot->count && len > 0
+      && !rres->READ3res_u.resok.eof ) {
+
+    // short read, ask for the rest
+    xdr_free((xdrproc_t)NFS3XDR(READ3res), (char *)rres);
+
+    if ( nfs3mirrorreadsend( slot ) == 0 ) return;
+
+    f->err = 1;
+    m->failed = 1;
+  } else {
+    xdr_free((xdrproc_t)NFS3XDR(READ3res), (char *)rres);
+  }
+
+  nfs3mirrorslotfree(slot);
+}
+
+// Open local copy, never through symbolic link. Link left there is
+// replaced, existing copy is written only if it's regular file.
+static int nfs3mirroropen( t_nfs3mfile *f ) {
+
+  int flags = O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC;
+  struct stat st;
+  int fd;
+
+  if ( f->delta ) {
+    fd = open(f->lpath, O_RDWR | O_NOFOLLOW | O_CLOEXEC);
+  } else if ( (fd = open(f->lpath, flags, 0600)) == -1
+      && errno == ELOOP && unlink(f->lpath) == 0 ) {
+    fd = open(f->lpath, flags, 0600);
+  }
+
+  if ( fd == -1 ) {
+    fprintf(stderr, "%s: %s\n", f->lpath, strerror(errno));
+    return -1;
+  }
+
+  if ( fstat(fd, &st) == -1 ) {
+    fprintf(stderr, "%s: %s\n", f->lpath, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  if ( !S_ISREG(st.st_mode) ) {
+    fprintf(stderr, "%s: exists and isn't a regular file\n", f->lpath);
+    close(fd);
+    return -1;
+  }
+
+return fd;
+}
+
+// give free slots to queued files
+static void nfs3mirrorfill( t_nfs3mirror *m ) {
+
+  int chunk = m->nfsclt->fsinfo.rtpref;
+  t_nfs3mslot *slot;
+  t_nfs3mfile *f;
+
+  while ( (f = m->files) != NULL && m->freeslots && !m->failed ) {
+
+    if ( f->fd == -1 && !f->err && (f->fd = nfs3mirroropen(f)) == -1 )
+      f->err = 1;
+
+    if ( !f->err && f->offset < f->attr.size ) {
+
+      slot = m->freeslots;
+      m->freeslots = slot->next;
+
+      slot->file = f;
+      slot->offset = f->offset;
+      slot->count = (f->attr.size - f->offset > chunk) ? chunk : f->attr.size - f->offset;
+      slot->len = 0;
+
+      if ( nfs3mirrorreadsend( slot ) == -1 ) {
+        slot->file = NULL;
+        slot->next = m->freeslots;
+        m->freeslots = slot;
+
+        f->err = 1;
+        m->failed = 1;
+      } else {
+        f->offset += slot->count;
+      }
+    }
+
+    // all ranges requested
+    if ( f->err || f->offset >= f->attr.size ) {
+      m->files = f->next;
+      if ( m->files == NULL ) m->filestail = NULL;
+      m->nqueued--;
+
+      f->queued = 0;
+      if ( f->outstanding == 0 ) nfs3mirrorfinish(m, f);
+    }
+  }
+}
+
+// entries which need synchronous calls
+static void nfs3mirrorlater( t_nfs3mirror *m ) {
+
+  t_nfsclt *nfsclt = m->nfsclt;
+  t_nfs3mlater *l;
+  LOOKUP3res *res;
+
+  // calls below complete other calls too, which could add new entries
+  while ( (l = m->later) != NULL ) {
+    m->later = l->next;
+
+    if ( m->failed ) {
+      m->errors++;
+
+    } else {
+
+      res = nfs3cachedlookup( nfsclt, NFS3FH(&l->dirfh), l->name);
+
+      if ( res && res->LOOKUP3res_u.resok.obj_attributes.attributes_follow ) {
+        nfs3mirrorentry(m, &res->LOOKUP3res_u.resok.object,
+            &res->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes,
+            l->lpath);
+        l->lpath = NULL;
+      } else {
+        if ( res ) fprintf(stderr, "%s: no attributes\n", l->lpath);
+        m->errors++;
+      }
+    }
+
+    free(l->name);
+    if ( l->lpath ) free(l->lpath);
+    free(l);
+  }
+}
+
+long nfs3mirror( t_nfsclt *nfsclt, char *rpath, char *lpath, int sync ) {
+
+  t_nfs3mirror m;
+  t_nfs3mslot *slots;
+  t_nfs3mdir *d;
+  t_nfs3mfile *f;
+  t_nfs3mlink *l;
+  t_nfs3mdirattr *da;
+  t_nfsfile nfsfile;
+  struct timespec ts[2], start, end;
+  char *path, buf[32];
+  int window, i, fd;
+
+  if ( nfsfileopen( nfsclt, &nfsfile, rpath, 1 ) == -1 )
+    return -1;
+
+  window = nfsclt->window > 0 ? nfsclt->window : 1;
+
+  memset(&m, 0, sizeof(m));
+  m.nfsclt = nfsclt;
+  m.sync = sync;
+
+  if ( (slots = calloc(window, sizeof(t_nfs3mslot))) == NULL
+      || (path = strdup(lpath)) == NULL ) {
+    perror("calloc()");
+    if ( slots ) free(slots);
+    nfsfileclose( nfsclt, &nfsfile );
+    return -1;
+  }
+
+  for ( i = 0; i < window ; i++ ) {
+    slots[i].mirror = &m;
+
+    if ( sync && (slots[i].buf = malloc(nfsclt->fsinfo.rtpref)) == NULL ) {
+      perror("malloc()");
+      m.failed = 1;
+      m.errors++;
+      break;
+    }
+
+    slots[i].next = m.freeslots;
+    m.freeslots = &slots[i];
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  nfs3mirrorentry(&m, NFS3FH(&nfsfile.fh.nfs3), &nfsfile.attr.nfs3, path);
+  nfsfileclose( nfsclt, &nfsfile );
+
+  while ( 1 ) {
+
+    nfs3mirrorlater(&m);
+
+    // read directories only when there is not much to download
+    while ( !m.failed && (d = m.dirs) != NULL && m.outstanding < window
+        && m.nqueued < NFS3_MIRROR_QUEUE * window ) {
+
+      m.dirs = d->next;
+
+      if ( nfs3mirrordirsend(&m, d) == -1 ) {
+        m.failed = 1;
+        m.errors++;
+        nfs3dirreplyfree(&d->reply);
+        free(d->lpath);
+        free(d);
+      }
+    }
+
+    while ( !m.failed && (l = m.links) != NULL && m.outstanding < window ) {
+
+      m.links = l->next;
+
+      if ( nfs3mirrorlinksend(&m, l) == -1 ) {
+        m.failed = 1;
+        m.errors++;
+        nfs3mirrorlinkfree(l);
+      }
+    }
+
+    nfs3mirrorfill(&m);
+
+    if ( m.outstanding == 0 ) {
+      if ( m.later ) continue;
+      if ( m.failed || (m.dirs == NULL && m.files == NULL && m.links == NULL) )
+        break;
+      continue;
+    }
+
+    // on failure outstanding calls are completed with error
+    rpcgroup_run(&nfsclt->nfsgroup);
+  }
+
+  // left after failure
+  while ( (d = m.dirs) != NULL ) {
+    m.dirs = d->next;
+    m.errors++;
+    nfs3dirreplyfree(&d->reply);
+    free(d->lpath);
+    free(d);
+  }
+
+  while ( (f = m.files) != NULL ) {
+    m.files = f->next;
+    f->err = 1;
+    nfs3mirrorfinish(&m, f);
+  }
+
+  while ( (l = m.links) != NULL ) {
+    m.links = l->next;
+    m.errors++;
+    nfs3mirrorlinkfree(l);
+  }
+
+  // children were created after parents, so they come first
+  while ( (da = m.dirattrs) != NULL ) {
+    m.dirattrs = da->next;
+
+    nfs3mirrortimes(ts, &da->attr);
+
+    // it could be replaced by symbolic link meanwhile
+    if ( (fd = open(da->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)) == -1
+        || fchmod(fd, da->attr.mode & 07777) == -1
+        || futimens(fd, ts) == -1 ) {
+      fprintf(stderr, "%s: %s\n", da->path, strerror(errno));
+      m.errors++;
+    }
+
+    if ( fd >= 0 ) close(fd);
+
+    free(da);
+  }
+
+  for ( i = 0; i < window ; i++ )
+    if ( slots[i].buf ) free(slots[i].buf);
+  free(slots);
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  printf("%ld files, %ld directories, %ld links, %s in %.2f s",
+      m.nfiles, m.ndirs, m.nlinks, hrbytes(buf, sizeof(buf), m.bytes),
+      (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+  if ( sync )
+    printf(", %ld unchanged, %s written", m.nunchanged,
+        hrbytes(buf, sizeof(buf), m.written));
+
+  if ( m.errors )
+    printf(", %ld errors", m.errors);
+
+  printf("\n");
+
+return m.errors ? -1 : m.bytes;
+}
+
+long nfsmirror( t_nfsclt *nfsclt, char *rpath, char *lpath ) {
+
+  switch ( nfsclt->version ) {
+    case 30:
+      return nfs3mirror( nfsclt, rpath, lpath, 0 );
+    break;
+  }
+
+return -1;
+}
+
+// File range written with UNSTABLE write, but not yet committed
+typedef struct {
+
+  long offset;
+  long count;
+  writeverf3 verf;
+
+} t_nfs3wrange;
+
+typedef struct {
+
+  t_nfs3wrange *ranges;
+  int len;
+  int size;
+
+} t_nfs3wranges;
+
+static int nfs3wrangeadd( t_nfs3wranges *wr, long offset, long count, char *verf ) {
+
+  t_nfs3wrange *last = wr->len ? &wr->ranges[wr->len - 1] : NULL;
+
+  // merge with previous range when possible
+  if ( last && last->offset + last->count == offset
+      && !memcmp(last->verf, verf, NFS3_WRITEVERFSIZE) ) {
+
+    last->count += count;
+    return 0;
+  }
+
+  if ( wr->len == wr->size ) {
+    int size = wr->size ? wr->size * 2 : 64;
+    t_nfs3wrange *tmp = realloc(wr->ranges, size * sizeof(t_nfs3wrange));
+
+    if ( tmp == NULL ) {
+      perror("realloc()");
+      return -1;
+    }
+
+    wr->ranges = tmp;
+    wr->size = size;
+  }
+
+  last = &wr->ranges[wr->len++];
+  last->offset = offset;
+  last->count = count;
+  memcpy(last->verf, verf, NFS3_WRITEVERFSIZE);
+
+return 0;
+}
+
+static int nfs3wrangecmp( const void *a, const void *b ) {
+
+  long oa = ((t_nfs3wrange *)a)->offset, ob = ((t_nfs3wrange *)b)->offset;
+
+return (oa > ob) - (oa < ob);
+}
+
+// sort ranges and join adjacent ones, verifiers are not compared
+static void nfs3wrangejoin( t_nfs3wranges *wr ) {
+
+  int i, j;
+
+  if ( wr->len < 2 ) return;
+
+  qsort(wr->ranges, wr->len, sizeof(t_nfs3wrange), nfs3wrangecmp);
+
+  for ( i = 0, j = 1; j < wr->len ; j++ ) {
+    if ( wr->ranges[i].offset + wr->ranges[i].count == wr->ranges[j].offset ) {
+      wr->ranges[i].count += wr->ranges[j].count;
+    } else {
+      wr->ranges[++i] = wr->ranges[j];
+    }
+  }
+
+  wr->len = i + 1;
+}
+
+// Map local file for sending, returns NULL when it can't be mapped
+static char *nfs3filewritemap( int fd, long size ) {
+
+  char *map;
+
+  if ( size == 0 ) return NULL;
+
+  map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  if ( map == MAP_FAILED ) return NULL;
+
+  madvise(map, size, MADV_SEQUENTIAL);
+
+return map;
+}
+
+static sigjmp_buf nfs3mapjmp;
+
+static void nfs3mapfault( int sig ) {
+
+  siglongjmp(nfs3mapjmp, 1);
+}
+
+// Mapped file can be truncated by someone else, touching it beyond new
+// end raises SIGBUS. Returns how many bytes of the range are still there,
+// like pread() would, or -1. Pages are touched, so they are in memory
+// when data is sent.
+static long nfs3mapavail( int fd, char *map, long offset, long count ) {
+
+  struct sigaction sa, old;
+  struct stat st;
+  volatile long i = 0;
+  volatile char c;
+  long avail, page = sysconf(_SC_PAGESIZE);
+
+  if ( fstat(fd, &st) == -1 ) return -1;
+
+  if ( st.st_size <= offset ) return 0;
+  avail = st.st_size - offset < count ? st.st_size - offset : count;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = nfs3mapfault;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGBUS, &sa, &old);
+
+  if ( sigsetjmp(nfs3mapjmp, 1) == 0 ) {
+    for ( i = 0; i < avail ; i += page ) c = map[offset + i];
+    c = map[offset + avail - 1];
+  } else {
+    // truncated since fstat()
+    avail = i;
+  }
+
+  sigaction(SIGBUS, &old, NULL);
+  (void)c;
+
+return avail;
+}
+
+// UNSTABLE WRITE of one range, short writes are sent again from where
+// server stopped. Used by put and by upload of trees.
+typedef struct {
+
+  t_rpccall call;
+  WRITE3res res;
+
+  offset3 offset;
+  u_int count;    // bytes to write
+  u_int len;      // bytes acknowledged by server
+
+  char *data;     // own buffer or part of mapped file
+
+} t_nfs3wreq;
+
+// send part of range server didn't acknowledge yet
+static int nfs3wreqsend( t_nfsclt *nfsclt, t_nfs3wreq *w, nfs_fh3 *fh,
+    void (*donefn)( t_rpcmux *, t_rpccall * ), void *arg ) {
+
+  WRITE3args wargs;
+
+  memset( &wargs, 0, sizeof(wargs));
+  wargs.file = *fh;
+  wargs.offset = w->offset + w->len;
+  wargs.count = w->count - w->len;
+  wargs.stable = UNSTABLE;
+  wargs.data.data_len = wargs.count;
+
+  memset( &w->res, 0, sizeof(w->res));
+  w->call.xres = (xdrproc_t)NFS3XDR(WRITE3res);
+  w->call.res = &w->res;
+  w->call.donefn = donefn;
+  w->call.arg = arg;
+
+return rpcgroup_submitv(&nfsclt->nfsgroup, &w->call, NFSPROC3_WRITE,
+    (xdrproc_t)nfs3xdrwritehead, &wargs, w->data + w->len, wargs.count);
+}
+
+// Check reply of WRITE, path is for messages. Returns result with count
+// server accepted, caller adds it to len after handling verifier, or
+// NULL after failure was reported.
+static WRITE3resok *nfs3wreqdone( t_nfsclt *nfsclt, t_nfs3wreq *w, nfs_fh3 *fh,
+    char *path ) {
+
+  WRITE3resok *wresok = &w->res.WRITE3res_u.resok;
+
+  if ( w->call.stat != RPC_SUCCESS ) {
+    fprintf(stderr, "%s: %s\n", path, clnt_sperrno(w->call.stat));
+    return NULL;
+  }
+
+  if ( w->res.status != NFS3_OK ) {
+    fprintf(stderr, "Write failed: %s - (%d) %s\n", path,
+        w->res.status, nfs3_error(w->res.status));
+    return NULL;
+  }
+
+  if ( wresok->count == 0 || wresok->count > w->count - w->len ) {
+    fprintf(stderr, "Write failed: %s - server accepted %u bytes but %u requested\n",
+        path, wresok->count, w->count - w->len);
+    return NULL;
+  }
+
+  nfs3cachewcc( nfsclt, fh, &wresok->file_wcc);
+
+return wresok;
+}
+
+struct s_nfs3writepipe;
+
+// One WRITE request of the pipeline
+typedef struct {
+
+  t_nfs3wreq w;
+  struct s_nfs3writepipe *pipe;
+
+  int busy;       // waiting for reply
+
+} t_nfs3writeslot;
+
+typedef struct s_nfs3writepipe {
+
+  t_nfsclt *nfsclt;
+  t_nfsfile *nfsfile;
+  t_nfs3wranges *uncommitted;
+
+  int outstanding;  // calls waiting for reply
+  long total;
+  int err;
+
+} t_nfs3writepipe;
+
+static void nfs3writeslotdone( t_rpcmux *mux, t_rpccall *call );
+
+static int nfs3writeslotsend( t_nfs3writeslot *slot ) {
+
+  t_nfs3writepipe *pipe = slot->pipe;
+
+  if ( nfs3wreqsend(pipe->nfsclt, &slot->w, NFS3FH(&pipe->nfsfile->fh.nfs3),
+      nfs3writeslotdone, slot) == -1 )
+    return -1;
+
+  slot->busy = 1;
+  pipe->outstanding++;
+
+return 0;
+}
+
+static void nfs3writeslotdone( t_rpcmux *mux, t_rpccall *call ) {
+
+  t_nfs3writeslot *slot = (t_nfs3writeslot *)call->arg;
+  t_nfs3writepipe *pipe = slot->pipe;
+  t_nfsfile *nfsfile = pipe->nfsfile;
+  WRITE3resok *wresok;
+
+  slot->busy = 0;
+  pipe->outstanding--;
+
+  if ( (wresok = nfs3wreqdone(pipe->nfsclt, &slot->w, NFS3FH(&nfsfile->fh.nfs3),
+      nfsfile->path)) == NULL )
+    pipe->err = 1;
+
+  if ( pipe->err ) return;  // let outstanding replies drain
+
+  if ( wresok->committed == UNSTABLE ) {
+    if ( nfs3wrangeadd(pipe->uncommitted, slot->w.offset + slot->w.len,
+        wresok->count, wresok->verf) == -1 )
+      pipe->err = 1;
+  }
+
+  slot->w.len += wresok->count;
+  pipe->total += wresok->count;
+
+  if ( wresok->file_wcc.after.attributes_follow ) {
+    memcpy(&nfsfile->attr.nfs3,
+      &wresok->file_wcc.after.post_op_attr_u.attributes,
+      sizeof(fattr3));
+  }
+
+  // short write, send the rest
+  if ( slot->w.len < slot->w.count && nfs3writeslotsend( slot ) == -1 )
+    pipe->err = 1;
+}
+
+// Send todo ranges of local file fd with UNSTABLE writes.
+// Ranges waiting for commit are appended to uncommitted.
+// When file is mapped, data is sent directly from map.
+static long nfs3writepipe(
+    t_nfsclt *nfsclt, t_nfsfile *nfsfile, int fd, char *map,
+    t_nfs3wrange *todo, int ntodo, t_nfs3wranges *uncommitted ) {
+
+  t_nfs3writeslot *slots, *slot;
+  t_nfs3writepipe pipe;
+  int window, chunk = nfsclt->fsinfo.wtpref;
+  int ri = 0, i, rlen;
+  long roff = 0;
+
+  window = nfsclt->window > 0 ? nfsclt->window : 1;
+
+  memset(&pipe, 0, sizeof(pipe));
+  pipe.nfsclt = nfsclt;
+  pipe.nfsfile = nfsfile;
+  pipe.uncommitted = uncommitted;
+
+  if ( (slots = calloc(window, sizeof(t_nfs3writeslot))) == NULL ) {
+    perror("calloc()");
+    return -1;
+  }
+
+  for ( i = 0; i < window ; i++ ) {
+    slots[i].pipe = &pipe;
+
+    if ( map ) continue;
+
+    if ( (slots[i].w.data = malloc(chunk)) == NULL ) {
+      perror("malloc()");
+      pipe.err = 1;
+      goto END;
+    }
+  }
+
+  while ( 1 ) {
+
+    // fill the window
+    while ( !pipe.err && pipe.outstanding < window && ri < ntodo ) {
+
+      if ( roff >= todo[ri].count ) {
+        ri++;
+        roff = 0;
+        continue;
+      }
+
+      for ( i = 0; slots[i].busy ; i++ ) ;
+      slot = &slots[i];
+
+      slot->w.offset = todo[ri].offset + roff;
+      slot->w.count = (todo[ri].count - roff > chunk) ? chunk : todo[ri].count - roff;
+      slot->w.len = 0;
+
+      if ( map ) {
+        slot->w.data = map + slot->w.offset;
+        rlen = nfs3mapavail(fd, map, slot->w.offset, slot->w.count);
+      } else {
+        rlen = pread(fd, slot->w.data, slot->w.count, slot->w.offset);
+      }
+
+      if ( rlen == -1 ) {
+        perror(map ? "fstat()" : "pread()");
+        pipe.err = 1;
+        break;
+      }
+
+      // local file is shorter than expected
+      if ( rlen == 0 ) {
+        ri++;
+        roff = 0;
+        continue;
+      }
+
+      slot->w.count = rlen;
+
+      if ( nfs3writeslotsend( slot ) == -1 ) {
+        pipe.err = 1;
+        break;
+      }
+
+      roff += slot->w.count;
+    }
+
+    if ( pipe.outstanding == 0 ) break;
+
+    // on failure outstanding calls are completed with error
+    rpcgroup_run(&nfsclt->nfsgroup);
+  }
+
+END:
+  if ( !map ) {
+    for ( i = 0; i < window ; i++ )
+      if ( slots[i].w.data ) free(slots[i].w.data);
+  }
+  free(slots);
+
+return pipe.err ? -1 : pipe.total;
+}
+
+// Maximum retransmissions of whole upload, after server lost uncommitted data
+#define NFS3_COMMIT_RETRIES 3
+
+long nfs3filewrite( t_nfsclt *nfsclt, t_nfsfile *nfsfile, int fd ) {
+
+  t_nfs3wranges uncommitted, todo;
+  t_nfs3wrange whole;
+  COMMIT3args cargs;
+  COMMIT3res *cres;
+  struct stat filestat;
+  long total = -1;
+  int i, retry;
+  char *map;
+
+  if ( nfsfile->attr.nfs3.type != NF3REG ) {
+    fprintf(stderr, "%s: is not a regular file\n", nfsfile->path);
+    return -1;
+  }
+
+  if ( fstat(fd, &filestat) == -1 ) {
+    perror("fstat()");
+    return -1;
+  }
+
+  memset(&uncommitted, 0, sizeof(uncommitted));
+  memset(&todo, 0, sizeof(todo));
+
+  whole.offset = 0;
+  whole.count = filestat.st_size;
+
+  // shrinking is checked before each range is sent from map
+  map = nfs3filewritemap(fd, filestat.st_size);
+
+  total = nfs3writepipe( nfsclt, nfsfile, fd, map, &whole, 1, &uncommitted );
+
+  for ( retry = 0; total != -1 && uncommitted.len ; retry++ ) {
+
+    memset(&cargs, 0, sizeof(cargs));
+    cargs.file = *NFS3FH(&nfsfile->fh.nfs3);
+    cargs.offset = 0;
+    cargs.count = 0;  // commit whole file
+
+    cres = nfsproc3_commit_3(&cargs, nfsclt->nfs.client);
+
+    if ( cres == NULL ) {
+      clnt_perror(nfsclt->nfs.client, "nfsproc3_commit_3()");
+      total = -1;
+      break;
+    }
+
+    if ( cres->status != NFS3_OK ) {
+      fprintf(stderr, "Commit failed: %s - (%d) %s\n", nfsfile->path,
+          cres->status, nfs3_error(cres->status));
+      total = -1;
+      break;
+    }
+
+    if ( cres->COMMIT3res_u.resok.file_wcc.after.attributes_follow ) {
+      memcpy(&nfsfile->attr.nfs3,
+        &cres->COMMIT3res_u.resok.file_wcc.after.post_op_attr_u.attributes,
+        sizeof(fattr3));
+    }
+
+    nfs3cachewcc( nfsclt, NFS3FH(&nfsfile->fh.nfs3), &cres->COMMIT3res_u.resok.file_wcc);
+
+    // server reboot changes verifier, data written
+    // before that could be lost and must be sent again
+    todo.len = 0;
+    for ( i = 0; i < uncommitted.len ; i++ ) {
+      if ( memcmp(uncommitted.ranges[i].verf, cres->COMMIT3res_u.resok.verf,
+          NFS3_WRITEVERFSIZE) ) {
+
+        if ( nfs3wrangeadd(&todo, uncommitted.ranges[i].offset,
+            uncommitted.ranges[i].count, uncommitted.ranges[i].verf) == -1 ) {
+          total = -1;
+          break;
+        }
+      }
+    }
+
+    uncommitted.len = 0;
+    if ( total == -1 || todo.len == 0 ) break;
+
+    nfs3wrangejoin(&todo);
+
+    if ( retry == NFS3_COMMIT_RETRIES ) {
+      fprintf(stderr, "Commit failed: %s - write verifier keeps changing\n",
+          nfsfile->path);
+      total = -1;
+      break;
+    }
+
+    fprintf(stderr, "%s: server lost uncommitted data, resending %d ranges\n",
+        nfsfile->path, todo.len);
+
+    if ( nfs3writepipe( nfsclt, nfsfile, fd, map, todo.ranges, todo.len, &uncommitted ) == -1 )
+      total = -1;
+  }
+
+  if ( map ) munmap(map, filestat.st_size);
+  if ( uncommitted.ranges ) free(uncommitted.ranges);
+  if ( todo.ranges ) free(todo.ranges);
+
+return total;
+}
+
+long nfsfilewrite( t_nfsclt *nfsclt, t_nfsfile *nfsfile, int fd ) {
+
+  switch ( nfsclt->version ) {
+    case 30:
+      return nfs3filewrite( nfsclt, nfsfile, fd );
+    break;
+  }
+
+return -1;
+}
+
+// Recursive upload. Local tree is walked with readdir() and remote
+// directories, files and links are created with many MKDIR, CREATE and
+// SYMLINK calls in flight. Local directory is read only after server
+// gave us handle of it's remote copy. File contents are sent with
+// UNSTABLE writes through a pool of window WRITE slots shared by all
+// files, each file is committed as soon as it's last range is written.
+//
+// Synchronizing reads existing remote directories with READDIRPLUS and
+// skips files which remote copy has the same size and mtime. Ranges of
+// other existing files are read first and written only if they differ,
+// at the end times of local file are set on remote one.
+
+// files queued per WRITE slot before we stop reading local directories
+#define NFS3_UPLOAD_QUEUE 4
+
+struct s_nfs3upload;
+
+typedef struct s_nfs3udir {
+
+  struct s_nfs3udir *next;      // mkdir or walk queue
+  struct s_nfs3udir *all;       // all directories, freed at the end
+
+  t_rpccall call;
+  union {
+    MKDIR3res mkdir;
+    LOOKUP3res lookup;          // directory already existed
+  } res;
+  struct s_nfs3upload *upload;
+  int lookup;
+
+  struct s_nfs3udir *parent;
+  struct stat st;
+  char *name;
+  char *lpath;
+
+  t_nfs3fh fh;                  // remote handle, when created
+  int existed;                  // could have entries already
+
+} t_nfs3udir;
+
+// Entry of existing remote directory
+typedef struct {
+
+  char *name;
+  t_nfs3fh fh;
+  fattr3 attr;
+
+} t_nfs3uremote;
+
+typedef struct s_nfs3ufile {
+
+  struct s_nfs3ufile *next;
+
+  t_rpccall call;
+  union {
+    CREATE3res create;
+    SYMLINK3res symlink;
+    REMOVE3res remove;          // link existed, it's replaced
+    COMMIT3res commit;
+    SETATTR3res setattr;
+  } res;
+  struct s_nfs3upload *upload;
+  int removing;
+
+  t_nfs3udir *dir;
+  struct stat st;
+  char *name;
+  char *lpath;
+  char *target;                 // links only
+
+  t_nfs3fh fh;
+  int fd;
+  char *map;                    // whole file, if it could be mapped
+  size_t mapsize;
+
+  int delta;                    // remote copy exists, send changed ranges
+  size3 rsize;                  // of remote copy
+
+  offset3 offset;               // next range to send
+  int outstanding;              // ranges in flight
+  int queued;                   // still has ranges to send
+
+  int unstable;                 // has data to commit
+  int verfchanged;              // server rebooted while we were writing
+  writeverf3 verf;
+  int retries;
+
+  int err;
+
+} t_nfs3ufile;
+
+// One WRITE request, data is buf or part of mapped file
+typedef struct s_nfs3uslot {
+
+  struct s_nfs3uslot *next;     // free slots chain
+
+  t_nfs3wreq w;
+  struct s_nfs3upload *upload;
+  t_nfs3ufile *file;
+
+  char *buf;
+
+  READ3res rres;  // remote data, when synchronizing
+  char *rbuf;
+
+} t_nfs3uslot;
+
+typedef struct s_nfs3upload {
+
+  t_nfsclt *nfsclt;
+
+  t_nfs3udir *mkdirs;           // waiting for MKDIR
+  t_nfs3udir *walks;            // created, waiting to be read
+  t_nfs3udir *dirs;             // all of them
+
+  t_nfs3ufile *creates;         // waiting for CREATE or SYMLINK
+  int ncreates;
+  t_nfs3ufile *files;           // with ranges to send
+  t_nfs3ufile *filestail;
+  int nqueued;
+  t_nfs3uslot *freeslots;
+
+  int outstanding;
+  int failed;                   // can't send more calls
+  int sync;
+
+  long ndirs;
+  long nfiles;
+  long nlinks;
+  long nunchanged;
+  long errors;
+  long long bytes;
+  long long read;
+
+} t_nfs3upload;
+
+static void nfs3uploadsattr( t_nfs3upload *u, sattr3 *sattr, struct stat *st ) {
+
+  struct stat fstat = *st;
+
+  fstat.st_dev = 0;   // don't try to create device
+  fstat.st_uid = u->nfsclt->uid;
+  fstat.st_gid = u->nfsclt->gid;
+
+  stat_to_sattr3(sattr, &fstat);
+}
+
+static void nfs3uploadfinish( t_nfs3upload *u, t_nfs3ufile *f ) {
+
+  if ( f->err )
+    u->errors++;
+  else if ( f->target )
+    u->nlinks++;
+  else
+    u->nfiles++;
+
+  if ( f->map ) munmap(f->map, f->mapsize);
+  if ( f->fd >= 0 ) close(f->fd);
+
+  free(f->name);
+  free(f->lpath);
+  if ( f->target ) free(f->target);
+  free(f);
+}
+
+// Take ownership of name and lpath, queue object for creation in d.
+// Remote object of the same name is r, if it's known.
+static void nfs3uploadentry( t_nfs3upload *u, t_nfs3udir *d, char *name, char *lpath,
+    t_nfs3uremote *r ) {
+
+  t_nfs3udir *nd;
+  t_nfs3ufile *f;
+  struct stat st;
+  ssize_t n;
+
+  if ( lstat(lpath, &st) == -1 ) {
+    fprintf(stderr, "%s: %s\n", lpath, strerror(errno));
+    u->errors++;
+    goto FREE;
+  }
+
+  if ( S_ISDIR(st.st_mode) ) {
+
+    if ( (nd = calloc(1, sizeof(t_nfs3udir))) == NULL ) {
+      perror("calloc()");
+      u->errors++;
+      goto FREE;
+    }
+
+    nd->upload = u;
+    nd->parent = d;
+    nd->st = st;
+    nd->name = name;
+    nd->lpath = lpath;
+
+    nd->all = u->dirs;
+    u->dirs = nd;
+
+    // no MKDIR, it's read as soon as possible
+    if ( r && r->attr.type == NF3DIR ) {
+      nd->fh = r->fh;
+      nd->existed = 1;
+      u->ndirs++;
+
+      nd->next = u->walks;
+      u->walks = nd;
+      return;
+    }
+
+    nd->next = u->mkdirs;
+    u->mkdirs = nd;
+
+    return;
+  }
+
+  if ( !S_ISREG(st.st_mode) && !S_ISLNK(st.st_mode) ) {
+    fprintf(stderr, "%s: skipping %s\n", lpath, stat_ftype(st.st_mode));
+    goto FREE;
+  }
+
+  // anything else is replaced
+  if ( r && (!S_ISREG(st.st_mode) || r->attr.type != NF3REG) ) r = NULL;
+
+  if ( r && r->attr.size == st.st_size
+      && r->attr.mtime.seconds == st.st_mtim.tv_sec
+      && r->attr.mtime.nseconds == st.st_mtim.tv_nsec ) {
+    u->nunchanged++;
+    goto FREE;
+  }
+
+  // it's cheaper to replace it
+  if ( r && !nfs3syncdelta(u->nfsclt, st.st_size, r->attr.size, u->nfsclt->fsinfo.wtpref) )
+    r = NULL;
+
+  if ( (f = calloc(1, sizeof(t_nfs3ufile))) == NULL ) {
+    perror("calloc()");
+    u->errors++;
+    goto FREE;
+  }
+
+  f->upload = u;
+  f->dir = d;
+  f->st = st;
+  f->name = name;
+  f->lpath = lpath;
+  f->fd = -1;
+
+  if ( S_ISLNK(st.st_mode) ) {
+    if ( (f->target = malloc(PATH_MAX)) == NULL
+        || (n = readlink(lpath, f->target, PATH_MAX - 1)) == -1 ) {
+      fprintf(stderr, "%s: %s\n", lpath, strerror(errno));
+      f->err = 1;
+      nfs3uploadfinish(u, f);
+      return;
+    }
+
+    f->target[n] = '\0';
+  }
+
+  // no CREATE, it would truncate remote copy
+  if ( r ) {
+    f->fh = r->fh;
+    f->delta = 1;
+    f->rsize = r->attr.size;
+    f->queued = 1;
+
+    if ( u->filestail )
+      u->filestail->next = f;
+    else
+      u->files = f;
+    u->filestail = f;
+    u->nqueued++;
+
+    return;
+  }
+
+  f->next = u->creates;
+  u->creates = f;
+  u->ncreates++;
+
+  return;
+
+FREE:
+  free(name);
+  free(lpath);
+}
+
+static int nfs3uploadremotecmp( const void *a, const void *b ) {
+
+return strcmp(((t_nfs3uremote *)a)->name, ((t_nfs3uremote *)b)->name);
+}
+
+static void nfs3uploadremotefree( t_nfs3uremote *remote, int n ) {
+
+  int i;
+
+  for ( i = 0; i < n ; i++ ) free(remote[i].name);
+  if ( remote ) free(remote);
+}
+
+// Entries of existing remote directory, sorted by name. Other calls
+// are completed while it's read.
+static int nfs3uploadremote( t_nfs3upload *u, t_nfs3udir *d,
+    t_nfs3uremote **remote, int *nremote ) {
+
+  t_nfs3uremote *list = NULL, *tmp;
+  tp_nfsdirent ent;
+  entryplus3 *ep;
+  t_nfsdir nfsdir;
+  int n = 0, max = 0, ret;
+
+  if ( nfs3diropenfh(u->nfsclt, &nfsdir, &d->fh, 1) == -1 ) return -1;
+
+  while ( (ret = nfs3dirnext(u->nfsclt, &nfsdir, &ent)) == 1 ) {
+
+    ep = ent.nfs3plus;
+
+    // without them entry is replaced as if it wasn't there
+    if ( !ep->name_handle.handle_follows || !ep->name_attributes.attributes_follow )
+      continue;
+
+    if ( n == max ) {
+      max = max ? max * 2 : 64;
+
+      if ( (tmp = realloc(list, max * sizeof(t_nfs3uremote))) == NULL ) {
+        perror("realloc()");
+        ret = -1;
+        break;
+      }
+
+      list = tmp;
+    }
+
+    if ( (list[n].name = strdup(ep->name)) == NULL ) {
+      perror("strdup()");
+      ret = -1;
+      break;
+    }
+
+    nfs3fhset(&list[n].fh, &ep->name_handle.post_op_fh3_u.handle);
+    list[n].attr = ep->name_attributes.post_op_attr_u.attributes;
+    n++;
+  }
+
+  nfs3dirclose(u->nfsclt, &nfsdir);
+
+  if ( ret == -1 ) {
+    fprintf(stderr, "%s: can't read remote directory\n", d->lpath);
+    nfs3uploadremotefree(list, n);
+    return -1;
+  }
+
+  qsort(list, n, sizeof(t_nfs3uremote), nfs3uploadremotecmp);
+
+  *remote = list;
+  *nremote = n;
+
+return 0;
+}
+
+// read local directory, which remote copy was just created
+static void nfs3uploadwalk( t_nfs3upload *u, t_nfs3udir *d ) {
+
+  t_nfs3uremote *remote = NULL, key;
+  struct dirent *de;
+  char *name, *lpath;
+  int nremote = 0;
+  DIR *dir;
+
+  if ( (dir = opendir(d->lpath)) == NULL ) {
+    fprintf(stderr, "%s: %s\n", d->lpath, strerror(errno));
+    u->errors++;
+    return;
+  }
+
+  // files are replaced if it can't be read
+  if ( u->sync && d->existed && nfs3uploadremote(u, d, &remote, &nremote) == -1 )
+    u->errors++;
+
+  while ( (de = readdir(dir)) != NULL ) {
+
+    if ( !strcmp(de->d_name, ".") || !strcmp(de->d_name, "..") ) continue;
+
+    name = strdup(de->d_name);
+    lpath = malloc(strlen(d->lpath) + strlen(de->d_name) + 2);
+
+    if ( name == NULL || lpath == NULL ) {
+      perror("malloc()");
+      if ( name ) free(name);
+      if ( lpath ) free(lpath);
+      u->errors++;
+      continue;
+    }
+
+    sprintf(lpath, "%s/%s", d->lpath, de->d_name);
+
+    key.name = name;
+    nfs3uploadentry(u, d, name, lpath, nremote == 0 ? NULL
+        : bsearch(&key, remote, nremote, sizeof(t_nfs3uremote), nfs3uploadremotecmp));
+  }
+
+  closedir(dir);
+  nfs3uploadremotefree(remote, nremote);
+}
+
+static void nfs3uploaddirdone( t_rpcmux *mux, t_rpccall *call );
+
+static int nfs3uploaddirsend( t_nfs3upload *u, t_nfs3udir *d ) {
+
+  MKDIR3args args;
+  LOOKUP3args largs;
+  int ret;
+
+  memset(&d->res, 0, sizeof(d->res));
+  d->call.donefn = nfs3uploaddirdone;
+  d->call.arg = d;
+
+  if ( d->lookup ) {
+    memset(&largs, 0, sizeof(largs));
+    largs.what.dir = *NFS3FH(&d->parent->fh);
+    largs.what.name = d->name;
+
+    d->call.xres = (xdrproc_t)NFS3XDR(LOOKUP3res);
+    d->call.res = &d->res.lookup;
+
+    ret = rpcgroup_submit(&u->nfsclt->nfsgroup, &d->call, NFSPROC3_LOOKUP,
+        (xdrproc_t)NFS3XDR(LOOKUP3args), &largs);
+  } else {
+    memset(&args, 0, sizeof(args));
+    args.where.dir = *NFS3FH(&d->parent->fh);
+    args.where.name = d->name;
+    nfs3uploadsattr(u, &args.attributes, &d->st);
+
+    d->call.xres = (xdrproc_t)xdr_MKDIR3res;
+    d->call.res = &d->res.mkdir;
+
+    ret = rpcgroup_submit(&u->nfsclt->nfsgroup, &d->call, NFSPROC3_MKDIR,
+        (xdrproc_t)xdr_MKDIR3args, &args);
+  }
+
+  if ( ret == -1 ) return -1;
+
+  u->outstanding++;
+
+return 0;
+}
+
+static void nfs3uploaddirdone( t_rpcmux *mux, t_rpccall *call ) {
+
+  t_nfs3udir *d = (t_nfs3udir *)call->arg;
+  t_nfs3upload *u = d->upload;
+  MKDIR3resok *mres = &d->res.mkdir.MKDIR3res_u.resok;
+  LOOKUP3resok *lres = &d->res.lookup.LOOKUP3res_u.resok;
+
+  u->outstanding--;
+
+  if ( call->stat != RPC_SUCCESS ) {
+    fprintf(stderr, "%s: %s\n", d->lpath, clnt_sperrno(call->stat));
+    u->errors++;
+    return;
+  }
+
+  if ( d->lookup ) {
+
+    if ( d->res.lookup.status != NFS3_OK ) {
+      fprintf(stderr, "Failed to lookup: %s - (%d) %s\n", d->lpath,
+          d->res.lookup.status, nfs3_error(d->res.lookup.status));
+      u->errors++;
+    } else if ( lres->obj_attributes.attributes_follow
+        && lres->obj_attributes.post_op_attr_u.attributes.type != NF3DIR ) {
+      fprintf(stderr, "%s: exists and is not a directory\n", d->lpath);
+      u->errors++;
+    } else {
+      nfs3fhset(&d->fh, &lres->object);
+      d->existed = 1;
+    }
+
+    xdr_free((xdrproc_t)NFS3XDR(LOOKUP3res), (char *)&d->res.lookup);
+
+  } else {
+
+    if ( d->res.mkdir.status == NFS3_OK ) {
+      nfs3cachenew( u->nfsclt, NFS3FH(&d->parent->fh), d->name, &mres->obj,
+          &mres->obj_attributes, &mres->dir_wcc);
+
+      if ( mres->obj.handle_follows )
+        nfs3fhset(&d->fh, &mres->obj.post_op_fh3_u.handle);
+    }
+
+    if ( d->res.mkdir.status == NFS3_OK || d->res.mkdir.status == NFS3ERR_EXIST ) {
+
+      if ( d->fh.len == 0 ) {
+        // exists or server didn't tell handle, ask for it
+        xdr_free((xdrproc_t)xdr_MKDIR3res, (char *)&d->res.mkdir);
+        d->lookup = 1;
+
+        if ( nfs3uploaddirsend(u, d) == 0 ) return;
+
+        u->failed = 1;
+        u->errors++;
+        return;
+      }
+
+    } else {
+      fprintf(stderr, "Creating directory: %s - (%d) %s\n", d->lpath,
+          d->res.mkdir.status, nfs3_error(d->res.mkdir.status));
+      u->errors++;
+    }
+
+    xdr_free((xdrproc_t)xdr_MKDIR3res, (char *)&d->res.mkdir);
+  }
+
+  if ( d->fh.len == 0 ) return;
+
+  u->ndirs++;
+
+  d->next = u->walks;
+  u->walks = d;
+}
+
+static void nfs3uploadcreatedone( t_rpcmux *mux, t_rpccall *call );
+
+static int nfs3uploadcreatesend( t_nfs3upload *u, t_nfs3ufile *f ) {
+
+  CREATE3args cargs;
+  SYMLINK3args sargs;
+  REMOVE3args rargs;
+  int ret;
+
+  memset(&f->res, 0, sizeof(f->res));
+  f->call.donefn = nfs3uploadcreatedone;
+  f->call.arg = f;
+
+  if ( f->removing ) {
+
+    memset(&rargs, 0, sizeof(rargs));
+    rargs.object.dir = *NFS3FH(&f->dir->fh);
+    rargs.object.name = f->name;
+
+    f->call.xres = (xdrproc_t)xdr_REMOVE3res;
+    f->call.res = &f->res.remove;
+
+    ret = rpcgroup_submit(&u->nfsclt->nfsgroup, &f->call, NFSPROC3_REMOVE,
+        (xdrproc_t)xdr_REMOVE3args, &rargs);
+
+  } else if ( f->target ) {
+
+    memset(&sargs, 0, sizeof(sargs));
+    sargs.where.dir = *NFS3FH(&f->dir->fh);
+    sargs.where.name = f->name;
+    nfs3uploadsattr(u, &sargs.symlink.symlink_attributes, &f->st);
+    sargs.symlink.symlink_data = f->target;
+
+    f->call.xres = (xdrproc_t)xdr_SYMLINK3res;
+    f->call.res = &f->res.symlink;
+
+    ret = rpcgroup_submit(&u->nfsclt->nfsgroup, &f->call, NFSPROC3_SYMLINK,
+        (xdrproc_t)xdr_SYMLINK3args, &sargs);
+
+  } else {
+
+    // replace existing file, like cp does
+    memset(&cargs, 0, sizeof(cargs));
+    cargs.where.dir = *NFS3FH(&f->dir->fh);
+    cargs.where.name = f->name;
+    cargs.how.mode = UNCHECKED;
+    nfs3uploadsattr(u, &cargs.how.createhow3_u.obj_attributes, &f->st);
+    cargs.how.createhow3_u.obj_attributes.size.set_it = TRUE;
+    cargs.how.createhow3_u.obj_attributes.size.set_size3_u.size = 0;
+
+    f->call.xres = (xdrproc_t)xdr_CREATE3res;
+    f->call.res = &f->res.create;
+
+    ret = rpcgroup_submit(&u->nfsclt->nfsgroup, &f->call, NFSPROC3_CREATE,
+        (xdrproc_t)xdr_CREATE3args, &cargs);
+  }
+
+  if ( ret == -1 ) return -1;
+
+  u->outstanding++;
+
+return 0;
+}
+
+static void nfs3uploadcreatedone( t_rpcmux *mux, t_rpccall *call ) {
+
+  t_nfs3ufile *f = (t_nfs3ufile *)call->arg;
+  t_nfs3upload *u = f->upload;
+  CREATE3resok *cres = &f->res.create.CREATE3res_u.resok;
+  SYMLINK3resok *sres = &f->res.symlink.SYMLINK3res_u.resok;
+
+  u->outstanding--;
+
+  if ( call->stat != RPC_SUCCESS ) {
+    fprintf(stderr, "%s: %s\n", f->lpath, clnt_sperrno(call->stat));
+    f->err = 1;
+    nfs3uploadfinish(u, f);
+    return;
+  }
+
+  if ( f->removing ) {
+
+    if ( f->res.remove.status == NFS3_OK )
+      nfs3cachewcc( u->nfsclt, NFS3FH(&f->dir->fh), &f->res.remove.REMOVE3res_u.resok.dir_wcc);
+
+    dnlc_remove(&u->nfsclt->dnlc, NFS3FH(&f->dir->fh), f->name);
+
+    if ( f->res.remove.status != NFS3_OK ) {
+      fprintf(stderr, "Removing: %s - (%d) %s\n", f->lpath,
+          f->res.remove.status, nfs3_error(f->res.remove.status));
+      f->err = 1;
+    }
+
+    xdr_free((xdrproc_t)xdr_REMOVE3res, (char *)&f->res.remove);
+    f->removing = 0;
+
+    if ( !f->err && nfs3uploadcreatesend(u, f) == 0 ) return;
+
+    if ( !f->err ) u->failed = 1;
+    f->err = 1;
+
+  } else if ( f->target ) {
+
+    if ( f->res.symlink.status == NFS3_OK ) {
+      nfs3cachenew( u->nfsclt, NFS3FH(&f->dir->fh), f->name, &sres->obj,
+          &sres->obj_attributes, &sres->dir_wcc);
+
+    } else if ( f->res.symlink.status == NFS3ERR_EXIST && !f->retries++ ) {
+
+      // replace link left by previous upload
+      xdr_free((xdrproc_t)xdr_SYMLINK3res, (char *)&f->res.symlink);
+      f->removing = 1;
+
+      if ( nfs3uploadcreatesend(u, f) == 0 ) return;
+
+      u->failed = 1;
+      f->err = 1;
+      nfs3uploadfinish(u, f);
+      return;
+
+    } else {
+      fprintf(stderr, "Creating symbolic link: %s - (%d) %s\n", f->lpath,
+          f->res.symlink.status, nfs3_error(f->res.symlink.status));
+      f->err = 1;
+    }
+
+    xdr_free((xdrproc_t)xdr_SYMLINK3res, (char *)&f->res.symlink);
+
+  } else {
+
+    if ( f->res.create.status != NFS3_OK ) {
+      fprintf(stderr, "Creating file: %s - (%d) %s\n", f->lpath,
+          f->res.create.status, nfs3_error(f->res.create.status));
+      f->err = 1;
+    } else {
+      nfs3cachenew( u->nfsclt, NFS3FH(&f->dir->fh), f->name, &cres->obj,
+          &cres->obj_attributes, &cres->dir_wcc);
+
+      if ( cres->obj.handle_follows ) {
+        nfs3fhset(&f->fh, &cres->obj.post_op_fh3_u.handle);
+      } else {
+        fprintf(stderr, "Creating file: %s - server didn't return handle\n",
+            f->lpath);
+        f->err = 1;
+      }
+    }
+
+    xdr_free((xdrproc_t)xdr_CREATE3res, (char *)&f->res.create);
+
+    if ( !f->err && f->st.st_size > 0 ) {
+
+      // contents will be sent by write slots
+      f->queued = 1;
+      f->next = NULL;
+
+      if ( u->filestail )
+        u->filestail->next = f;
+      else
+        u->files = f;
+      u->filestail = f;
+      u->nqueued++;
+
+      return;
+    }
+  }
+
+  nfs3uploadfinish(u, f);
+}
+
+static void nfs3uploadsetattrdone( t_rpcmux *mux, t_rpccall *call ) {
+
+  t_nfs3ufile *f = (t_nfs3ufile *)call->arg;
+  t_nfs3upload *u = f->upload;
+
+  u->outstanding--;
+
+  if ( call->stat != RPC_SUCCESS ) {
+    fprintf(stderr, "%s: %s\n", f->lpath, clnt_sperrno(call->stat));
+    f->err = 1;
+    nfs3uploadfinish(u, f);
+    return;
+  }
+
+  if ( f->res.setattr.status != NFS3_OK ) {
+    fprintf(stderr, "Setattr failed: %s - (%d) %s\n", f->lpath,
+        f->res.setattr.status, nfs3_error(f->res.setattr.status));
+    f->err = 1;
+  } else {
+    nfs3cachewcc( u->nfsclt, NFS3FH(&f->fh), &f->res.setattr.SETATTR3res_u.resok.obj_wcc);
+  }
+
+  xdr_free((xdrproc_t)xdr_SETATTR3res, (char *)&f->res.setattr);
+  nfs3uploadfinish(u, f);
+}
+
+// File is written and committed. Synchronized one gets times of local
+// file, so it's skipped next time, and is truncated if it was longer.
+static void nfs3uploaddone( t_nfs3upload *u, t_nfs3ufile *f ) {
+
+  SETATTR3args sargs;
+
+  if ( !u->sync || f->err || f->target ) {
+    nfs3uploadfinish(u, f);
+    return;
+  }
+
+  memset(&sargs, 0, sizeof(sargs));
+  sargs.object = *NFS3FH(&f->fh);
+  nfs3uploadsattr(u, &sargs.new_attributes, &f->st);
+
+  // owner was set by CREATE, changing it could be denied
+  sargs.new_attributes.uid.set_it = FALSE;
+  sargs.new_attributes.gid.set_it = FALSE;
+
+  if ( f->delta && f->rsize > f->st.st_size ) {
+    sargs.new_attributes.size.set_it = TRUE;
+    sargs.new_attributes.size.set_size3_u.size = f->st.st_size;
+  }
+
+  memset(&f->res, 0, sizeof(f->res));
+  f->call.xres = (xdrproc_t)xdr_SETATTR3res;
+  f->call.res = &f->res.setattr;
+  f->call.donefn = nfs3uploadsetattrdone;
+  f->call.arg = f;
+
+  if ( rpcgroup_submit(&u->nfsclt->nfsgroup, &f->call, NFSPROC3_SETATTR,
+      (xdrproc_t)xdr_SETATTR3args, &sargs) == -1 ) {
+    u->failed = 1;
+    f->err = 1;
+    nfs3uploadfinish(u, f);
+    return;
+  }
+
+  u->outstanding++;
+}
+
+static void nfs3uploadcommitdone( t_rpcmux *mux, t_rpccall *call ) {
+
+  t_nfs3ufile *f = (t_nfs3ufile *)call->arg;
+  t_nfs3upload *u = f->upload;
+  COMMIT3resok *cres = &f->res.commit.COMMIT3res_u.resok;
+
+  u->outstanding--;
+
+  if ( call->stat != RPC_SUCCESS ) {
+    fprintf(stderr, "%s: %s\n", f->lpath, clnt_sperrno(call->stat));
+    f->err = 1;
+    nfs3uploadfinish(u, f);
+    return;
+  }
+
+  if ( f->res.commit.status != NFS3_OK ) {
+    fprintf(stderr, "Commit failed: %s - (%d) %s\n", f->lpath,
+        f->res.commit.status, nfs3_error(f->res.commit.status));
+    f->err = 1;
+  } else {
+
+    nfs3cachewcc( u->nfsclt, NFS3FH(&f->fh), &cres->file_wcc);
+
+    // server reboot changes verifier, whole file is sent again
+    if ( f->verfchanged || memcmp(f->verf, cres->verf, NFS3_WRITEVERFSIZE) ) {
+
+      if ( f->retries++ == NFS3_COMMIT_RETRIES ) {
+        fprintf(stderr, "Commit failed: %s - write verifier keeps changing\n",
+            f->lpath);
+        f->err = 1;
+      } else {
+        fprintf(stderr, "%s: server lost uncommitted data, resending\n", f->lpath);
+
+        f->offset = 0;
+        f->unstable = 0;
+        f->verfchanged = 0;
+        f->queued = 1;
+        f->next = NULL;
+
+        if ( u->filestail )
+          u->filestail->next = f;
+        else
+          u->files = f;
+        u->filestail = f;
+        u->nqueued++;
+      }
+    }
+  }
+
+  xdr_free((xdrproc_t)xdr_COMMIT3res, (char *)&f->res.commit);
+
+  if ( !f->queued ) nfs3uploaddone(u, f);
+}
+
+// all ranges were written
+static void nfs3uploadcommit( t_nfs3upload *u, t_nfs3ufile *f ) {
+
+  COMMIT3args cargs;
+
+  if ( f->err || !f->unstable ) {
+    nfs3uploaddone(u, f);
+    return;
+  }
+
+  memset(&cargs, 0, sizeof(cargs));
+  cargs.file = *NFS3FH(&f->fh);
+  cargs.offset = 0;
+  cargs.count = 0;  // commit whole file
+
+  memset(&f->res, 0, sizeof(f->res));
+  f->call.xres = (xdrproc_t)xdr_COMMIT3res;
+  f->call.res = &f->res.commit;
+  f->call.donefn = nfs3uploadcommitdone;
+  f->call.arg = f;
+
+  if ( rpcgroup_submit(&u->nfsclt->nfsgroup, &f->call, NFSPROC3_COMMIT,
+      (xdrproc_t)xdr_COMMIT3args, &cargs) == -1 ) {
+    u->failed = 1;
+    f->err = 1;
+    nfs3uploadfinish(u, f);
+    return;
+  }
+
+  u->outstanding++;
+}
+
+static void nfs3uploadwritedone( t_rpcmux *mux, t_rpccall *call );
+
+static int nfs3uploadwritesend( t_nfs3uslot *slot ) {
+
+  t_nfs3upload *u = slot->upload;
+
+  if ( nfs3wreqsend(u->nfsclt, &slot->w, NFS3FH(&slot->file->fh),
+      nfs3uploadwritedone, slot) == -1 )
+    return -1;
+
+  u->outstanding++;
+  slot->file->outstanding++;
+
+return 0;
+}
+
+static void nfs3uploadreaddone( t_rpcmux *mux, t_rpccall *call );
+
+// read remote range before writing it
+static int nfs3uploadreadsend( t_nfs3uslot *slot ) {
+
+  t_nfs3upload *u = slot->upload;
+  READ3args rargs;
+
+  memset( &rargs, 0, sizeof(rargs));
+  rargs.file = *NFS3FH(&slot->file->fh);
+  rargs.offset = slot->w.offset;
+  rargs.count = slot->w.count;
+
+  memset( &slot->rres, 0, sizeof(slot->rres));
+  slot->rres.READ3res_u.resok.data.data_val = slot->rbuf;
+  slot->rres.READ3res_u.resok.data.data_len = slot->w.count;
+
+  slot->w.call.xres = (xdrproc_t)nfs3xdrreadinplace;
+  slot->w.call.res = &slot->rres;
+  slot->w.call.donefn = nfs3uploadreaddone;
+  slot->w.call.arg = slot;
+
+  if ( rpcgroup_submit(&u->nfsclt->nfsgroup, &slot->w.call, NFSPROC3_READ,
+      (xdrproc_t)NFS3XDR(READ3args), &rargs) == -1 )
+    return -1;
+
+  u->outstanding++;
+  slot->file->outstanding++;
+
+return 0;
+}
+
+static void nfs3uploadslotfree( t_nfs3uslot *slot );
+
+static void nfs3uploadreaddone( t_rpcmux *mux, t_rpccall *call ) {
+
+  t_nfs3uslot *slot = (t_nfs3uslot *)call->arg;
+  t_nfs3upload *u = slot->upload;
+  t_nfs3ufile *f = slot->file;
+  READ3res *rres = &slot->rres;
+
+  u->outstanding--;
+  f->outstanding--;
+
+  if ( call->stat != RPC_SUCCESS ) {
+    fprintf(stderr, "%s: %s\n", f->lpath, clnt_sperrno(call->stat));
+    f->err = 1;
+    nfs3uploadslotfree(slot);
+    return;
+  }
+
+  if ( rres->status != NFS3_OK ) {
+    fprintf(stderr, "Read failed: %s - (%d) %s\n", f->lpath,
+        rres->status, nfs3_error(rres->status));
+    f->err = 1;
+    nfs3uploadslotfree(slot);
+    return;
+  }
+
+  u->read += rres->READ3res_u.resok.data.data_len;
+
+  // server has it already, short read is sent whole
+  if ( rres->READ3res_u.resok.data.data_len == slot->w.count
+      && !memcmp(slot->rbuf, slot->w.data, slot->w.count) ) {
+    nfs3uploadslotfree(slot);
+    return;
+  }
+
+  if ( nfs3uploadwritesend( slot ) == 0 ) return;
+
+  f->err = 1;
+  u->failed = 1;
+  nfs3uploadslotfree(slot);
+}
+
+static void nfs3uploadslotfree( t_nfs3uslot *slot ) {
+
+  t_nfs3upload *u = slot->upload;
+  t_nfs3ufile *f = slot->file;
+
+  slot->file = NULL;
+  slot->next = u->freeslots;
+  u->freeslots = slot;
+
+  // last range of the file
+  if ( !f->queued && f->outstanding == 0 ) nfs3uploadcommit(u, f);
+}
+
+static void nfs3uploadwritedone( t_rpcmux *mux, t_rpccall *call ) {
+
+  t_nfs3uslot *slot = (t_nfs3uslot *)call->arg;
+  t_nfs3upload *u = slot->upload;
+  t_nfs3ufile *f = slot->file;
+  WRITE3resok *wresok;
+
+  u->outstanding--;
+  f->outstanding--;
+
+  if ( (wresok = nfs3wreqdone(u->nfsclt, &slot->w, NFS3FH(&f->fh), f->lpath)) == NULL )
+    f->err = 1;
+
+  if ( f->err ) {
+    nfs3uploadslotfree(slot);
+    return;
+  }
+
+  if ( wresok->committed == UNSTABLE ) {
+    if ( !f->unstable ) {
+      memcpy(f->verf, wresok->verf, NFS3_WRITEVERFSIZE);
+      f->unstable = 1;
+    } else if ( memcmp(f->verf, wresok->verf, NFS3_WRITEVERFSIZE) ) {
+      f->verfchanged = 1;
+    }
+  }
+
+  slot->w.len += wresok->count;
+  u->bytes += wresok->count;
+
+  // short write, send the rest
+  if ( slot->w.len < slot->w.count ) {
+    if ( nfs3uploadwritesend( slot ) == 0 ) return;
+
+    f->err = 1;
+    u->failed = 1;
+  }
+
+  nfs3uploadslotfree(slot);
+}
+
+// give free slots to created files
+static void nfs3uploadfill( t_nfs3upload *u ) {
+
+  int chunk = u->nfsclt->fsinfo.wtpref;
+  t_nfs3uslot *slot;
+  t_nfs3ufile *f;
+  struct stat st;
+  ssize_t rlen;
+
+  while ( (f = u->files) != NULL && u->freeslots && !u->failed ) {
+
+    if ( f->fd == -1 && !f->err ) {
+      if ( (f->fd = open(f->lpath, O_RDONLY | O_CLOEXEC)) == -1
+          || fstat(f->fd, &st) == -1 ) {
+        fprintf(stderr, "%s: %s\n", f->lpath, strerror(errno));
+        f->err = 1;
+      } else {
+        // size could change since directory was read
+        f->st.st_size = st.st_size;
+
+        // delta data is compared after reply comes, it's read into slot
+        f->map = f->delta ? NULL : nfs3filewritemap(f->fd, f->st.st_size);
+        f->mapsize = f->st.st_size;
+      }
+    }
+
+    if ( !f->err && f->offset < f->st.st_size ) {
+
+      slot = u->freeslots;
+
+      slot->file = f;
+      slot->w.offset = f->offset;
+      slot->w.count = (f->st.st_size - f->offset > chunk) ? chunk : f->st.st_size - f->offset;
+      slot->w.len = 0;
+
+      if ( f->map ) {
+        slot->w.data = f->map + slot->w.offset;
+        rlen = nfs3mapavail(f->fd, f->map, slot->w.offset, slot->w.count);
+      } else {
+        slot->w.data = slot->buf;
+        rlen = pread(f->fd, slot->w.data, slot->w.count, slot->w.offset);
+      }
+
+      if ( rlen == -1 ) {
+        fprintf(stderr, "%s: %s\n", f->lpath, strerror(errno));
+        f->err = 1;
+      } else if ( rlen == 0 ) {
+        // local file is shorter than it was
+        f->st.st_size = f->offset;
+      } else {
+        slot->w.count = rlen;
+        u->freeslots = slot->next;
+
+        // ranges which remote copy has are compared first
+        if ( (f->delta && slot->w.offset < f->rsize ?
+            nfs3uploadreadsend( slot ) : nfs3uploadwritesend( slot )) == -1 ) {
+          slot->file = NULL;
+          slot->next = u->freeslots;
+          u->freeslots = slot;
+
+          f->err = 1;
+          u->failed = 1;
+        } else {
+          f->offset += slot->w.count;
+        }
+      }
+    }
+
+    // all ranges sent
+    if ( f->err || f->offset >= f->st.st_size ) {
+      u->files = f->next;
+      if ( u->files == NULL ) u->filestail = NULL;
+      u->nqueued--;
+
+      f->queued = 0;
+      if ( f->outstanding == 0 ) nfs3uploadcommit(u, f);
+    }
+  }
+}
+
+long nfs3upload( t_nfsclt *nfsclt, char *lpath, char *rpath, int sync ) {
+
+  t_nfs3upload u;
+  t_nfs3udir top, *d;
+  t_nfs3uslot *slots;
+  t_nfs3ufile *f;
+  t_nfs3uremote topremote, *r = NULL;
+  LOOKUP3args largs;
+  LOOKUP3res *lres;
+  struct timespec start, end;
+  char *dir = NULL, *file = NULL, *path, buf[32];
+  int window, chunk = nfsclt->fsinfo.wtpref, i;
+
+  memset(&u, 0, sizeof(u));
+  u.nfsclt = nfsclt;
+  u.sync = sync;
+
+  // remote parent directory plays role of top directory
+  memset(&top, 0, sizeof(top));
+
+  if ( pathsplit(rpath, &dir, &file) == -1 || file == NULL ) {
+    fprintf(stderr, "%s: invalid remote name\n", rpath);
+    if ( dir ) free(dir);
+    return -1;
+  }
+
+  if ( nfs3dirfh( nfsclt, dir, &top.fh ) == -1 ) {
+    free(dir);
+    free(file);
+    return -1;
+  }
+
+  free(dir);
+
+  window = nfsclt->window > 0 ? nfsclt->window : 1;
+
+  if ( (slots = calloc(window, sizeof(t_nfs3uslot))) == NULL
+      || (path = strdup(lpath)) == NULL ) {
+    perror("calloc()");
+    if ( slots ) free(slots);
+    free(file);
+    return -1;
+  }
+
+  for ( i = 0; i < window ; i++ ) {
+    slots[i].upload = &u;
+
+    if ( (slots[i].buf = malloc(chunk)) == NULL
+        || (sync && (slots[i].rbuf = malloc(chunk)) == NULL) ) {
+      perror("malloc()");
+      u.failed = 1;
+      u.errors++;
+      break;
+    }
+
+    slots[i].next = u.freeslots;
+    u.freeslots = &slots[i];
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // it's fine if it doesn't exist yet
+  if ( sync ) {
+    memset(&largs, 0, sizeof(largs));
+    largs.what.dir = *NFS3FH(&top.fh);
+    largs.what.name = file;
+
+    lres = NFS3PROC(lookup)(&largs, nfsclt->nfs.client);
+
+    if ( lres && lres->status == NFS3_OK
+        && lres->LOOKUP3res_u.resok.obj_attributes.attributes_follow ) {
+      topremote.name = file;
+      nfs3fhset(&topremote.fh, &lres->LOOKUP3res_u.resok.object);
+      topremote.attr = lres->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes;
+      r = &topremote;
+    }
+  }
+
+  nfs3uploadentry(&u, &top, file, path, r);
+
+  while ( 1 ) {
+
+    while ( !u.failed && (d = u.mkdirs) != NULL && u.outstanding < window ) {
+      u.mkdirs = d->next;
+
+      if ( nfs3uploaddirsend(&u, d) == -1 ) {
+        u.failed = 1;
+        u.errors++;
+      }
+    }
+
+    // read directories only when there is not much to create and send
+    while ( !u.failed && (d = u.walks) != NULL
+        && u.ncreates + u.nqueued < NFS3_UPLOAD_QUEUE * window ) {
+      u.walks = d->next;
+      nfs3uploadwalk(&u, d);
+    }
+
+    while ( !u.failed && (f = u.creates) != NULL && u.outstanding < window ) {
+      u.creates = f->next;
+      u.ncreates--;
+
+      if ( nfs3uploadcreatesend(&u, f) == -1 ) {
+        u.failed = 1;
+        f->err = 1;
+        nfs3uploadfinish(&u, f);
+      }
+    }
+
+    nfs3uploadfill(&u);
+
+    if ( u.outstanding == 0 ) {
+      if ( u.failed || (u.mkdirs == NULL && u.walks == NULL
+          && u.creates == NULL && u.files == NULL) )
+        break;
+      continue;
+    }
+
+    // on failure outstanding calls are completed with error
+    rpcgroup_run(&nfsclt->nfsgroup);
+  }
+
+  // left after failure
+  while ( (f = u.creates) != NULL ) {
+    u.creates = f->next;
+    f->err = 1;
+    nfs3uploadfinish(&u, f);
+  }
+
+  while ( (f = u.files) != NULL ) {
+    u.files = f->next;
+    f->err = 1;
+    nfs3uploadfinish(&u, f);
+  }
+
+  for ( d = u.mkdirs; d ; d = d->next ) u.errors++;
+  for ( d = u.walks; d ; d = d->next ) u.errors++;
+
+  while ( (d = u.dirs) != NULL ) {
+    u.dirs = d->all;
+    free(d->name);
+    free(d->lpath);
+    free(d);
+  }
+
+  for ( i = 0; i < window ; i++ ) {
+    if ( slots[i].buf ) free(slots[i].buf);
+    if ( slots[i].rbuf ) free(slots[i].rbuf);
+  }
+  free(slots);
+
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  printf("%ld files, %ld directories, %ld links, %s in %.2f s",
+      u.nfiles, u.ndirs, u.nlinks, hrbytes(buf, sizeof(buf), u.bytes),
+      (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+  if ( sync )
+    printf(", %ld unchanged, %s compared", u.nunchanged,
+        hrbytes(buf, sizeof(buf), u.read));
+
+  if ( u.errors )
+    printf(", %ld errors", u.errors);
+
+  printf("\n");
+
+return u.errors ? -1 : u.bytes;
+}
+
+long nfssync( t_nfsclt *nfsclt, char *src, char *dst, int download ) {
+
+  switch ( nfsclt->version ) {
+    case 30:
+      return download ? nfs3mirror( nfsclt, src, dst, 1 )
+        : nfs3upload( nfsclt, src, dst, 1 );
+    break;
+  }
+
+return -1;
+}
+
+long nfsupload( t_nfsclt *nfsclt, char *lpath, char *rpath ) {
+
+  switch ( nfsclt->version ) {
+    case 30:
+      return nfs3upload( nfsclt, lpath, rpath, 0 );
+    break;
+  }
+
+return -1;
+}
+
+int nfsfilepwrite(
+    t_nfsclt *nfsclt, t_nfsfile *nfsfile, long offset,
+    char *data, int datalen ) {
+
+  switch ( nfsclt->version ) {
+    case 30:
+      return nfs3filepwrite( nfsclt, nfsfile, offset, data, datalen );
+    break;
+  }
+
+return -1;
+}
+
+int nfsfilepread(
+    t_nfsclt *nfsclt, t_nfsfile *nfsfile, long offset,
+    char *data, int datalen ) {
+
+  switch ( nfsclt->version ) {
+    case 30:
+      return nfs3filepread( nfsclt, nfsfile, offset, data, datalen );
+    break;
+  }
+
+return -1;
+}
+
+static void nfs3attrstat( fattr3 *attr, struct stat *fstat ) {
+
+  memset(fstat, 0, sizeof(*fstat));
+
+  fstat->st_mode = attr->mode;
+
+  // set file type
   switch (attr->type) {
   case NF3SOCK:
     fstat->st_mode |= S_IFSOCK;
@@ -1051,332 +4604,2405 @@ int nfs3filestat( t_nfsclt *nfsclt, char *path, struct stat *fstat ) {
   break;
   }
 
-  fstat->st_ino = attr->fileid;
-//  fstat->st_rdev = ((attr->rdev.specdata1&0xff)<<8) | (attr->rdev.specdata2&0xff);
-  fstat->st_rdev = makedev(attr->rdev.specdata1, attr->rdev.specdata2);
-  fstat->st_size = attr->size;
-  fstat->st_nlink = attr->nlink;
-  fstat->st_uid = attr->uid;
-  fstat->st_gid = attr->gid;
+  fstat->st_ino = attr->fileid;
+//  fstat->st_rdev = ((attr->rdev.specdata1&0xff)<<8) | (attr->rdev.specdata2&0xff);
+  fstat->st_rdev = makedev(attr->rdev.specdata1, attr->rdev.specdata2);
+  fstat->st_size = attr->size;
+  fstat->st_nlink = attr->nlink;
+  fstat->st_uid = attr->uid;
+  fstat->st_gid = attr->gid;
+
+  fstat->st_atim.tv_sec = attr->atime.seconds;
+  fstat->st_mtim.tv_sec = attr->mtime.seconds;
+  fstat->st_ctim.tv_sec = attr->ctime.seconds;
+
+  fstat->st_atim.tv_nsec = attr->atime.nseconds;
+  fstat->st_mtim.tv_nsec = attr->mtime.nseconds;
+  fstat->st_ctim.tv_nsec = attr->ctime.nseconds;
+}
+
+int nfs3filestat( t_nfsclt *nfsclt, char *path, struct stat *fstat ) {
+
+  LOOKUP3res *res;
+
+  res = nfs3pathlookup( nfsclt, path, 0); // don't follow links
+  if ( res == NULL ) return -1;
+
+  nfs3attrstat(&res->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes, fstat);
+
+return 0;
+}
+
+int nfsfilestat( t_nfsclt *nfsclt, char *path, struct stat *fstat ) {
+
+  switch ( nfsclt->version ) {
+    case 30:
+      return nfs3filestat( nfsclt, path, fstat );
+    break;
+  }
+
+return -1;
+}
+
+int nfs3filecreate( t_nfsclt *nfsclt, char *dir, char *file, struct stat *fstat ) {
+
+  CREATE3args cargs;
+  CREATE3res *cres;
+
+  // lookup directory handle
+  LOOKUP3res *res;
+  res = nfs3pathlookup( nfsclt, dir, 0);
+  if ( res == NULL ) return -1;
+
+  if ( res->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes.type
+      != NF3DIR ) {
+
+    fprintf(stderr, "%s: is not a directory\n", dir);
+    return -1;
+  }
+
+  // set new file attributes
+  memset(&cargs, 0, sizeof(cargs));
+  cargs.where.dir = res->LOOKUP3res_u.resok.object;
+  cargs.where.name = file;
+
+  // one of UNCHECKED GUARDED EXCLUSIVE
+  // UNCHECKED - without checking for the existence of a duplicate file
+  cargs.how.mode = GUARDED; 
+
+  stat_to_sattr3(&cargs.how.createhow3_u.obj_attributes, fstat);
+
+  cres = nfsproc3_create_3(&cargs, nfsclt->nfs.client);
+
+  if ( cres && cres->status == NFS3_OK )
+    nfs3cachenew( nfsclt, &cargs.where.dir, file, &cres->CREATE3res_u.resok.obj,
+        &cres->CREATE3res_u.resok.obj_attributes, &cres->CREATE3res_u.resok.dir_wcc);
+
+
+  if ( cres == NULL ) {
+    clnt_perror(nfsclt->nfs.client, "nfsproc3_create_3()");
+    return -1;
+  }
+
+  if (cres->status != NFS3_OK) {
+    fprintf(stderr, "Creating file: %s - (%d) %s\n", file,
+        res->status, nfs3_error(cres->status));
+    return -1;
+  }
+
+return 0;
+}
+
+int nfsfilecreate( t_nfsclt *nfsclt, char *path, struct stat *fstat ) {
+
+  char *dir = NULL, *file = NULL;
+  int ret = -1;
+
+  if ( pathsplit(path, &dir, &file ) == -1 )
+    return -1;
+
+//  printf("dir: %s, file: %s\n", dir, file);
+
+  switch ( nfsclt->version ) {
+    case 30:
+      ret = nfs3filecreate( nfsclt, dir, file, fstat );
+    break;
+  }
+
+  if ( dir ) free(dir);
+  if ( file ) free(file);
+
+return ret;
+}
+
+int nfs3filerm( t_nfsclt *nfsclt, char *dir, char *file) {
+
+  REMOVE3args rargs;
+  REMOVE3res *rres;
+
+  // lookup directory handle
+  LOOKUP3res *res;
+  res = nfs3pathlookup( nfsclt, dir, 0);
+  if ( res == NULL ) return -1;
+
+  if ( res->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes.type
+      != NF3DIR ) {
+
+    fprintf(stderr, "%s: is not a directory\n", dir);
+    return -1;
+  }
+
+  // set new file attributes
+  memset(&rargs, 0, sizeof(rargs));
+  rargs.object.dir = res->LOOKUP3res_u.resok.object;
+  rargs.object.name = file;
+
+  rres = nfsproc3_remove_3(&rargs, nfsclt->nfs.client);
+  dnlc_remove(&nfsclt->dnlc, &rargs.object.dir, file);
+
+  if ( rres && rres->status == NFS3_OK )
+    nfs3cachewcc( nfsclt, &rargs.object.dir, &rres->REMOVE3res_u.resok.dir_wcc);
+
+  if ( rres == NULL ) {
+    clnt_perror(nfsclt->nfs.client, "nfsproc3_remove_3()");
+    return -1;
+  }
+
+  if (rres->status != NFS3_OK) {
+    fprintf(stderr, "Removing file: %s - (%d) %s\n", file,
+        res->status, nfs3_error(rres->status));
+    return -1;
+  }
+
+return 0;
+}
+
+int nfsfilerm( t_nfsclt *nfsclt, char *path) {
+
+  char *dir = NULL, *file = NULL;
+  int ret = -1;
+
+  if ( pathsplit(path, &dir, &file ) == -1 )
+    return -1;
+
+//  printf("dir: %s, file: %s\n", dir, file);
+
+  switch ( nfsclt->version ) {
+    case 30:
+      ret = nfs3filerm( nfsclt, dir, file );
+    break;
+  }
+
+  if ( dir ) free(dir);
+  if ( file ) free(file);
+
+return ret;
+}
+
+// One LOOKUP or REMOVE call of nfs3namesall()
+typedef struct {
+
+  t_rpccall call;
+  union {
+    LOOKUP3res lookup;
+    REMOVE3res remove;
+  } res;
+  struct s_nfs3names *names;
+
+  int busy;
+  int idx;            // of path
+  t_nfs3fh dirfh;
+  char *name;
+
+} t_nfs3nameslot;
+
+typedef struct s_nfs3names {
+
+  t_nfsclt *nfsclt;
+  u_long proc;        // NFSPROC3_LOOKUP or NFSPROC3_REMOVE
+
+  char **paths;
+  struct stat *fstats;
+  int *status;
+
+  int inflight;
+
+} t_nfs3names;
+
+static void nfs3namesdone( t_rpcmux *mux, t_rpccall *call ) {
+
+  t_nfs3nameslot *slot = (t_nfs3nameslot *)call->arg;
+  t_nfs3names *n = slot->names;
+  LOOKUP3resok *lres = &slot->res.lookup.LOOKUP3res_u.resok;
+  nfs_fh3 *dirfh = NFS3FH(&slot->dirfh);
+  char *path = n->paths[slot->idx];
+
+  n->inflight--;
+  slot->busy = 0;
+
+  if ( call->stat != RPC_SUCCESS ) {
+    fprintf(stderr, "%s: %s\n", path, clnt_sperrno(call->stat));
+    goto ERR;
+  }
+
+  if ( n->proc == NFSPROC3_REMOVE ) {
+
+    dnlc_remove(&n->nfsclt->dnlc, dirfh, slot->name);
+
+    if ( slot->res.remove.status == NFS3_OK ) {
+      nfs3cachewcc(n->nfsclt, dirfh, &slot->res.remove.REMOVE3res_u.resok.dir_wcc);
+      n->status[slot->idx] = 0;
+    } else {
+      fprintf(stderr, "Removing file: %s - (%d) %s\n", path,
+          slot->res.remove.status, nfs3_error(slot->res.remove.status));
+    }
+
+    xdr_free((xdrproc_t)xdr_REMOVE3res, (char *)&slot->res.remove);
+
+  } else {
+
+    if ( slot->res.lookup.status != NFS3_OK ) {
+      fprintf(stderr, "Lookup failed: %s - (%d) %s\n", path,
+          slot->res.lookup.status, nfs3_error(slot->res.lookup.status));
+    } else if ( !lres->obj_attributes.attributes_follow ) {
+      fprintf(stderr, "%s: server didn't return attributes\n", path);
+    } else {
+      nfs3cacheattr(n->nfsclt, dirfh, &lres->dir_attributes);
+      nfs3cacheattr(n->nfsclt, &lres->object, &lres->obj_attributes);
+      dnlc_enter(&n->nfsclt->dnlc, dirfh, slot->name, &lres->object,
+          &lres->dir_attributes);
+
+      nfs3attrstat(&lres->obj_attributes.post_op_attr_u.attributes,
+          &n->fstats[slot->idx]);
+      n->status[slot->idx] = 0;
+    }
+
+    xdr_free((xdrproc_t)NFS3XDR(LOOKUP3res), (char *)&slot->res.lookup);
+  }
+
+ERR:
+  free(slot->name);
+  slot->name = NULL;
+}
+
+// Resolve directory of path and send call for it's last component.
+// Returns 1 if call is in flight, 0 if path is done already or -1
+// when it can't be sent.
+static int nfs3namessend( t_nfs3names *n, t_nfs3nameslot *slot, int idx ) {
+
+  t_nfsclt *nfsclt = n->nfsclt;
+  char *dir = NULL, *path = n->paths[idx];
+  LOOKUP3args args;
+  t_dnlcentry *e;
+  fattr3 *attr;
+  int ret;
+
+  memset(slot, 0, sizeof(t_nfs3nameslot));
+  slot->names = n;
+  slot->idx = idx;
+
+  if ( pathsplit(path, &dir, &slot->name) == -1 ) return -1;
+
+  // ".", ".." and paths ending with slash are resolved as whole
+  if ( slot->name == NULL || !slot->name[0]
+      || !strcmp(slot->name, ".") || !strcmp(slot->name, "..") ) {
+
+    if ( n->proc == NFSPROC3_REMOVE ) {
+      fprintf(stderr, "%s: not a file name\n", path);
+    } else if ( nfs3filestat(nfsclt, path, &n->fstats[idx]) == 0 ) {
+      n->status[idx] = 0;
+    }
+
+    ret = 0;
+    goto ERR;
+  }
+
+  if ( nfs3dirfh(nfsclt, dir, &slot->dirfh) == -1 ) {
+    ret = 0;
+    goto ERR;
+  }
+
+  free(dir);
+  dir = NULL;
+
+  if ( n->proc == NFSPROC3_LOOKUP ) {
+
+    e = dnlc_lookup(&nfsclt->dnlc, NFS3FH(&slot->dirfh), slot->name);
+
+    if ( e && (attr = acache_get(&nfsclt->acache,
+        &(nfs_fh3){ { e->fhlen, e->fh } })) != NULL ) {
+
+      nfs3attrstat(attr, &n->fstats[idx]);
+      n->status[idx] = 0;
+
+      ret = 0;
+      goto ERR;
+    }
+  }
+
+  // REMOVE3args is the same directory and name
+  memset(&args, 0, sizeof(args));
+  args.what.dir = *NFS3FH(&slot->dirfh);
+  args.what.name = slot->name;
+
+  slot->call.donefn = nfs3namesdone;
+  slot->call.arg = slot;
+
+  if ( n->proc == NFSPROC3_REMOVE ) {
+    slot->call.xres = (xdrproc_t)xdr_REMOVE3res;
+    slot->call.res = &slot->res.remove;
+    ret = rpcgroup_submit(&nfsclt->nfsgroup, &slot->call, NFSPROC3_REMOVE,
+        (xdrproc_t)xdr_REMOVE3args, &args);
+  } else {
+    slot->call.xres = (xdrproc_t)NFS3XDR(LOOKUP3res);
+    slot->call.res = &slot->res.lookup;
+    ret = rpcgroup_submit(&nfsclt->nfsgroup, &slot->call, NFSPROC3_LOOKUP,
+        (xdrproc_t)NFS3XDR(LOOKUP3args), &args);
+  }
+
+  if ( ret == -1 ) goto ERR;
+
+  slot->busy = 1;
+  n->inflight++;
+
+return 1;
+
+ERR:
+  if ( dir ) free(dir);
+  if ( slot->name ) free(slot->name);
+  slot->name = NULL;
+
+return ret;
+}
+
+// LOOKUP or REMOVE last components of paths, window calls in flight
+int nfs3namesall( t_nfsclt *nfsclt, u_long proc, char **paths, int npaths,
+    struct stat *fstats, int *status ) {
+
+  t_nfs3nameslot *slots;
+  t_nfs3names n;
+  int i, s, window, idx = 0, failed = 0;
+
+  window = nfsclt->window > 0 ? nfsclt->window : 1;
+  if ( window > npaths ) window = npaths;
+
+  for ( i = 0; i < npaths ; i++ ) status[i] = -1;
+
+  if ( npaths == 0 ) return 0;
+
+  if ( (slots = calloc(window, sizeof(t_nfs3nameslot))) == NULL ) {
+    perror("calloc()");
+    return -1;
+  }
+
+  memset(&n, 0, sizeof(n));
+  n.nfsclt = nfsclt;
+  n.proc = proc;
+  n.paths = paths;
+  n.fstats = fstats;
+  n.status = status;
+
+  while ( 1 ) {
+
+    // directories are resolved with blocking lookups, which could
+    // complete some of the calls, so free slots are looked for each time
+    for ( s = 0; s < window && idx < npaths && !failed ; s++ ) {
+      if ( slots[s].busy ) continue;
+
+      while ( idx < npaths && !failed ) {
+        if ( (i = nfs3namessend(&n, &slots[s], idx++)) == 1 ) break;
+        if ( i == -1 ) failed = 1;
+      }
+    }
+
+    if ( n.inflight == 0 ) break;
+
+    // on failure outstanding calls are completed with error
+    rpcgroup_run(&nfsclt->nfsgroup);
+  }
+
+  free(slots);
+
+  for ( i = 0; i < npaths ; i++ )
+    if ( status[i] == -1 ) return -1;
+
+return 0;
+}
+
+int nfsfilermall( t_nfsclt *nfsclt, char **paths, int npaths, int *status ) {
+
+  switch ( nfsclt->version ) {
+    case 30:
+      return nfs3namesall( nfsclt, NFSPROC3_REMOVE, paths, npaths, NULL, status );
+    break;
+  }
+
+return -1;
+}
+
+int nfsfilestatall( t_nfsclt *nfsclt, char **paths, int npaths,
+    struct stat *fstats, int *status ) {
+
+  switch ( nfsclt->version ) {
+    case 30:
+      return nfs3namesall( nfsclt, NFSPROC3_LOOKUP, paths, npaths, fstats, status );
+    break;
+  }
+
+return -1;
+}
+
+int nfs3fileattr( t_nfsclt *nfsclt, char *filename, struct stat *fstat) {
+
+  SETATTR3args sargs;
+  SETATTR3res *sres;
+  sattr3 *sattr;
+
+  // lookup file handle
+  LOOKUP3res *res;
+  res = nfs3pathlookup( nfsclt, filename, 0);
+  if ( res == NULL ) return -1;
+
+  // set new attributes
+  memset(&sargs, 0, sizeof(sargs));
+  sargs.object = res->LOOKUP3res_u.resok.object;
+
+  stat_to_sattr3(&sargs.new_attributes, fstat);
+
+  sres = nfsproc3_setattr_3(&sargs, nfsclt->nfs.client);
+
+  if ( sres && sres->status == NFS3_OK )
+    nfs3cachewcc( nfsclt, &sargs.object, &sres->SETATTR3res_u.resok.obj_wcc);
+  else
+    acache_forget(&nfsclt->acache, &sargs.object);
+
+  if ( sres == NULL ) {
+    clnt_perror(nfsclt->nfs.client, "nfsproc3_setattr_3()");
+    return -1;
+  }
+
+  if (sres->status != NFS3_OK) {
+    fprintf(stderr, "Setting attributes: %s - (%d) %s\n", filename,
+        res->status, nfs3_error(sres->status));
+    return -1;
+  }
+
+return 0;
+}
+
+int nfsfileattr( t_nfsclt *nfsclt, char *path, struct stat *fstat ) {
+
+  fstat->st_dev = 0;  // don't try to create device
+
+  switch ( nfsclt->version ) {
+    case 30:
+      return nfs3fileattr( nfsclt, path, fstat );
+    break;
+  }
+
+return -1;
+}
+
+int nfs3dirmk( t_nfsclt *nfsclt, char *dir, char *file, struct stat *fstat ) {
+
+  MKDIR3args args;
+  MKDIR3res *res;
+
+  // lookup directory handle
+  LOOKUP3res *lres;
+  lres = nfs3pathlookup( nfsclt, dir, 0);
+  if ( lres == NULL ) return -1;
+
+  if ( lres->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes.type
+      != NF3DIR ) {
+
+    fprintf(stderr, "%s: is not a directory\n", dir);
+    return -1;
+  }
+
+  // set new file attributes
+  memset(&args, 0, sizeof(args));
+  args.where.dir = lres->LOOKUP3res_u.resok.object;
+  args.where.name = file;
+
+  stat_to_sattr3(&args.attributes, fstat);
+
+  res = nfsproc3_mkdir_3(&args, nfsclt->nfs.client);
+
+  if ( res && res->status == NFS3_OK )
+    nfs3cachenew( nfsclt, &args.where.dir, file, &res->MKDIR3res_u.resok.obj,
+        &res->MKDIR3res_u.resok.obj_attributes, &res->MKDIR3res_u.resok.dir_wcc);
+
+
+  if ( res == NULL ) {
+    clnt_perror(nfsclt->nfs.client, "nfsproc3_mkdir_3()");
+    return -1;
+  }
+
+  if (res->status != NFS3_OK) {
+    fprintf(stderr, "Creating directory: %s - (%d) %s\n", file,
+        res->status, nfs3_error(res->status));
+    return -1;
+  }
+
+return 0;
+}
+
+int nfsdirmk( t_nfsclt *nfsclt, char *path, struct stat *fstat ) {
+
+  char *dir = NULL, *file = NULL;
+  int ret = -1;
+
+  fstat->st_dev = 0;  // don't try to create device
+
+  if ( pathsplit(path, &dir, &file ) == -1 )
+    return -1;
+
+//  printf("dir: %s, file: %s\n", dir, file);
+
+  switch ( nfsclt->version ) {
+    case 30:
+      ret = nfs3dirmk( nfsclt, dir, file, fstat );
+    break;
+  }
+
+  if ( dir ) free(dir);
+  if ( file ) free(file);
+
+return ret;
+}
+
+int nfs3dirrm( t_nfsclt *nfsclt, char *dir, char *file) {
+
+  RMDIR3args args;
+  RMDIR3res *res;
+
+  // lookup directory handle
+  LOOKUP3res *dres;
+  dres = nfs3pathlookup( nfsclt, dir, 0);
+  if ( dres == NULL ) return -1;
+
+  if ( dres->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes.type
+      != NF3DIR ) {
+
+    fprintf(stderr, "%s: is not a directory\n", dir);
+    return -1;
+  }
+
+  memset(&args, 0, sizeof(args));
+  args.object.dir = dres->LOOKUP3res_u.resok.object;
+  args.object.name = file;
+
+  res = nfsproc3_rmdir_3(&args, nfsclt->nfs.client);
+  dnlc_remove(&nfsclt->dnlc, &args.object.dir, file);
+
+  if ( res && res->status == NFS3_OK )
+    nfs3cachewcc( nfsclt, &args.object.dir, &res->RMDIR3res_u.resok.dir_wcc);
+
+  if ( res == NULL ) {
+    clnt_perror(nfsclt->nfs.client, "nfsproc3_rmdir_3()");
+    return -1;
+  }
+
+  if (res->status != NFS3_OK) {
+    fprintf(stderr, "Removing directory: %s - (%d) %s\n", file,
+        res->status, nfs3_error(res->status));
+    return -1;
+  }
+
+return 0;
+}
+
+int nfsdirrm( t_nfsclt *nfsclt, char *path) {
+
+  char *dir = NULL, *file = NULL;
+  int ret = -1;
+
+  if ( pathsplit(path, &dir, &file ) == -1 )
+    return -1;
+
+  switch ( nfsclt->version ) {
+    case 30:
+      ret = nfs3dirrm( nfsclt, dir, file );
+    break;
+  }
+
+  if ( dir ) free(dir);
+  if ( file ) free(file);
+
+return ret;
+}
+
+// Tree walk. Directories wait in queue and window of them is read
+// with READDIRPLUS at once over all connections. Entries go to entry
+// callback right away, the ones server didn't fully describe are
+// looked up synchronously between batches. Walk holds reference of
+// directory while it's read and one for each entry to lookup, release
+// callback drops it.
+
+struct s_nfs3walk;
+
+// Directory to read, first member of command's own directory
+typedef struct s_nfs3wdir {
+
+  struct s_nfs3wdir *next;      // read queue
+
+  t_rpccall call;
+  t_nfsdirreply reply;
+  struct s_nfs3walk *walk;
+
+  t_nfs3fh fh;
+  cookie3 cookie;
+  cookieverf3 cookieverf;
+
+  char *path;         // for messages, or walk's path callback
+  int pending;        // references
+  int replies;        // since it was queued
+
+} t_nfs3wdir;
+
+// Entry which READDIRPLUS returned without handle or attributes
+typedef struct s_nfs3wlater {
+
+  struct s_nfs3wlater *next;
+
+  t_nfs3wdir *dir;
+  char *name;
+
+} t_nfs3wlater;
+
+// First member of command's own context
+typedef struct s_nfs3walk {
+
+  t_nfsclt *nfsclt;
+  int window;
+
+  t_nfs3wdir *dirs;             // waiting to be read
+  t_nfs3wdir *dirstail;
+  t_nfs3wlater *later;
+  int fifo;                     // breadth first, depth first otherwise
+
+  int outstanding;              // command's own calls too
+  int failed;                   // can't send more calls
+
+  long nread;                   // directories read to the end
+  long errors;
+
+  // entry of directory with it's handle and attributes
+  void (*entry)( struct s_nfs3walk *w, t_nfs3wdir *d, char *name,
+      nfs_fh3 *fh, fattr3 *attr );
+  // drop one reference of directory
+  void (*release)( struct s_nfs3walk *w, t_nfs3wdir *d );
+
+  // optional, directory stays incomplete, error is counted already
+  void (*incomplete)( struct s_nfs3walk *w, t_nfs3wdir *d );
+  // optional, sends directory's call instead of READDIRPLUS
+  int (*send)( struct s_nfs3walk *w, t_nfs3wdir *d );
+  // optional, sends command's own calls, returns 1 to hold reading
+  int (*pump)( struct s_nfs3walk *w );
+  // optional, path of directory without one
+  char *(*path)( struct s_nfs3walk *w, t_nfs3wdir *d, char *buf, size_t size );
+
+} t_nfs3walk;
+
+static void nfs3walkinit( t_nfs3walk *w, t_nfsclt *nfsclt,
+    void (*entry)( t_nfs3walk *, t_nfs3wdir *, char *, nfs_fh3 *, fattr3 * ),
+    void (*release)( t_nfs3walk *, t_nfs3wdir * ) ) {
+
+  memset(w, 0, sizeof(t_nfs3walk));
+
+  w->nfsclt = nfsclt;
+  w->window = nfsclt->window > 0 ? nfsclt->window : 1;
+  w->entry = entry;
+  w->release = release;
+}
+
+static char *nfs3walkpath( t_nfs3walk *w, t_nfs3wdir *d, char *buf, size_t size ) {
+
+  if ( d->path ) return d->path;
+
+  if ( w->path && w->path(w, d, buf, size) ) return buf;
+
+return "...";
+}
+
+// put directory in front of queue
+static void nfs3walkpush( t_nfs3walk *w, t_nfs3wdir *d ) {
+
+  d->next = w->dirs;
+  w->dirs = d;
+  if ( w->dirstail == NULL ) w->dirstail = d;
+}
+
+// Queue directory to be read from it's beginning, walk holds it's
+// reference until then
+static void nfs3walkqueue( t_nfs3walk *w, t_nfs3wdir *d ) {
+
+  d->walk = w;
+  d->pending++;
+  d->cookie = 0;
+  memset(d->cookieverf, 0, sizeof(cookieverf3));
+  d->replies = 0;
+
+  if ( !w->fifo ) {
+    nfs3walkpush(w, d);
+    return;
+  }
+
+  d->next = NULL;
+
+  if ( w->dirstail ) w->dirstail->next = d;
+  else w->dirs = d;
+  w->dirstail = d;
+}
+
+static void nfs3walkfail( t_nfs3walk *w, t_nfs3wdir *d ) {
+
+  w->errors++;
+  if ( w->incomplete ) w->incomplete(w, d);
+  w->release(w, d);
+}
+
+static void nfs3walkdirdone( t_rpcmux *mux, t_rpccall *call ) {
+
+  t_nfs3wdir *d = (t_nfs3wdir *)call->arg;
+  t_nfs3walk *w = d->walk;
+  READDIRPLUS3res *res = &d->reply.res.nfs3plus;
+  t_nfs3wlater *l;
+  entryplus3 *ep;
+  char path[PATH_MAX];
+
+  w->outstanding--;
+
+  if ( call->stat != RPC_SUCCESS ) {
+    fprintf(stderr, "%s: %s\n", nfs3walkpath(w, d, path, sizeof(path)),
+        clnt_sperrno(call->stat));
+    goto FAIL;
+  }
+
+  if ( res->status != NFS3_OK ) {
+    fprintf(stderr, "Readdirplus failed: %s - (%d) %s\n",
+        nfs3walkpath(w, d, path, sizeof(path)), res->status, nfs3_error(res->status));
+    goto FAIL;
+  }
+
+  nfs3cacheattr( w->nfsclt, NFS3FH(&d->fh), &res->READDIRPLUS3res_u.resok.dir_attributes);
+
+  d->replies++;
+
+  for ( ep = res->READDIRPLUS3res_u.resok.reply.entries; ep ; ep = ep->nextentry ) {
+
+    d->cookie = ep->cookie;
+
+    if ( !strcmp(ep->name, ".") || !strcmp(ep->name, "..") ) continue;
+
+    if ( ep->name_handle.handle_follows && ep->name_attributes.attributes_follow ) {
+      w->entry(w, d, ep->name, &ep->name_handle.post_op_fh3_u.handle,
+          &ep->name_attributes.post_op_attr_u.attributes);
+      continue;
+    }
+
+    // server didn't give us everything, lookup it later
+    if ( (l = calloc(1, sizeof(t_nfs3wlater))) == NULL
+        || (l->name = strdup(ep->name)) == NULL ) {
+      perror("calloc()");
+      if ( l ) free(l);
+      w->errors++;
+      if ( w->incomplete ) w->incomplete(w, d);
+      continue;
+    }
+
+    l->dir = d;
+    d->pending++;
+
+    l->next = w->later;
+    w->later = l;
+  }
+
+  if ( !res->READDIRPLUS3res_u.resok.reply.eof ) {
+
+    // read rest of directory before others
+    memcpy(d->cookieverf, res->READDIRPLUS3res_u.resok.cookieverf,
+        sizeof(cookieverf3));
+
+    nfs3walkpush(w, d);
+    return;
+  }
+
+  w->nread++;
+  nfs3dirreplyfree(&d->reply);
+  w->release(w, d);
+  return;
+
+FAIL:
+  nfs3dirreplyfree(&d->reply);
+  nfs3walkfail(w, d);
+}
+
+static int nfs3walkdirsend( t_nfs3walk *w, t_nfs3wdir *d ) {
+
+  t_nfsclt *nfsclt = w->nfsclt;
+  READDIRPLUS3args args;
+
+  memset(&args, 0, sizeof(args));
+  args.dir = *NFS3FH(&d->fh);
+  args.cookie = d->cookie;
+  memcpy(args.cookieverf, d->cookieverf, sizeof(cookieverf3));
+
+  args.dircount = nfsclt->fsinfo.dtpref;
+  args.maxcount = nfsclt->fsinfo.rtpref > nfsclt->fsinfo.dtpref ?
+    nfsclt->fsinfo.rtpref : nfsclt->fsinfo.dtpref;
+
+  d->reply.plus = 1;
+  d->call.xres = (xdrproc_t)nfs3xdrdirreply;
+  d->call.res = &d->reply;
+  d->call.donefn = nfs3walkdirdone;
+  d->call.arg = d;
+
+  if ( rpcgroup_submit(&nfsclt->nfsgroup, &d->call, NFSPROC3_READDIRPLUS,
+      (xdrproc_t)NFS3XDR(READDIRPLUS3args), &args) == -1 )
+    return -1;
+
+  w->outstanding++;
+
+return 0;
+}
+
+// synchronous lookups of entries READDIRPLUS didn't fully describe
+static void nfs3walklater( t_nfs3walk *w ) {
+
+  t_nfs3wlater *l;
+  LOOKUP3res *res;
+  LOOKUP3resok *resok;
+  char path[PATH_MAX];
+
+  while ( (l = w->later) != NULL ) {
+    w->later = l->next;
+
+    if ( w->failed ) {
+      if ( w->incomplete ) w->incomplete(w, l->dir);
+    } else {
+      res = nfs3filelookup(w->nfsclt->nfs.client, NFS3FH(&l->dir->fh), l->name);
+      resok = res ? &res->LOOKUP3res_u.resok : NULL;
+
+      if ( resok && resok->obj_attributes.attributes_follow ) {
+        w->entry(w, l->dir, l->name, &resok->object,
+            &resok->obj_attributes.post_op_attr_u.attributes);
+      } else {
+        if ( res ) fprintf(stderr, "%s/%s: no attributes\n",
+            nfs3walkpath(w, l->dir, path, sizeof(path)), l->name);
+        w->errors++;
+        if ( w->incomplete ) w->incomplete(w, l->dir);
+      }
+    }
+
+    w->release(w, l->dir);
+    free(l->name);
+    free(l);
+  }
+}
+
+// Read queued directories until there's nothing left. After failure
+// directories still waiting are released incomplete.
+static void nfs3walk( t_nfs3walk *w ) {
+
+  t_nfs3wdir *d;
+  int hold;
+
+  while ( 1 ) {
+
+    nfs3walklater(w);
+
+    hold = w->pump ? w->pump(w) : 0;
+
+    while ( !hold && !w->failed && (d = w->dirs) != NULL && w->outstanding < w->window ) {
+
+      w->dirs = d->next;
+      if ( w->dirs == NULL ) w->dirstail = NULL;
+      d->next = NULL;
+
+      if ( (w->send ? w->send(w, d) : nfs3walkdirsend(w, d)) == -1 ) {
+        w->failed = 1;
+        nfs3walkfail(w, d);
+      }
+    }
+
+    if ( w->outstanding == 0 ) {
+      if ( w->later ) continue;
+      break;
+    }
+
+    // on failure outstanding calls are completed with error
+    rpcgroup_run(&w->nfsclt->nfsgroup);
+  }
+
+  // left after failure
+  while ( (d = w->dirs) != NULL ) {
+    w->dirs = d->next;
+    if ( w->incomplete ) w->incomplete(w, d);
+    w->release(w, d);
+  }
+
+  w->dirstail = NULL;
+}
+
+// Recursive remove. Directories are read with nfs3walk() and their
+// entries are removed with REMOVE calls to already known directory
+// handle, window of them in flight. Directory is removed with RMDIR
+// from it's parent when it was read to the end and everything inside
+// is gone. Removing entries shifts cookies on some servers, so directory
+// read in more than one reply is read again until a pass removes nothing.
+
+// removals queued per slot before we stop reading more directories
+#define NFS3_RMTREE_QUEUE 4
+
+struct s_nfs3rmtree;
+
+// Directory being emptied
+typedef struct s_nfs3rdir {
+
+  t_nfs3wdir wd;                // reading, entries and subdirectories
+                                // still inside hold references
+
+  struct s_nfs3rdir *parent;    // NULL for the top one
+  t_nfs3fh parentfh;
+  char *name;         // in parent
+
+  long removed;       // entries removed during current pass
+  int err;            // something inside stays, so directory too
+
+} t_nfs3rdir;
+
+// Entry waiting for REMOVE or RMDIR
+typedef struct s_nfs3rentry {
+
+  struct s_nfs3rentry *next;
+
+  t_nfs3rdir *dir;    // where entry is, NULL for RMDIR of the top one
+  t_nfs3rdir *sub;    // directory to RMDIR, name is it's
+
+  char *name;
+
+} t_nfs3rentry;
+
+// One REMOVE or RMDIR request
+typedef struct s_nfs3rslot {
+
+  struct s_nfs3rslot *next;     // free slots chain
+
+  t_rpccall call;
+  union {
+    REMOVE3res remove;
+    RMDIR3res rmdir;
+  } res;
+  struct s_nfs3rmtree *rmtree;
+  t_nfs3rentry *entry;
+
+} t_nfs3rslot;
+
+typedef struct s_nfs3rmtree {
+
+  t_nfs3walk walk;
+
+  t_nfs3rentry *entries;        // waiting for REMOVE or RMDIR
+  t_nfs3rentry *entriestail;
+  int nqueued;
+  t_nfs3rslot *freeslots;
+
+  long nfiles;
+  long ndirs;
+
+} t_nfs3rmtree;
+
+static void nfs3rmtreedirfree( t_nfs3rdir *d ) {
+
+  nfs3dirreplyfree(&d->wd.reply);
+
+  free(d->name);
+  free(d->wd.path);
+  free(d);
+}
+
+static void nfs3rmtreeentryfree( t_nfs3rentry *e ) {
+
+  if ( e->sub == NULL ) free(e->name);
+  free(e);
+}
+
+static void nfs3rmtreequeue( t_nfs3rmtree *m, t_nfs3rentry *e ) {
+
+  e->next = NULL;
+
+  if ( m->entriestail ) m->entriestail->next = e;
+  else m->entries = e;
+  m->entriestail = e;
+
+  m->nqueued++;
+}
+
+// start reading directory from it's beginning
+static void nfs3rmtreepass( t_nfs3rmtree *m, t_nfs3rdir *d ) {
+
+  d->removed = 0;
+
+  // depth first, so few directories are open at once
+  nfs3walkqueue(&m->walk, &d->wd);
+}
+
+// Drop one reference of directory. Directory without references is
+// read again or removed, or it's parent is told it stays.
+static void nfs3rmtreerelease( t_nfs3walk *w, t_nfs3wdir *wd ) {
+
+  t_nfs3rmtree *m = (t_nfs3rmtree *)w;
+  t_nfs3rdir *d = (t_nfs3rdir *)wd, *parent;
+  t_nfs3rentry *e;
+
+  while ( d && --d->wd.pending == 0 ) {
+
+    if ( !d->err && !w->failed ) {
+
+      if ( d->wd.replies > 1 && d->removed > 0 ) {
+        nfs3rmtreepass(m, d);
+        return;
+      }
+
+      if ( (e = calloc(1, sizeof(t_nfs3rentry))) != NULL ) {
+        e->dir = d->parent;
+        e->sub = d;
+        e->name = d->name;
+
+        nfs3rmtreequeue(m, e);
+        return;
+      }
+
+      perror("calloc()");
+      w->errors++;
+    }
+
+    // something inside stays, so does directory
+    parent = d->parent;
+    if ( parent ) parent->err = 1;
+
+    nfs3rmtreedirfree(d);
+    d = parent;
+  }
+}
+
+static void nfs3rmtreeincomplete( t_nfs3walk *w, t_nfs3wdir *wd ) {
+
+  ((t_nfs3rdir *)wd)->err = 1;
+}
+
+static int nfs3rmtreedir( t_nfs3rmtree *m, t_nfs3rdir *parent, nfs_fh3 *fh,
+    nfs_fh3 *parentfh, char *name, char *path ) {
+
+  t_nfs3rdir *d;
+
+  if ( (d = calloc(1, sizeof(t_nfs3rdir))) == NULL
+      || (d->name = strdup(name)) == NULL
+      || (d->wd.path = strdup(path)) == NULL ) {
+    perror("calloc()");
+    if ( d && d->name ) free(d->name);
+    if ( d ) free(d);
+    return -1;
+  }
+
+  d->parent = parent;
+  nfs3fhset(&d->wd.fh, fh);
+  nfs3fhset(&d->parentfh, parentfh);
+
+  if ( parent ) parent->wd.pending++;
+
+  nfs3rmtreepass(m, d);
+
+return 0;
+}
+
+// queue entry of directory d for removal
+static void nfs3rmtreeentry( t_nfs3walk *w, t_nfs3wdir *wd, char *name,
+    nfs_fh3 *fh, fattr3 *attr ) {
+
+  t_nfs3rmtree *m = (t_nfs3rmtree *)w;
+  t_nfs3rdir *d = (t_nfs3rdir *)wd;
+  t_nfs3rentry *e;
+  char *path;
+
+  if ( !nfs3mirrorname(name) ) {
+    fprintf(stderr, "%s: skipping invalid name '%s'\n", d->wd.path, name);
+    w->errors++;
+    d->err = 1;
+    return;
+  }
+
+  if ( attr->type == NF3DIR ) {
+
+    if ( (path = nfs3mirrorpath(d->wd.path, name)) == NULL
+        || nfs3rmtreedir(m, d, fh, NFS3FH(&d->wd.fh), name, path) == -1 ) {
+      w->errors++;
+      d->err = 1;
+    }
+
+    if ( path ) free(path);
+    return;
+  }
+
+  if ( (e = calloc(1, sizeof(t_nfs3rentry))) == NULL
+      || (e->name = strdup(name)) == NULL ) {
+    perror("calloc()");
+    if ( e ) free(e);
+    w->errors++;
+    d->err = 1;
+    return;
+  }
+
+  e->dir = d;
+  d->wd.pending++;
+
+  nfs3rmtreequeue(m, e);
+}
+
+static void nfs3rmtreeremovedone( t_rpcmux *mux, t_rpccall *call ) {
+
+  t_nfs3rslot *slot = (t_nfs3rslot *)call->arg;
+  t_nfs3rmtree *m = slot->rmtree;
+  t_nfs3rentry *e = slot->entry;
+  t_nfs3rdir *d = e->sub ? e->sub : e->dir;
+  nfs_fh3 *dirfh = e->sub ? NFS3FH(&e->sub->parentfh) : NFS3FH(&e->dir->wd.fh);
+  nfsstat3 status;
+  wcc_data *wcc;
+
+  m->walk.outstanding--;
+
+  slot->entry = NULL;
+  slot->next = m->freeslots;
+  m->freeslots = slot;
+
+  if ( call->stat != RPC_SUCCESS ) {
+    fprintf(stderr, "%s%s%s: %s\n", e->sub ? "" : d->wd.path, e->sub ? "" : "/",
+        e->sub ? d->wd.path : e->name, clnt_sperrno(call->stat));
+    m->walk.errors++;
+    if ( e->dir ) e->dir->err = 1;
+    goto DONE;
+  }
+
+  if ( e->sub ) {
+    status = slot->res.rmdir.status;
+    wcc = status == NFS3_OK ? &slot->res.rmdir.RMDIR3res_u.resok.dir_wcc
+      : &slot->res.rmdir.RMDIR3res_u.resfail.dir_wcc;
+  } else {
+    status = slot->res.remove.status;
+    wcc = status == NFS3_OK ? &slot->res.remove.REMOVE3res_u.resok.dir_wcc
+      : &slot->res.remove.REMOVE3res_u.resfail.dir_wcc;
+  }
+
+  dnlc_remove(&m->walk.nfsclt->dnlc, dirfh, e->name);
+  nfs3cachewcc(m->walk.nfsclt, dirfh, wcc);
+
+  if ( status == NFS3_OK ) {
+
+    if ( e->sub ) m->ndirs++;
+    else m->nfiles++;
+
+    if ( e->dir ) e->dir->removed++;
+
+  } else if ( status != NFS3ERR_NOENT ) {
+
+    // somebody else could remove it too, that's fine
+    fprintf(stderr, "Removing %s: %s%s%s - (%d) %s\n",
+        e->sub ? "directory" : "file", e->sub ? "" : d->wd.path,
+        e->sub ? "" : "/", e->sub ? d->wd.path : e->name, status, nfs3_error(status));
+    m->walk.errors++;
+    if ( e->dir ) e->dir->err = 1;
+  }
+
+  if ( e->sub ) xdr_free((xdrproc_t)xdr_RMDIR3res, (char *)&slot->res.rmdir);
+  else xdr_free((xdrproc_t)xdr_REMOVE3res, (char *)&slot->res.remove);
+
+DONE:
+  d = e->dir;
+
+  if ( e->sub ) nfs3rmtreedirfree(e->sub);
+  nfs3rmtreeentryfree(e);
+
+  nfs3rmtreerelease(&m->walk, (t_nfs3wdir *)d);
+}
+
+static int nfs3rmtreeremovesend( t_nfs3rmtree *m, t_nfs3rslot *slot, t_nfs3rentry *e ) {
+
+  REMOVE3args args;   // RMDIR3args is the same
+
+  memset(&args, 0, sizeof(args));
+  args.object.dir = e->sub ? *NFS3FH(&e->sub->parentfh) : *NFS3FH(&e->dir->wd.fh);
+  args.object.name = e->name;
+
+  memset(&slot->res, 0, sizeof(slot->res));
+  slot->entry = e;
+  slot->call.xres = e->sub ? (xdrproc_t)xdr_RMDIR3res : (xdrproc_t)xdr_REMOVE3res;
+  slot->call.res = &slot->res;
+  slot->call.donefn = nfs3rmtreeremovedone;
+  slot->call.arg = slot;
+
+  if ( rpcgroup_submit(&m->walk.nfsclt->nfsgroup, &slot->call,
+      e->sub ? NFSPROC3_RMDIR : NFSPROC3_REMOVE,
+      e->sub ? (xdrproc_t)xdr_RMDIR3args : (xdrproc_t)xdr_REMOVE3args, &args) == -1 )
+    return -1;
+
+  m->walk.outstanding++;
+
+return 0;
+}
+
+// Removals first, they free memory. Directories are read only when
+// there is not much to remove.
+static int nfs3rmtreepump( t_nfs3walk *w ) {
+
+  t_nfs3rmtree *m = (t_nfs3rmtree *)w;
+  t_nfs3rslot *slot;
+  t_nfs3rentry *e;
+
+  while ( !w->failed && (e = m->entries) != NULL && (slot = m->freeslots) != NULL ) {
+
+    m->entries = e->next;
+    if ( m->entries == NULL ) m->entriestail = NULL;
+    m->nqueued--;
+    m->freeslots = slot->next;
+
+    if ( nfs3rmtreeremovesend(m, slot, e) == -1 ) {
+      w->failed = 1;
+      w->errors++;
+      slot->next = m->freeslots;
+      m->freeslots = slot;
+
+      // put it back, it's released with the rest
+      e->next = m->entries;
+      m->entries = e;
+      if ( m->entriestail == NULL ) m->entriestail = e;
+      m->nqueued++;
+    }
+  }
+
+return m->nqueued >= NFS3_RMTREE_QUEUE * w->window;
+}
+
+long nfs3rmtree( t_nfsclt *nfsclt, char *path ) {
+
+  t_nfs3rmtree m;
+  t_nfs3rslot *slots;
+  t_nfs3rentry *e;
+  t_nfs3rdir *d;
+  t_nfs3fh parentfh;
+  LOOKUP3res *res;
+  struct timespec start, end;
+  char *dir = NULL, *name = NULL;
+  int i;
+  long ret = -1;
+
+  if ( pathsplit(path, &dir, &name) == -1 ) return -1;
+
+  if ( name == NULL || !nfs3mirrorname(name) ) {
+    fprintf(stderr, "%s: refusing to remove\n", path);
+    goto ERR;
+  }
+
+  if ( nfs3dirfh(nfsclt, dir, &parentfh) == -1 ) goto ERR;
+
+  if ( (res = nfs3cachedlookup(nfsclt, NFS3FH(&parentfh), name)) == NULL ) goto ERR;
+
+  if ( !res->LOOKUP3res_u.resok.obj_attributes.attributes_follow ) {
+    fprintf(stderr, "%s: server didn't return attributes\n", path);
+    goto ERR;
+  }
+
+  if ( res->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes.type != NF3DIR ) {
+    ret = nfs3filerm(nfsclt, dir, name) == -1 ? -1 : 1;
+    goto ERR;
+  }
+
+  memset(&m, 0, sizeof(m));
+  nfs3walkinit(&m.walk, nfsclt, nfs3rmtreeentry, nfs3rmtreerelease);
+  m.walk.incomplete = nfs3rmtreeincomplete;
+  m.walk.pump = nfs3rmtreepump;
+
+  if ( (slots = calloc(m.walk.window, sizeof(t_nfs3rslot))) == NULL ) {
+    perror("calloc()");
+    goto ERR;
+  }
+
+  for ( i = 0; i < m.walk.window ; i++ ) {
+    slots[i].rmtree = &m;
+    slots[i].next = m.freeslots;
+    m.freeslots = &slots[i];
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  if ( nfs3rmtreedir(&m, NULL, &res->LOOKUP3res_u.resok.object,
+      NFS3FH(&parentfh), name, path) == -1 ) {
+    free(slots);
+    goto ERR;
+  }
+
+  nfs3walk(&m.walk);
+
+  // left after failure, releasing them frees directories up to the top
+  while ( (e = m.entries) != NULL ) {
+    m.entries = e->next;
+
+    d = e->dir;
+    if ( e->sub ) nfs3rmtreedirfree(e->sub);
+    nfs3rmtreeentryfree(e);
+
+    if ( d ) d->err = 1;
+    nfs3rmtreerelease(&m.walk, (t_nfs3wdir *)d);
+  }
+
+  free(slots);
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  printf("%ld files, %ld directories removed in %.2f s", m.nfiles, m.ndirs,
+      (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+  if ( m.walk.errors )
+    printf(", %ld errors", m.walk.errors);
+
+  printf("\n");
+
+  ret = m.walk.errors ? -1 : m.nfiles + m.ndirs;
+
+ERR:
+  if ( dir ) free(dir);
+  if ( name ) free(name);
+
+return ret;
+}
+
+long nfsrmtree( t_nfsclt *nfsclt, char *path ) {
+
+  switch ( nfsclt->version ) {
+    case 30:
+      return nfs3rmtree( nfsclt, path );
+    break;
+  }
+
+return -1;
+}
+
+// Disk usage of tree. Directories are read with nfs3walk(), depth
+// first so few of them wait for their subdirectories. Directory totals include
+// everything below and are added to it's parent when it was read to
+// the end and all it's subdirectories are summed up.
+
+// initial size of hard linked files table, power of 2
+#define NFS3_DU_LINKS 1024
+
+typedef struct {
+
+  unsigned long long size;    // apparent
+  unsigned long long used;    // on disk
+  long files;                 // all non directories
+  long dirs;
+
+} t_nfs3dusum;
+
+// Directory waiting to be read, or being read, or waiting for it's
+// subdirectories
+typedef struct s_nfs3dudir {
+
+  t_nfs3wdir wd;                // subdirectories not summed up yet
+                                // hold references too
+  struct s_nfs3dudir *parent;
+  t_nfs3dusum sum;
+
+} t_nfs3dudir;
+
+// One of the largest directories
+typedef struct {
+
+  t_nfs3dusum sum;
+  char *path;
+
+} t_nfs3dutop;
+
+typedef struct s_nfs3du {
+
+  t_nfs3walk walk;
+
+  int all;                      // print every directory
+  int ntop;
+  int maxtop;
+  t_nfs3dutop *top;             // min heap by used bytes
+
+  uint64_t *links;              // fileids of files with more links
+  u_int nlinks;
+  u_int maxlinks;
+
+} t_nfs3du;
+
+static void nfs3duprint( t_nfs3dusum *sum, char *path ) {
+
+  char used[32], size[32];
+
+  printf("%10s %10s %9ld %7ld  %s\n", hrbytes(used, sizeof(used), sum->used),
+      hrbytes(size, sizeof(size), sum->size), sum->files, sum->dirs, path);
+}
+
+// Remember fileid of hard linked file. Returns 1 if it was seen
+// already, so it's not counted twice.
+static int nfs3dulink( t_nfs3du *du, uint64_t fileid ) {
+
+  uint64_t *links, id;
+  u_int i, n, max;
+
+  if ( du->nlinks * 2 >= du->maxlinks ) {
+
+    max = du->maxlinks ? du->maxlinks * 2 : NFS3_DU_LINKS;
+
+    if ( (links = calloc(max, sizeof(uint64_t))) == NULL ) {
+      perror("calloc()");
+      return 0;
+    }
+
+    // 0 marks free slot, fileid 0 is stored as ~0
+    for ( n = 0; n < du->maxlinks ; n++ ) {
+      if ( (id = du->links[n]) == 0 ) continue;
+
+      for ( i = (id * 0x9e3779b97f4a7c15ULL) >> 32 & (max - 1); links[i] ; i = (i + 1) & (max - 1) );
+      links[i] = id;
+    }
+
+    if ( du->links ) free(du->links);
+    du->links = links;
+    du->maxlinks = max;
+  }
+
+  id = fileid ? fileid : ~0ULL;
+
+  for ( i = (id * 0x9e3779b97f4a7c15ULL) >> 32 & (du->maxlinks - 1); du->links[i] ;
+      i = (i + 1) & (du->maxlinks - 1) ) {
+    if ( du->links[i] == id ) return 1;
+  }
+
+  du->links[i] = id;
+  du->nlinks++;
+
+return 0;
+}
+
+static void nfs3duadd( t_nfs3du *du, t_nfs3dusum *sum, fattr3 *attr ) {
+
+  if ( attr->type != NF3DIR && attr->nlink > 1 && nfs3dulink(du, attr->fileid) )
+    return;
+
+  sum->size += attr->size;
+  sum->used += attr->used;
+
+  if ( attr->type == NF3DIR ) sum->dirs++;
+  else sum->files++;
+}
+
+static void nfs3dutopswap( t_nfs3dutop *a, t_nfs3dutop *b ) {
+
+  t_nfs3dutop t = *a;
+
+  *a = *b;
+  *b = t;
+}
+
+// keep directory if it's among maxtop largest ones
+static void nfs3dutopadd( t_nfs3du *du, t_nfs3dudir *d ) {
+
+  t_nfs3dutop *top = du->top;
+  int i, c;
+
+  if ( du->maxtop == 0 ) return;
+
+  if ( du->ntop == du->maxtop ) {
+
+    if ( d->sum.used <= top[0].sum.used ) return;
+
+    // replace the smallest one and sift it down
+    free(top[0].path);
+    top[0].sum = d->sum;
+    top[0].path = d->wd.path;
+    d->wd.path = NULL;
+
+    for ( i = 0; (c = 2 * i + 1) < du->ntop ; i = c ) {
+      if ( c + 1 < du->ntop && top[c + 1].sum.used < top[c].sum.used ) c++;
+      if ( top[i].sum.used <= top[c].sum.used ) break;
+      nfs3dutopswap(&top[i], &top[c]);
+    }
+
+    return;
+  }
+
+  i = du->ntop++;
+  top[i].sum = d->sum;
+  top[i].path = d->wd.path;
+  d->wd.path = NULL;
 
-  fstat->st_atim.tv_sec = attr->atime.seconds;
-  fstat->st_mtim.tv_sec = attr->mtime.seconds;
-  fstat->st_ctim.tv_sec = attr->ctime.seconds;
+  for ( ; i > 0 && top[(i - 1) / 2].sum.used > top[i].sum.used ; i = (i - 1) / 2 )
+    nfs3dutopswap(&top[i], &top[(i - 1) / 2]);
+}
 
-  fstat->st_atim.tv_nsec = attr->atime.nseconds;
-  fstat->st_mtim.tv_nsec = attr->mtime.nseconds;
-  fstat->st_ctim.tv_nsec = attr->ctime.nseconds;
+static int nfs3dutopcmp( const void *a, const void *b ) {
 
-return 0;
+  unsigned long long ua = ((t_nfs3dutop *)a)->sum.used, ub = ((t_nfs3dutop *)b)->sum.used;
+
+return (ua < ub) - (ua > ub);
 }
 
-int nfsfilestat( t_nfsclt *nfsclt, char *path, struct stat *fstat ) {
+static void nfs3dudirfree( t_nfs3dudir *d ) {
+
+  nfs3dirreplyfree(&d->wd.reply);
+
+  if ( d->wd.path ) free(d->wd.path);
+  free(d);
+}
+
+// Drop one reference of directory. Directory without references is
+// complete, it's totals go to parent.
+static void nfs3durelease( t_nfs3walk *w, t_nfs3wdir *wd ) {
+
+  t_nfs3du *du = (t_nfs3du *)w;
+  t_nfs3dudir *d = (t_nfs3dudir *)wd, *parent;
+  t_nfs3dusum *psum;
+
+  while ( d && --d->wd.pending == 0 ) {
+
+    parent = d->parent;
+
+    // top one is printed by caller
+    if ( parent ) {
+      if ( du->all ) nfs3duprint(&d->sum, d->wd.path);
+      nfs3dutopadd(du, d);
+
+      psum = &parent->sum;
+      psum->size += d->sum.size;
+      psum->used += d->sum.used;
+      psum->files += d->sum.files;
+      psum->dirs += d->sum.dirs;
+
+      nfs3dudirfree(d);
+    }
+
+    d = parent;
+  }
+}
+
+static t_nfs3dudir *nfs3dudir( t_nfs3du *du, t_nfs3dudir *parent, nfs_fh3 *fh,
+    fattr3 *attr, char *path ) {
+
+  t_nfs3dudir *d;
+
+  if ( (d = calloc(1, sizeof(t_nfs3dudir))) == NULL ) {
+    perror("calloc()");
+    free(path);
+    return NULL;
+  }
+
+  d->parent = parent;
+  d->wd.path = path;
+  nfs3fhset(&d->wd.fh, fh);
+  nfs3duadd(du, &d->sum, attr);
+
+  if ( parent ) parent->wd.pending++;
+
+  nfs3walkqueue(&du->walk, &d->wd);
+
+return d;
+}
+
+static void nfs3duentry( t_nfs3walk *w, t_nfs3wdir *wd, char *name,
+    nfs_fh3 *fh, fattr3 *attr ) {
+
+  t_nfs3du *du = (t_nfs3du *)w;
+  t_nfs3dudir *d = (t_nfs3dudir *)wd;
+  char *path;
+
+  if ( attr->type != NF3DIR ) {
+    nfs3duadd(du, &d->sum, attr);
+    return;
+  }
+
+  if ( (path = nfs3mirrorpath(d->wd.path, name)) == NULL
+      || nfs3dudir(du, d, fh, attr, path) == NULL )
+    w->errors++;
+}
+
+int nfs3du( t_nfsclt *nfsclt, char *path, int all, int ntop ) {
+
+  t_nfs3du du;
+  t_nfs3dudir *root;
+  t_nfs3dusum sum;
+  LOOKUP3res *res;
+  fattr3 *attr;
+  struct timespec start, end;
+  char *rpath;
+  int i;
+
+  if ( (res = nfs3pathlookup(nfsclt, path, 1)) == NULL ) return -1;
+
+  if ( !res->LOOKUP3res_u.resok.obj_attributes.attributes_follow ) {
+    fprintf(stderr, "%s: server didn't return attributes\n", path);
+    return -1;
+  }
+
+  attr = &res->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes;
+
+  memset(&du, 0, sizeof(du));
+  nfs3walkinit(&du.walk, nfsclt, nfs3duentry, nfs3durelease);
+  du.all = all;
+
+  printf("%10s %10s %9s %7s  %s\n", "used", "size", "files", "dirs", "path");
+
+  if ( attr->type != NF3DIR ) {
+    memset(&sum, 0, sizeof(sum));
+    nfs3duadd(&du, &sum, attr);
+    nfs3duprint(&sum, path);
+    if ( du.links ) free(du.links);
+    return 0;
+  }
+
+  if ( ntop > 0 && (du.top = calloc(ntop, sizeof(t_nfs3dutop))) == NULL ) {
+    perror("calloc()");
+    return -1;
+  }
+  du.maxtop = ntop;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  if ( (rpath = strdup(path)) == NULL
+      || (root = nfs3dudir(&du, NULL, &res->LOOKUP3res_u.resok.object, attr, rpath)) == NULL ) {
+    if ( du.top ) free(du.top);
+    return -1;
+  }
+
+  // directories left after failure are summed up too
+  nfs3walk(&du.walk);
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  nfs3duprint(&root->sum, root->wd.path);
+
+  if ( du.ntop ) {
+    qsort(du.top, du.ntop, sizeof(t_nfs3dutop), nfs3dutopcmp);
+
+    printf("\nlargest directories:\n");
+
+    for ( i = 0; i < du.ntop ; i++ ) {
+      nfs3duprint(&du.top[i].sum, du.top[i].path);
+      free(du.top[i].path);
+    }
+  }
+
+  printf("%ld directories read in %.2f s", root->sum.dirs,
+      (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+  if ( du.walk.errors )
+    printf(", %ld errors, totals are incomplete", du.walk.errors);
+
+  printf("\n");
+
+  nfs3dudirfree(root);
+  if ( du.top ) free(du.top);
+  if ( du.links ) free(du.links);
+
+return du.walk.errors ? -1 : 0;
+}
+
+int nfsdu( t_nfsclt *nfsclt, char *path, int all, int ntop ) {
 
   switch ( nfsclt->version ) {
     case 30:
-      return nfs3filestat( nfsclt, path, fstat );
+      return nfs3du( nfsclt, path, all, ntop );
     break;
   }
 
 return -1;
 }
 
-int nfs3filecreate( t_nfsclt *nfsclt, char *dir, char *file, struct stat *fstat ) {
+// Search of tree. Directories are read breadth first with nfs3walk(),
+// entries are matched
+// against attributes READDIRPLUS returned and printed right away.
 
-  CREATE3args cargs;
-  CREATE3res *cres;
+typedef struct s_nfs3find {
 
-  // lookup directory handle
+  t_nfs3walk walk;
+
+  t_nfsfind *query;
+  time_t now;
+  long matches;
+
+} t_nfs3find;
+
+// -1, 0 or 1 as value is less, equal or greater than ref
+static int nfs3findcmp( unsigned long long value, unsigned long long ref ) {
+
+return (value > ref) - (value < ref);
+}
+
+static int nfs3findmatch( t_nfsfind *q, time_t now, char *name, fattr3 *attr ) {
+
+  unsigned long long size;
+  long days;
+
+  if ( q->type && attr->type != q->type ) return 0;
+
+  if ( q->uid != -1 && attr->uid != q->uid ) return 0;
+
+  if ( q->sizecmp != NFSFIND_ANY ) {
+    // like find, size is counted in whole units
+    size = (attr->size + q->sizeunit - 1) / q->sizeunit;
+    if ( nfs3findcmp(size, q->size) != q->sizecmp ) return 0;
+  }
+
+  if ( q->mtimecmp != NFSFIND_ANY ) {
+    days = ((long)now - (long)attr->mtime.seconds) / 86400;
+    if ( days < 0 ) days = 0;
+    if ( nfs3findcmp(days, q->mtime) != q->mtimecmp ) return 0;
+  }
+
+  if ( q->name && fnmatch(q->name, name, 0) != 0 ) return 0;
+
+return 1;
+}
+
+static void nfs3findrelease( t_nfs3walk *w, t_nfs3wdir *d ) {
+
+  if ( --d->pending ) return;
+
+  nfs3dirreplyfree(&d->reply);
+
+  free(d->path);
+  free(d);
+}
+
+// Queue directory to be read after ones already waiting
+static int nfs3finddir( t_nfs3find *f, nfs_fh3 *fh, char *path ) {
+
+  t_nfs3wdir *d;
+
+  if ( (d = calloc(1, sizeof(t_nfs3wdir))) == NULL ) {
+    perror("calloc()");
+    free(path);
+    return -1;
+  }
+
+  d->path = path;
+  nfs3fhset(&d->fh, fh);
+
+  nfs3walkqueue(&f->walk, d);
+
+return 0;
+}
+
+static void nfs3findentry( t_nfs3walk *w, t_nfs3wdir *d, char *name,
+    nfs_fh3 *fh, fattr3 *attr ) {
+
+  t_nfs3find *f = (t_nfs3find *)w;
+  int match;
+  char *path;
+
+  match = nfs3findmatch(f->query, f->now, name, attr);
+
+  if ( !match && attr->type != NF3DIR ) return;
+
+  if ( (path = nfs3mirrorpath(d->path, name)) == NULL ) {
+    w->errors++;
+    return;
+  }
+
+  if ( match ) {
+    printf("%s\n", path);
+    f->matches++;
+  }
+
+  if ( attr->type != NF3DIR ) {
+    free(path);
+    return;
+  }
+
+  if ( nfs3finddir(f, fh, path) == -1 ) w->errors++;
+}
+
+long nfs3find( t_nfsclt *nfsclt, char *path, t_nfsfind *query ) {
+
+  t_nfs3find f;
   LOOKUP3res *res;
-  res = nfs3pathlookup( nfsclt, dir, 0);
-  if ( res == NULL ) return -1;
+  fattr3 *attr;
+  char *rpath, *name;
 
-  if ( res->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes.type
-      != NF3DIR ) {
+  if ( (res = nfs3pathlookup(nfsclt, path, 1)) == NULL ) return -1;
 
-    fprintf(stderr, "%s: is not a directory\n", dir);
+  if ( !res->LOOKUP3res_u.resok.obj_attributes.attributes_follow ) {
+    fprintf(stderr, "%s: server didn't return attributes\n", path);
+    return -1;
+  }
+
+  attr = &res->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes;
+
+  memset(&f, 0, sizeof(f));
+  nfs3walkinit(&f.walk, nfsclt, nfs3findentry, nfs3findrelease);
+  f.walk.fifo = 1;
+  f.query = query;
+  f.now = time(NULL);
+
+  // starting point is matched too, by it's last component
+  name = strrchr(path, '/');
+  name = name && name[1] ? name + 1 : path;
+
+  if ( nfs3findmatch(query, f.now, name, attr) ) {
+    printf("%s\n", path);
+    f.matches++;
+  }
+
+  if ( attr->type != NF3DIR ) return f.matches;
+
+  if ( (rpath = strdup(path)) == NULL ) {
+    perror("strdup()");
+    return -1;
+  }
+
+  if ( nfs3finddir(&f, &res->LOOKUP3res_u.resok.object, rpath) == -1 )
+    return -1;
+
+  nfs3walk(&f.walk);
+
+  if ( f.walk.errors ) {
+    fprintf(stderr, "%ld errors, %ld directories read, results are incomplete\n",
+        f.walk.errors, f.walk.nread);
+    return -1;
+  }
+
+return f.matches;
+}
+
+long nfsfind( t_nfsclt *nfsclt, char *path, t_nfsfind *query ) {
+
+  switch ( nfsclt->version ) {
+    case 30:
+      return nfs3find( nfsclt, path, query );
+    break;
+  }
+
+return -1;
+}
+
+// Snapshot of tree. Directories are read with nfs3walk(), depth first
+// so few of them wait in queue. Entries of directory are kept
+// aside until it's read to the end, then stored next to each other.
+// With old snapshot, directory which mtime didn't change has it's
+// entries copied from there, only subdirectories are checked with
+// GETATTR. Attributes of other entries are from old snapshot then.
+
+#define NFS3_SNAP_GETATTR   1
+#define NFS3_SNAP_LOOKUP    2   // by name, old handle is stale
+
+typedef struct s_nfs3snapdir {
+
+  t_nfs3wdir wd;
+  union {
+    GETATTR3res getattr;
+    LOOKUP3res lookup;
+  } res;
+
+  uint32_t idx;       // record in new snapshot
+  uint32_t old;       // in old one, SNAPSHOT_NONE if not there
+  int check;          // attributes are from old snapshot, get them
+                      // with NFS3_SNAP_GETATTR or NFS3_SNAP_LOOKUP
+
+  t_snaprec *ents;    // read so far
+  uint32_t nents;
+  uint32_t maxents;
+
+} t_nfs3snapdir;
+
+typedef struct s_nfs3snap {
+
+  t_nfs3walk walk;
+
+  t_snapshot new;
+  t_snapshot old;
+  int hasold;
+
+  long ncopied;
+
+} t_nfs3snap;
+
+static void nfs3snapdirfree( t_nfs3snapdir *d ) {
+
+  nfs3dirreplyfree(&d->wd.reply);
+
+  if ( d->ents ) free(d->ents);
+  free(d);
+}
+
+// Directory wasn't read completely, mtime nobody sets makes next
+// incremental snapshot read it again
+static void nfs3snapunread( t_nfs3snap *sn, uint32_t idx ) {
+
+  sn->new.recs[idx].attr.mtime.seconds = 0;
+  sn->new.recs[idx].attr.mtime.nseconds = 0;
+}
+
+static void nfs3snapincomplete( t_nfs3snap *sn, uint32_t idx ) {
+
+  nfs3snapunread(sn, idx);
+  sn->walk.errors++;
+}
+
+// walk counted the error already
+static void nfs3snapdirincomplete( t_nfs3walk *w, t_nfs3wdir *wd ) {
+
+  nfs3snapunread((t_nfs3snap *)w, ((t_nfs3snapdir *)wd)->idx);
+}
+
+static char *nfs3snappath( t_nfs3walk *w, t_nfs3wdir *wd, char *buf, size_t size ) {
+
+return snapshot_path(&((t_nfs3snap *)w)->new, ((t_nfs3snapdir *)wd)->idx, buf, size);
+}
+
+static int nfs3snapqueue( t_nfs3snap *sn, uint32_t idx, uint32_t old, int check ) {
+
+  t_nfs3snapdir *d;
+  t_snaprec *rec = &sn->new.recs[idx];
+
+  if ( (d = calloc(1, sizeof(t_nfs3snapdir))) == NULL ) {
+    perror("calloc()");
+    nfs3snapincomplete(sn, idx);
     return -1;
   }
 
-  // set new file attributes
-  memset(&cargs, 0, sizeof(cargs));
-  nfs_fh3copy(&cargs.where.dir, &res->LOOKUP3res_u.resok.object);
-  cargs.where.name = file;
+  d->idx = idx;
+  d->old = old;
+  d->check = check;
+
+  d->wd.fh.len = rec->fhlen;
+  memcpy(d->wd.fh.data, rec->fh, rec->fhlen);
+
+  nfs3walkqueue(&sn->walk, &d->wd);
+
+return 0;
+}
+
+static int nfs3snapunchanged( t_nfs3snap *sn, uint32_t idx, uint32_t old ) {
+
+  fattr3 *a = &sn->new.recs[idx].attr, *o;
+
+  if ( old == SNAPSHOT_NONE ) return 0;
+
+  o = &sn->old.recs[old].attr;
+
+return o->type == NF3DIR && o->fileid == a->fileid
+    && o->mtime.seconds == a->mtime.seconds
+    && o->mtime.nseconds == a->mtime.nseconds;
+}
+
+// Copy entries of unchanged directory from old snapshot, it's
+// subdirectories have to be checked
+static void nfs3snapcopy( t_nfs3snap *sn, uint32_t idx, uint32_t old ) {
+
+  t_snaprec *orec = &sn->old.recs[old], *rec;
+  uint32_t first, i;
+  int64_t name;
+
+  if ( (first = snapshot_reserve(&sn->new, orec->nchildren)) == SNAPSHOT_NONE ) {
+    nfs3snapincomplete(sn, idx);
+    return;
+  }
+
+  sn->new.recs[idx].first = first;
+  sn->new.recs[idx].nchildren = orec->nchildren;
+  sn->ncopied++;
+
+  for ( i = 0; i < orec->nchildren ; i++ ) {
+
+    if ( (name = snapshot_name(&sn->new, SNAPSHOT_NAME(&sn->old, orec->first + i))) == -1 ) {
+      // empty name is never looked up, directory is read again next time
+      name = 0;
+      nfs3snapincomplete(sn, idx);
+    }
+
+    rec = &sn->new.recs[first + i];
+    *rec = sn->old.recs[orec->first + i];
+    rec->name = name;
+    rec->parent = idx;
+    rec->first = rec->nchildren = 0;
+
+    if ( rec->attr.type == NF3DIR )
+      nfs3snapqueue(sn, first + i, orec->first + i, NFS3_SNAP_GETATTR);
+  }
+}
+
+// read directory again or copy it's entries
+static void nfs3snapvisit( t_nfs3snap *sn, uint32_t idx, uint32_t old ) {
+
+  if ( nfs3snapunchanged(sn, idx, old) ) nfs3snapcopy(sn, idx, old);
+  else nfs3snapqueue(sn, idx, old, 0);
+}
+
+static void nfs3snapentry( t_nfs3walk *w, t_nfs3wdir *wd, char *name,
+    nfs_fh3 *fh, fattr3 *attr ) {
+
+  t_nfs3snap *sn = (t_nfs3snap *)w;
+  t_nfs3snapdir *d = (t_nfs3snapdir *)wd;
+  t_snaprec *ents, *rec;
+  uint32_t max;
+  int64_t off;
+
+  if ( d->nents == d->maxents ) {
+
+    max = d->maxents ? d->maxents * 2 : 64;
+
+    if ( (ents = realloc(d->ents, max * sizeof(t_snaprec))) == NULL ) {
+      perror("realloc()");
+      nfs3snapincomplete(sn, d->idx);
+      return;
+    }
+
+    d->ents = ents;
+    d->maxents = max;
+  }
+
+  if ( (off = snapshot_name(&sn->new, name)) == -1 ) {
+    nfs3snapincomplete(sn, d->idx);
+    return;
+  }
+
+  rec = &d->ents[d->nents++];
+  memset(rec, 0, sizeof(t_snaprec));
 
-  // one of UNCHECKED GUARDED EXCLUSIVE
-  // UNCHECKED - without checking for the existence of a duplicate file
-  cargs.how.mode = GUARDED; 
+  rec->name = off;
+  rec->parent = d->idx;
+  rec->fhlen = fh->data.data_len;
+  memcpy(rec->fh, fh->data.data_val, fh->data.data_len);
+  rec->attr = *attr;
+}
 
-  stat_to_sattr3(&cargs.how.createhow3_u.obj_attributes, fstat);
+// Drop one reference of directory. Directory without references was
+// read, it's entries are stored and subdirectories visited.
+static void nfs3snaprelease( t_nfs3walk *w, t_nfs3wdir *wd ) {
 
-  cres = nfsproc3_create_3(&cargs, nfsclt->nfs.client);
-  nfs_fh3free(&cargs.where.dir); 
+  t_nfs3snap *sn = (t_nfs3snap *)w;
+  t_nfs3snapdir *d = (t_nfs3snapdir *)wd;
+  t_snaprec *rec;
+  uint32_t first, i, old;
 
-  if ( cres == NULL ) {
-    clnt_perror(nfsclt->nfs.client, "nfsproc3_create_3()");
-    return -1;
+  if ( --d->wd.pending ) return;
+
+  if ( d->check || d->nents == 0 ) {
+    nfs3snapdirfree(d);
+    return;
   }
 
-  if (cres->status != NFS3_OK) {
-    fprintf(stderr, "Creating file: %s - (%d) %s\n", file,
-        res->status, nfs3_error(cres->status));
-    return -1;
+  if ( (first = snapshot_reserve(&sn->new, d->nents)) == SNAPSHOT_NONE ) {
+    nfs3snapincomplete(sn, d->idx);
+    nfs3snapdirfree(d);
+    return;
   }
 
-return 0;
-}
+  memcpy(&sn->new.recs[first], d->ents, d->nents * sizeof(t_snaprec));
+  snapshot_sortchildren(&sn->new, first, d->nents);
 
-int nfsfilecreate( t_nfsclt *nfsclt, char *path, struct stat *fstat ) {
+  sn->new.recs[d->idx].first = first;
+  sn->new.recs[d->idx].nchildren = d->nents;
 
-  char *dir = NULL, *file = NULL;
-  int ret = -1;
+  for ( i = 0; i < d->nents ; i++ ) {
 
-  if ( pathsplit(path, &dir, &file ) == -1 )
-    return -1;
+    rec = &sn->new.recs[first + i];
+    if ( rec->attr.type != NF3DIR ) continue;
 
-//  printf("dir: %s, file: %s\n", dir, file);
+    old = SNAPSHOT_NONE;
+    if ( d->old != SNAPSHOT_NONE )
+      old = snapshot_child(&sn->old, d->old, SNAPSHOT_NAME(&sn->new, first + i));
 
-  switch ( nfsclt->version ) {
-    case 30:
-      ret = nfs3filecreate( nfsclt, dir, file, fstat );
-    break;
+    nfs3snapvisit(sn, first + i, old);
   }
 
-  if ( dir ) free(dir);
-  if ( file ) free(file);
-
-return ret;
+  nfs3snapdirfree(d);
 }
 
-int nfs3filerm( t_nfsclt *nfsclt, char *dir, char *file) {
+static void nfs3snapattrdone( t_rpcmux *mux, t_rpccall *call ) {
 
-  REMOVE3args rargs;
-  REMOVE3res *rres;
+  t_nfs3snapdir *d = (t_nfs3snapdir *)call->arg;
+  t_nfs3snap *sn = (t_nfs3snap *)d->wd.walk;
+  t_snaprec *rec = &sn->new.recs[d->idx];
+  LOOKUP3resok *lres = &d->res.lookup.LOOKUP3res_u.resok;
+  nfsstat3 status;
+  char path[PATH_MAX];
 
-  // lookup directory handle
-  LOOKUP3res *res;
-  res = nfs3pathlookup( nfsclt, dir, 0);
-  if ( res == NULL ) return -1;
+  sn->walk.outstanding--;
 
-  if ( res->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes.type
-      != NF3DIR ) {
+  status = d->check == NFS3_SNAP_GETATTR ? d->res.getattr.status : d->res.lookup.status;
 
-    fprintf(stderr, "%s: is not a directory\n", dir);
-    return -1;
-  }
+  if ( call->stat == RPC_SUCCESS && status == NFS3_OK ) {
 
-  // set new file attributes
-  memset(&rargs, 0, sizeof(rargs));
-  nfs_fh3copy(&rargs.object.dir, &res->LOOKUP3res_u.resok.object);
-  rargs.object.name = file;
+    if ( d->check == NFS3_SNAP_GETATTR ) {
+      rec->attr = d->res.getattr.GETATTR3res_u.resok.obj_attributes;
+      nfs3snapvisit(sn, d->idx, d->old);
+      nfs3snaprelease(&sn->walk, &d->wd);
+      return;
+    }
 
-  rres = nfsproc3_remove_3(&rargs, nfsclt->nfs.client);
-  nfs_fh3free(&rargs.object.dir); 
+    if ( lres->obj_attributes.attributes_follow ) {
+      rec->fhlen = lres->object.data.data_len;
+      memcpy(rec->fh, lres->object.data.data_val, rec->fhlen);
+      rec->attr = lres->obj_attributes.post_op_attr_u.attributes;
 
-  if ( rres == NULL ) {
-    clnt_perror(nfsclt->nfs.client, "nfsproc3_remove_3()");
-    return -1;
+      xdr_free((xdrproc_t)NFS3XDR(LOOKUP3res), (char *)&d->res.lookup);
+
+      // it's other object with the same name, old entries don't matter
+      if ( rec->attr.fileid != sn->old.recs[d->old].attr.fileid )
+        d->old = SNAPSHOT_NONE;
+
+      nfs3snapvisit(sn, d->idx, d->old);
+      nfs3snaprelease(&sn->walk, &d->wd);
+      return;
+    }
   }
 
-  if (rres->status != NFS3_OK) {
-    fprintf(stderr, "Removing file: %s - (%d) %s\n", file,
-        res->status, nfs3_error(rres->status));
-    return -1;
+  if ( d->check == NFS3_SNAP_LOOKUP && call->stat == RPC_SUCCESS )
+    xdr_free((xdrproc_t)NFS3XDR(LOOKUP3res), (char *)&d->res.lookup);
+
+  // handles of old snapshot aren't valid if file system was exported
+  // again, directory is looked up by name then
+  if ( call->stat == RPC_SUCCESS && status == NFS3ERR_STALE
+      && d->check == NFS3_SNAP_GETATTR ) {
+
+    d->check = NFS3_SNAP_LOOKUP;
+    nfs3walkpush(&sn->walk, &d->wd);
+    return;
   }
 
-return 0;
-}
+  if ( snapshot_path(&sn->new, d->idx, path, sizeof(path)) == NULL )
+    strcpy(path, "...");
 
-int nfsfilerm( t_nfsclt *nfsclt, char *path) {
+  if ( call->stat != RPC_SUCCESS )
+    fprintf(stderr, "%s: %s\n", path, clnt_sperrno(call->stat));
+  else if ( status != NFS3_OK )
+    fprintf(stderr, "%s failed: %s - (%d) %s\n", d->check == NFS3_SNAP_GETATTR ?
+        "Getattr" : "Lookup", path, status, nfs3_error(status));
+  else
+    fprintf(stderr, "%s: server didn't return attributes\n", path);
 
-  char *dir = NULL, *file = NULL;
-  int ret = -1;
+  nfs3snapincomplete(sn, d->idx);
+  nfs3snaprelease(&sn->walk, &d->wd);
+}
 
-  if ( pathsplit(path, &dir, &file ) == -1 )
-    return -1;
+// GETATTR or LOOKUP of directory which attributes are from old
+// snapshot, READDIRPLUS of others
+static int nfs3snapdirsend( t_nfs3walk *w, t_nfs3wdir *wd ) {
 
-//  printf("dir: %s, file: %s\n", dir, file);
+  t_nfs3snap *sn = (t_nfs3snap *)w;
+  t_nfs3snapdir *d = (t_nfs3snapdir *)wd;
+  t_nfsclt *nfsclt = w->nfsclt;
+  GETATTR3args aargs;
+  LOOKUP3args largs;
+  t_snaprec *parent;
 
-  switch ( nfsclt->version ) {
-    case 30:
-      ret = nfs3filerm( nfsclt, dir, file );
-    break;
-  }
+  if ( !d->check ) return nfs3walkdirsend(w, wd);
 
-  if ( dir ) free(dir);
-  if ( file ) free(file);
+  d->wd.call.arg = d;
+  d->wd.call.donefn = nfs3snapattrdone;
 
-return ret;
-}
+  if ( d->check == NFS3_SNAP_GETATTR ) {
 
-int nfs3fileattr( t_nfsclt *nfsclt, char *filename, struct stat *fstat) {
+    aargs.object = *NFS3FH(&d->wd.fh);
 
-  SETATTR3args sargs;
-  SETATTR3res *sres;
-  sattr3 *sattr;
+    d->wd.call.xres = (xdrproc_t)NFS3XDR(GETATTR3res);
+    d->wd.call.res = &d->res.getattr;
 
-  // lookup file handle
-  LOOKUP3res *res;
-  res = nfs3pathlookup( nfsclt, filename, 0);
-  if ( res == NULL ) return -1;
+    if ( rpcgroup_submit(&nfsclt->nfsgroup, &d->wd.call, NFSPROC3_GETATTR,
+        (xdrproc_t)NFS3XDR(GETATTR3args), &aargs) == -1 )
+      return -1;
 
-  // set new attributes
-  memset(&sargs, 0, sizeof(sargs));
-  nfs_fh3copy(&sargs.object, &res->LOOKUP3res_u.resok.object);
+  } else {
 
-  stat_to_sattr3(&sargs.new_attributes, fstat);
+    // parent is in new snapshot already, with valid handle
+    parent = &sn->new.recs[sn->new.recs[d->idx].parent];
 
-  sres = nfsproc3_setattr_3(&sargs, nfsclt->nfs.client);
-  nfs_fh3free(&sargs.object); 
+    memset(&largs, 0, sizeof(largs));
+    largs.what.dir.data.data_len = parent->fhlen;
+    largs.what.dir.data.data_val = parent->fh;
+    largs.what.name = SNAPSHOT_NAME(&sn->new, d->idx);
 
-  if ( sres == NULL ) {
-    clnt_perror(nfsclt->nfs.client, "nfsproc3_setattr_3()");
-    return -1;
-  }
+    memset(&d->res.lookup, 0, sizeof(LOOKUP3res));
+    d->wd.call.xres = (xdrproc_t)NFS3XDR(LOOKUP3res);
+    d->wd.call.res = &d->res.lookup;
 
-  if (sres->status != NFS3_OK) {
-    fprintf(stderr, "Setting attributes: %s - (%d) %s\n", filename,
-        res->status, nfs3_error(sres->status));
-    return -1;
+    if ( rpcgroup_submit(&nfsclt->nfsgroup, &d->wd.call, NFSPROC3_LOOKUP,
+        (xdrproc_t)NFS3XDR(LOOKUP3args), &largs) == -1 )
+      return -1;
   }
 
+  w->outstanding++;
+
 return 0;
 }
 
-int nfsfileattr( t_nfsclt *nfsclt, char *path, struct stat *fstat ) {
+long nfs3snapshot( t_nfsclt *nfsclt, char *path, char *file, int incremental ) {
 
-  fstat->st_dev = 0;  // don't try to create device
+  t_nfs3snap sn;
+  t_snaprec *rec;
+  LOOKUP3res *res;
+  LOOKUP3resok *resok;
+  struct timespec start, end;
+  uint32_t old = SNAPSHOT_NONE;
+  long ret = -1;
 
-  switch ( nfsclt->version ) {
-    case 30:
-      return nfs3fileattr( nfsclt, path, fstat );
-    break;
+  if ( (res = nfs3pathlookup(nfsclt, path, 1)) == NULL ) return -1;
+
+  resok = &res->LOOKUP3res_u.resok;
+
+  if ( !resok->obj_attributes.attributes_follow ) {
+    fprintf(stderr, "%s: server didn't return attributes\n", path);
+    return -1;
   }
 
-return -1;
-}
+  memset(&sn, 0, sizeof(sn));
+  nfs3walkinit(&sn.walk, nfsclt, nfs3snapentry, nfs3snaprelease);
+  sn.walk.incomplete = nfs3snapdirincomplete;
+  sn.walk.send = nfs3snapdirsend;
+  sn.walk.path = nfs3snappath;
 
-int nfs3dirmk( t_nfsclt *nfsclt, char *dir, char *file, struct stat *fstat ) {
+  if ( incremental ) {
+    if ( snapshot_open(&sn.old, file) == -1 ) return -1;
+    sn.hasold = 1;
+  }
 
-  MKDIR3args args;
-  MKDIR3res *res;
+  if ( snapshot_init(&sn.new, path) == -1
+      || snapshot_reserve(&sn.new, 1) == SNAPSHOT_NONE )
+    goto ERR;
 
-  // lookup directory handle
-  LOOKUP3res *lres;
-  lres = nfs3pathlookup( nfsclt, dir, 0);
-  if ( lres == NULL ) return -1;
+  rec = &sn.new.recs[0];
+  rec->parent = SNAPSHOT_NONE;
+  rec->fhlen = resok->object.data.data_len;
+  memcpy(rec->fh, resok->object.data.data_val, rec->fhlen);
+  rec->attr = resok->obj_attributes.post_op_attr_u.attributes;
 
-  if ( lres->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes.type
-      != NF3DIR ) {
+  // the same tree, not only the same path
+  if ( sn.hasold && sn.old.recs[0].attr.fileid == rec->attr.fileid
+      && sn.old.recs[0].attr.fsid == rec->attr.fsid )
+    old = 0;
 
-    fprintf(stderr, "%s: is not a directory\n", dir);
-    return -1;
-  }
+  clock_gettime(CLOCK_MONOTONIC, &start);
 
-  // set new file attributes
-  memset(&args, 0, sizeof(args));
-  nfs_fh3copy(&args.where.dir, &lres->LOOKUP3res_u.resok.object);
-  args.where.name = file;
+  if ( rec->attr.type == NF3DIR ) nfs3snapvisit(&sn, 0, old);
 
-  stat_to_sattr3(&args.attributes, fstat);
+  nfs3walk(&sn.walk);
 
-  res = nfsproc3_mkdir_3(&args, nfsclt->nfs.client);
-  nfs_fh3free(&args.where.dir); 
+  clock_gettime(CLOCK_MONOTONIC, &end);
 
-  if ( res == NULL ) {
-    clnt_perror(nfsclt->nfs.client, "nfsproc3_mkdir_3()");
-    return -1;
-  }
+  if ( snapshot_write(&sn.new, file) == -1 ) goto ERR;
 
-  if (res->status != NFS3_OK) {
-    fprintf(stderr, "Creating directory: %s - (%d) %s\n", file,
-        res->status, nfs3_error(res->status));
-    return -1;
-  }
+  printf("%u objects, %ld directories read, %ld unchanged in %.2f s",
+      sn.new.hdr.nrecs, sn.walk.nread, sn.ncopied,
+      (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
 
-return 0;
-}
+  if ( sn.walk.errors )
+    printf(", %ld errors, snapshot is incomplete", sn.walk.errors);
 
-int nfsdirmk( t_nfsclt *nfsclt, char *path, struct stat *fstat ) {
+  printf("\n");
 
-  char *dir = NULL, *file = NULL;
-  int ret = -1;
+  ret = sn.walk.errors ? -1 : sn.new.hdr.nrecs;
 
-  fstat->st_dev = 0;  // don't try to create device
+ERR:
+  snapshot_free(&sn.new);
+  if ( sn.hasold ) snapshot_free(&sn.old);
 
-  if ( pathsplit(path, &dir, &file ) == -1 )
-    return -1;
+return ret;
+}
 
-//  printf("dir: %s, file: %s\n", dir, file);
+long nfssnapshot( t_nfsclt *nfsclt, char *path, char *file, int incremental ) {
 
   switch ( nfsclt->version ) {
     case 30:
-      ret = nfs3dirmk( nfsclt, dir, file, fstat );
+      return nfs3snapshot( nfsclt, path, file, incremental );
     break;
   }
 
-  if ( dir ) free(dir);
-  if ( file ) free(file);
-
-return ret;
+return -1;
 }
 
-int nfs3dirrm( t_nfsclt *nfsclt, char *dir, char *file) {
+// Preorder walk under top, buf holds path of current entry. Parent links
+// lead back up, so depth of the tree doesn't need stack.
+static void nfssnapfindwalk( t_snapshot *s, t_nfsfind *query, time_t now,
+    uint32_t top, char **buf, size_t *size, size_t len, long *matches ) {
 
-  RMDIR3args args;
-  RMDIR3res *res;
+  uint32_t dir = top, i = s->recs[top].first;
+  const char *name;
+  size_t nlen, max;
+  char *p;
 
-  // lookup directory handle
-  LOOKUP3res *dres;
-  dres = nfs3pathlookup( nfsclt, dir, 0);
-  if ( dres == NULL ) return -1;
+  while ( 1 ) {
 
-  if ( dres->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes.type
-      != NF3DIR ) {
+    // directory is done, continue with it's next sibling
+    if ( i == s->recs[dir].first + s->recs[dir].nchildren ) {
+      if ( dir == top ) break;
 
-    fprintf(stderr, "%s: is not a directory\n", dir);
-    return -1;
-  }
+      len -= strlen(SNAPSHOT_NAME(s, dir)) + 1;
+      i = dir + 1;
+      dir = s->recs[dir].parent;
+      continue;
+    }
 
-  memset(&args, 0, sizeof(args));
-  nfs_fh3copy(&args.object.dir, &dres->LOOKUP3res_u.resok.object);
-  args.object.name = file;
+    name = SNAPSHOT_NAME(s, i);
+    nlen = strlen(name);
 
-  res = nfsproc3_rmdir_3(&args, nfsclt->nfs.client);
-  nfs_fh3free(&args.object.dir); 
+    if ( len + nlen + 2 > *size ) {
+      for ( max = *size * 2; len + nlen + 2 > max ; max *= 2 );
 
-  if ( res == NULL ) {
-    clnt_perror(nfsclt->nfs.client, "nfsproc3_rmdir_3()");
-    return -1;
+      if ( (p = realloc(*buf, max)) == NULL ) {
+        perror("realloc()");
+        return;
+      }
+
+      *buf = p;
+      *size = max;
+    }
+
+    (*buf)[len] = '/';
+    memcpy(*buf + len + 1, name, nlen + 1);
+
+    if ( nfs3findmatch(query, now, (char *)name, &s->recs[i].attr) ) {
+      printf("%s\n", *buf);
+      (*matches)++;
+    }
+
+    if ( s->recs[i].attr.type == NF3DIR ) {
+      dir = i;
+      len += 1 + nlen;
+      i = s->recs[dir].first;
+    } else {
+      i++;
+    }
   }
+}
 
-  if (res->status != NFS3_OK) {
-    fprintf(stderr, "Removing directory: %s - (%d) %s\n", file,
-        res->status, nfs3_error(res->status));
+long nfssnapfind( char *file, char *path, t_nfsfind *query ) {
+
+  t_snapshot s;
+  uint32_t idx;
+  size_t size;
+  long matches = 0;
+  char *buf, *name;
+  time_t now;
+
+  if ( snapshot_open(&s, file) == -1 ) return -1;
+
+  if ( (idx = snapshot_lookup(&s, path)) == SNAPSHOT_NONE ) {
+    fprintf(stderr, "%s: not in snapshot of %s\n", path, s.names + s.hdr.rootpath);
+    snapshot_free(&s);
     return -1;
   }
 
-return 0;
-}
+  size = strlen(path) + 256;
 
-int nfsdirrm( t_nfsclt *nfsclt, char *path) {
+  if ( (buf = malloc(size)) == NULL ) {
+    perror("malloc()");
+    snapshot_free(&s);
+    return -1;
+  }
 
-  char *dir = NULL, *file = NULL;
-  int ret = -1;
+  strcpy(buf, path);
+  now = time(NULL);
 
-  if ( pathsplit(path, &dir, &file ) == -1 )
-    return -1;
+  // starting point is matched too, by it's last component
+  name = strrchr(path, '/');
+  name = name && name[1] ? name + 1 : path;
 
-  switch ( nfsclt->version ) {
-    case 30:
-      ret = nfs3dirrm( nfsclt, dir, file );
-    break;
+  if ( nfs3findmatch(query, now, name, &s.recs[idx].attr) ) {
+    printf("%s\n", buf);
+    matches++;
   }
 
-  if ( dir ) free(dir);
-  if ( file ) free(file);
+  nfssnapfindwalk(&s, query, now, idx, &buf, &size, strlen(buf), &matches);
 
-return ret;
+  free(buf);
+  snapshot_free(&s);
+
+return matches;
 }
 
 int nfs3move(
@@ -1386,6 +7012,7 @@ int nfs3move(
 
   RENAME3args args;
   RENAME3res *res;
+  t_nfs3fh fromfh;
 
   memset(&args, 0, sizeof(args));
 
@@ -1401,7 +7028,9 @@ int nfs3move(
     return -1;
   }
 
-  nfs_fh3copy(&args.from.dir, &dres->LOOKUP3res_u.resok.object);
+  // lookup result is overwritten by next lookup
+  nfs3fhset(&fromfh, &dres->LOOKUP3res_u.resok.object);
+  args.from.dir = *NFS3FH(&fromfh);
   args.from.name = srcfile;
 
   // lookup dst directory
@@ -1415,7 +7044,7 @@ int nfs3move(
     return -1;
   }
 
-  nfs_fh3copy(&args.to.dir, &dres->LOOKUP3res_u.resok.object);
+  args.to.dir = dres->LOOKUP3res_u.resok.object;
   if ( dstfile == NULL ) {
     args.to.name = srcfile;
   } else {
@@ -1423,8 +7052,13 @@ int nfs3move(
   }
 
   res = nfsproc3_rename_3(&args, nfsclt->nfs.client);
-  nfs_fh3free(&args.from.dir); 
-  nfs_fh3free(&args.to.dir); 
+  dnlc_remove(&nfsclt->dnlc, &args.from.dir, args.from.name);
+  dnlc_remove(&nfsclt->dnlc, &args.to.dir, args.to.name);
+
+  if ( res && res->status == NFS3_OK ) {
+    nfs3cachewcc( nfsclt, &args.from.dir, &res->RENAME3res_u.resok.fromdir_wcc);
+    nfs3cachewcc( nfsclt, &args.to.dir, &res->RENAME3res_u.resok.todir_wcc);
+  }
 
   if ( res == NULL ) {
     clnt_perror(nfsclt->nfs.client, "nfsproc3_rename_3()");
@@ -1470,6 +7104,7 @@ int nfs3link( t_nfsclt *nfsclt, char *target, char *dir, char *file) {
 
   LINK3args args;
   LINK3res *res;
+  t_nfs3fh dirfh;
 
   // lookup handle for the directory in which the link is to be created
   LOOKUP3res *dres;
@@ -1484,18 +7119,27 @@ int nfs3link( t_nfsclt *nfsclt, char *target, char *dir, char *file) {
   }
 
   memset(&args, 0, sizeof(args));
-  nfs_fh3copy(&args.link.dir, &dres->LOOKUP3res_u.resok.object);
+  // lookup result is overwritten by next lookup
+  nfs3fhset(&dirfh, &dres->LOOKUP3res_u.resok.object);
+  args.link.dir = *NFS3FH(&dirfh);
   args.link.name = file;
 
   // lookup file handle for the existing file system object
   dres = nfs3pathlookup( nfsclt, target, 0);
   if ( dres == NULL ) return -1;
 
-  nfs_fh3copy(&args.file, &dres->LOOKUP3res_u.resok.object);
+  args.file = dres->LOOKUP3res_u.resok.object;
 
   res = nfsproc3_link_3(&args, nfsclt->nfs.client);
-  nfs_fh3free(&args.link.dir); 
-  nfs_fh3free(&args.link.dir); 
+
+  // link count of target has changed
+  if ( res && res->status == NFS3_OK ) {
+    nfs3cacheattr( nfsclt, &args.file, &res->LINK3res_u.resok.file_attributes);
+    nfs3cachewcc( nfsclt, &args.link.dir, &res->LINK3res_u.resok.linkdir_wcc);
+  } else {
+    acache_forget(&nfsclt->acache, &args.file);
+  }
+
 
   if ( res == NULL ) {
     clnt_perror(nfsclt->nfs.client, "nfsproc3_link_3()");
@@ -1551,14 +7195,18 @@ int nfs3symlink(
   }
 
   memset(&args, 0, sizeof(args));
-  nfs_fh3copy(&args.where.dir, &dres->LOOKUP3res_u.resok.object);
+  args.where.dir = dres->LOOKUP3res_u.resok.object;
   args.where.name = file;
 
   stat_to_sattr3(&args.symlink.symlink_attributes, fstat);
   args.symlink.symlink_data = target;
 
   res = nfsproc3_symlink_3(&args, nfsclt->nfs.client);
-  nfs_fh3free(&args.where.dir); 
+
+  if ( res && res->status == NFS3_OK )
+    nfs3cachenew( nfsclt, &args.where.dir, file, &res->SYMLINK3res_u.resok.obj,
+        &res->SYMLINK3res_u.resok.obj_attributes, &res->SYMLINK3res_u.resok.dir_wcc);
+
 
   if ( res == NULL ) {
     clnt_perror(nfsclt->nfs.client, "nfsproc3_symlink_3()");
@@ -1616,7 +7264,7 @@ int nfs3mknod(
   }
 
   memset(&args, 0, sizeof(args));
-  nfs_fh3copy(&args.where.dir, &dres->LOOKUP3res_u.resok.object);
+  args.where.dir = dres->LOOKUP3res_u.resok.object;
   args.where.name = file;
 
   switch ( fstat->st_mode & ~0777) {
@@ -1643,7 +7291,11 @@ int nfs3mknod(
   }
 
   res = nfsproc3_mknod_3(&args, nfsclt->nfs.client);
-  nfs_fh3free(&args.where.dir); 
+
+  if ( res && res->status == NFS3_OK )
+    nfs3cachenew( nfsclt, &args.where.dir, file, &res->MKNOD3res_u.resok.obj,
+        &res->MKNOD3res_u.resok.obj_attributes, &res->MKNOD3res_u.resok.dir_wcc);
+
 
   if ( res == NULL ) {
     clnt_perror(nfsclt->nfs.client, "nfsproc3_mknod_3()");
@@ -1683,18 +7335,20 @@ int nfs3printstat( t_nfsclt *nfsclt) {
 
   FSSTAT3args args;
   FSSTAT3res *res;
+  t_nfs3fh fsroot;
   
   memset(&args, 0, sizeof(args));
 
   if ( nfsclt->mountres.nfs3 != NULL ) {
-    fhandle3_to_nfs_fh3(&args.fsroot,
+    nfs3fhsetmnt(&fsroot,
       &nfsclt->mountres.nfs3->mountres3_u.mountinfo.fhandle);
   } else {
-    nfs_fh3copy(&args.fsroot, &nfsclt->currentdir.nfs3);
+    fsroot = nfsclt->currentdir.nfs3;
   }
+
+  args.fsroot = *NFS3FH(&fsroot);
   
   res = nfsproc3_fsstat_3(&args, nfsclt->nfs.client);
-  nfs_fh3free(&args.fsroot);
 
   if ( res == NULL ) {
     clnt_perror(nfsclt->nfs.client, "nfsproc3_fsstat_3()");
@@ -1729,3 +7383,93 @@ int nfsprintstat(t_nfsclt *nfsclt) {
 return -1;
 }
 
+
+static const char *nfs3procnames[] = {
+  "NULL", "GETATTR", "SETATTR", "LOOKUP", "ACCESS", "READLINK", "READ",
+  "WRITE", "CREATE", "MKDIR", "SYMLINK", "MKNOD", "REMOVE", "RMDIR",
+  "RENAME", "LINK", "READDIR", "READDIRPLUS", "FSSTAT", "FSINFO",
+  "PATHCONF", "COMMIT", NULL
+};
+
+static const char *mount3procnames[] = {
+  "NULL", "MNT", "DUMP", "UMNT", "UMNTALL", "EXPORT", NULL
+};
+
+// name of procedure from NULL terminated table
+static const char *nfsprocname( const char **names, int proc ) {
+
+  int i;
+
+  for ( i = 0; names[i] && i < proc ; i++ );
+
+return names[i] ? names[i] : "?";
+}
+
+static void nfsprintprogstats( t_rpcstats *stats, const char *prog,
+    const char **names, int parsable ) {
+
+  t_rpcprocstats *ps;
+  struct timespec now;
+  unsigned long calls = 0;
+  unsigned long long bytes = 0;
+  double elapsed;
+  int i;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  elapsed = (now.tv_sec - stats->since.tv_sec)
+    + (now.tv_nsec - stats->since.tv_nsec) / 1e9;
+
+  if ( !parsable ) {
+    for ( i = 0; i < RPCSTATS_PROCS ; i++ ) {
+      calls += stats->procs[i].calls;
+      bytes += stats->procs[i].sent + stats->procs[i].received;
+    }
+
+    printf("%s: %lu calls in %.1f s, %.1f calls/s, %.2f MB/s\n", prog, calls,
+        elapsed, elapsed > 0 ? calls / elapsed : 0,
+        elapsed > 0 ? bytes / elapsed / 1048576 : 0);
+
+    if ( calls == 0 ) return;
+
+    printf("  %-12s %9s %7s %7s %10s %10s %9s %9s %9s %9s\n", "procedure",
+        "calls", "errors", "failed", "sent KB", "recv KB",
+        "avg ms", "p50 ms", "p99 ms", "max ms");
+  }
+
+  for ( i = 0; i < RPCSTATS_PROCS ; i++ ) {
+    ps = &stats->procs[i];
+
+    if ( ps->calls == 0 ) continue;
+
+    if ( parsable ) {
+      printf("%s %s %lu %lu %lu %llu %llu %llu %lu %lu %lu %.3f\n", prog,
+          nfsprocname(names, i), ps->calls, ps->errors, ps->failed,
+          ps->sent, ps->received, ps->usecs / ps->calls,
+          rpcstats_percentile(ps, 0.5), rpcstats_percentile(ps, 0.99),
+          ps->maxusecs, elapsed);
+      continue;
+    }
+
+    printf("  %-12s %9lu %7lu %7lu %10.1f %10.1f %9.3f %9.3f %9.3f %9.3f\n",
+        nfsprocname(names, i), ps->calls, ps->errors, ps->failed,
+        ps->sent / 1024.0, ps->received / 1024.0,
+        ps->usecs / 1000.0 / ps->calls, rpcstats_percentile(ps, 0.5) / 1000.0,
+        rpcstats_percentile(ps, 0.99) / 1000.0, ps->maxusecs / 1000.0);
+  }
+}
+
+void nfsprintrpcstats( t_nfsclt *nfsclt, int parsable ) {
+
+  if ( parsable )
+    printf("# program procedure calls errors failed sent_bytes received_bytes"
+        " avg_us p50_us p99_us max_us seconds\n");
+
+  if ( nfsclt->mountstats.since.tv_sec || nfsclt->mountstats.since.tv_nsec )
+    nfsprintprogstats(&nfsclt->mountstats, "mount", mount3procnames, parsable);
+
+  if ( nfsclt->nfsstats.since.tv_sec || nfsclt->nfsstats.since.tv_nsec )
+    nfsprintprogstats(&nfsclt->nfsstats, "nfs", nfs3procnames, parsable);
+  else if ( !parsable && !nfsclt->mountstats.since.tv_sec
+      && !nfsclt->mountstats.since.tv_nsec )
+    printf("No connections were made yet\n");
+}
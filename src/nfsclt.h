@@ -13,13 +13,26 @@
 #include <unistd.h>
 #include <string.h>
 #include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <dirent.h>
 #include <libgen.h>
+#include <fnmatch.h>
+#include <signal.h>
+#include <setjmp.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 
 #include <rpc/rpc.h>
 #include <rpc/pmap_clnt.h>
 
+#include "arena.h"
 #include "netsocket.h"
+#include "nfs3xdr.h"
+#include "nfscache.h"
+#include "rpcmux.h"
+#include "snapshot.h"
 #include "utils.h"
 #include "xdr/mount.h"
 #include "xdr/nfsv3.h"
@@ -28,10 +41,28 @@
 // Just in case if we hit symlinks loop
 #define MAX_PATH_DEPTH 2000
 
+// Default number of READ/WRITE requests kept in flight
+#define NFS_WINDOW 16
+#define NFS_WINDOW_MAX 1024
+
+// Connections to nfs daemon used by pipelined transfers
+#define NFS_NCONNECT 1
+#define NFS_NCONNECT_MAX RPCGROUP_MAX
+
+// READDIR replies kept by directory stream, one of them is consumed
+// while next one is transferred
+#define NFS_DIRBATCHES 2
+
+// Transfer sizes used until server tells us its preferences
+#define NFS_RTPREF 16384
+#define NFS_WTPREF 16384
+#define NFS_DTPREF 8192
+
 typedef struct {
 
   int socket;
-  CLIENT *client;
+  CLIENT *client;     // blocking client over mux, for rpcgen stubs
+  t_rpcmux mux;       // asynchronous calls, replies matched by xid
 
 } t_nfsconnection;
 
@@ -41,17 +72,53 @@ typedef union {
 
 } tp_nfsmountres;
 
+// NFSv3 file handle kept inline, so copying it never touches heap.
+// Encoders take nfs_fh3, NFS3FH() makes one which refers to it and
+// is valid within enclosing block.
+typedef struct {
+
+  u_int len;
+  char data[NFS3_FHSIZE];
+
+} t_nfs3fh;
+
+#define NFS3FH(fh) (&(nfs_fh3){ { (fh)->len, (fh)->data } })
+
 typedef union {
 
-  nfs_fh3 nfs3;
+  t_nfs3fh nfs3;
 
 } t_nfsfh;
 
 typedef union {
 
-  READDIR3res *nfs3;
+  fattr3 nfs3;
 
-} tp_nfsdir;
+} t_nfsattr;
+
+// Remote file opened with nfsfileopen(). Path is resolved only once,
+// read and write calls reuse cached handle and attributes.
+typedef struct {
+
+  t_nfsfh fh;
+  t_nfsattr attr;
+
+  char *path;
+
+} t_nfsfile;
+
+// Server transfer sizes, queried with FSINFO
+typedef struct {
+
+  int valid;
+
+  u_int rtmax;
+  u_int rtpref;   // preferred READ size
+  u_int wtmax;
+  u_int wtpref;   // preferred WRITE size
+  u_int dtpref;   // preferred READDIR size
+
+} t_nfsfsinfo;
 
 typedef struct {
 
@@ -62,24 +129,83 @@ typedef struct {
   int gid;
   int mode;
 
+  int window;   // max outstanding requests for pipelined transfers
+  int nconnect; // number of connections to nfs daemon
+
   char *hostname;
+  int mountport;            // set ports skip portmapper, 0 asks it
+  int nfsport;
   t_nfsconnection mount;    // connection to mount daemon
   t_nfsconnection nfs;      // connection to nfs daemon
+  t_nfsconnection nfsx[NFS_NCONNECT_MAX - 1]; // additional ones
+  t_rpcgroup nfsgroup;      // all connections to nfs daemon
 
   char *mountpath;
   tp_nfsmountres mountres;
 
   t_nfsfh currentdir;
 
+  t_nfsfsinfo fsinfo;
+
+  t_dnlc dnlc;        // name lookup cache for path resolving
+  t_acache acache;    // attributes cache, indexed by file handle
+
+  // calls of this session, kept across reconnects
+  t_rpcstats mountstats;
+  t_rpcstats nfsstats;
+
 } t_nfsclt;
 
 extern t_nfsclt nfsclt;
 
+struct s_nfsdir;
+
+// One READDIR reply of directory stream
+typedef struct {
+
+  t_rpccall call;
+  t_nfsdirreply reply;
+  struct s_nfsdir *dir;
+
+  int state;          // NFS_DIRBATCH_*
+  int ok;             // entries were decoded
+
+} t_nfsdirbatch;
+
+#define NFS_DIRBATCH_FREE   0
+#define NFS_DIRBATCH_SENT   1
+#define NFS_DIRBATCH_READY  2
+#define NFS_DIRBATCH_USED   3   // it's entries are returned
+
+// Directory opened with nfsdiropen(). Batch following the current one
+// is requested as soon as position after it is known, replies are
+// consumed in order of requests.
+typedef struct s_nfsdir {
+
+  t_nfsclt *nfsclt;
+  t_nfsfh fh;
+  int withattrs;
+
+  cookie3 cookie;     // position after last requested batch
+  cookieverf3 cookieverf;
+  int eof;            // last batch was requested
+  int err;
+
+  int send;           // next batch to request
+  int cur;            // next batch to consume
+  t_nfsdirbatch batch[NFS_DIRBATCHES];
+
+  tp_nfsdirent next;  // next entry of current batch
+
+} t_nfsdir;
+
 void nfshandleprint( t_nfsfh *nfsfh, unsigned long version );
 int nfshandleset_str( t_nfsfh *nfsfh, unsigned long version, char *handle );
 
 int nfsconnect( t_nfsclt *nfsclt, unsigned long prognum );
+int nfsfsinfo( t_nfsclt *nfsclt );
 void nfsdisconnect( t_nfsconnection *nfsconn );
+void nfsdisconnectnfs( t_nfsclt *nfsclt );
 
 exports nfsexports( t_nfsclt *nfsclt );
 
@@ -91,16 +217,61 @@ int nfsfilestat( t_nfsclt *nfsclt, char *path, struct stat *fstat );
 int nfsfileattr( t_nfsclt *nfsclt, char *filename, struct stat *fstat);
 int nfsfilerm( t_nfsclt *nfsclt, char *path );
 
-int nfsfilepread( t_nfsclt *nfsclt, char *path, long offset, char *data, int datalen );
-int nfsfilepwrite( t_nfsclt *nfsclt, char *file, long offset, char *data, int datalen );
-
-// nfsdir - structure with directory files, prepared by nfsdirread()
-// Path is only needed when it needs to lookup for file attributes (printattrs=1)
-// and we do'nt list current catalog
-int nfsdirprint( t_nfsclt *nfsclt, tp_nfsdir *nfsdir, int printattrs, char *path );
-int nfsdirread( t_nfsclt *nfsclt, tp_nfsdir *nfsdir, char *path );
+// Stat or remove many files, nfsclt->window calls are kept in flight.
+// Directories of paths are resolved one by one, mostly from name
+// cache. Status of each path is 0 or -1, -1 is returned if any failed.
+int nfsfilestatall( t_nfsclt *nfsclt, char **paths, int npaths,
+    struct stat *fstats, int *status );
+int nfsfilermall( t_nfsclt *nfsclt, char **paths, int npaths, int *status );
+
+// follow - resolve symbolic link if it's final path object
+int nfsfileopen( t_nfsclt *nfsclt, t_nfsfile *nfsfile, char *path, int follow );
+void nfsfileclose( t_nfsclt *nfsclt, t_nfsfile *nfsfile );
+
+int nfsfilepread( t_nfsclt *nfsclt, t_nfsfile *nfsfile, long offset, char *data, int datalen );
+int nfsfilepwrite( t_nfsclt *nfsclt, t_nfsfile *nfsfile, long offset, char *data, int datalen );
+
+// read whole file to out, keeping nfsclt->window requests in flight
+// returns number of read bytes
+long nfsfileread( t_nfsclt *nfsclt, t_nfsfile *nfsfile, FILE *out );
+
+// download rpath recursively into lpath, preserving modes and times,
+// returns number of read bytes or -1 if anything failed
+long nfsmirror( t_nfsclt *nfsclt, char *rpath, char *lpath );
+
+// write whole local file fd with UNSTABLE writes and commit it,
+// keeping nfsclt->window requests in flight
+// returns number of written bytes
+long nfsfilewrite( t_nfsclt *nfsclt, t_nfsfile *nfsfile, int fd );
+
+// upload local lpath recursively as rpath, existing files are replaced
+// returns number of written bytes or -1 if anything failed
+long nfsupload( t_nfsclt *nfsclt, char *lpath, char *rpath );
+
+// Copy tree src to dst like nfsmirror() or nfsupload(), download=1 for
+// remote src. Files which copy has the same size and mtime are skipped,
+// of other existing ones only ranges which differ are written. NFSv3 has
+// no checksums, so upload READs whole remote copy to compare it, which
+// costs as much as writing it. Files smaller than window chunks or which
+// size changed by more than 1/4 are therefore copied whole.
+// Returns number of transferred bytes or -1 if anything failed.
+long nfssync( t_nfsclt *nfsclt, char *src, char *dst, int download );
+
+// Attributes are read together with names (READDIRPLUS) when withattrs=1.
+// Current directory is opened if path is NULL.
+int nfsdiropen( t_nfsclt *nfsclt, t_nfsdir *nfsdir, char *path, int withattrs );
+// Returns 1 and next entry, which is valid until following call,
+// 0 after last one or -1 if reading failed
+int nfsdirnext( t_nfsclt *nfsclt, t_nfsdir *nfsdir, tp_nfsdirent *ent );
+void nfsdirclose( t_nfsclt *nfsclt, t_nfsdir *nfsdir );
+// print remaining entries of opened directory, with attributes if
+// it was opened with them
+int nfsdirprint( t_nfsclt *nfsclt, t_nfsdir *nfsdir );
 int nfsdirmk( t_nfsclt *nfsclt, char *path, struct stat *fstat );
 int nfsdirrm( t_nfsclt *nfsclt, char *path);
+// remove path with everything inside, keeping nfsclt->window calls
+// in flight, returns number of removed objects or -1 if anything failed
+long nfsrmtree( t_nfsclt *nfsclt, char *path );
 int nfscd( t_nfsclt *nfsclt, char *path );
 
 int nfsmove( t_nfsclt *nfsclt, char *src, char *dst);
@@ -110,4 +281,44 @@ int nfsmknod( t_nfsclt *nfsclt, char *path, struct stat *fstat, dev_t dev);
 
 int nfsprintstat(t_nfsclt *nfsclt);
 
+// Print used and apparent size, files and directories of tree path,
+// hard linked files are counted once. Every directory is printed if
+// all=1, ntop largest ones after total.
+int nfsdu( t_nfsclt *nfsclt, char *path, int all, int ntop );
+
+#define NFSFIND_ANY   2   // sizecmp and mtimecmp not checked
+
+// What find looks for, all conditions must be true
+typedef struct {
+
+  char *name;           // shell pattern of file name, NULL any
+  int type;             // ftype3, 0 any
+
+  int sizecmp;          // -1 less, 0 equal, 1 greater than size
+  unsigned long long size;
+  unsigned long long sizeunit;  // file size is rounded up to it
+
+  int mtimecmp;         // as sizecmp, days since modification
+  long mtime;
+
+  long uid;             // -1 any
+
+} t_nfsfind;
+
+// Print paths of objects in tree path matching query, path itself
+// included. Returns number of them, -1 on any error.
+long nfsfind( t_nfsclt *nfsclt, char *path, t_nfsfind *query );
+
+// Write snapshot of tree path to file, see snapshot.h. Incremental
+// one reads again only directories which mtime changed since snapshot
+// in file. Returns number of objects, -1 on any error.
+long nfssnapshot( t_nfsclt *nfsclt, char *path, char *file, int incremental );
+
+// find in snapshot file, path is relative to it's root
+long nfssnapfind( char *file, char *path, t_nfsfind *query );
+
+// Print per procedure statistics of MOUNT and NFS calls made so far,
+// as table or one line per procedure with plain numbers if parsable
+void nfsprintrpcstats( t_nfsclt *nfsclt, int parsable );
+
 #endif // __NFSCLT_H__
@@ -0,0 +1,925 @@
+/*
+ *
+ * Adrian Brzezinski (2018) <adrbxx at gmail.com>
+ * License: GPLv2+
+ *
+ */
+
+#include "rpcmux.h"
+
+// record marking (RFC 5531), highest bit marks last fragment
+#define RPCMUX_LASTFRAG 0x80000000
+#define RPCMUX_FRAGLEN  0x7fffffff
+
+static struct clnt_ops rpcmux_clntops;
+
+static uint64_t rpcmux_usnow( void ) {
+
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// 4 buckets for each power of 2, exact below 4 microseconds
+static int rpcstats_bucket( unsigned long usecs ) {
+
+  int e, b;
+
+  if ( usecs < 4 ) return usecs;
+
+  for ( e = 2; usecs >> (e + 1) ; e++ );
+
+  b = e * 4 - 4 + ((usecs >> (e - 2)) & 3);
+
+return b < RPCSTATS_BUCKETS ? b : RPCSTATS_BUCKETS - 1;
+}
+
+unsigned long rpcstats_bucketmax( int bucket ) {
+
+  int e = bucket / 4 + 1;
+
+  if ( bucket < 4 ) return bucket;
+
+return ((5UL + bucket % 4) << (e - 2)) - 1;
+}
+
+unsigned long rpcstats_percentile( t_rpcprocstats *ps, double p ) {
+
+  unsigned long n = 0, want;
+  int i;
+
+  if ( ps->calls == 0 ) return 0;
+
+  want = p * ps->calls;
+  if ( want < p * ps->calls || want == 0 ) want++;
+
+  for ( i = 0; i < RPCSTATS_BUCKETS - 1 ; i++ ) {
+    if ( (n += ps->hist[i]) >= want ) break;
+  }
+
+return rpcstats_bucketmax(i) < ps->maxusecs ? rpcstats_bucketmax(i) : ps->maxusecs;
+}
+
+void rpcstats_reset( t_rpcstats *stats ) {
+
+  memset(stats->procs, 0, sizeof(stats->procs));
+  clock_gettime(CLOCK_MONOTONIC, &stats->since);
+}
+
+// count done call, status is the first word of results
+static void rpcmux_account( t_rpcmux *mux, t_rpccall *call, u_int reclen, u_int status ) {
+
+  t_rpcprocstats *ps;
+  unsigned long usecs;
+
+  if ( mux->stats == NULL || call->proc >= RPCSTATS_PROCS ) return;
+
+  ps = &mux->stats->procs[call->proc];
+  usecs = rpcmux_usnow() - call->start;
+
+  ps->calls++;
+  ps->sent += call->sentlen;
+  ps->received += reclen;
+  ps->usecs += usecs;
+  ps->hist[rpcstats_bucket(usecs)]++;
+  if ( usecs > ps->maxusecs ) ps->maxusecs = usecs;
+
+  if ( call->stat != RPC_SUCCESS )
+    ps->failed++;
+  else if ( status && (mux->stats->statusprocs & (1U << call->proc)) )
+    ps->errors++;
+}
+
+int rpcmux_init( t_rpcmux *mux, int socket, u_long prognum, u_long versnum ) {
+
+  struct epoll_event ev;
+
+  rpcmux_free(mux);
+
+  mux->prognum = prognum;
+  mux->versnum = versnum;
+  mux->timeout.tv_sec = RPCMUX_TIMEOUT;
+
+  // don't start from zero, it's never used as valid xid
+  mux->xid = (getpid() ^ time(NULL)) << 8;
+
+  if ( (mux->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1 ) {
+    perror("epoll_create1()");
+    return -1;
+  }
+
+  if ( socknonblock(socket, 1) == -1 ) {
+    rpcmux_free(mux);
+    return -1;
+  }
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+
+  if ( epoll_ctl(mux->epfd, EPOLL_CTL_ADD, socket, &ev) == -1 ) {
+    perror("epoll_ctl()");
+    rpcmux_free(mux);
+    return -1;
+  }
+
+  mux->socket = socket;
+  mux->events = EPOLLIN;
+
+  mux->client.cl_ops = &rpcmux_clntops;
+  mux->client.cl_private = (void *)mux;
+
+return 0;
+}
+
+// complete all outstanding calls with error
+static void rpcmux_fail( t_rpcmux *mux, enum clnt_stat stat ) {
+
+  t_rpccall *call, *failed = NULL;
+  t_rpcbuf *b;
+  int i;
+
+  // take them out of table first, done functions could submit new calls
+  for ( i = 0; i < RPCMUX_HASHSIZE ; i++ ) {
+    while ( (call = mux->calls[i]) != NULL ) {
+      mux->calls[i] = call->next;
+      call->next = failed;
+      failed = call;
+    }
+  }
+
+  mux->ncalls = 0;
+  mux->broken = 0;
+
+  while ( (b = mux->sendhead) != NULL ) {
+    mux->sendhead = b->next;
+    free(b);
+  }
+  mux->sendtail = NULL;
+
+  // stream position is lost, connection can't be used anymore
+  if ( mux->socket >= 0 ) {
+    epoll_ctl(mux->epfd, EPOLL_CTL_DEL, mux->socket, NULL);
+    mux->socket = -1;
+  }
+
+  mux->err.re_status = stat;
+
+  while ( (call = failed) != NULL ) {
+    failed = call->next;
+
+    call->stat = stat;
+    call->done = 1;
+    rpcmux_account(mux, call, 0, 0);
+    if ( call->donefn ) call->donefn(mux, call);
+  }
+}
+
+// Outstanding calls are forgotten without calling their done functions,
+// callers should not free connection while waiting for replies.
+void rpcmux_free( t_rpcmux *mux ) {
+
+  t_rpcbuf *b;
+
+  while ( (b = mux->sendhead) != NULL ) {
+    mux->sendhead = b->next;
+    free(b);
+  }
+
+  if ( mux->ibuf ) free(mux->ibuf);
+  if ( mux->rbuf ) free(mux->rbuf);
+
+  if ( mux->epfd > 0 ) close(mux->epfd);
+
+  memset(mux, 0, sizeof(t_rpcmux));
+  mux->socket = -1;
+  mux->epfd = -1;
+}
+
+int rpcmux_alive( t_rpcmux *mux ) {
+return mux->socket >= 0;
+}
+
+CLIENT *rpcmux_client( t_rpcmux *mux ) {
+return &mux->client;
+}
+
+static void rpcmux_events( t_rpcmux *mux, uint32_t events ) {
+
+  struct epoll_event ev;
+
+  if ( mux->events == events ) return;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+
+  if ( epoll_ctl(mux->epfd, EPOLL_CTL_MOD, mux->socket, &ev) == -1 ) {
+    perror("epoll_ctl()");
+    return;
+  }
+
+  mux->events = events;
+}
+
+// segments of record b which are not sent yet
+static int rpcmux_iov( t_rpcbuf *b, struct iovec *iov ) {
+
+  static char pad[4];
+  char *seg[3] = { b->data, b->ext, pad };
+  u_int seglen[3], off = b->off;
+  int i, n = 0;
+
+  seglen[0] = b->datalen;
+  seglen[1] = b->extlen;
+  seglen[2] = b->len - b->datalen - b->extlen;
+
+  for ( i = 0; i < 3 ; i++ ) {
+    if ( off >= seglen[i] ) {
+      off -= seglen[i];
+      continue;
+    }
+
+    iov[n].iov_base = seg[i] + off;
+    iov[n].iov_len = seglen[i] - off;
+    off = 0;
+    n++;
+  }
+
+return n;
+}
+
+// send queued records until socket buffer is full,
+// many of them are gathered into single writev()
+static int rpcmux_output( t_rpcmux *mux ) {
+
+  struct iovec iov[RPCMUX_IOVMAX];
+  t_rpcbuf *b;
+  ssize_t n, left;
+  int niov;
+
+  while ( mux->sendhead != NULL ) {
+
+    niov = 0;
+    left = 0;
+    for ( b = mux->sendhead; b && niov + 3 <= RPCMUX_IOVMAX ; b = b->next ) {
+      niov += rpcmux_iov(b, iov + niov);
+      left += b->len - b->off;
+    }
+
+    do {
+      n = writev(mux->socket, iov, niov);
+    } while ( n < 0 && errno == EINTR );
+
+    if ( n < 0 ) {
+      if ( errno == EAGAIN || errno == EWOULDBLOCK ) break;
+
+      mux->err.re_errno = errno;
+      return -1;
+    }
+
+    mux->sent += n;
+    left -= n;
+
+    while ( (b = mux->sendhead) != NULL && n >= b->len - b->off ) {
+      n -= b->len - b->off;
+
+      mux->sendhead = b->next;
+      if ( mux->sendhead == NULL ) mux->sendtail = NULL;
+      free(b);
+    }
+
+    if ( b ) b->off += n;
+
+    // socket buffer is full
+    if ( left > 0 ) break;
+  }
+
+  // wait for room in socket buffer only if there is something to send
+  rpcmux_events(mux, mux->sendhead ? EPOLLIN | EPOLLOUT : EPOLLIN);
+
+return 0;
+}
+
+int rpcmux_submit( t_rpcmux *mux, t_rpccall *call,
+    u_long proc, xdrproc_t xargs, void *args ) {
+return rpcmux_submitv(mux, call, proc, xargs, args, NULL, 0);
+}
+
+int rpcmux_submitv( t_rpcmux *mux, t_rpccall *call,
+    u_long proc, xdrproc_t xargs, void *args, char *ext, u_int extlen ) {
+
+  struct rpc_msg msg;
+  AUTH *auth = mux->client.cl_auth;
+  XDR xdrs;
+  t_rpcbuf *b;
+  u_int buflen, reclen, idx;
+
+  call->done = 0;
+  call->stat = RPC_SUCCESS;
+
+  if ( mux->socket < 0 || mux->broken || auth == NULL ) {
+    call->stat = RPC_CANTSEND;
+    return -1;
+  }
+
+  if ( ++mux->xid == 0 ) mux->xid++;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.rm_xid = mux->xid;
+  msg.rm_direction = CALL;
+  msg.rm_call.cb_rpcvers = RPC_MSG_VERSION;
+  msg.rm_call.cb_prog = mux->prognum;
+  msg.rm_call.cb_vers = mux->versnum;
+  msg.rm_call.cb_proc = proc;
+  msg.rm_call.cb_cred = auth->ah_cred;
+  msg.rm_call.cb_verf = auth->ah_verf;
+
+  // record mark + call header + arguments
+  buflen = sizeof(u_int) + xdr_sizeof((xdrproc_t)xdr_callmsg, &msg)
+    + xdr_sizeof(xargs, args);
+
+  if ( (b = malloc(sizeof(t_rpcbuf) + buflen)) == NULL ) {
+    perror("malloc()");
+    call->stat = RPC_SYSTEMERROR;
+    return -1;
+  }
+
+  xdrmem_create(&xdrs, b->data + sizeof(u_int), buflen - sizeof(u_int), XDR_ENCODE);
+
+  if ( !xdr_callmsg(&xdrs, &msg) || !xargs(&xdrs, args) ) {
+    fprintf(stderr, "rpcmux_submit(): can't encode arguments\n");
+    xdr_destroy(&xdrs);
+    free(b);
+    call->stat = RPC_CANTENCODEARGS;
+    return -1;
+  }
+
+  // opaque data is padded to multiple of 4 bytes
+  reclen = xdr_getpos(&xdrs) + RNDUP(extlen);
+  b->datalen = xdr_getpos(&xdrs) + sizeof(u_int);
+  xdr_destroy(&xdrs);
+
+  b->next = NULL;
+  b->len = reclen + sizeof(u_int);
+  b->off = 0;
+  b->ext = ext;
+  b->extlen = extlen;
+
+  reclen = htonl(RPCMUX_LASTFRAG | reclen);
+  memcpy(b->data, &reclen, sizeof(u_int));
+
+  if ( mux->sendtail ) mux->sendtail->next = b;
+  else mux->sendhead = b;
+  mux->sendtail = b;
+
+  if ( mux->stats ) {
+    call->proc = proc;
+    call->sentlen = b->len;
+    call->start = rpcmux_usnow();
+  }
+
+  // register call before sending, reply could be read anytime later
+  call->xid = mux->xid;
+  idx = call->xid & (RPCMUX_HASHSIZE - 1);
+  call->next = mux->calls[idx];
+  mux->calls[idx] = call;
+  mux->ncalls++;
+  mux->submitted++;
+
+  // call is registered, so it will be completed with error by next poll
+  if ( rpcmux_output(mux) == -1 ) {
+    perror("rpcmux_submit()");
+    mux->broken = 1;
+  }
+
+return 0;
+}
+
+// take call out of table
+static t_rpccall *rpcmux_unlink( t_rpcmux *mux, u_int xid ) {
+
+  t_rpccall **pc, *call;
+
+  for ( pc = &mux->calls[xid & (RPCMUX_HASHSIZE - 1)]; *pc ; pc = &(*pc)->next ) {
+    if ( (*pc)->xid == xid ) {
+      call = *pc;
+      *pc = call->next;
+      call->next = NULL;
+      mux->ncalls--;
+
+      return call;
+    }
+  }
+
+return NULL;
+}
+
+void rpcmux_cancel( t_rpcmux *mux, t_rpccall *call ) {
+
+  if ( !call->done ) rpcmux_unlink(mux, call->xid);
+}
+
+// decode reply record into it's call
+static t_rpccall *rpcmux_decode( t_rpcmux *mux, char *rec, u_int reclen ) {
+
+  struct rpc_msg msg;
+  char verfbuf[MAX_AUTH_BYTES];
+  t_rpccall *call;
+  u_int xid, pos, status = 0;
+  XDR xdrs;
+
+  if ( reclen < sizeof(u_int) ) return NULL;
+
+  memcpy(&xid, rec, sizeof(u_int));
+
+  // not ours or cancelled, drop it
+  if ( (call = rpcmux_unlink(mux, ntohl(xid))) == NULL ) return NULL;
+
+  mux->replies++;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.acpted_rply.ar_verf.oa_base = verfbuf;  // don't let decoder allocate
+  msg.acpted_rply.ar_results.where = call->res;
+  msg.acpted_rply.ar_results.proc = call->xres;
+
+  xdrmem_create(&xdrs, rec, reclen, XDR_DECODE);
+
+  if ( !xdr_replymsg(&xdrs, &msg) ) {
+    call->stat = RPC_CANTDECODERES;
+  } else if ( msg.rm_reply.rp_stat != MSG_ACCEPTED ) {
+
+    if ( msg.rjcted_rply.rj_stat == RPC_MISMATCH )
+      call->stat = RPC_VERSMISMATCH;
+    else
+      call->stat = RPC_AUTHERROR;
+  } else {
+
+    switch ( msg.acpted_rply.ar_stat ) {
+      case SUCCESS:
+        call->stat = RPC_SUCCESS;
+      break;
+      case PROG_UNAVAIL:
+        call->stat = RPC_PROGUNAVAIL;
+      break;
+      case PROG_MISMATCH:
+        call->stat = RPC_PROGVERSMISMATCH;
+      break;
+      case PROC_UNAVAIL:
+        call->stat = RPC_PROCUNAVAIL;
+      break;
+      case GARBAGE_ARGS:
+        call->stat = RPC_CANTDECODEARGS;
+      break;
+      default:
+        call->stat = RPC_SYSTEMERROR;
+      break;
+    }
+  }
+
+  xdr_destroy(&xdrs);
+
+  if ( mux->stats ) {
+
+    // xid, direction, reply and accept status, verifier
+    pos = 6 * sizeof(u_int) + RNDUP(msg.acpted_rply.ar_verf.oa_length);
+
+    if ( call->stat == RPC_SUCCESS && pos + sizeof(u_int) <= reclen ) {
+      memcpy(&status, rec + pos, sizeof(u_int));
+      status = ntohl(status);
+    }
+
+    // record mark is counted too
+    rpcmux_account(mux, call, reclen + sizeof(u_int), status);
+  }
+
+  call->done = 1;
+
+return call;
+}
+
+// Read what is available and decode complete records. Done functions
+// are called after buffers are consistent again, so they can poll.
+static int rpcmux_input( t_rpcmux *mux ) {
+
+  t_rpccall *call, *done = NULL, **donetail = &done;
+  u_int pos, fraghdr, fraglen;
+  size_t size, need = 0;
+  char *tmp;
+  int n, ndone = 0;
+
+  while ( ndone != -1 ) {
+
+    // room for at least one more fragment header and a bit of data
+    if ( mux->ibufsize - mux->ibuflen < RPCMUX_BUFSIZE / 4
+        || mux->ibufsize < need ) {
+
+      size = mux->ibufsize ? (size_t)mux->ibufsize * 2 : RPCMUX_BUFSIZE;
+      while ( size < need ) size *= 2;
+
+      if ( (tmp = realloc(mux->ibuf, size)) == NULL ) {
+        perror("realloc()");
+        ndone = -1;
+        break;
+      }
+
+      mux->ibuf = tmp;
+      mux->ibufsize = size;
+    }
+
+    n = sockread(mux->socket, mux->ibuf + mux->ibuflen, mux->ibufsize - mux->ibuflen);
+
+    if ( n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ) break;
+
+    if ( n <= 0 ) {
+      mux->err.re_errno = n < 0 ? errno : ECONNRESET;
+      ndone = -1;
+      break;
+    }
+
+    mux->ibuflen += n;
+    mux->received += n;
+    need = 0;
+
+    // parse complete fragments
+    for ( pos = 0; mux->ibuflen - pos >= sizeof(u_int) ; ) {
+
+      memcpy(&fraghdr, mux->ibuf + pos, sizeof(u_int));
+      fraghdr = ntohl(fraghdr);
+      fraglen = fraghdr & RPCMUX_FRAGLEN;
+
+      // length comes from server, buffers aren't grown beyond limit
+      if ( (size_t)mux->rbuflen + fraglen > RPCMUX_MAXREC ) {
+        fprintf(stderr, "rpcmux: reply too big, %zu bytes\n", (size_t)mux->rbuflen + fraglen);
+        mux->err.re_errno = EMSGSIZE;
+        ndone = -1;
+        break;
+      }
+
+      if ( mux->ibuflen - pos - sizeof(u_int) < fraglen ) {
+        need = (size_t)fraglen + sizeof(u_int);
+        break;
+      }
+
+      pos += sizeof(u_int);
+      call = NULL;
+
+      if ( (fraghdr & RPCMUX_LASTFRAG) && mux->rbuflen == 0 ) {
+
+        // whole record in one fragment, decode in place
+        call = rpcmux_decode(mux, mux->ibuf + pos, fraglen);
+      } else {
+
+        if ( mux->rbuflen + fraglen > mux->rbufsize ) {
+          if ( (tmp = realloc(mux->rbuf, mux->rbuflen + fraglen)) == NULL ) {
+            perror("realloc()");
+            ndone = -1;
+            break;
+          }
+
+          mux->rbuf = tmp;
+          mux->rbufsize = mux->rbuflen + fraglen;
+        }
+
+        memcpy(mux->rbuf + mux->rbuflen, mux->ibuf + pos, fraglen);
+        mux->rbuflen += fraglen;
+
+        if ( fraghdr & RPCMUX_LASTFRAG ) {
+          call = rpcmux_decode(mux, mux->rbuf, mux->rbuflen);
+          mux->rbuflen = 0;
+        }
+      }
+
+      pos += fraglen;
+
+      if ( call ) {
+        *donetail = call;
+        donetail = &call->next;
+        ndone++;
+      }
+    }
+
+    if ( pos ) {
+      memmove(mux->ibuf, mux->ibuf + pos, mux->ibuflen - pos);
+      mux->ibuflen -= pos;
+    }
+  }
+
+  while ( (call = done) != NULL ) {
+    done = call->next;
+    call->next = NULL;
+
+    if ( call->donefn ) call->donefn(mux, call);
+  }
+
+return ndone;
+}
+
+int rpcmux_poll( t_rpcmux *mux, int timeout ) {
+
+  struct epoll_event ev;
+  int n, ndone = 0;
+
+  if ( mux->socket < 0 ) return -1;
+
+  if ( mux->broken ) {
+    rpcmux_fail(mux, RPC_CANTSEND);
+    return -1;
+  }
+
+  do {
+    n = epoll_wait(mux->epfd, &ev, 1, timeout);
+  } while ( n < 0 && errno == EINTR );
+
+  if ( n < 0 ) {
+    perror("epoll_wait()");
+    return -1;
+  }
+
+  if ( n == 0 ) return 0;   // timeout
+
+  if ( ev.events & (EPOLLIN | EPOLLERR | EPOLLHUP) ) {
+    if ( (ndone = rpcmux_input(mux)) == -1 ) {
+      rpcmux_fail(mux, RPC_CANTRECV);
+      return -1;
+    }
+  }
+
+  if ( mux->socket >= 0 && mux->sendhead && (ev.events & EPOLLOUT) ) {
+    if ( rpcmux_output(mux) == -1 ) {
+      rpcmux_fail(mux, RPC_CANTSEND);
+      return -1;
+    }
+  }
+
+return ndone;
+}
+
+int rpcmux_run( t_rpcmux *mux ) {
+
+  int n;
+
+  n = rpcmux_poll(mux, mux->timeout.tv_sec * 1000L + mux->timeout.tv_usec / 1000L);
+
+  if ( n == 0 ) {
+    fprintf(stderr, "rpcmux_run(): no reply from server in %ld seconds\n",
+        (long)mux->timeout.tv_sec);
+    rpcmux_fail(mux, RPC_TIMEDOUT);
+    return -1;
+  }
+
+return n;
+}
+
+static long rpcmux_msnow( void ) {
+
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+enum clnt_stat rpcmux_wait( t_rpcmux *mux, t_rpccall *call ) {
+
+  long deadline, left;
+
+  deadline = rpcmux_msnow() + mux->timeout.tv_sec * 1000L
+    + mux->timeout.tv_usec / 1000L;
+
+  while ( !call->done ) {
+
+    if ( (left = deadline - rpcmux_msnow()) <= 0 ) {
+      rpcmux_cancel(mux, call);
+      call->stat = RPC_TIMEDOUT;
+      call->done = 1;
+      rpcmux_account(mux, call, 0, 0);
+      break;
+    }
+
+    if ( rpcmux_poll(mux, left) == -1 && !call->done ) {
+      rpcmux_cancel(mux, call);
+      call->stat = RPC_CANTRECV;
+      call->done = 1;
+      rpcmux_account(mux, call, 0, 0);
+    }
+  }
+
+return call->stat;
+}
+
+void rpcgroup_init( t_rpcgroup *group ) {
+
+  memset(group, 0, sizeof(t_rpcgroup));
+
+  if ( (group->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1 )
+    perror("epoll_create1()");
+}
+
+void rpcgroup_free( t_rpcgroup *group ) {
+
+  if ( group->epfd > 0 ) close(group->epfd);
+
+  memset(group, 0, sizeof(t_rpcgroup));
+  group->epfd = -1;
+}
+
+int rpcgroup_add( t_rpcgroup *group, t_rpcmux *mux ) {
+
+  struct epoll_event ev;
+
+  if ( group->epfd < 0 || group->nmux == RPCGROUP_MAX ) return -1;
+
+  // epoll of connection is readable when connection has events
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = mux;
+
+  if ( epoll_ctl(group->epfd, EPOLL_CTL_ADD, mux->epfd, &ev) == -1 ) {
+    perror("epoll_ctl()");
+    return -1;
+  }
+
+  group->mux[group->nmux++] = mux;
+
+return 0;
+}
+
+t_rpcmux *rpcgroup_pick( t_rpcgroup *group ) {
+
+  t_rpcmux *mux, *best = NULL;
+  int i;
+
+  // rotate start, so idle connections are used in turns
+  for ( i = 0; i < group->nmux ; i++ ) {
+    mux = group->mux[(group->next + i) % group->nmux];
+
+    if ( !rpcmux_alive(mux) || mux->broken ) continue;
+
+    if ( best == NULL || mux->ncalls < best->ncalls )
+      best = mux;
+  }
+
+  group->next++;
+
+return best;
+}
+
+int rpcgroup_submit( t_rpcgroup *group, t_rpccall *call,
+    u_long proc, xdrproc_t xargs, void *args ) {
+
+  t_rpcmux *mux;
+
+  if ( (mux = rpcgroup_pick(group)) == NULL ) {
+    fprintf(stderr, "rpcgroup_submit(): no connection\n");
+    return -1;
+  }
+
+return rpcmux_submit(mux, call, proc, xargs, args);
+}
+
+int rpcgroup_submitv( t_rpcgroup *group, t_rpccall *call,
+    u_long proc, xdrproc_t xargs, void *args, char *ext, u_int extlen ) {
+
+  t_rpcmux *mux;
+
+  if ( (mux = rpcgroup_pick(group)) == NULL ) {
+    fprintf(stderr, "rpcgroup_submitv(): no connection\n");
+    return -1;
+  }
+
+return rpcmux_submitv(mux, call, proc, xargs, args, ext, extlen);
+}
+
+// Failure of one connection doesn't stop others, it's calls are
+// completed with error and -1 is returned after polling the rest.
+int rpcgroup_run( t_rpcgroup *group ) {
+
+  struct epoll_event ev[RPCGROUP_MAX];
+  t_rpcmux *mux;
+  long timeout = 0, t;
+  int i, n, ret, ncalls = 0, ndone = 0, failed = 0;
+
+  for ( i = 0; i < group->nmux ; i++ ) {
+    mux = group->mux[i];
+
+    // send failures are reported by poll
+    if ( mux->broken && rpcmux_poll(mux, 0) == -1 ) failed = 1;
+
+    ncalls += mux->ncalls;
+
+    t = mux->timeout.tv_sec * 1000L + mux->timeout.tv_usec / 1000L;
+    if ( t > timeout ) timeout = t;
+  }
+
+  if ( ncalls == 0 ) return failed ? -1 : 0;
+
+  do {
+    n = epoll_wait(group->epfd, ev, RPCGROUP_MAX, timeout);
+  } while ( n < 0 && errno == EINTR );
+
+  if ( n < 0 ) {
+    perror("epoll_wait()");
+    return -1;
+  }
+
+  if ( n == 0 ) {
+    fprintf(stderr, "rpcgroup_run(): no reply from server in %ld seconds\n",
+        timeout / 1000);
+
+    for ( i = 0; i < group->nmux ; i++ ) {
+      if ( group->mux[i]->ncalls ) rpcmux_fail(group->mux[i], RPC_TIMEDOUT);
+    }
+
+    return -1;
+  }
+
+  for ( i = 0; i < n ; i++ ) {
+    if ( (ret = rpcmux_poll((t_rpcmux *)ev[i].data.ptr, 0)) == -1 ) {
+      failed = 1;
+      continue;
+    }
+
+    ndone += ret;
+  }
+
+return failed ? -1 : ndone;
+}
+
+// CLIENT operations, so rpcgen stubs can use our connection
+
+static enum clnt_stat rpcmux_clntcall( CLIENT *clnt, t_rpcproc proc,
+    xdrproc_t xargs, t_rpcaddr args, xdrproc_t xres, t_rpcaddr res,
+    struct timeval timeout ) {
+
+  t_rpcmux *mux = (t_rpcmux *)clnt->cl_private;
+  t_rpccall call;
+
+  memset(&call, 0, sizeof(call));
+  call.xres = xres;
+  call.res = res;
+
+  memset(&mux->err, 0, sizeof(mux->err));
+
+  if ( rpcmux_submit(mux, &call, proc, xargs, args) == -1 )
+    return mux->err.re_status = call.stat;
+
+return mux->err.re_status = rpcmux_wait(mux, &call);
+}
+
+static void rpcmux_clntabort( CLIENT *clnt ) {
+}
+
+static void rpcmux_clntgeterr( CLIENT *clnt, struct rpc_err *err ) {
+
+  t_rpcmux *mux = (t_rpcmux *)clnt->cl_private;
+
+  *err = mux->err;
+}
+
+static bool_t rpcmux_clntfreeres( CLIENT *clnt, xdrproc_t xres, t_rpcaddr res ) {
+
+  xdr_free(xres, (char *)res);
+
+return TRUE;
+}
+
+// connection is owned by rpcmux, it's released with rpcmux_free()
+static void rpcmux_clntdestroy( CLIENT *clnt ) {
+}
+
+static bool_t rpcmux_clntcontrol( CLIENT *clnt, t_rpcctl request, t_rpcaddr info ) {
+
+  t_rpcmux *mux = (t_rpcmux *)clnt->cl_private;
+
+  switch ( request ) {
+    case CLSET_TIMEOUT:
+      mux->timeout = *(struct timeval *)info;
+    break;
+    case CLGET_TIMEOUT:
+      *(struct timeval *)info = mux->timeout;
+    break;
+    case CLGET_FD:
+      *(int *)info = mux->socket;
+    break;
+    case CLGET_XID:
+      *(u_int32_t *)info = mux->xid;
+    break;
+    case CLSET_FD_CLOSE:
+    case CLSET_FD_NCLOSE:
+    break;
+    default:
+      return FALSE;
+  }
+
+return TRUE;
+}
+
+static struct clnt_ops rpcmux_clntops = {
+  .cl_call = rpcmux_clntcall,
+  .cl_abort = rpcmux_clntabort,
+  .cl_geterr = rpcmux_clntgeterr,
+  .cl_freeres = rpcmux_clntfreeres,
+  .cl_destroy = rpcmux_clntdestroy,
+  .cl_control = rpcmux_clntcontrol
+};
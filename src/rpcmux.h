@@ -0,0 +1,245 @@
+/*
+ *
+ * Adrian Brzezinski (2018) <adrbxx at gmail.com>
+ * License: GPLv2+
+ *
+ */
+
+#ifndef __RPCMUX_H__
+#define __RPCMUX_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+
+#include <rpc/rpc.h>
+
+#include "netsocket.h"
+
+#define RPCMUX_HASHSIZE 256       // buckets of outstanding calls table, power of 2
+#define RPCMUX_BUFSIZE  65536     // initial size of receive buffer
+#define RPCMUX_MAXREC   (16 << 20) // bigger replies break connection
+#define RPCMUX_TIMEOUT  60        // seconds to wait for reply
+#define RPCGROUP_MAX    16        // connections in group
+#define RPCMUX_IOVMAX   64        // segments passed to single writev()
+
+#define RPCSTATS_PROCS    32      // procedures counted for each program
+#define RPCSTATS_BUCKETS  128     // latency histogram, 4 buckets per power of 2
+
+// libtirpc and glibc sunrpc differ in client operations types
+#ifdef _TIRPC_RPC_H
+typedef rpcproc_t t_rpcproc;
+typedef void * t_rpcaddr;
+typedef u_int t_rpcctl;
+#else
+typedef u_long t_rpcproc;
+typedef caddr_t t_rpcaddr;
+typedef int t_rpcctl;
+#endif
+
+struct s_rpcmux;
+struct s_rpccall;
+
+// called when reply arrived or call failed
+typedef void (tf_rpcdone)( struct s_rpcmux *mux, struct s_rpccall *call );
+
+// Outstanding call. Caller owns it and fills xres, res and optionally
+// done and arg before rpcmux_submit(). Reply is decoded into res.
+typedef struct s_rpccall {
+
+  struct s_rpccall *next;   // calls table chain
+
+  u_int xid;
+  xdrproc_t xres;
+  void *res;
+
+  enum clnt_stat stat;
+  int done;
+
+  tf_rpcdone *donefn;
+  void *arg;
+
+  // set by submit when connection keeps statistics
+  u_int proc;
+  u_int sentlen;
+  uint64_t start;     // monotonic time in microseconds
+
+} t_rpccall;
+
+// Done calls of one procedure. Latency is time from submit to decoded
+// reply, histogram bucket i counts latencies up to rpcstats_bucketmax(i).
+typedef struct {
+
+  unsigned long calls;
+  unsigned long errors;     // replied with error status
+  unsigned long failed;     // timed out or connection failed
+  unsigned long long sent;  // bytes
+  unsigned long long received;
+  unsigned long long usecs; // sum of latencies
+  unsigned long maxusecs;
+  unsigned long hist[RPCSTATS_BUCKETS];
+
+} t_rpcprocstats;
+
+// Statistics of one program, shared by all connections to it
+typedef struct {
+
+  u_int statusprocs;  // bitmask of procedures which results start with
+                      // status, nonzero one is counted as error
+  struct timespec since;
+
+  t_rpcprocstats procs[RPCSTATS_PROCS];
+
+} t_rpcstats;
+
+// queued request record, encoded data optionally followed by caller's
+// memory and XDR padding
+typedef struct s_rpcbuf {
+
+  struct s_rpcbuf *next;
+
+  u_int len;      // whole record
+  u_int off;      // bytes already sent
+
+  char *ext;      // not copied, sent straight from caller's memory
+  u_int extlen;
+
+  u_int datalen;
+  char data[];
+
+} t_rpcbuf;
+
+// RPC over TCP connection. Many calls can be outstanding at once,
+// replies are matched with calls by XID. Socket is non-blocking and
+// driven by epoll, so we never stop reading replies while sending.
+typedef struct s_rpcmux {
+
+  int socket;
+  int epfd;
+  uint32_t events;    // registered epoll events
+
+  u_long prognum;
+  u_long versnum;
+
+  u_int xid;          // last used transaction id
+
+  struct timeval timeout;
+  struct rpc_err err; // status of last call done through client
+  int broken;         // sending failed, calls wait for poll to fail them
+
+  // blocking client for rpcgen stubs, it's cl_auth is used
+  // for all calls
+  CLIENT client;
+
+  int ncalls;
+  t_rpccall *calls[RPCMUX_HASHSIZE];
+
+  t_rpcbuf *sendhead;
+  t_rpcbuf *sendtail;
+
+  char *ibuf;         // received stream, not parsed yet
+  u_int ibufsize;
+  u_int ibuflen;
+
+  char *rbuf;         // record assembled from fragments
+  u_int rbufsize;
+  u_int rbuflen;
+
+  // statistics, since connection was made
+  unsigned long submitted;
+  unsigned long replies;
+  unsigned long long sent;      // bytes
+  unsigned long long received;
+
+  t_rpcstats *stats;  // per procedure, not owned, NULL if not kept
+
+} t_rpcmux;
+
+// Connections to the same program. Calls are spread over them
+// and all of them are polled together.
+typedef struct {
+
+  int epfd;
+
+  int nmux;
+  t_rpcmux *mux[RPCGROUP_MAX];
+  u_int next;         // where to start looking for least busy connection
+
+} t_rpcgroup;
+
+int rpcmux_init( t_rpcmux *mux, int socket, u_long prognum, u_long versnum );
+void rpcmux_free( t_rpcmux *mux );
+
+// is connection usable?
+int rpcmux_alive( t_rpcmux *mux );
+
+// client usable with rpcgen stubs, each call waits for it's reply
+CLIENT *rpcmux_client( t_rpcmux *mux );
+
+// Queue call and send as much as possible without blocking.
+// Returns -1 if call wasn't queued, otherwise it's done function
+// will be called from one of following polls.
+int rpcmux_submit( t_rpcmux *mux, t_rpccall *call,
+    u_long proc, xdrproc_t xargs, void *args );
+
+// Like rpcmux_submit(), but xargs encodes arguments only up to the
+// length of trailing opaque, which bytes are sent from ext without
+// copying. Ext has to stay untouched until call is done, such call
+// should not be canceled.
+int rpcmux_submitv( t_rpcmux *mux, t_rpccall *call,
+    u_long proc, xdrproc_t xargs, void *args, char *ext, u_int extlen );
+
+// forget call, it's reply will be dropped
+void rpcmux_cancel( t_rpcmux *mux, t_rpccall *call );
+
+// Wait up to timeout miliseconds (-1 forever) for socket events and
+// complete calls which replies arrived. Returns number of completed
+// calls or -1 when connection failed, all outstanding calls are
+// completed with error then.
+int rpcmux_poll( t_rpcmux *mux, int timeout );
+
+// Poll with mux timeout, for pipelines. Connection which doesn't
+// answer in that time is failed, returns -1 then.
+int rpcmux_run( t_rpcmux *mux );
+
+// poll until call is done or mux timeout passed
+enum clnt_stat rpcmux_wait( t_rpcmux *mux, t_rpccall *call );
+
+void rpcgroup_init( t_rpcgroup *group );
+void rpcgroup_free( t_rpcgroup *group );
+
+// mux has to be initialized already, after rpcmux_init()
+// group has to be built again
+int rpcgroup_add( t_rpcgroup *group, t_rpcmux *mux );
+
+// alive connection with least outstanding calls or NULL
+t_rpcmux *rpcgroup_pick( t_rpcgroup *group );
+
+// rpcmux_submit() through least busy connection
+int rpcgroup_submit( t_rpcgroup *group, t_rpccall *call,
+    u_long proc, xdrproc_t xargs, void *args );
+
+// rpcmux_submitv() through least busy connection
+int rpcgroup_submitv( t_rpcgroup *group, t_rpccall *call,
+    u_long proc, xdrproc_t xargs, void *args, char *ext, u_int extlen );
+
+// rpcmux_run() for all connections at once
+int rpcgroup_run( t_rpcgroup *group );
+
+// clear counters, statusprocs is kept
+void rpcstats_reset( t_rpcstats *stats );
+
+// highest latency in microseconds counted by histogram bucket
+unsigned long rpcstats_bucketmax( int bucket );
+
+// latency in microseconds below which fraction p of calls was done,
+// bucket resolution is 25%, but it's never above maximal one
+unsigned long rpcstats_percentile( t_rpcprocstats *ps, double p );
+
+#endif // __RPCMUX_H__
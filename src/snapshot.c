@@ -0,0 +1,362 @@
+/*
+ *
+ * Adrian Brzezinski (2018) <adrbxx at gmail.com>
+ * License: GPLv2+
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "snapshot.h"
+
+int snapshot_init( t_snapshot *s, const char *rootpath ) {
+
+  int64_t off;
+
+  memset(s, 0, sizeof(t_snapshot));
+
+  memcpy(s->hdr.magic, SNAPSHOT_MAGIC, sizeof(s->hdr.magic));
+  s->hdr.order = SNAPSHOT_ORDER;
+  s->hdr.created = time(NULL);
+
+  if ( (off = snapshot_name(s, rootpath)) == -1 ) return -1;
+  s->hdr.rootpath = off;
+
+return 0;
+}
+
+uint32_t snapshot_reserve( t_snapshot *s, uint32_t n ) {
+
+  t_snaprec *recs;
+  uint32_t first = s->hdr.nrecs, max;
+
+  if ( n > SNAPSHOT_NONE - 1 - first ) {
+    fprintf(stderr, "snapshot: too many records\n");
+    return SNAPSHOT_NONE;
+  }
+
+  if ( first + n > s->maxrecs ) {
+
+    for ( max = s->maxrecs ? s->maxrecs : 1024; max < first + n ; )
+      max = max > SNAPSHOT_NONE / 2 ? SNAPSHOT_NONE - 1 : max * 2;
+
+    if ( (recs = realloc(s->recs, (size_t)max * sizeof(t_snaprec))) == NULL ) {
+      perror("realloc()");
+      return SNAPSHOT_NONE;
+    }
+
+    s->recs = recs;
+    s->maxrecs = max;
+  }
+
+  memset(&s->recs[first], 0, (size_t)n * sizeof(t_snaprec));
+  s->hdr.nrecs += n;
+
+return first;
+}
+
+int64_t snapshot_name( t_snapshot *s, const char *name ) {
+
+  size_t len = strlen(name) + 1;
+  uint64_t max, off = s->hdr.namesize;
+  char *names;
+
+  if ( off + len > s->maxnames ) {
+
+    for ( max = s->maxnames ? s->maxnames : 65536; max < off + len ; max *= 2 );
+
+    if ( (names = realloc(s->names, max)) == NULL ) {
+      perror("realloc()");
+      return -1;
+    }
+
+    s->names = names;
+    s->maxnames = max;
+  }
+
+  memcpy(s->names + off, name, len);
+  s->hdr.namesize += len;
+
+return off;
+}
+
+// qsort() has no argument for comparison function
+static const char *snapshot_sortnames;
+
+static int snapshot_cmp( const void *a, const void *b ) {
+
+return strcmp(snapshot_sortnames + ((t_snaprec *)a)->name,
+    snapshot_sortnames + ((t_snaprec *)b)->name);
+}
+
+void snapshot_sortchildren( t_snapshot *s, uint32_t first, uint32_t n ) {
+
+  snapshot_sortnames = s->names;
+  qsort(&s->recs[first], n, sizeof(t_snaprec), snapshot_cmp);
+}
+
+static int snapshot_writeall( int fd, const void *buf, size_t len ) {
+
+  ssize_t n;
+
+  while ( len ) {
+    if ( (n = write(fd, buf, len)) == -1 ) {
+      if ( errno == EINTR ) continue;
+      return -1;
+    }
+
+    buf = (const char *)buf + n;
+    len -= n;
+  }
+
+return 0;
+}
+
+int snapshot_write( t_snapshot *s, const char *file ) {
+
+  char *tmp;
+  int fd = -1;
+
+  if ( (tmp = malloc(strlen(file) + 5)) == NULL ) {
+    perror("malloc()");
+    return -1;
+  }
+
+  sprintf(tmp, "%s.tmp", file);
+
+  if ( (fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1 ) {
+    perror(tmp);
+    goto ERR;
+  }
+
+  if ( snapshot_writeall(fd, &s->hdr, sizeof(t_snaphdr)) == -1
+      || snapshot_writeall(fd, s->recs, (size_t)s->hdr.nrecs * sizeof(t_snaprec)) == -1
+      || snapshot_writeall(fd, s->names, s->hdr.namesize) == -1
+      || fsync(fd) == -1 ) {
+    perror(tmp);
+    goto ERR;
+  }
+
+  if ( close(fd) == -1 ) {
+    fd = -1;
+    perror(tmp);
+    goto ERR;
+  }
+
+  fd = -1;
+
+  if ( rename(tmp, file) == -1 ) {
+    perror(file);
+    goto ERR;
+  }
+
+  free(tmp);
+
+return 0;
+
+ERR:
+  if ( fd != -1 ) close(fd);
+  unlink(tmp);
+  free(tmp);
+
+return -1;
+}
+
+// Records are used without further checks, so links between them must
+// be sane. Parent is always before it's children, so there are no cycles,
+// and children ranges don't overlap, each child points back to it's dir.
+static int snapshot_check( t_snapshot *s ) {
+
+  t_snaprec *rec;
+  uint32_t idx, i;
+
+  if ( s->recs[0].parent != SNAPSHOT_NONE ) return -1;
+
+  for ( idx = 0; idx < s->hdr.nrecs ; idx++ ) {
+    rec = &s->recs[idx];
+
+    if ( rec->name >= s->hdr.namesize || rec->fhlen > NFS3_FHSIZE
+        || (idx && rec->parent >= idx) )
+      return -1;
+
+    if ( rec->nchildren == 0 ) continue;
+
+    if ( rec->attr.type != NF3DIR || rec->first <= idx
+        || (uint64_t)rec->first + rec->nchildren > s->hdr.nrecs )
+      return -1;
+
+    for ( i = rec->first; i < rec->first + rec->nchildren ; i++ )
+      if ( s->recs[i].parent != idx ) return -1;
+  }
+
+return 0;
+}
+
+int snapshot_open( t_snapshot *s, const char *file ) {
+
+  struct stat st;
+  t_snaphdr *hdr;
+  size_t len;
+  int fd;
+
+  memset(s, 0, sizeof(t_snapshot));
+
+  if ( (fd = open(file, O_RDONLY)) == -1 ) {
+    perror(file);
+    return -1;
+  }
+
+  if ( fstat(fd, &st) == -1 ) {
+    perror(file);
+    close(fd);
+    return -1;
+  }
+
+  if ( st.st_size < sizeof(t_snaphdr) ) {
+    fprintf(stderr, "%s: not a snapshot\n", file);
+    close(fd);
+    return -1;
+  }
+
+  s->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if ( s->map == MAP_FAILED ) {
+    s->map = NULL;
+    perror("mmap()");
+    return -1;
+  }
+
+  s->maplen = st.st_size;
+  hdr = (t_snaphdr *)s->map;
+
+  if ( memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic))
+      || hdr->order != SNAPSHOT_ORDER ) {
+    fprintf(stderr, "%s: not a snapshot, or written on other architecture\n", file);
+    goto ERR;
+  }
+
+  len = sizeof(t_snaphdr) + (size_t)hdr->nrecs * sizeof(t_snaprec);
+
+  if ( hdr->nrecs == 0 || len + hdr->namesize != s->maplen
+      || hdr->rootpath >= hdr->namesize || ((char *)s->map)[s->maplen - 1] != '\0' ) {
+    fprintf(stderr, "%s: snapshot is damaged\n", file);
+    goto ERR;
+  }
+
+  s->hdr = *hdr;
+  s->recs = (t_snaprec *)((char *)s->map + sizeof(t_snaphdr));
+  s->names = (char *)s->map + len;
+
+  if ( snapshot_check(s) == -1 ) {
+    fprintf(stderr, "%s: snapshot is damaged\n", file);
+    goto ERR;
+  }
+
+return 0;
+
+ERR:
+  munmap(s->map, s->maplen);
+  s->map = NULL;
+
+return -1;
+}
+
+void snapshot_free( t_snapshot *s ) {
+
+  if ( s->map ) {
+    munmap(s->map, s->maplen);
+  } else {
+    if ( s->recs ) free(s->recs);
+    if ( s->names ) free(s->names);
+  }
+
+  memset(s, 0, sizeof(t_snapshot));
+}
+
+// binary search of len bytes of name, which doesn't need to end there
+static uint32_t snapshot_childn( t_snapshot *s, uint32_t dir, const char *name, size_t len ) {
+
+  const char *cname;
+  uint32_t lo, hi, mid;
+  int cmp;
+
+  if ( s->recs[dir].attr.type != NF3DIR ) return SNAPSHOT_NONE;
+
+  lo = s->recs[dir].first;
+  hi = lo + s->recs[dir].nchildren;
+
+  while ( lo < hi ) {
+    mid = lo + (hi - lo) / 2;
+    cname = SNAPSHOT_NAME(s, mid);
+
+    if ( (cmp = strncmp(name, cname, len)) == 0 ) {
+      if ( cname[len] == '\0' ) return mid;
+      cmp = -1;   // cname is longer
+    }
+
+    if ( cmp < 0 ) hi = mid;
+    else lo = mid + 1;
+  }
+
+return SNAPSHOT_NONE;
+}
+
+uint32_t snapshot_child( t_snapshot *s, uint32_t dir, const char *name ) {
+
+return snapshot_childn(s, dir, name, strlen(name));
+}
+
+uint32_t snapshot_lookup( t_snapshot *s, const char *path ) {
+
+  uint32_t idx = 0;
+  size_t len;
+
+  while ( idx != SNAPSHOT_NONE && *path ) {
+
+    len = strcspn(path, "/");
+
+    if ( len == 0 || (len == 1 && path[0] == '.') ) {
+      // nothing to do
+    } else if ( len == 2 && !strncmp(path, "..", 2) ) {
+      idx = s->recs[idx].parent;
+    } else {
+      idx = snapshot_childn(s, idx, path, len);
+    }
+
+    path += len;
+    while ( *path == '/' ) path++;
+  }
+
+return idx;
+}
+
+char *snapshot_path( t_snapshot *s, uint32_t idx, char *buf, size_t size ) {
+
+  const char *name;
+  size_t off = size, len;
+
+  if ( size == 0 ) return NULL;
+  buf[--off] = '\0';
+
+  // filled from the end
+  for ( ; idx != SNAPSHOT_NONE ; idx = s->recs[idx].parent ) {
+
+    name = idx ? SNAPSHOT_NAME(s, idx) : s->names + s->hdr.rootpath;
+    len = strlen(name);
+
+    if ( len + (idx ? 1 : 0) > off ) return NULL;
+
+    off -= len;
+    memcpy(buf + off, name, len);
+    if ( idx ) buf[--off] = '/';
+  }
+
+  memmove(buf, buf + off, size - off);
+
+return buf;
+}
@@ -0,0 +1,102 @@
+/*
+ *
+ * Adrian Brzezinski (2018) <adrbxx at gmail.com>
+ * License: GPLv2+
+ *
+ */
+
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <rpc/rpc.h>
+
+#include "xdr/nfsv3.h"
+
+#define SNAPSHOT_MAGIC  "NFSSNAP1"
+#define SNAPSHOT_ORDER  0x01020304    // tells byte order of writer
+#define SNAPSHOT_NONE   0xffffffffU   // no record
+
+// Snapshot file starts with header, then records, then null terminated
+// names. It's mapped as is, so numbers are in byte order and layout of
+// machine which wrote it. Root record is first, children of directory
+// are next to each other and sorted by name.
+typedef struct {
+
+  char magic[8];
+  uint32_t order;
+  uint32_t nrecs;
+  uint64_t namesize;
+  int64_t created;        // when scan started
+  uint64_t rootpath;      // path scanned, offset in names
+
+} t_snaphdr;
+
+typedef struct {
+
+  uint64_t name;          // offset in names
+  uint32_t parent;
+  uint32_t first;         // first child, directories only
+  uint32_t nchildren;
+
+  uint32_t fhlen;
+  char fh[NFS3_FHSIZE];
+
+  fattr3 attr;
+
+} t_snaprec;
+
+// Snapshot being built in memory, or mapped from file. Records are
+// referred by index, building moves them.
+typedef struct {
+
+  t_snaphdr hdr;
+  t_snaprec *recs;
+  char *names;
+
+  uint32_t maxrecs;
+  uint64_t maxnames;
+
+  void *map;              // of opened file
+  size_t maplen;
+
+} t_snapshot;
+
+// New empty snapshot of rootpath
+int snapshot_init( t_snapshot *s, const char *rootpath );
+
+// Add n zeroed records at the end, returns index of first one or
+// SNAPSHOT_NONE if there is no memory
+uint32_t snapshot_reserve( t_snapshot *s, uint32_t n );
+
+// Store name, returns it's offset or -1
+int64_t snapshot_name( t_snapshot *s, const char *name );
+
+// Sort n records from first by name, before any of them has children
+void snapshot_sortchildren( t_snapshot *s, uint32_t first, uint32_t n );
+
+// Write to file atomically, through temporary one renamed over it
+int snapshot_write( t_snapshot *s, const char *file );
+
+// Map file read only
+int snapshot_open( t_snapshot *s, const char *file );
+
+void snapshot_free( t_snapshot *s );
+
+#define SNAPSHOT_NAME(s, idx)   ((s)->names + (s)->recs[idx].name)
+
+// Child of directory dir with given name, or SNAPSHOT_NONE
+uint32_t snapshot_child( t_snapshot *s, uint32_t dir, const char *name );
+
+// Record of path relative to snapshot root, or SNAPSHOT_NONE
+uint32_t snapshot_lookup( t_snapshot *s, const char *path );
+
+// Path of record, root path included. Returns NULL if it doesn't fit.
+char *snapshot_path( t_snapshot *s, uint32_t idx, char *buf, size_t size );
+
+#endif // __SNAPSHOT_H__
@@ -111,3 +111,74 @@ char *hrbytes(char *buf, unsigned int buflen, long long bytes) {
 return buf;
 }
 
+char* stripline( char *str ) {
+  char *start, *end;
+
+  for ( start = str; *start && isblank(*start) ; start++ ) ;
+
+  for ( end = start + strlen(start) -1;
+        end > start && isblank(*end);
+        end-- ) {
+
+    *end = '\0';
+  }
+
+return start;
+}
+
+char* tokenizestr( char *data, char *argv[TOKENIZEARGMAX], int *argc ) {
+
+  int quotes = 0;
+  char *line = NULL;
+  int i;
+
+  if ( !data || !data[0] || !argv || !argc ) return 0;
+
+// initialize argv list
+  for ( i = 0 ; i < TOKENIZEARGMAX ; i++ ) argv[i] = 0;
+  *argc = 0;
+
+// skip white chars at beginning
+  for ( line = data ; *line && *line <= ' ' ; line++ ) ;
+  if ( !(*line) ) return 0;
+
+  for ( i = 1, argv[0] = line ; *line ; line++ ) {
+
+    // end of line?
+    if ( *line == '\n' || *line == '\r' ) {
+      *line++ = '\0';
+      break;
+    }
+
+    if ( *line == '\"' ) {
+      quotes++;
+      continue;
+    }
+
+    if ( !(quotes&1) && *line <= ' ' && i < TOKENIZEARGMAX ) {
+      *line++ = '\0';
+
+      // skip white chars between args
+      while ( *line && *line <= ' ' )
+        if ( *line == '\n' || *line == '\r' )
+          break;
+        else
+          line++;
+
+      if ( !(*line) ) break;
+      if ( *line == '\n' || *line == '\r' ) {
+        *line++ = '\0';
+        break;
+      }
+
+      argv[i++] = line;
+
+      quotes = 0;
+      if ( *line == '\"' ) quotes++;
+    }
+  }
+
+  *argc = i;
+
+return line;
+}
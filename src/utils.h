@@ -12,6 +12,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <ctype.h>
 #include <math.h>
 
 #include <sys/capability.h>
@@ -28,4 +29,13 @@ cap_flag_value_t cap_flag(pid_t pid, cap_value_t cap);
 
 char *hrbytes(char *buf, unsigned int buflen, long long bytes);
 
+// remove blanks from both ends of the string, in place
+char* stripline( char *str );
+
+// Split line into arguments, double quotes group words. Line is
+// modified, argv points into it. Returns rest of the line after
+// first new line or NULL if there are no arguments.
+#define TOKENIZEARGMAX 80
+char* tokenizestr( char *data, char *argv[TOKENIZEARGMAX], int *argc );
+
 #endif // __UTILS_H__